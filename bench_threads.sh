@@ -0,0 +1,194 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+usage() {
+    cat <<'EOF'
+Usage: ./bench_threads.sh [--threads "1 2 4"] [--variants "fd f smp"] [--runs <n>] [--timeout <seconds>] [--build] [--help] <image.elf|image.hex>
+
+Compare the simulation speed (KHz) of the build_result/ simulators built with ./build.sh --threads <n>.
+- Each binary runs the image in batch mode, the BATCH line gives the cycles and the time of the run.
+- The best of --runs runs (3 by default) is kept, the best thread count of each variant is marked with '*'.
+- Variants : fd (GenMax), f (GenMaxRv32F), smp (VexRiscvSmp2Gen, 2 cores, cycles of the SoC clock).
+- Pass --build to first run ./build.sh --threads <n> for each thread count.
+- Binaries which are missing are reported and skipped.
+EOF
+}
+
+THREADS_LIST="${THREADS_LIST:-1 2 4}"
+VARIANTS="${VARIANTS:-fd f smp}"
+RUNS="${RUNS:-3}"
+RUN_TIMEOUT="${RUN_TIMEOUT:-600}"
+BUILD=0
+IMAGE=""
+
+while [[ $# -gt 0 ]]; do
+    case "$1" in
+        --threads)
+            if [[ $# -lt 2 ]]; then
+                echo "Error: --threads requires a list of thread counts."
+                exit 1
+            fi
+            THREADS_LIST="$2"
+            shift
+            ;;
+        --threads=*) THREADS_LIST="${1#*=}" ;;
+        --variants)
+            if [[ $# -lt 2 ]]; then
+                echo "Error: --variants requires a list of variants."
+                exit 1
+            fi
+            VARIANTS="$2"
+            shift
+            ;;
+        --variants=*) VARIANTS="${1#*=}" ;;
+        --runs)
+            if [[ $# -lt 2 ]]; then
+                echo "Error: --runs requires a count."
+                exit 1
+            fi
+            RUNS="$2"
+            shift
+            ;;
+        --runs=*) RUNS="${1#*=}" ;;
+        --timeout)
+            if [[ $# -lt 2 ]]; then
+                echo "Error: --timeout requires a duration in seconds."
+                exit 1
+            fi
+            RUN_TIMEOUT="$2"
+            shift
+            ;;
+        --timeout=*) RUN_TIMEOUT="${1#*=}" ;;
+        --build) BUILD=1 ;;
+        --help|-h) usage; exit 0 ;;
+        -*) echo "Unknown option: $1"; usage; exit 1 ;;
+        *)
+            if [[ -n "$IMAGE" ]]; then
+                echo "Error: only one image is benchmarked, got: $IMAGE and $1"
+                exit 1
+            fi
+            IMAGE="$1"
+            ;;
+    esac
+    shift
+done
+
+if [[ -z "$IMAGE" ]]; then
+    usage
+    exit 1
+fi
+if [[ ! -f "$IMAGE" ]]; then
+    echo "Error: no such image: $IMAGE"
+    exit 1
+fi
+IMAGE="$(cd "$(dirname "$IMAGE")" && pwd)/$(basename "$IMAGE")"
+
+for n in $THREADS_LIST; do
+    if ! [[ "$n" =~ ^[1-9][0-9]*$ ]]; then
+        echo "Error: --threads expects thread counts, got: $n"
+        exit 1
+    fi
+done
+if ! [[ "$RUNS" =~ ^[1-9][0-9]*$ ]]; then
+    echo "Error: --runs expects a count, got: $RUNS"
+    exit 1
+fi
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+OUT_DIR="${ROOT_DIR}/build_result"
+
+variant_bin() { # <variant> <threads>
+    local suffix=""
+    if (( $2 > 1 )); then
+        suffix="_t$2"
+    fi
+    case "$1" in
+        fd) echo "${OUT_DIR}/vex_rv32_fd${suffix}" ;;
+        f) echo "${OUT_DIR}/vex_rv32_f${suffix}" ;;
+        smp) echo "${OUT_DIR}/vex_rv32_smp_2c${suffix}" ;;
+        *) echo "Error: unknown variant: $1 (fd, f or smp)" >&2; exit 1 ;;
+    esac
+}
+
+for v in $VARIANTS; do
+    variant_bin "$v" 1 > /dev/null
+done
+
+if (( BUILD )); then
+    SMP_ARG="--no-smp"
+    for v in $VARIANTS; do
+        if [[ "$v" == "smp" ]]; then
+            SMP_ARG="--smp"
+        fi
+    done
+    for n in $THREADS_LIST; do
+        echo "==> ./build.sh --threads $n $SMP_ARG"
+        "${ROOT_DIR}/build.sh" --threads "$n" "$SMP_ARG"
+    done
+fi
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Best KHz of the runs of one binary, empty if none of them succeeded
+bench_bin() { # <binary>
+    local best="" run line cycles ms khz
+    for (( run = 0; run < RUNS; run++ )); do
+        rm -rf "${WORK_DIR:?}"/*
+        line="$(cd "$WORK_DIR" && printf '%s bench\n' "$IMAGE" | timeout "$RUN_TIMEOUT" "$1" +batch=- 2>/dev/null | grep '^BATCH ' | tail -n 1 || true)"
+        if [[ ! "$line" =~ status=0\ cycles=([0-9]+)\ time=([0-9.]+) ]]; then
+            echo "    run $run failed: ${line:-no BATCH line}" >&2
+            continue
+        fi
+        cycles="${BASH_REMATCH[1]}"
+        ms="${BASH_REMATCH[2]}"
+        khz="$(awk -v c="$cycles" -v t="$ms" 'BEGIN { if(t > 0) printf "%.1f", c / t; else print 0 }')"
+        echo "    run $run : $cycles cycles in $ms ms, $khz KHz" >&2
+        if [[ -z "$best" ]] || awk -v a="$khz" -v b="$best" 'BEGIN { exit !(a > b) }'; then
+            best="$khz"
+        fi
+    done
+    echo "$best"
+}
+
+declare -A RESULT
+for v in $VARIANTS; do
+    for n in $THREADS_LIST; do
+        bin="$(variant_bin "$v" "$n")"
+        if [[ ! -x "$bin" ]]; then
+            echo "==> $v, $n threads : missing $bin (./build.sh --threads $n)" >&2
+            RESULT["$v,$n"]=""
+            continue
+        fi
+        echo "==> $v, $n threads : $bin" >&2
+        RESULT["$v,$n"]="$(bench_bin "$bin")"
+    done
+done
+
+echo
+printf '%-8s' "variant"
+for n in $THREADS_LIST; do
+    printf '%14s' "${n} threads"
+done
+echo
+for v in $VARIANTS; do
+    best_n=""
+    for n in $THREADS_LIST; do
+        khz="${RESULT["$v,$n"]}"
+        if [[ -n "$khz" ]] && { [[ -z "$best_n" ]] || awk -v a="$khz" -v b="${RESULT["$v,$best_n"]}" 'BEGIN { exit !(a > b) }'; }; then
+            best_n="$n"
+        fi
+    done
+    printf '%-8s' "$v"
+    for n in $THREADS_LIST; do
+        khz="${RESULT["$v,$n"]}"
+        if [[ -z "$khz" ]]; then
+            printf '%14s' "-"
+        elif [[ "$n" == "$best_n" ]]; then
+            printf '%14s' "*${khz} KHz"
+        else
+            printf '%14s' "${khz} KHz"
+        fi
+    done
+    echo
+done
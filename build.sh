@@ -3,7 +3,7 @@ set -euo pipefail
 
 usage() {
     cat <<'EOF'
-Usage: ./build.sh [--coverage|--coverage-light|--no-coverage] [--memorder <cache|store-buffer|fence|atomic>] [--memorder-smp <cache|store-buffer|fence|atomic>] [--clean] [--smp|--no-smp] [--help] [-- extra_verilator_args...]
+Usage: ./build.sh [--coverage|--coverage-light|--no-coverage] [--threads <n>] [--memorder <cache|store-buffer|fence|atomic>] [--memorder-smp <cache|store-buffer|fence|atomic>] [--clean] [--smp|--no-smp] [--help] [-- extra_verilator_args...]
 
 Build Verilator-based VexRiscv simulators that accept an ELF/HEX path.
 - Default builds RV32FD (GenMax), RV32F (GenMaxRv32F), and SMP 2-core (VexRiscvSmp2Gen) binaries in build_result/.
@@ -11,11 +11,13 @@ Build Verilator-based VexRiscv simulators that accept an ELF/HEX path.
 - Pass --memorder-smp <name> to build an SMP 2-core MemOrder variant via VexRiscvSmp2Gen.
 - Pass --coverage to build full coverage-enabled binaries (suffix *_cov) with Verilator --coverage.
 - Pass --coverage-light to build lightweight coverage binaries (suffix *_cov_light) with line/user-only coverage.
+- Pass --threads <n> to build models evaluated by n threads (Verilator --threads), suffix *_t<n> (see bench_threads.sh).
 - Arguments after "--" are forwarded to Verilator (e.g. -- --compiler clang).
 EOF
 }
 
 COVERAGE_MODE="${COVERAGE_MODE:-none}" # none|full|light
+VERILATOR_THREADS="${VERILATOR_THREADS:-1}"
 BUILD_SMP="${BUILD_SMP:-yes}"
 CLEAN=0
 MEMORDER_VARIANT="${MEMORDER_VARIANT:-}"
@@ -27,6 +29,15 @@ while [[ $# -gt 0 ]]; do
         --coverage|-c) COVERAGE_MODE="full" ;;
         --coverage-light) COVERAGE_MODE="light" ;;
         --no-coverage|-n) COVERAGE_MODE="none" ;;
+        --threads)
+            if [[ $# -lt 2 ]]; then
+                echo "Error: --threads requires a thread count."
+                exit 1
+            fi
+            VERILATOR_THREADS="$2"
+            shift
+            ;;
+        --threads=*) VERILATOR_THREADS="${1#*=}" ;;
         --memorder)
             if [[ $# -lt 2 ]]; then
                 echo "Error: --memorder requires a variant name."
@@ -57,10 +68,12 @@ done
 
 # Build Verilator-based VexRiscv simulators that accept an ELF/HEX path.
 # Output binaries:
-#   - build_result/vex_rv32_fd[[_cov|_cov_light]] : RV32IMAFD + S-mode + MMU (GenMax)
-#   - build_result/vex_rv32_f[[_cov|_cov_light]]  : RV32IMAF  + S-mode + MMU (GenMaxRv32F)
-#   - build_result/vex_rv32_memorder_<name>[[_cov|_cov_light]] : MemOrder variant (GenMemOrder, optional)
-#   - build_result/vex_rv32_smp_2c_memorder_<name>[[_cov|_cov_light]] : SMP 2-core MemOrder variant (VexRiscvSmp2Gen, optional)
+#   - build_result/vex_rv32_fd[[_cov|_cov_light]][_t<n>] : RV32IMAFD + S-mode + MMU (GenMax)
+#   - build_result/vex_rv32_f[[_cov|_cov_light]][_t<n>]  : RV32IMAF  + S-mode + MMU (GenMaxRv32F)
+#   - build_result/vex_rv32_smp_2c[[_cov|_cov_light]][_t<n>] : SMP 2-core (VexRiscvSmp2Gen)
+#   - build_result/vex_rv32_memorder_<name>[[_cov|_cov_light]][_t<n>] : MemOrder variant (GenMemOrder, optional)
+#   - build_result/vex_rv32_smp_2c_memorder_<name>[[_cov|_cov_light]][_t<n>] : SMP 2-core MemOrder variant (VexRiscvSmp2Gen, optional)
+#   _t<n> : model evaluated by n threads (--threads n), none for the single threaded ones
 #
 # Requirements:
 # - Java (for Scala codegen)
@@ -69,8 +82,8 @@ done
 # - A C++ toolchain (g++, make)
 #
 # Notes:
-# - The simulator will auto-convert .elf to Intel HEX using riscv64-unknown-elf-objcopy
-#   (or riscv32-unknown-elf-objcopy). Set RISCV_OBJCOPY to override if needed.
+# - The simulators load .elf inputs natively (PT_LOAD segments, entry point and the HTIF
+#   tohost symbol), so no RISC-V toolchain is needed at run time.
 
 ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 OUT_DIR="${ROOT_DIR}/build_result"
@@ -94,6 +107,15 @@ case "$COVERAGE_MODE" in
         ;;
 esac
 
+if ! [[ "$VERILATOR_THREADS" =~ ^[1-9][0-9]*$ ]]; then
+    echo "Error: --threads expects a thread count, got: ${VERILATOR_THREADS}"
+    exit 1
+fi
+if (( VERILATOR_THREADS > 1 )); then
+    BIN_SUFFIX="${BIN_SUFFIX}_t${VERILATOR_THREADS}"
+    BUILD_KIND="${BUILD_KIND}, ${VERILATOR_THREADS} threads"
+fi
+
 VERILATOR_ARGS_STR="${EXTRA_VERILATOR_ARGS[*]-}"
 case "$COVERAGE_MODE" in
     full)
@@ -219,6 +241,7 @@ if (( CLEAN )); then
           "${OUT_DIR}/vex_rv32_smp_2c_memorder_${MEMORDER_SMP_VARIANT}_cov" \
           "${OUT_DIR}/vex_rv32_smp_2c_memorder_${MEMORDER_SMP_VARIANT}_cov_light"
   fi
+  rm -f "${OUT_BIN_FD}" "${OUT_BIN_F}" "${OUT_BIN_SMP}" ${OUT_BIN_MEMORDER:+"${OUT_BIN_MEMORDER}"} ${OUT_BIN_SMP_MEMORDER:+"${OUT_BIN_SMP_MEMORDER}"}
 else
   rm -f "${OUT_BIN_FD}" "${OUT_BIN_F}"
   if [[ -n "$OUT_BIN_MEMORDER" ]]; then
@@ -247,7 +270,7 @@ build_variant() {
 
     pushd "${ROOT_DIR}/src/test/cpp/regression" >/dev/null
     WITH_RISCV_REF="${WITH_RISCV_REF}" make clean
-    WITH_RISCV_REF="${WITH_RISCV_REF}" VERILATOR_ARGS="${VERILATOR_ARGS_STR}" \
+    WITH_RISCV_REF="${WITH_RISCV_REF}" VERILATOR_ARGS="${VERILATOR_ARGS_STR}" VERILATOR_THREADS="${VERILATOR_THREADS}" \
         make verilate RUN_HEX="" COMPRESSED=yes LRSC=yes AMO=yes RVF="${rvf}" RVD="${rvd}" SUPERVISOR=yes MMU=yes CSR=yes IBUS_DATA_WIDTH=64 DBUS_LOAD_DATA_WIDTH=64 DBUS_STORE_DATA_WIDTH=64 TRACE_ACCESS=yes TRACE_WITH_TIME=yes "${extra_make_args[@]}"
     WITH_RISCV_REF="${WITH_RISCV_REF}" make -j"$(nproc)" -C obj_dir -f VVexRiscv.mk VVexRiscv
     cp -f "obj_dir/VVexRiscv" "${out_bin}"
@@ -347,7 +370,7 @@ build_smp_memorder_variant() {
 
     pushd "${ROOT_DIR}/src/test/cpp/regression" >/dev/null
     WITH_RISCV_REF="${WITH_RISCV_REF}" make clean
-    WITH_RISCV_REF="${WITH_RISCV_REF}" VERILATOR_ARGS="${VERILATOR_ARGS_STR}" \
+    WITH_RISCV_REF="${WITH_RISCV_REF}" VERILATOR_ARGS="${VERILATOR_ARGS_STR}" VERILATOR_THREADS="${VERILATOR_THREADS}" \
         make verilate RUN_HEX="" CSR=yes "${make_args[@]}"
     WITH_RISCV_REF="${WITH_RISCV_REF}" make -j"$(nproc)" -C obj_dir -f VVexRiscv.mk VVexRiscv
     cp -f "obj_dir/VVexRiscv" "${out_bin}"
@@ -378,7 +401,7 @@ if [[ "$BUILD_SMP" == "yes" ]]; then
 
     pushd "${ROOT_DIR}/src/test/cpp/regression" >/dev/null
     WITH_RISCV_REF="${WITH_RISCV_REF}" make clean
-    WITH_RISCV_REF="${WITH_RISCV_REF}" VERILATOR_ARGS="${VERILATOR_ARGS_STR}" \
+    WITH_RISCV_REF="${WITH_RISCV_REF}" VERILATOR_ARGS="${VERILATOR_ARGS_STR}" VERILATOR_THREADS="${VERILATOR_THREADS}" \
         make verilate RUN_HEX="" COMPRESSED=yes LRSC=yes AMO=yes SUPERVISOR=yes MMU=yes CSR=yes \
         IBUS_DATA_WIDTH=64 DBUS_LOAD_DATA_WIDTH=64 DBUS_STORE_DATA_WIDTH=64 TRACE_ACCESS=yes \
         TRACE_WITH_TIME=yes LINUX_SOC_SMP=yes MAIN_CPP=main_smp.cpp
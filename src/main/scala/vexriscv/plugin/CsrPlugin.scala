@@ -998,7 +998,7 @@ class CsrPlugin(val config: CsrPluginConfig) extends Plugin[VexRiscv] with Excep
         val exceptionCode = Reg(UInt(trapCodeWidth bits))
       }
       val mtval = Reg(UInt(xlen bits))
-      val mcycle   = Reg(UInt(64 bits)) init(0)
+      val mcycle   = Reg(UInt(64 bits)) init(0) addAttribute(Verilator.public)
       val minstret = Reg(UInt(64 bits)) init(0)
 
 
@@ -0,0 +1,94 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Batch mode manifests, shared by the RUN_HEX (main.cpp) and SMP (main_smp.cpp) harnesses.
+//
+// A manifest lists one input per line : "<image.elf|image.hex> [name]", blank lines and # comments are ignored.
+// The name prefixes the trace files of that input, it defaults to the image file name without its extension
+// (suffixed by the input index when already used). The manifest is a file, or "-" for stdin : lines are read
+// as they come, so a driver can feed a running simulator and wait for the BATCH result line of each input :
+//   BATCH <index> <name> status=<exit status of a single run> cycles=<N> time=<ms>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <set>
+#include <string>
+
+struct BatchEntry{
+	uint32_t index = 0;
+	std::string image;
+	std::string name;
+};
+
+class BatchManifest{
+public:
+	std::string path;
+	std::string error;
+	uint32_t count = 0;  // entries returned so far
+	uint32_t failed = 0; // entries reported with a non zero status
+
+	BatchManifest(const std::string &path) : path(path) {
+		if(path == "-") file = stdin;
+		else file = fopen(path.c_str(), "r");
+		if(file == NULL) error = "can't open " + path;
+	}
+
+	BatchManifest(const BatchManifest&) = delete;
+	BatchManifest& operator=(const BatchManifest&) = delete;
+
+	~BatchManifest(){
+		if(file && file != stdin) fclose(file);
+	}
+
+	bool ok() const { return error.empty(); }
+
+	// False once the manifest is exhausted
+	bool next(BatchEntry *entry){
+		if(file == NULL) return false;
+		char line[4096];
+		while(fgets(line, sizeof(line), file)){
+			char* hash = strchr(line, '#');
+			if(hash) *hash = 0;
+			char* image = strtok(line, " \t\r\n");
+			if(image == NULL) continue;
+			char* name = strtok(NULL, " \t\r\n");
+			entry->index = count++;
+			entry->image = image;
+			entry->name = name ? name : defaultName(entry->image);
+			if(!names.insert(entry->name).second){
+				entry->name += "_" + std::to_string(entry->index);
+				names.insert(entry->name);
+			}
+			return true;
+		}
+		return false;
+	}
+
+	void report(const BatchEntry &entry, int status, uint64_t cycles, double ms){
+		if(status != 0) failed++;
+		printf("BATCH %u %s status=%d cycles=%llu time=%.3f ms\n", entry.index, entry.name.c_str(), status, (unsigned long long)cycles, ms);
+		fflush(stdout);
+	}
+
+private:
+	FILE* file = NULL;
+	std::set<std::string> names;
+
+	static std::string defaultName(const std::string &image){
+		size_t slash = image.find_last_of('/');
+		std::string name = slash == std::string::npos ? image : image.substr(slash + 1);
+		size_t dot = name.find_last_of('.');
+		if(dot != std::string::npos && dot != 0) name.resize(dot);
+		return name;
+	}
+};
+
+// +batch=<manifest path|->
+static std::string batchManifestPath;
+
+static inline void batchConfigure(const char* plusargValue){
+	if(plusargValue && *plusargValue) batchManifestPath = plusargValue;
+}
+
+#endif
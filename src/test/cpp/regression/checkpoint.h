@@ -0,0 +1,183 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Simulation checkpoints.
+//
+// A Checkpoint is a binary archive over a file which works in both directions : each stateful object lists its
+// fields once in a checkpoint(Checkpoint &c) method (c.io(pc, regs, queue, ...)), which writes them when saving
+// and reads them back when restoring. Trivially copyable values are stored raw, the std containers element by
+// element, and a Memory as its materialised pages which differ from the 0xFF fill.
+//
+// The files aren't portable, they are only meant to be restored by the binary (same configuration) which wrote
+// them. The harness decides when to checkpoint from CheckpointTriggers, set by the +checkpoint_* plusargs.
+
+#include "sim_memory.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#define CHECKPOINT_MAGIC "VEXCKPT"
+#define CHECKPOINT_VERSION 3
+
+class Checkpoint{
+public:
+	enum Direction {SAVE, RESTORE};
+	Direction direction;
+	std::string path;
+	std::string error; // first error, the archive does nothing once set
+
+	Checkpoint(const std::string &path, Direction direction) : direction(direction), path(path) {
+		file = fopen(path.c_str(), direction == SAVE ? "wb" : "rb");
+		if(file == NULL) { error = "can't open " + path; return; }
+		char magic[8] = CHECKPOINT_MAGIC;
+		uint32_t version = CHECKPOINT_VERSION;
+		io(magic, version);
+		if(ok() && (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 || version != CHECKPOINT_VERSION)) error = path + " isn't a checkpoint of this version";
+	}
+
+	Checkpoint(const Checkpoint&) = delete;
+	Checkpoint& operator=(const Checkpoint&) = delete;
+
+	~Checkpoint(){ close(); }
+
+	bool saving() const { return direction == SAVE; }
+	bool ok() const { return error.empty(); }
+
+	// Flush and close the file, false if anything went wrong since the open
+	bool close(){
+		if(file && fclose(file) != 0 && ok()) error = "can't write " + path;
+		file = NULL;
+		return ok();
+	}
+
+	void io(){}
+	template <typename T, typename... Ts>
+	void io(T &value, Ts&... values){
+		field(value);
+		io(values...);
+	}
+
+	void bytes(void* data, size_t size){
+		if(!ok() || size == 0) return;
+		size_t done = saving() ? fwrite(data, 1, size, file) : fread(data, 1, size, file);
+		if(done != size) error = (saving() ? "can't write " : "truncated ") + path;
+	}
+
+	// Named marker between sections, so a layout mismatch is reported where it happens instead of loading garbage
+	void tag(const char* name){
+		std::string value = name;
+		field(value);
+		if(ok() && value != name) error = path + " : expected section " + name + ", found " + value;
+	}
+
+private:
+	FILE* file = NULL;
+
+	template <typename T>
+	typename std::enable_if<std::is_trivially_copyable<T>::value>::type field(T &value){
+		bytes(&value, sizeof(T));
+	}
+
+	void field(std::string &value){
+		uint64_t size = value.size();
+		field(size);
+		if(!saving()) value.resize(ok() ? size : 0);
+		bytes(&value[0], value.size());
+	}
+
+	template <typename T>
+	void field(std::vector<T> &value){
+		uint64_t size = value.size();
+		field(size);
+		if(!saving()) value.resize(ok() ? size : 0);
+		for(T &element : value) field(element);
+	}
+
+	template <typename T>
+	void field(std::deque<T> &value){
+		uint64_t size = value.size();
+		field(size);
+		if(!saving()) value.resize(ok() ? size : 0);
+		for(T &element : value) field(element);
+	}
+
+	template <typename T, typename C>
+	void field(std::queue<T, C> &value){
+		// The container of a std::queue is a protected member
+		struct Access : std::queue<T, C> {
+			static C& container(std::queue<T, C> &queue){ return queue.*(&Access::c); }
+		};
+		field(Access::container(value));
+	}
+
+	// Materialised pages which aren't fully 0xFF, then a MEMORY_PAGE_COUNT terminator. The restore starts from an
+	// empty Memory, so the skipped pages read back as the fill value.
+	void field(Memory &memory){
+		if(!ok()) return;
+		if(saving()){
+			for(uint32_t id = 0;id < MEMORY_PAGE_COUNT;id++){
+				if(memory.mem[id] == NULL || isFill(memory.mem[id])) continue;
+				field(id);
+				bytes(memory.mem[id], MEMORY_PAGE_SIZE);
+			}
+			uint32_t end = MEMORY_PAGE_COUNT;
+			field(end);
+		} else {
+			memory.reset();
+			while(ok()){
+				uint32_t id;
+				field(id);
+				if(!ok() || id == MEMORY_PAGE_COUNT) break;
+				if(id > MEMORY_PAGE_COUNT) { error = path + " has a corrupted memory page"; break; }
+				bytes(memory.get(id << MEMORY_PAGE_BITS), MEMORY_PAGE_SIZE);
+			}
+		}
+	}
+
+	static bool isFill(const uint8_t* page){
+		static uint8_t fill[4096];
+		static bool init = (memset(fill, MEMORY_FILL, sizeof(fill)), true);
+		(void)init;
+		for(uint32_t offset = 0;offset < MEMORY_PAGE_SIZE;offset += sizeof(fill)){
+			if(memcmp(page + offset, fill, sizeof(fill)) != 0) return false;
+		}
+		return true;
+	}
+};
+
+// When the harness takes its checkpoint, the first trigger which matches wins
+struct CheckpointTriggers{
+	bool hasCycle = false;
+	uint64_t cycle = 0;     // +checkpoint_cycle=N : after N simulated cycles
+	bool hasPc = false;
+	uint32_t pc = 0;        // +checkpoint_pc=0x... : after the instruction at this PC committed
+	std::string console;    // +checkpoint_console=STRING : once the DUT printed STRING
+	std::string file;       // +checkpoint_file=path, defaults to <test name>.ckpt
+	bool exitAfter = false; // +checkpoint_then=exit : stop the simulation once the checkpoint is written
+	std::string restore;    // +checkpoint_restore=path : start from that checkpoint instead of the reset state
+
+	bool enabled() const { return hasCycle || hasPc || !console.empty(); }
+};
+
+static CheckpointTriggers checkpointTriggers;
+
+// Apply the value of one +checkpoint_<name>= plusarg
+static inline void checkpointConfigure(const char* name, const char* value){
+	if(value == NULL || *value == 0) return;
+	CheckpointTriggers &t = checkpointTriggers;
+	if(!strcmp(name, "cycle")) { t.hasCycle = true; t.cycle = strtoull(value, NULL, 0); }
+	else if(!strcmp(name, "pc")) { t.hasPc = true; t.pc = strtoul(value, NULL, 0); }
+	else if(!strcmp(name, "console")) t.console = value;
+	else if(!strcmp(name, "file")) t.file = value;
+	else if(!strcmp(name, "then")) t.exitAfter = !strcmp(value, "exit");
+	else if(!strcmp(name, "restore")) t.restore = value;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef ELF_LOADER_H
+#define ELF_LOADER_H
+
+// Minimal ELF32 little endian RISC-V loader used by both harnesses, so an .elf input doesn't need a
+// toolchain (objcopy -O ihex) at run time.
+//
+// The file is mmaped read only. load() copies the PT_LOAD segments at their physical address (like objcopy
+// does) and zero fills their .bss tail, symbol() looks into the static symbol table (tohost, _start, ...).
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+class ElfFile{
+public:
+	std::string path;
+	std::string error;   // set when the file can't be used
+	const uint8_t* data = NULL;
+	size_t size = 0;
+	uint32_t entry = 0;
+
+	ElfFile(const std::string &path) : path(path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0) { error = "can't open " + path; return; }
+		struct stat st;
+		if(fstat(fd, &st) == 0 && st.st_size > 0){
+			void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(ptr != MAP_FAILED) { data = (const uint8_t*)ptr; size = st.st_size; }
+		}
+		close(fd);
+		if(data == NULL) { error = "can't map " + path; return; }
+		check();
+	}
+
+	ElfFile(const ElfFile&) = delete;
+	ElfFile& operator=(const ElfFile&) = delete;
+
+	~ElfFile(){
+		if(data) munmap((void*)data, size);
+	}
+
+	bool valid() const { return error.empty(); }
+
+	// Quick test on the magic number, without opening the file as an ELF
+	static bool isElf(const std::string &path){
+		unsigned char magic[SELFMAG];
+		FILE* f = fopen(path.c_str(), "rb");
+		if(!f) return false;
+		bool ok = fread(magic, 1, SELFMAG, f) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0;
+		fclose(f);
+		return ok;
+	}
+
+	// Copy every PT_LOAD segment into sink, which provides write(address, length, data) (Memory, ImageBuilder)
+	template <typename Sink>
+	void load(Sink *sink) const {
+		static const uint8_t zeros[4096] = {};
+		for(uint32_t i = 0;i < header()->e_phnum;i++){
+			const Elf32_Phdr* ph = programHeader(i);
+			if(ph->p_type != PT_LOAD || ph->p_memsz == 0) continue;
+			if(ph->p_filesz) sink->write(ph->p_paddr, ph->p_filesz, data + ph->p_offset);
+			for(uint32_t offset = ph->p_filesz;offset < ph->p_memsz;){
+				uint32_t chunk = ph->p_memsz - offset;
+				if(chunk > sizeof(zeros)) chunk = sizeof(zeros);
+				sink->write(ph->p_paddr + offset, chunk, zeros);
+				offset += chunk;
+			}
+		}
+	}
+
+	// Value (and optionally size) of a symbol of the static symbol table
+	bool symbol(const char* name, uint32_t *value, uint32_t *symbolSize = NULL) const {
+		for(uint32_t i = 0;i < header()->e_shnum;i++){
+			const Elf32_Shdr* sh = sectionHeader(i);
+			if(sh->sh_type != SHT_SYMTAB || sh->sh_entsize != sizeof(Elf32_Sym)) continue;
+			if(sh->sh_link >= header()->e_shnum) continue;
+			const Elf32_Shdr* strtab = sectionHeader(sh->sh_link);
+			if(!inFile(sh->sh_offset, sh->sh_size) || !inFile(strtab->sh_offset, strtab->sh_size)) continue;
+			const Elf32_Sym* syms = (const Elf32_Sym*)(data + sh->sh_offset);
+			const char* strings = (const char*)(data + strtab->sh_offset);
+			for(uint32_t s = 0;s < sh->sh_size / sizeof(Elf32_Sym);s++){
+				if(syms[s].st_name >= strtab->sh_size || syms[s].st_shndx == SHN_UNDEF) continue;
+				if(strncmp(strings + syms[s].st_name, name, strtab->sh_size - syms[s].st_name) != 0) continue;
+				*value = syms[s].st_value;
+				if(symbolSize) *symbolSize = syms[s].st_size;
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	const Elf32_Ehdr* header() const { return (const Elf32_Ehdr*)data; }
+	const Elf32_Phdr* programHeader(uint32_t i) const { return (const Elf32_Phdr*)(data + header()->e_phoff + i*header()->e_phentsize); }
+	const Elf32_Shdr* sectionHeader(uint32_t i) const { return (const Elf32_Shdr*)(data + header()->e_shoff + i*header()->e_shentsize); }
+	bool inFile(uint64_t offset, uint64_t length) const { return offset <= size && length <= size - offset; }
+
+	void check(){
+		const Elf32_Ehdr* h = header();
+		if(size < sizeof(Elf32_Ehdr) || memcmp(h->e_ident, ELFMAG, SELFMAG) != 0) { error = path + " is not an ELF file"; return; }
+		if(h->e_ident[EI_CLASS] != ELFCLASS32) { error = path + " is not an ELF32 file"; return; }
+		if(h->e_ident[EI_DATA] != ELFDATA2LSB) { error = path + " is not little endian"; return; }
+		if(h->e_machine != EM_RISCV) { error = path + " is not a RISC-V ELF"; return; }
+		if(h->e_phnum && (h->e_phentsize != sizeof(Elf32_Phdr) || !inFile(h->e_phoff, (uint64_t)h->e_phnum*h->e_phentsize))) { error = path + " has corrupted program headers"; return; }
+		if(h->e_shnum && (h->e_shentsize != sizeof(Elf32_Shdr) || !inFile(h->e_shoff, (uint64_t)h->e_shnum*h->e_shentsize))) { error = path + " has corrupted section headers"; return; }
+		for(uint32_t i = 0;i < h->e_phnum;i++){
+			const Elf32_Phdr* ph = programHeader(i);
+			if(ph->p_type == PT_LOAD && (!inFile(ph->p_offset, ph->p_filesz) || ph->p_filesz > ph->p_memsz)) { error = path + " has a segment out of the file"; return; }
+		}
+		entry = h->e_entry;
+	}
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+// Waveform flight recorder (FLIGHT=yes, which implies TRACE=yes and CHECKPOINT=yes).
+//
+// Instead of dumping the waveform all along, the harness keeps in memory a snapshot of the simulation (harness
+// checkpoint and Verilated model, see checkpoint.h) every +flight=<cycles>, the last two of them. Only when the test
+// fails (fail(), liveness, timeout) or when +flight_trigger=<trigger> fires, it restores the older one and replays
+// the cycles up to that point with the FST dump enabled : the waveform covers between one and two intervals before
+// the event, and the passing runs only pay for a snapshot per interval. The replay doesn't touch the traces nor the
+// console, a trigger replay then resumes the simulation where it was. The trigger syntax is the one of
+// +trace_start (see trace_filter.h), the first hit is recorded. +flight=0 dumps the whole run as without FLIGHT.
+//
+// A snapshot isn't free : the harness checkpoint holds every materialised page of both memories (DUT and golden
+// model) which isn't all 0xFF, so a Linux boot writes tens of MB per snapshot, plus the Verilated model. Without
+// +flight, the interval starts at FLIGHT_CYCLES and doubles (up to FLIGHT_CYCLES_MAX) whenever a snapshot took
+// more than FLIGHT_OVERHEAD % of the time simulated since the previous one, each change reported by a FLIGHT line.
+// The waveform of a failure then covers one to two of the current intervals. +flight=<cycles> fixes the interval.
+
+#include "trace_filter.h"
+
+#if defined(FLIGHT) && !(defined(TRACE) && defined(CHECKPOINT))
+#error FLIGHT requires TRACE and CHECKPOINT
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+
+#ifndef FLIGHT_CYCLES
+#define FLIGHT_CYCLES 100000
+#endif
+#ifndef FLIGHT_CYCLES_MAX
+#define FLIGHT_CYCLES_MAX 10000000
+#endif
+#ifndef FLIGHT_OVERHEAD
+#define FLIGHT_OVERHEAD 2 // %
+#endif
+
+struct FlightConfig{
+	uint64_t cycles = FLIGHT_CYCLES; // snapshot interval, 0 : plain TRACE dump
+	bool fixed = false;              // +flight given, the interval doesn't adapt
+	TraceTrigger trigger;
+};
+
+static FlightConfig flightConfig;
+
+// Apply the value of one +flight / +flight_trigger plusarg, false if it can't be parsed
+static inline bool flightConfigure(const char* name, const char* value){
+	if(value == NULL || *value == 0) return true;
+	if(!strcmp(name, "flight")) { flightConfig.cycles = strtoull(value, NULL, 0); flightConfig.fixed = true; }
+	else if(!strcmp(name, "flight_trigger")) return flightConfig.trigger.parse(value);
+	else return false;
+	return true;
+}
+
+// +flight_trigger as the start trigger of a TraceFilter of its own, which the harness feeds with the same events as
+// the trace filter
+static inline TraceFilterConfig flightTriggerConfig(){
+	TraceFilterConfig config;
+	config.start = flightConfig.trigger;
+	return config;
+}
+
+// The two snapshot slots, each an anonymous in-memory file for the harness checkpoint and one for the model, which
+// the checkpoint code opens through /proc/self/fd
+class FlightRecorder{
+public:
+	struct Slot{
+		int fd = -1, modelFd = -1;
+		bool valid = false;
+		uint64_t cycle = 0;
+
+		std::string path() const { return "/proc/self/fd/" + std::to_string(fd); }
+		std::string modelPath() const { return "/proc/self/fd/" + std::to_string(modelFd); }
+	};
+
+	uint64_t next = UINT64_MAX; // cycle of the next snapshot
+	uint64_t interval = FLIGHT_CYCLES;
+
+	FlightRecorder(){}
+	FlightRecorder(const FlightRecorder&) = delete;
+	FlightRecorder& operator=(const FlightRecorder&) = delete;
+	~FlightRecorder(){
+		for(Slot &slot : slots){
+			if(slot.fd >= 0) ::close(slot.fd);
+			if(slot.modelFd >= 0) ::close(slot.modelFd);
+		}
+	}
+
+	bool enabled() const { return flightConfig.cycles != 0; }
+
+	// Forget the snapshots, the first one is taken at cycle
+	void reset(uint64_t cycle){
+		for(Slot &slot : slots) slot.valid = false;
+		next = enabled() ? cycle : UINT64_MAX;
+		interval = flightConfig.cycles;
+		lastSnapshot = 0;
+	}
+
+	// The slot to overwrite with the snapshot of cycle (the older one), NULL if no memory file can be created
+	Slot* take(uint64_t cycle){
+		Slot &slot = slots[0].valid && (!slots[1].valid || slots[1].cycle < slots[0].cycle) ? slots[1] : slots[0];
+		if(slot.fd < 0) slot.fd = memfd_create("flight", MFD_CLOEXEC);
+		if(slot.modelFd < 0) slot.modelFd = memfd_create("flight.vlt", MFD_CLOEXEC);
+		next = cycle + interval;
+		if(slot.fd < 0 || slot.modelFd < 0) return NULL;
+		slot.valid = false;
+		slot.cycle = cycle;
+		takenAt = seconds();
+		return &slot;
+	}
+
+	// Once the snapshot of take() is written : the interval doubles if it cost more than FLIGHT_OVERHEAD % of the
+	// time simulated since the previous one. True when it changed, snapshotMs and snapshotBytes describe the snapshot.
+	bool taken(const Slot &slot, double *snapshotMs, uint64_t *snapshotBytes){
+		double now = seconds(), cost = now - takenAt, simulated = takenAt - lastSnapshot;
+		bool first = lastSnapshot == 0;
+		lastSnapshot = now;
+		struct stat st;
+		*snapshotMs = cost*1e3;
+		*snapshotBytes = 0;
+		if(fstat(slot.fd, &st) == 0) *snapshotBytes += st.st_size;
+		if(fstat(slot.modelFd, &st) == 0) *snapshotBytes += st.st_size;
+		if(flightConfig.fixed || first || interval >= FLIGHT_CYCLES_MAX || cost*100 <= simulated*FLIGHT_OVERHEAD) return false;
+		interval = interval*2 > FLIGHT_CYCLES_MAX ? FLIGHT_CYCLES_MAX : interval*2;
+		next = slot.cycle + interval;
+		return true;
+	}
+
+	// The oldest snapshot, where a replay starts, NULL if there is none
+	const Slot* oldest() const {
+		const Slot* found = NULL;
+		for(const Slot &slot : slots) if(slot.valid && (!found || slot.cycle < found->cycle)) found = &slot;
+		return found;
+	}
+
+private:
+	Slot slots[2];
+	double takenAt = 0, lastSnapshot = 0; // seconds()
+
+	static double seconds(){
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return t.tv_sec + t.tv_nsec*1e-9;
+	}
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef FORK_SERVER_H
+#define FORK_SERVER_H
+
+// AFL style fork server.
+//
+// The simulator is built and reset once, then forks a child per input, so a fuzzer only pays for the image load
+// and the simulation itself. The protocol is the classic one of afl-fuzz, over two inherited pipes :
+// - the server writes a 4 bytes hello on FORK_SERVER_FD + 1; if that fails nobody drives us, run normally
+// - for each input, the fuzzer writes 4 bytes on FORK_SERVER_FD, the server forks, replies the child pid, waits
+//   for it and replies its waitpid() status (4 bytes each, on FORK_SERVER_FD + 1)
+// The input file (@@) is the same path for every execution, its content is rewritten by the fuzzer between them.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define FORK_SERVER_FD 198
+
+// +fork_server=auto|off
+static bool forkServerEnabled = true;
+
+static inline void forkServerConfigure(const char* plusargValue){
+	if(plusargValue == NULL || *plusargValue == 0) return;
+	if(!strcmp(plusargValue, "off")) forkServerEnabled = false;
+	else if(!strcmp(plusargValue, "auto")) forkServerEnabled = true;
+	else fprintf(stderr, "Unknown fork server mode '%s'\n", plusargValue);
+}
+
+// Returns false right away when no fuzzer is attached. Otherwise only returns in the children, once per input,
+// and the server process itself exits when the fuzzer closes the pipes.
+static inline bool forkServerStart(){
+	if(!forkServerEnabled) return false;
+	uint32_t hello = 0;
+	if(write(FORK_SERVER_FD + 1, &hello, 4) != 4) return false;
+	fflush(stdout);
+	fflush(stderr);
+	while(true){
+		uint32_t killed;
+		if(read(FORK_SERVER_FD, &killed, 4) != 4) _exit(0);
+		pid_t pid = fork();
+		if(pid < 0) _exit(1);
+		if(pid == 0){
+			close(FORK_SERVER_FD);
+			close(FORK_SERVER_FD + 1);
+			return true;
+		}
+		int status = 0;
+		if(write(FORK_SERVER_FD + 1, &pid, 4) != 4) _exit(0);
+		if(waitpid(pid, &status, 0) < 0) _exit(1);
+		if(write(FORK_SERVER_FD + 1, &status, 4) != 4) _exit(0);
+	}
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+// Idle fast-forward of the regression harness (main.cpp), +idle=<off|fast>.
+//
+// off, the default, simulates every cycle and stays bit-exact with the previous runs. fast skips the cycles where
+// nothing can happen : the core is halted in wfi (CsrPlugin_inWfi for IDLE_WFI_CYCLES cycles in a row, so it didn't
+// find a wake up condition with the interrupt lines as they are) and every bus SimElement is quiescent
+// (SimElement::idle()), so only the timer line can change. The harness then moves the time straight to the cycle
+// before mTime reaches mTimeCmp, or to the end of the run without a timer to wait for, and adds the skipped cycles
+// to the cycle counters of the harness and of the core (mcycle). The golden model has no notion of time, the lines
+// it sees don't change over the skipped cycles. The debug plugin is quiescent while no debugger is connected (never
+// with DEBUG_PLUGIN_EXTERNAL, which waits for one) : a connected one keeps the harness simulating every cycle.
+//
+// The skipped cycles don't evaluate the model nor draw from the harness random generator, so a fast run isn't the
+// same as an off one from the first skip on : the stall decisions which follow differ. A fast run is reproducible
+// (+replay, checkpoints and the flight recorder replay the same skips), as long as it is run again with +idle=fast.
+// Only the harness time (mTime = cycle) is supported, REF_TIME and MTIME_INSTR_FACTOR builds ignore +idle=fast.
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef IDLE_WFI_CYCLES
+#define IDLE_WFI_CYCLES 4
+#endif
+
+struct IdleConfig{
+	bool fast = false;
+};
+
+static IdleConfig idleConfig;
+
+// +idle=<off|fast> (plusarg value), false if it can't be parsed
+static inline bool idleConfigure(const char* value){
+	if(value == NULL || *value == 0) return true;
+	if(!strcmp(value, "fast") || !strcmp(value, "on")) idleConfig.fast = true;
+	else if(!strcmp(value, "off")) idleConfig.fast = false;
+	else return false;
+	return true;
+}
+
+// Adds the skipped cycles to mcycle, when the core has one (CsrPlugin mcycleAccess != NONE)
+template <typename Cpu>
+static inline auto idleAddMcycle(Cpu* cpu, uint64_t cycles, int) -> decltype(cpu->CsrPlugin_mcycle += cycles, void()) {
+	cpu->CsrPlugin_mcycle += cycles;
+}
+
+template <typename Cpu>
+static inline void idleAddMcycle(Cpu* cpu, uint64_t cycles, long) {}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef IHEX_H
+#define IHEX_H
+
+// Intel HEX decoder shared by both harnesses.
+//
+// The file is mmaped and each record (":LLAAAATT<data>CC") is decoded in one pass : the hex digits are
+// validated and converted 32 (AVX2) or 16 (SSE2) at a time, with a scalar fallback for other hosts and for the
+// record tails. Every record checksum is checked, truncated / malformed lines are reported with their line
+// number instead of being mis-parsed. Contiguous data records are merged and handed to the sink as one
+// write(address, length, data) call (Memory, ImageBuilder, ...).
+//
+// Supported records : 00 data, 01 end of file, 02 extended segment address, 03/05 start address,
+// 04 extended linear address.
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IHEX_X86
+#endif
+
+enum IhexImpl {IHEX_SCALAR, IHEX_SSE2, IHEX_AVX2};
+
+struct IhexResult{
+	bool ok = true;
+	uint32_t line = 0;     // line of the error
+	std::string error;
+	uint32_t records = 0;
+	uint64_t bytes = 0;    // data bytes
+	bool hasStart = false; // start address record
+	uint32_t start = 0;
+};
+
+static inline const char* ihexImplName(IhexImpl impl){
+	switch(impl){
+	case IHEX_AVX2: return "avx2";
+	case IHEX_SSE2: return "sse2";
+	default: return "scalar";
+	}
+}
+
+static inline IhexImpl ihexBestImpl(){
+#ifdef IHEX_X86
+	static IhexImpl best = __builtin_cpu_supports("avx2") ? IHEX_AVX2 : (__builtin_cpu_supports("sse2") ? IHEX_SSE2 : IHEX_SCALAR);
+	return best;
+#else
+	return IHEX_SCALAR;
+#endif
+}
+
+// Decode 2*count hex digits into count bytes, false on any non hex digit
+static inline bool ihexDecodeScalar(const char* in, uint8_t* out, uint32_t count){
+	static const struct Table{
+		int8_t v[256];
+		Table(){
+			for(int i = 0;i < 256;i++) v[i] = -1;
+			for(int i = 0;i < 10;i++) v['0' + i] = i;
+			for(int i = 0;i < 6;i++) v['a' + i] = v['A' + i] = 10 + i;
+		}
+	} table;
+	uint32_t bad = 0;
+	for(uint32_t i = 0;i < count;i++){
+		int hi = table.v[(uint8_t)in[2*i]], lo = table.v[(uint8_t)in[2*i + 1]];
+		bad |= (uint32_t)(hi | lo) >> 31;
+		out[i] = (hi << 4) | (lo & 0xF);
+	}
+	return bad == 0;
+}
+
+#ifdef IHEX_X86
+// 16 digits -> 8 bytes per step
+static inline bool ihexDecodeSse2(const char* in, uint8_t* out, uint32_t count){
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i digitLo = _mm_set1_epi8('0' - 1), digitHi = _mm_set1_epi8('9' + 1);
+	const __m128i alphaLo = _mm_set1_epi8('a' - 1), alphaHi = _mm_set1_epi8('f' + 1);
+	const __m128i digitBase = _mm_set1_epi8('0'), alphaBase = _mm_set1_epi8('a' - 10);
+	const __m128i lowByte = _mm_set1_epi16(0x00FF);
+	uint32_t i = 0;
+	for(;i + 8 <= count;i += 8){
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + 2*i));
+		__m128i l = _mm_or_si128(v, lower);
+		__m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(v, digitLo), _mm_cmpgt_epi8(digitHi, v));
+		__m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(l, alphaLo), _mm_cmpgt_epi8(alphaHi, l));
+		if(_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xFFFF) return false;
+		__m128i nibbles = _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(v, digitBase)), _mm_andnot_si128(isDigit, _mm_sub_epi8(l, alphaBase)));
+		__m128i bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, lowByte), 4), _mm_srli_epi16(nibbles, 8));
+		_mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(bytes, bytes));
+	}
+	return ihexDecodeScalar(in + 2*i, out + i, count - i);
+}
+
+// 32 digits -> 16 bytes per step
+__attribute__((target("avx2")))
+static inline bool ihexDecodeAvx2(const char* in, uint8_t* out, uint32_t count){
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	const __m256i digitLo = _mm256_set1_epi8('0' - 1), digitHi = _mm256_set1_epi8('9' + 1);
+	const __m256i alphaLo = _mm256_set1_epi8('a' - 1), alphaHi = _mm256_set1_epi8('f' + 1);
+	const __m256i digitBase = _mm256_set1_epi8('0'), alphaBase = _mm256_set1_epi8('a' - 10);
+	const __m256i lowByte = _mm256_set1_epi16(0x00FF);
+	uint32_t i = 0;
+	for(;i + 16 <= count;i += 16){
+		__m256i v = _mm256_loadu_si256((const __m256i*)(in + 2*i));
+		__m256i l = _mm256_or_si256(v, lower);
+		__m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(v, digitLo), _mm256_cmpgt_epi8(digitHi, v));
+		__m256i isAlpha = _mm256_and_si256(_mm256_cmpgt_epi8(l, alphaLo), _mm256_cmpgt_epi8(alphaHi, l));
+		if((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(isDigit, isAlpha)) != 0xFFFFFFFFu) return false;
+		__m256i nibbles = _mm256_or_si256(_mm256_and_si256(isDigit, _mm256_sub_epi8(v, digitBase)), _mm256_andnot_si256(isDigit, _mm256_sub_epi8(l, alphaBase)));
+		__m256i bytes = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(nibbles, lowByte), 4), _mm256_srli_epi16(nibbles, 8));
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(bytes, bytes), 0x08);
+		_mm_storeu_si128((__m128i*)(out + i), _mm256_castsi256_si128(packed));
+	}
+	return ihexDecodeSse2(in + 2*i, out + i, count - i);
+}
+#endif
+
+static inline bool ihexDecodeDigits(const char* in, uint8_t* out, uint32_t count, IhexImpl impl){
+#ifdef IHEX_X86
+	if(impl == IHEX_AVX2) return ihexDecodeAvx2(in, out, count);
+	if(impl == IHEX_SSE2) return ihexDecodeSse2(in, out, count);
+#endif
+	return ihexDecodeScalar(in, out, count);
+}
+
+// Decode the size bytes of text into sink
+template <typename Sink>
+IhexResult ihexDecode(const char* text, size_t size, Sink *sink, IhexImpl impl = ihexBestImpl()){
+	IhexResult result;
+	const char* end = text + size;
+	const char* line = text;
+	uint32_t upper = 0;
+	std::vector<uint8_t> pending;
+	uint32_t pendingAddress = 0;
+	auto flush = [&](){
+		if(!pending.empty()) sink->write(pendingAddress, pending.size(), pending.data());
+		pending.clear();
+	};
+	auto fail = [&](const char* message){
+		flush();
+		result.ok = false;
+		result.error = message;
+		return result;
+	};
+	uint8_t record[5 + 255 + 1];
+
+	while(line < end){
+		result.line++;
+		const char* eol = (const char*)memchr(line, '\n', end - line);
+		if(eol == NULL) eol = end;
+		const char* last = eol;
+		while(last > line && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) last--;
+		const char* next = eol + 1;
+		if(last == line) { line = next; continue; }
+		if(line[0] != ':') return fail("line doesn't start with ':'");
+
+		uint32_t digits = last - line - 1;
+		if(digits < 10 || !ihexDecodeScalar(line + 1, record, 1)) return fail("truncated record");
+		uint32_t length = record[0];
+		if(digits != 2*(length + 5)) return fail(digits < 2*(length + 5) ? "truncated record" : "record longer than its byte count");
+		if(!ihexDecodeDigits(line + 1, record, length + 5, impl)) return fail("invalid hex digit");
+		uint8_t sum = 0;
+		for(uint32_t i = 0;i < length + 5;i++) sum += record[i];
+		if(sum != 0) return fail("checksum mismatch");
+
+		result.records++;
+		uint32_t offset = (record[1] << 8) | record[2];
+		const uint8_t* data = record + 4;
+		switch(record[3]){
+		case 0x00:{
+			uint32_t address = upper + offset;
+			if(pending.empty() || pendingAddress + pending.size() != address || pending.size() >= 65536) {
+				flush();
+				pendingAddress = address;
+			}
+			pending.insert(pending.end(), data, data + length);
+			result.bytes += length;
+		} break;
+		case 0x01:
+			flush();
+			return result;
+		case 0x02:
+			if(length != 2) return fail("bad extended segment address record");
+			upper = ((data[0] << 8) | data[1]) << 4;
+			break;
+		case 0x04:
+			if(length != 2) return fail("bad extended linear address record");
+			upper = ((data[0] << 8) | data[1]) << 16;
+			break;
+		case 0x03:
+		case 0x05:
+			if(length != 4) return fail("bad start address record");
+			result.hasStart = true;
+			result.start = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+			if(record[3] == 0x03) result.start = (result.start >> 16)*16 + (result.start & 0xFFFF);
+			break;
+		default:
+			return fail("unknown record type");
+		}
+		line = next;
+	}
+	flush();
+	return result;
+}
+
+// mmap path and decode it into sink
+template <typename Sink>
+IhexResult ihexLoad(const std::string &path, Sink *sink, IhexImpl impl = ihexBestImpl()){
+	IhexResult result;
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0){
+		if(fd >= 0) close(fd);
+		result.ok = false;
+		result.error = "not found";
+		return result;
+	}
+	if(st.st_size == 0) { close(fd); return result; }
+	void* text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(text == MAP_FAILED){
+		result.ok = false;
+		result.error = "can't be mapped";
+		return result;
+	}
+	madvise(text, st.st_size, MADV_SEQUENTIAL);
+	result = ihexDecode((const char*)text, st.st_size, sink, impl);
+	munmap(text, st.st_size);
+	return result;
+}
+
+#endif
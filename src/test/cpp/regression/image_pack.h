@@ -0,0 +1,285 @@
+#ifndef IMAGE_PACK_H
+#define IMAGE_PACK_H
+
+// Image packs : pre-linked program images which are mmaped as is, without any parsing.
+//
+// A pack is written next to its source (<file>.pack, or <file>@<offset>.pack for bin files loaded at an offset),
+// or into $VEX_IMAGE_PACK_DIR when set. Layout (host endianness) :
+//   ImagePackHeader
+//   ImagePackSegment[segmentCount]  load map
+//   ImagePackSymbol[symbolCount]
+//   segment data, each one at a file offset congruent to its guest address modulo 4 KiB, so whole host pages
+//   are mapped copy-on-write straight into Memory (see Image::Segment)
+// The header keeps the size and mtime of the source, a pack which doesn't match them anymore is ignored.
+// The hash (FNV-1a 64 of the entry point and of every segment address, length and bytes) identifies the content
+// and is checked in verify mode.
+//
+// Selected by +image_pack=off|on|write|verify (or VEX_IMAGE_PACK) :
+// - off    : always parse the source
+// - on     : use packs when they exist and are up to date (default)
+// - write  : as on, and (re)write the pack of each parsed source
+// - verify : as on, and recompute the hash of each pack used
+
+#include "sim_image.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#define IMAGE_PACK_MAGIC "VEXPACK"
+#define IMAGE_PACK_VERSION 1
+#define IMAGE_PACK_ALIGN 4096u
+
+struct ImagePackHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t hasEntry;
+	uint32_t entry;
+	uint32_t segmentCount;
+	uint32_t symbolCount;
+	uint32_t reserved;
+	uint64_t sourceSize;
+	int64_t sourceMtimeNs;
+	uint64_t hash;
+	uint64_t fileSize;
+};
+
+struct ImagePackSegment{
+	uint32_t address;
+	uint32_t length;
+	uint64_t offset;
+};
+
+struct ImagePackSymbol{
+	uint32_t value;
+	char name[60];
+};
+
+class ImagePack{
+public:
+	enum Mode {OFF, ON, WRITE, VERIFY};
+	// Function-local statics, so that several translation units can include the header
+	static Mode &mode(){ static Mode value = ON; return value; }
+	static std::atomic<uint32_t> &parsed(){ static std::atomic<uint32_t> value(0); return value; }
+	static std::atomic<uint32_t> &loaded(){ static std::atomic<uint32_t> value(0); return value; }
+	static std::atomic<uint32_t> &written(){ static std::atomic<uint32_t> value(0); return value; }
+
+	static const char* modeName(Mode mode){
+		switch(mode){
+		case OFF: return "off";
+		case WRITE: return "write";
+		case VERIFY: return "verify";
+		default: return "on";
+		}
+	}
+
+	static void setMode(const char* value){
+		if(value == NULL) return;
+		if(!strcmp(value, "off")) mode() = OFF;
+		else if(!strcmp(value, "on")) mode() = ON;
+		else if(!strcmp(value, "write")) mode() = WRITE;
+		else if(!strcmp(value, "verify")) mode() = VERIFY;
+		else fprintf(stderr, "Unknown image pack mode '%s', keeping %s\n", value, modeName(mode()));
+	}
+
+	// Where the pack of (kind, path) lives, kind is "hex", "elf", "bin@<offset>"
+	static std::string packPath(const std::string &kind, const std::string &path){
+		std::string suffix = ".pack";
+		size_t at = kind.find('@');
+		if(at != std::string::npos) suffix = kind.substr(at) + suffix;
+		const char* dir = getenv("VEX_IMAGE_PACK_DIR");
+		if(dir == NULL || *dir == 0) return path + suffix;
+		std::string flat = path;
+		std::replace(flat.begin(), flat.end(), '/', '_');
+		return std::string(dir) + "/" + flat + suffix;
+	}
+
+	static uint64_t hash(const Image &image){
+		uint64_t h = 0xcbf29ce484222325ull;
+		auto mix = [&](const void* data, size_t length){
+			const uint8_t* p = (const uint8_t*)data;
+			for(size_t i = 0;i < length;i++) { h ^= p[i]; h *= 0x100000001b3ull; }
+		};
+		mix(&image.entry, 4);
+		for(const Image::Segment &segment : image.segments){
+			mix(&segment.address, 4);
+			mix(&segment.length, 4);
+			mix(image.view + segment.offset, segment.length);
+		}
+		return h;
+	}
+
+	// Map an up to date pack of path, NULL when there is none
+	static Image* open(const std::string &kind, const std::string &path){
+		struct stat source, st;
+		if(stat(path.c_str(), &source) != 0) return NULL;
+		std::string pack = packPath(kind, path);
+		int fd = ::open(pack.c_str(), O_RDONLY);
+		if(fd < 0) return NULL;
+		if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImagePackHeader)) { close(fd); return NULL; }
+		uint8_t* view = (uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(view == MAP_FAILED) { close(fd); return NULL; }
+
+		Image *image = new Image();
+		image->name = pack;
+		image->fd = fd;
+		image->view = view;
+		image->viewSize = st.st_size;
+
+		const ImagePackHeader* header = (const ImagePackHeader*)view;
+		uint64_t tables = sizeof(ImagePackHeader) + (uint64_t)header->segmentCount*sizeof(ImagePackSegment) + (uint64_t)header->symbolCount*sizeof(ImagePackSymbol);
+		if(memcmp(header->magic, IMAGE_PACK_MAGIC, sizeof(IMAGE_PACK_MAGIC)) != 0 || header->version != IMAGE_PACK_VERSION
+			|| header->fileSize != (uint64_t)st.st_size || tables > (uint64_t)st.st_size
+			|| header->sourceSize != (uint64_t)source.st_size || header->sourceMtimeNs != mtimeNs(source)) {
+			delete image;
+			return NULL;
+		}
+
+		image->hasEntry = header->hasEntry;
+		image->entry = header->entry;
+		const ImagePackSegment* segments = (const ImagePackSegment*)(header + 1);
+		for(uint32_t i = 0;i < header->segmentCount;i++){
+			if(segments[i].offset > (uint64_t)st.st_size || segments[i].length > st.st_size - segments[i].offset) { delete image; return NULL; }
+			image->segments.push_back(Image::Segment{segments[i].address, segments[i].length, segments[i].offset});
+		}
+		const ImagePackSymbol* symbols = (const ImagePackSymbol*)(segments + header->segmentCount);
+		for(uint32_t i = 0;i < header->symbolCount;i++){
+			image->symbols[std::string(symbols[i].name, strnlen(symbols[i].name, sizeof(symbols[i].name)))] = symbols[i].value;
+		}
+
+		if(mode() == VERIFY && hash(*image) != header->hash){
+			fprintf(stderr, "Image pack %s is corrupted, ignoring it\n", pack.c_str());
+			delete image;
+			return NULL;
+		}
+		return image;
+	}
+
+	// Write the pack of a parsed (page based) image, through a temporary file so concurrent runs never see a partial pack
+	static bool write(const std::string &kind, const std::string &path, const Image &image){
+		struct stat source;
+		if(stat(path.c_str(), &source) != 0) return false;
+
+		// Merge the written runs into contiguous segments
+		std::map<uint32_t, const Image::Page*> pages;
+		for(const Image::Page &page : image.pages) pages[page.id] = &page;
+		std::vector<ImagePackSegment> segments;
+		for(auto &it : pages){
+			std::vector<std::pair<uint32_t, uint32_t>> runs = it.second->runs;
+			std::sort(runs.begin(), runs.end());
+			uint64_t pageAddress = ((uint64_t)it.first) << MEMORY_PAGE_BITS;
+			for(auto &run : runs){
+				uint64_t begin = pageAddress + run.first, end = pageAddress + run.second;
+				ImagePackSegment* last = segments.empty() ? NULL : &segments.back();
+				uint64_t lastEnd = last ? (uint64_t)last->address + last->length : 0;
+				if(last && begin <= lastEnd){
+					last->length = std::max(lastEnd, end) - last->address;
+				} else {
+					segments.push_back(ImagePackSegment{(uint32_t)begin, (uint32_t)(end - begin), 0});
+				}
+			}
+		}
+
+		ImagePackHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, IMAGE_PACK_MAGIC, sizeof(IMAGE_PACK_MAGIC));
+		header.version = IMAGE_PACK_VERSION;
+		header.hasEntry = image.hasEntry;
+		header.entry = image.entry;
+		header.segmentCount = segments.size();
+		header.symbolCount = image.symbols.size();
+		header.sourceSize = source.st_size;
+		header.sourceMtimeNs = mtimeNs(source);
+
+		uint64_t cursor = sizeof(header) + segments.size()*sizeof(ImagePackSegment) + image.symbols.size()*sizeof(ImagePackSymbol);
+		for(ImagePackSegment &segment : segments){
+			uint64_t offset = (cursor & ~(uint64_t)(IMAGE_PACK_ALIGN - 1)) + (segment.address & (IMAGE_PACK_ALIGN - 1));
+			if(offset < cursor) offset += IMAGE_PACK_ALIGN;
+			segment.offset = offset;
+			cursor = offset + segment.length;
+		}
+		header.fileSize = cursor;
+
+		std::string pack = packPath(kind, path);
+		std::string tmp = pack + ".tmp" + std::to_string((long long)getpid());
+		FILE* f = fopen(tmp.c_str(), "wb");
+		if(f == NULL) return false;
+		uint64_t h = 0xcbf29ce484222325ull;
+		auto mix = [&](const void* data, size_t length){
+			const uint8_t* p = (const uint8_t*)data;
+			for(size_t i = 0;i < length;i++) { h ^= p[i]; h *= 0x100000001b3ull; }
+		};
+		mix(&header.entry, 4);
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+		if(!segments.empty()) ok &= fwrite(&segments[0], sizeof(ImagePackSegment), segments.size(), f) == segments.size();
+		for(auto &symbol : image.symbols){
+			ImagePackSymbol s;
+			memset(&s, 0, sizeof(s));
+			s.value = symbol.second;
+			strncpy(s.name, symbol.first.c_str(), sizeof(s.name) - 1);
+			ok &= fwrite(&s, sizeof(s), 1, f) == 1;
+		}
+		for(ImagePackSegment &segment : segments){
+			mix(&segment.address, 4);
+			mix(&segment.length, 4);
+			ok &= fseek(f, segment.offset, SEEK_SET) == 0;
+			for(uint64_t address = segment.address, end = address + segment.length;address < end;){
+				uint32_t chunk = std::min<uint64_t>(end - address, MEMORY_PAGE_SIZE - (address & MEMORY_PAGE_MASK));
+				const uint8_t* data = pages[address >> MEMORY_PAGE_BITS]->data + (address & MEMORY_PAGE_MASK);
+				mix(data, chunk);
+				ok &= fwrite(data, 1, chunk, f) == chunk;
+				address += chunk;
+			}
+		}
+		header.hash = h;
+		ok &= fseek(f, 0, SEEK_SET) == 0;
+		ok &= fwrite(&header, sizeof(header), 1, f) == 1;
+		ok &= fclose(f) == 0;
+		if(!ok || rename(tmp.c_str(), pack.c_str()) != 0){
+			unlink(tmp.c_str());
+			fprintf(stderr, "Can't write image pack %s\n", pack.c_str());
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static int64_t mtimeNs(const struct stat &st){
+		return ((int64_t)st.st_mtim.tv_sec)*1000000000ll + st.st_mtim.tv_nsec;
+	}
+};
+
+// Apply +image_pack=off|on|write|verify (plusarg value) or VEX_IMAGE_PACK
+static inline void imagePackConfigure(const char* plusargValue){
+	ImagePack::setMode(getenv("VEX_IMAGE_PACK"));
+	if(plusargValue && *plusargValue) ImagePack::setMode(plusargValue);
+}
+
+// Cached image of (kind, path), from its pack when possible, else parsed (and packed in write mode)
+static inline std::shared_ptr<const Image> imageLoad(const std::string &kind, const std::string &path, const ImageParser &parser){
+	return ImageCache::get(kind, path, [&]()->Image*{
+		if(ImagePack::mode() != ImagePack::OFF){
+			Image* image = ImagePack::open(kind, path);
+			if(image) { ImagePack::loaded()++; return image; }
+		}
+		Image* image = imageParse(path, parser);
+		ImagePack::parsed()++;
+		if(ImagePack::mode() == ImagePack::WRITE && ImagePack::write(kind, path, *image)) ImagePack::written()++;
+		return image;
+	});
+}
+
+static inline void imagePackReport(FILE* f){
+	fprintf(f, "IMAGES pack=%s parsed=%u packed=%u written=%u\n", ImagePack::modeName(ImagePack::mode()),
+		ImagePack::parsed().load(), ImagePack::loaded().load(), ImagePack::written().load());
+}
+
+#endif
@@ -118,6 +118,9 @@ public:
 	int32_t rxBufferSize = 0;
 	int32_t rxBufferRemaining = 0;
 
+	// The remote bitbang connection itself isn't part of the checkpoint
+	virtual void checkpoint(Checkpoint &c){ c.io(state, timer, selfSleep, checkNewConnectionsTimer); }
+
 //    	virtual void onReset(){}
 //    	virtual void postReset(){}
 //    	virtual void preCycle(){}
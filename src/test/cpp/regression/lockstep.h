@@ -0,0 +1,424 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+// Online lockstep comparison against the commit log of another model, shared by both harnesses.
+//
+// +lockstep=<path> streams a reference while the DUT runs (a FIFO works too, the reference model can run
+// alongside) and checks each committed instruction (PC, integer register write) and each store (address, size,
+// data) as the DUT produces it. The first divergence fails the test with the last commits of both sides, so nothing
+// past it is simulated or traced. The reference is either :
+// - a spike --log-commits text log : "core   0: 3 0x80000004 (0x00000297) x5  0x80000004 mem 0x80001000 0x01"
+//   (CSR and F register writes are skipped, lines which aren't commits are ignored)
+// - a binary regTrace of this harness (+trace_format=bin|binz, see trace_format.h), with the stores taken from the
+//   memTrace.bin next to it when there is one
+// {name} in the path is replaced by the test name. The commits are matched per hart, in order, the stores too but
+// independently of the commits (the DUT emits a store before the instruction commits). The reference commits
+// before the first PC of the DUT (boot ROM) are skipped. The stores are only checked by the regression harness built
+// with TRACE_ACCESS, which knows their PC.
+
+#include "trace_format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#define LOCKSTEP_HARTS 8
+#define LOCKSTEP_ALIGN_LIMIT 100000 // reference commits skipped at most to find the first PC of the DUT
+
+struct LockstepCommit{
+	uint64_t line = 0;   // in the reference, 0 for the DUT
+	uint32_t pc = 0;
+	int32_t rd = -1;     // -1 : no integer register write
+	uint32_t value = 0;
+};
+
+struct LockstepStore{
+	uint64_t line = 0;
+	uint32_t pc = 0;
+	uint32_t address = 0;
+	uint32_t size = 0;
+	uint64_t value = 0;
+};
+
+// A reference, read on demand. Each call returns the next record of any hart.
+class LockstepSource{
+public:
+	std::string error;
+	virtual ~LockstepSource(){}
+	// false at the end
+	virtual bool next(uint32_t *hart, LockstepCommit *commit, bool *hasStore, LockstepStore *store) = 0;
+	// Stores which aren't attached to commits (binary memTrace), false at the end
+	virtual bool nextStore(uint32_t *, LockstepStore *){ return false; }
+	virtual bool separateStores() const { return false; }
+};
+
+class SpikeCommitLog : public LockstepSource{
+public:
+	SpikeCommitLog(const std::string &path){
+		file = fopen(path.c_str(), "r");
+		if(file == NULL) error = "can't open " + path;
+	}
+	~SpikeCommitLog(){ if(file) fclose(file); }
+
+	bool next(uint32_t *hart, LockstepCommit *commit, bool *hasStore, LockstepStore *store) override {
+		char text[1024];
+		while(file && fgets(text, sizeof(text), file)){
+			line++;
+			if(parse(text, hart, commit, hasStore, store)) return true;
+		}
+		return false;
+	}
+
+private:
+	FILE* file = NULL;
+	uint64_t line = 0;
+
+	static const char* token(const char* &p, size_t *length){
+		while(*p == ' ' || *p == '\t') p++;
+		const char* start = p;
+		while(*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+		*length = p - start;
+		return start;
+	}
+
+	static bool hex(const char* t, size_t length, uint64_t *value){
+		if(length < 3 || t[0] != '0' || t[1] != 'x') return false;
+		uint64_t v = 0;
+		for(size_t i = 2;i < length;i++){
+			char c = t[i];
+			uint32_t digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 16;
+			if(digit == 16) return false;
+			v = v << 4 | digit;
+		}
+		*value = v;
+		return true;
+	}
+
+	bool parse(const char* p, uint32_t *hart, LockstepCommit *commit, bool *hasStore, LockstepStore *store){
+		size_t length;
+		const char* t = token(p, &length);
+		if(length != 4 || strncmp(t, "core", 4)) return false;
+		while(*p == ' ') p++;
+		char* end;
+		*hart = strtoul(p, &end, 10);
+		if(end == p || *end != ':') return false;
+		p = end + 1;
+		uint64_t value;
+		t = token(p, &length);
+		if(length == 1 && *t >= '0' && *t <= '3') t = token(p, &length); // privilege
+		if(!hex(t, length, &value)) return false; // not a commit (exception, ...)
+		*commit = LockstepCommit();
+		commit->line = line;
+		commit->pc = value;
+		t = token(p, &length); // (0xinstruction)
+		*hasStore = false;
+		while(true){
+			t = token(p, &length);
+			if(length == 0) break;
+			if(t[0] == 'x' && (length == 1 || (t[1] >= '0' && t[1] <= '9'))){
+				if(length == 1) t = token(p, &length) - 1; // older spike : "x 5 0x..."
+				uint32_t rd = strtoul(t + 1, NULL, 10);
+				t = token(p, &length);
+				if(!hex(t, length, &value)) return false;
+				if(rd != 0) { commit->rd = rd; commit->value = value; }
+			} else if(length == 3 && !strncmp(t, "mem", 3)){
+				t = token(p, &length);
+				if(!hex(t, length, &value)) return false;
+				const char* save = p;
+				const char* v = token(p, &length);
+				uint64_t data;
+				if(hex(v, length, &data)){
+					*hasStore = true;
+					store->line = line;
+					store->pc = commit->pc;
+					store->address = value;
+					store->size = (length - 2) / 2;
+					store->value = data;
+				} else {
+					p = save;
+				}
+			} else {
+				token(p, &length); // CSR / F register write value
+			}
+		}
+		return true;
+	}
+};
+
+class BinaryCommitLog : public LockstepSource{
+public:
+	BinaryCommitLog(const std::string &path) : reg(path) {
+		if(!reg.ok()) { error = reg.error; return; }
+		const std::string suffix = ".regTrace.bin";
+		if(path.size() > suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0){
+			std::string memPath = path.substr(0, path.size() - suffix.size()) + ".memTrace.bin";
+			struct stat st;
+			if(stat(memPath.c_str(), &st) == 0) mem.reset(new TraceReader(memPath));
+			if(mem && !mem->ok()) { error = mem->error; mem.reset(); }
+		}
+	}
+
+	bool next(uint32_t *hart, LockstepCommit *commit, bool *hasStore, LockstepStore *) override {
+		TraceEvent e;
+		while(reg.next(&e)){
+			regLine++;
+			if(e.type != TRACE_RECORD_PC && e.type != TRACE_RECORD_REG) continue;
+			*hart = e.hart;
+			*commit = LockstepCommit();
+			commit->line = regLine;
+			commit->pc = e.pc;
+			if(e.type == TRACE_RECORD_REG && e.index != 0) { commit->rd = e.index; commit->value = e.value; }
+			*hasStore = false;
+			return true;
+		}
+		if(!reg.ok()) error = reg.error;
+		return false;
+	}
+
+	bool nextStore(uint32_t *hart, LockstepStore *store) override {
+		TraceEvent e;
+		while(mem && mem->next(&e)){
+			memLine++;
+			if(e.type != TRACE_RECORD_MEM) continue;
+			*hart = e.hart;
+			store->line = memLine;
+			store->pc = e.pc;
+			store->address = e.address;
+			store->size = e.index;
+			store->value = e.value;
+			return true;
+		}
+		if(mem && !mem->ok()) error = mem->error;
+		return false;
+	}
+
+	bool separateStores() const override { return true; }
+	bool hasStores() const { return mem != nullptr; }
+
+private:
+	TraceReader reg;
+	std::unique_ptr<TraceReader> mem;
+	uint64_t regLine = 0, memLine = 0;
+};
+
+// +lockstep=<path>, +lockstep_context=<commits>
+struct LockstepConfig{
+	std::string path;
+	uint32_t context = 8;
+};
+
+static LockstepConfig lockstepConfig;
+
+// Apply the value of the +<name>= plusarg
+static inline void lockstepConfigure(const char* name, const char* value){
+	if(value == NULL || *value == 0) return;
+	if(!strcmp(name, "lockstep")) lockstepConfig.path = value;
+	else if(!strcmp(name, "lockstep_context")) lockstepConfig.context = strtoul(value, NULL, 0);
+}
+
+class Lockstep{
+public:
+	std::string error;    // the reference can't be used
+	std::string mismatch; // report of the first divergence, the harness fails with it
+	uint64_t commits = 0, stores = 0;
+
+	// path : the reference, {name} replaced by name
+	Lockstep(std::string path, const std::string &name, uint32_t context = lockstepConfig.context) : context(context) {
+		for(size_t at;(at = path.find("{name}")) != std::string::npos;) path.replace(at, 6, name);
+		this->path = path;
+		const std::string bin = ".bin";
+		bool binary = path.size() > bin.size() && path.compare(path.size() - bin.size(), bin.size(), bin) == 0;
+		if(binary) source.reset(new BinaryCommitLog(path));
+		else source.reset(new SpikeCommitLog(path));
+		error = source->error;
+	}
+
+	bool ok() const { return error.empty() && mismatch.empty(); }
+
+	// A commit of the DUT, false on a divergence (then reported in mismatch)
+	bool commit(uint32_t hart, uint32_t pc, int32_t rd, uint32_t value){
+		if(!ok() || hart >= LOCKSTEP_HARTS) return ok();
+		Hart &h = harts[hart];
+		LockstepCommit dut;
+		dut.pc = pc;
+		dut.rd = rd == 0 ? -1 : rd;
+		dut.value = dut.rd < 0 ? 0 : value;
+		if(!h.aligned){
+			h.aligned = true;
+			for(uint32_t skipped = 0;skipped < LOCKSTEP_ALIGN_LIMIT && fillCommit(hart) && h.commits.front().pc != pc;skipped++){
+				h.commits.pop_front();
+				h.skipped++;
+			}
+		}
+		if(!fillCommit(hart)) {
+			if(!h.ended){
+				h.ended = true;
+				printf("LOCKSTEP %s ended for hart %u after %llu commits, no more checks\n", path.c_str(), hart, (unsigned long long)h.matched);
+			}
+			return ok();
+		}
+		LockstepCommit ref = h.commits.front();
+		h.commits.pop_front();
+		bool same = ref.pc == dut.pc && ref.rd == dut.rd && ref.value == dut.value;
+		remember(h.dutHistory, dut);
+		remember(h.refHistory, ref);
+		if(!same) {
+			report(hart, "commit", formatCommit(dut), formatCommit(ref));
+			return false;
+		}
+		h.matched++;
+		commits++;
+		return true;
+	}
+
+	// A store of the DUT, false on a divergence
+	bool store(uint32_t hart, uint32_t pc, uint32_t address, uint32_t size, uint64_t value){
+		if(!ok() || hart >= LOCKSTEP_HARTS) return ok();
+		Hart &h = harts[hart];
+		if(!fillStore(hart)) return ok();
+		LockstepStore ref = h.stores.front();
+		h.stores.pop_front();
+		if(size < 8) value &= (1ull << size*8) - 1;
+		uint64_t refValue = ref.size < 8 ? ref.value & ((1ull << ref.size*8) - 1) : ref.value;
+		if(ref.address != address || ref.size != size || refValue != value){
+			LockstepStore dut;
+			dut.pc = pc;
+			dut.address = address;
+			dut.size = size;
+			dut.value = value;
+			report(hart, "store", formatStore(dut), formatStore(ref));
+			return false;
+		}
+		stores++;
+		return true;
+	}
+
+	std::string summary() const {
+		std::ostringstream s;
+		s << "LOCKSTEP " << path << " : " << commits << " commits and " << stores << " stores matched";
+		for(uint32_t i = 0;i < LOCKSTEP_HARTS;i++) if(harts[i].skipped) s << ", hart " << i << " skipped " << harts[i].skipped << " reference commits to its first PC";
+		return s.str();
+	}
+
+private:
+	struct Hart{
+		std::deque<LockstepCommit> commits;
+		std::deque<LockstepStore> stores;
+		std::deque<LockstepCommit> dutHistory, refHistory;
+		bool aligned = false;
+		bool ended = false;
+		uint64_t matched = 0, skipped = 0;
+	};
+
+	std::string path;
+	uint32_t context;
+	std::unique_ptr<LockstepSource> source;
+	Hart harts[LOCKSTEP_HARTS];
+
+	// Read the reference until hart has a commit queued, false at its end
+	bool fillCommit(uint32_t hart){
+		while(harts[hart].commits.empty()){
+			uint32_t h;
+			LockstepCommit c;
+			LockstepStore s;
+			bool hasStore;
+			if(!source->next(&h, &c, &hasStore, &s)) { readError(); return false; }
+			if(h >= LOCKSTEP_HARTS) continue;
+			harts[h].commits.push_back(c);
+			if(hasStore) harts[h].stores.push_back(s);
+		}
+		return true;
+	}
+
+	bool fillStore(uint32_t hart){
+		while(harts[hart].stores.empty()){
+			uint32_t h;
+			LockstepStore s;
+			if(source->separateStores()){
+				if(!source->nextStore(&h, &s)) { readError(); return false; }
+				if(h < LOCKSTEP_HARTS) harts[h].stores.push_back(s);
+			} else {
+				// The commit of that store is still ahead, read the commits up to it
+				LockstepCommit c;
+				bool hasStore;
+				if(!source->next(&h, &c, &hasStore, &s)) { readError(); return false; }
+				if(h >= LOCKSTEP_HARTS) continue;
+				harts[h].commits.push_back(c);
+				if(hasStore) harts[h].stores.push_back(s);
+			}
+		}
+		return true;
+	}
+
+	// A corrupted reference fails the test like a divergence
+	void readError(){
+		if(source->error.empty() || !error.empty()) return;
+		error = source->error;
+		mismatch = "LOCKSTEP " + error + "\n";
+	}
+
+	template <typename T>
+	void remember(std::deque<T> &history, const T &value){
+		history.push_back(value);
+		if(history.size() > context + 1) history.pop_front();
+	}
+
+	static std::string formatCommit(const LockstepCommit &c){
+		char text[96];
+		if(c.rd < 0) snprintf(text, sizeof(text), "PC %08x", c.pc);
+		else snprintf(text, sizeof(text), "PC %08x x%-2d = %08x", c.pc, c.rd, c.value);
+		std::string s = text;
+		if(c.line) s += " (line " + std::to_string(c.line) + ")";
+		return s;
+	}
+
+	static std::string formatStore(const LockstepStore &c){
+		char text[96];
+		snprintf(text, sizeof(text), "PC %08x MEM[0x%08x] <= %u bytes : 0x%0*llx", c.pc, c.address, c.size, c.size*2 < 2 ? 2 : c.size*2, (unsigned long long)c.value);
+		std::string s = text;
+		if(c.line) s += " (line " + std::to_string(c.line) + ")";
+		return s;
+	}
+
+	void report(uint32_t hart, const char* what, const std::string &dut, const std::string &ref){
+		Hart &h = harts[hart];
+		std::ostringstream s;
+		s << "LOCKSTEP " << what << " mismatch on hart " << hart << " after " << h.matched << " matching commits" << std::endl;
+		s << "  DUT " << dut << std::endl;
+		s << "  REF " << ref << std::endl;
+		s << "  last commits, DUT | REF :" << std::endl;
+		for(size_t i = 0;i < h.dutHistory.size() && i < h.refHistory.size();i++){
+			s << "    " << formatCommit(h.dutHistory[i]) << " | " << formatCommit(h.refHistory[i]) << std::endl;
+		}
+		fillCommit(hart);
+		s << "  next REF commits :" << std::endl;
+		for(uint32_t i = 0;i < context && (i < h.commits.size() || fillAhead(hart));i++){
+			s << "    " << formatCommit(h.commits[i]) << std::endl;
+		}
+		mismatch = s.str();
+	}
+
+	// Read one more reference commit for hart, for the report
+	bool fillAhead(uint32_t hart){
+		size_t size = harts[hart].commits.size();
+		while(harts[hart].commits.size() == size){
+			uint32_t h;
+			LockstepCommit c;
+			LockstepStore s;
+			bool hasStore;
+			if(!source->next(&h, &c, &hasStore, &s)) return false;
+			if(h >= LOCKSTEP_HARTS) continue;
+			harts[h].commits.push_back(c);
+			if(hasStore) harts[h].stores.push_back(s);
+		}
+		return true;
+	}
+};
+
+#endif
@@ -9,6 +9,9 @@
 #include "verilated.h"
 #include "verilated_fst_c.h"
 #include "verilated_cov.h"
+#ifdef CHECKPOINT
+#include "verilated_save.h"
+#endif
 #include <stdio.h>
 #include <iostream>
 #include <stdlib.h>
@@ -19,16 +22,48 @@
 #include <fstream>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <condition_variable>
 #include <iomanip>
 #include <queue>
 #include <time.h>
 #include "encoding.h"
+#include "sim_memory.h"
+#include "sim_image.h"
+#include "image_pack.h"
+#include "elf_loader.h"
+#include "ihex.h"
+#include "checkpoint.h"
+#include "fork_server.h"
+#include "batch.h"
+#include "trace_format.h"
+#include "trace_sink.h"
+#include "trace_filter.h"
+#include "lockstep.h"
+#include "flight.h"
+#include "replay.h"
+#include "idle.h"
+#include "sim_elements.h"
+#include "sim_random.h"
+#include "profile.h"
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
-#define VL_RANDOM_I_WIDTH(w) (VL_RANDOM_I() & (1l << w)-1l)
+// Random source of the harness (see sim_random.h). Each Workspace owns one and makes it current on its thread. Outside
+// of a test (the selection of the FreeRTOS / Zephyr tasks, ...) the draws come from simRandomMain, seeded from the
+// base seed.
+static SimRandom simRandomMain;
+static thread_local SimRandom* simRandomCurrent = NULL;
+
+static inline uint32_t simRandomBits(uint32_t width){
+	return simRandomCurrent ? simRandomCurrent->next(width) : simRandomMain.next(width);
+}
+
+#define VL_RANDOM_I_WIDTH(w) simRandomBits(w)
 
 #ifdef LINUX_SOC_SMP
 #define VEX_CPU (top->VexRiscv->cores_0_cpu_logic_cpu)
@@ -36,6 +71,20 @@
 #define VEX_CPU (top->VexRiscv)
 #endif
 
+// Models built with VERILATOR_THREADS=N (verilator --threads) evaluate on a thread pool of their context, which
+// Verilator 5 sizes from the context : each one is given the threads of the model. eval() only returns once the
+// workers are done with it, so the harness reads and pokes the model (VEX_CPU->...) between the eval() calls as
+// with a single threaded one.
+#ifndef VERILATOR_THREADS
+#define VERILATOR_THREADS 1
+#endif
+
+static void modelThreads(VerilatedContext* context){
+	#if VERILATOR_THREADS > 1 && defined(VERILATOR_VERSION_INTEGER) && VERILATOR_VERSION_INTEGER >= 5000000
+	context->threads(VERILATOR_THREADS);
+	#endif
+}
+
 using namespace std;
 
 #if VM_COVERAGE
@@ -54,79 +103,29 @@ struct timespec timer_get(){
 	return start_time;
 }
 
-class Memory{
-public:
-	uint8_t* mem[1 << 12];
-
-	Memory(){
-		for(uint32_t i = 0;i < (1 << 12);i++) mem[i] = NULL;
-	}
-	~Memory(){
-		for(uint32_t i = 0;i < (1 << 12);i++) if(mem[i]) delete [] mem[i];
-	}
-
-	uint8_t* get(uint32_t address){
-		if(mem[address >> 20] == NULL) {
-			uint8_t* ptr = new uint8_t[1024*1024];
-			for(uint32_t i = 0;i < 1024*1024;i+=4) {
-				ptr[i + 0] = 0xFF;
-				ptr[i + 1] = 0xFF;
-				ptr[i + 2] = 0xFF;
-				ptr[i + 3] = 0xFF;
-			}
-			mem[address >> 20] = ptr;
-		}
-		return &mem[address >> 20][address & 0xFFFFF];
-	}
-
-	void read(uint32_t address,uint32_t length, uint8_t *data){
-		for(int i = 0;i < length;i++){
-			data[i] = (*this)[address + i];
-		}
-	}
-
-	void write(uint32_t address,uint32_t length, uint8_t *data){
-		for(int i = 0;i < length;i++){
-			(*this)[address + i] = data[i];
-		}
-	}
-
-	uint8_t& operator [](uint32_t address) {
-		return *get(address);
-	}
-
-	/*T operator [](uint32_t address) const {
-		return get(address);
-	}*/
-};
-
 //uint8_t memory[1024 * 1024];
 
-uint32_t hti(char c) {
-	if (c >= 'A' && c <= 'F')
-		return c - 'A' + 10;
-	if (c >= 'a' && c <= 'f')
-		return c - 'a' + 10;
-	return c - '0';
+//Preload 0x0 <-> 0x80000000 jumps
+void preloadBootJumps(ImageBuilder* image) {
+	image->write32(0, 0x800000b7);
+	image->write32(4, 0x000080e7);
+	image->write32(0x80000000, 0x00000097);
 }
 
-uint32_t hToI(char *c, uint32_t size) {
-	uint32_t value = 0;
-	for (uint32_t i = 0; i < size; i++) {
-		value += hti(c[i]) << ((size - i - 1) * 4);
+void loadHexImpl(string path,ImageBuilder* image) {
+	preloadBootJumps(image);
+	IhexResult result = ihexLoad(path, image);
+	if(!result.ok){
+		cout << path << ":" << result.line << " " << result.error << endl;
+		exit(4);
 	}
-	return value;
 }
 
-void loadHexImpl(string path,Memory* mem) {
+void loadBinImpl(string path,ImageBuilder* image, uint32_t offset) {
 	FILE *fp = fopen(&path[0], "r");
 	if(fp == 0){
 		cout << path << " not found" << endl;
 	}
-	//Preload 0x0 <-> 0x80000000 jumps
-	((uint32_t*)mem->get(0))[0] = 0x800000b7;
-	((uint32_t*)mem->get(0))[1] = 0x000080e7;
-	((uint32_t*)mem->get(0x80000000))[0] = 0x00000097;
 
 	fseek(fp, 0, SEEK_END);
 	uint32_t size = ftell(fp);
@@ -135,70 +134,29 @@ void loadHexImpl(string path,Memory* mem) {
 	fread(content, 1, size, fp);
 	fclose(fp);
 
-	int offset = 0;
-	char* line = content;
-	while (1) {
-		if (line[0] == ':') {
-			uint32_t byteCount = hToI(line + 1, 2);
-			uint32_t nextAddr = hToI(line + 3, 4) + offset;
-			uint32_t key = hToI(line + 7, 2);
-//			printf("%d %d %d\n", byteCount, nextAddr,key);
-			switch (key) {
-			case 0:
-				for (uint32_t i = 0; i < byteCount; i++) {
-					*(mem->get(nextAddr + i)) = hToI(line + 9 + i * 2, 2);
-					//printf("%x %x %c%c\n",nextAddr + i,hToI(line + 9 + i*2,2),line[9 + i * 2],line[9 + i * 2+1]);
-				}
-				break;
-			case 2:
-//				cout << offset << endl;
-				offset = hToI(line + 9, 4) << 4;
-				break;
-			case 4:
-//				cout << offset << endl;
-				offset = hToI(line + 9, 4) << 16;
-				break;
-			default:
-//				cout << "??? " << key << endl;
-				break;
-			}
-		}
-
-		while (*line != '\n' && size != 0) {
-			line++;
-			size--;
-		}
-		if (size <= 1)
-			break;
-		line++;
-		size--;
-	}
+	image->write(offset, size, (uint8_t*)content);
 
 	delete [] content;
 }
 
-void loadBinImpl(string path,Memory* mem, uint32_t offset) {
-	FILE *fp = fopen(&path[0], "r");
-	if(fp == 0){
-		cout << path << " not found" << endl;
-	}
 
-	fseek(fp, 0, SEEK_END);
-	uint32_t size = ftell(fp);
-	fseek(fp, 0, SEEK_SET);
-	char* content = new char[size];
-	fread(content, 1, size, fp);
-	fclose(fp);
 
-	for(int byteId = 0; byteId < size;byteId++){
-		*(mem->get(offset + byteId)) = content[byteId];
+// PT_LOAD segments are copied straight from the mmaped file, no objcopy round trip
+void loadElfImpl(string path,ImageBuilder* image) {
+	ElfFile elf(path);
+	if(!elf.valid()){
+		cout << elf.error << endl;
+		exit(4);
+	}
+	preloadBootJumps(image);
+	elf.load(image);
+	image->setEntry(elf.entry);
+	for(const char* name : {"_start", "tohost", "fromhost"}){
+		uint32_t value;
+		if(elf.symbol(name, &value)) image->setSymbol(name, value);
 	}
-
-	delete [] content;
 }
 
-
-
 #define TEXTIFY(A) #A
 
 void breakMe(){
@@ -459,6 +417,11 @@ public:
     u32 dutRfWriteValue;
 
 	RiscvGolden() {
+		reset();
+	}
+
+	// State out of reset, also how the next program of a batch gets a fresh model
+	virtual void reset(){
 		pc = 0x80000000;
 		regs[0] = 0;
 		for (int i = 0; i < 32; i++)
@@ -492,6 +455,29 @@ public:
 		sbadaddr = 42;
 		lrscReserved = false;
 		fpuCompletionTockens = 0;
+
+		lastPc = 0;
+		lastInstruction = 0;
+		currentInstruction = 0;
+		mscratch = sscratch = 0;
+		stvec.raw = 0;
+		scause.raw = 0;
+		satp.raw = 0;
+		sepc = 0;
+		livenessStep = livenessInterrupt = 0;
+		pendingInterruptsPtr = 0;
+		for(uint32_t &pending : pendingInterrupts) pending = 0;
+		while(!fpuRsp.empty()) fpuRsp.pop();
+		while(!fpuCommit.empty()) fpuCommit.pop();
+		while(!fpuCompletion.empty()) fpuCompletion.pop();
+	}
+
+	virtual void checkpoint(Checkpoint &c){
+		c.tag("golden");
+		c.io(pc, lastPc, lastInstruction, currentInstruction, regs, stepCounter, mscratch, sscratch, misa, privilege, medeleg, mideleg);
+		c.io(fpuRsp, fpuCommit, fpuCompletion, status, ipInput, ipSoft, ie, mtvec, stvec, mcause, scause, satp, fcsr);
+		c.io(lrscReserved, lrscReservedAddress, fpuCompletionTockens, dutRfWriteValue, mbadaddr, sbadaddr, mepc, sepc);
+		c.io(livenessStep, livenessInterrupt, pendingInterruptsPtr, pendingInterrupts);
 	}
 
 	virtual void rfWrite(int32_t address, int32_t data) {
@@ -602,6 +588,7 @@ public:
 		privilege = targetPrivilege;
 		pcWrite(xtvec.base << 2);
 		if(interrupt) livenessInterrupt = 0;
+		else stepTrapped = true;
 
 //		if(!interrupt) step(); //As VexRiscv instruction which trap do not reach writeback stage fire
 	}
@@ -786,9 +773,12 @@ public:
 
 
 
+	bool stepTrapped = false; // the last step() ended in an exception
+
 	virtual void step() {
 	    stepCounter++;
 	    livenessStep = 0;
+	    stepTrapped = false;
 
 	    while(fpuCompletionTockens != 0 && !fpuCompletion.empty()){
             FpuCompletion completion = fpuCompletion.front(); fpuCompletion.pop();
@@ -1308,46 +1298,78 @@ public:
 	virtual void postReset(){}
 	virtual void preCycle(){}
 	virtual void postCycle(){}
+	virtual void checkpoint(Checkpoint &c){}
+	// No transaction in flight nor requested, +idle=fast only skips cycles when all the elements are (see idle.h)
+	virtual bool idle(){ return false; }
 };
 
 
 
 class Workspace;
+class SimModels; // the bus and debug models of the configuration, after their definitions
 
 class Workspace{
 public:
-	static mutex staticMutex;
-	static uint32_t testsCounter, successCounter;
-	static uint64_t cycles;
+	static mutex staticMutex; // keeps the result lines of parallel tests whole
+	static atomic<uint32_t> testsCounter, successCounter;
+	static atomic<uint64_t> cycles;
+	static uint64_t baseSeed;
+	static int processArgc; // forwarded to the context of each test
+	static char** processArgv;
+	static struct timespec processStartedAt;
+	static double startupMs;
 	uint64_t instanceCycles = 0;
-	vector<SimElement*> simElements;
+	SimModels* simModels = NULL; // fillSimELements()
+	vector<SimElement*> simElements; // addSimElement(), the slow path
 	Memory mem;
 	string name;
 	uint64_t currentTime = 22;
 	uint64_t mTimeCmp = 0;
 	uint64_t mTime = 0;
 	VVexRiscv* top;
+	VerilatedContext* context;
+	unique_ptr<VerilatedContext> ownedContext;
 	bool resetDone = false;
 	bool riscvRefEnable = false;
 	uint64_t i;
 	double cyclesPerSecond = 10e6;
 	double allowedCycles = 0.0;
 	uint32_t bootPc = -1;
+	uint32_t tohost = 0; // HTIF tohost in RAM (ELF symbol), 0 when unused
 	uint32_t iStall = STALL,dStall = STALL;
 	#ifdef TRACE
-	VerilatedFstC* tfp;
+	VerilatedFstC* tfp = NULL;
 	#endif
 	bool allowInvalidate = true;
+	bool failed = false; // outcome of the last run()
 
-	uint32_t seed;
+	uint64_t seed;
+	uint32_t modelSeed; // randSeed of the context of the model, for the random initialisation of its state
+	SimRandom random;
 
 	Workspace* setIStall(bool enable) { iStall = enable; return this; }
 	Workspace* setDStall(bool enable) { dStall = enable; return this; }
 
-	ofstream regTraces;
-	ofstream memTraces;
-	ofstream logTraces;
-	ofstream fregTraces;
+	// The writers go through traceSink, declared first so it outlives them
+	TraceSink traceSink;
+	TraceWriter regTraces;
+	TraceWriter memTraces;
+	TraceWriter logTraces;
+	TraceWriter fregTraces;
+	TraceFilter traceFilter; // +trace_pc, +trace_cycles, ... (see trace_filter.h)
+	std::unique_ptr<Lockstep> lockstep; // +lockstep (see lockstep.h), opened by run()
+	std::unique_ptr<ReplayLog> replay; // +replay_record / +replay (see replay.h), opened before the model is built
+	bool replayBegun = false; // its header was written / read by run()
+	bool flightReplaying = false; // the flight recorder replays cycles which were already simulated (see flight.h)
+	uint32_t idleWfi = 0; // cycles in a row with the core in wfi
+	uint64_t idleSkipped = 0, idleJumps = 0; // +idle=fast (see idle.h)
+	SimProfile profile; // +profile (see profile.h), of the last run()
+	std::vector<uint32_t> simElementSlots; // profile slots of the simElements
+	#ifdef FLIGHT
+	FlightRecorder flight;
+	TraceFilter flightTrigger;
+	bool flightArmed = false; // +flight_trigger not hit yet
+	#endif
 
 #ifdef RVF
 	struct FpuIssueInfo {
@@ -1417,6 +1439,10 @@ public:
             if((address & (size-1)) != 0)
             	cout << "Ref did a unaligned read" << endl;
     		if(ws->isPerifRegion(address)){
+				if(periphRead.empty()){
+					cout << "DRead without DUT read" << hex << " address=" << address << " size=" << size << dec << endl;
+					fail();
+				}
 				MemRead t = periphRead.front();
 				if(t.address != address || t.size != size){
 					cout << "DRead missmatch" << hex <<  endl;
@@ -1458,6 +1484,21 @@ public:
         }
 
 
+        virtual void reset(){
+        	RiscvGolden::reset();
+        	mem.reset();
+        	periphWriteTimer = 0;
+        	while(!periphWritesGolden.empty()) periphWritesGolden.pop();
+        	while(!periphWrites.empty()) periphWrites.pop();
+        	while(!periphRead.empty()) periphRead.pop();
+        	rfWriteValid = false;
+        }
+
+        virtual void checkpoint(Checkpoint &c){
+        	RiscvGolden::checkpoint(c);
+        	c.io(mem, periphWriteTimer, periphWritesGolden, periphWrites, periphRead, rfWriteValid, rfWriteAddress, rfWriteData);
+        }
+
         void step() {
         	rfWriteValid = false;
         	RiscvGolden::step();
@@ -1496,48 +1537,157 @@ public:
     }
 	Workspace(string name){
 	    vcdName = name;
-	    //seed = VL_RANDOM_I_WIDTH(32)^VL_RANDOM_I_WIDTH(32)^0x1093472;
-	    //srand48(seed);
     //    setIStall(false);
    //     setDStall(false);
-		staticMutex.lock();
 		testsCounter++;
-		staticMutex.unlock();
 		this->name = name;
-		top = new VVexRiscv;
-		#ifdef TRACE_ACCESS
-			regTraces.open (name + ".regTrace");
-			memTraces.open (name + ".memTrace");
+		seed = seedFor(name);
+		random.seed(seed);
+		simRandomCurrent = &random;
+		#if VM_COVERAGE
+		// The coverage points live in the context of the model, +covfile writes the process one
+		context = Verilated::defaultContextp();
+		modelSeed = context->randSeed();
+		#else
+		ownedContext.reset(new VerilatedContext);
+		context = ownedContext.get();
+		// The +verilator+ args of the process, then the seed of the recorded run with +replay, else one derived from
+		// the seed of the test (0 would take the time). Setting it starts a new seed epoch, so the generator of this
+		// thread is reseeded from it for the model.
+		context->randReset(2);
+		context->commandArgs(processArgc, processArgv);
+		openReplay();
+		if(replay && replay->replaying() && replay->ok()) modelSeed = replay->header.modelSeed;
+		else modelSeed = (uint32_t)(seed ^ seed >> 32) & 0x7FFFFFFF;
+		if(modelSeed == 0) modelSeed = 1;
+		context->randSeed(modelSeed);
+		modelThreads(context);
+		#endif
+		top = new VVexRiscv(context);
+		for(TraceWriter* writer : {&regTraces, &memTraces, &logTraces, &fregTraces}) traceSink.attach(*writer);
+		openTraces();
+		#ifdef FLIGHT
+		flightTrigger.reset(flightTriggerConfig());
+		flightArmed = flightConfig.trigger.kind != TraceTrigger::NONE;
 		#endif
-		logTraces.open (name + ".logTrace");
-		fregTraces.open(name + ".fregTrace");
 		fillSimELements();
 		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start_time);
 	}
 
+	// (Re)create the text traces of the test
+	void openTraces(){
+		#ifdef TRACE_ACCESS
+			uint32_t timeFlag = 0;
+			#ifdef TRACE_WITH_TIME
+			timeFlag = TRACE_FLAG_TIME;
+			#endif
+			regTraces.open(name + ".regTrace", timeFlag | TRACE_FLAG_SPACES);
+			memTraces.open(name + ".memTrace", timeFlag);
+		#endif
+		logTraces.open(name + ".logTrace", 0, TraceWriter::TEXT, false);
+		#ifdef RVD
+		fregTraces.open(name + ".fregTrace", TRACE_FLAG_FREG64);
+		#else
+		fregTraces.open(name + ".fregTrace", 0);
+		#endif
+	}
+
+	// Batch mode : get ready to run another program under another name. Only the memory pages which the previous
+	// one touched are released, the golden model starts afresh and run() goes through the reset sequence again.
+	Workspace* recycle(string name){
+		this->name = name;
+		vcdName = name;
+		seed = seedFor(name);
+		random.seed(seed);
+		mem.reset();
+		riscvRef.reset();
+		currentTime = 22;
+		mTimeCmp = 0;
+		mTime = 0;
+		instanceCycles = 0;
+		idleWfi = 0;
+		idleSkipped = idleJumps = 0;
+		bootPc = -1;
+		tohost = 0;
+		riscvRefEnable = false;
+		resetDone = false;
+		failed = false;
+		for(uint64_t &counter : privilegeCounters) counter = 0;
+		checkpointPending = false;
+		consoleTail.clear();
+		#ifdef RVF
+		fpuPending.clear();
+		#endif
+		traceFilter.reset();
+		lockstep.reset();
+		replay.reset();
+		replayBegun = false;
+		#ifdef FLIGHT
+		flightTrigger.reset(flightTriggerConfig());
+		flightArmed = flightConfig.trigger.kind != TraceTrigger::NONE;
+		#endif
+		openTraces();
+		return this;
+	}
+
+	// Tests of each name created so far by the task (TaskPool) of this thread
+	static thread_local map<string, uint32_t> taskOccurrences;
+
+	// Deterministic per test : the base seed (SEED, +verilator+seed), the name and how many tests of that name its
+	// task created before, so the REDO runs of a test differ and the parallel tasks don't depend on each other
+	static uint64_t seedFor(const string &name){
+		uint32_t occurrence = taskOccurrences[name]++;
+		uint64_t hash = 0xCBF29CE484222325ull ^ baseSeed;
+		for(char c : name) hash = (hash ^ (uint8_t)c) * 0x100000001B3ull;
+		return hash ^ (occurrence * 0x9E3779B97F4A7C15ull);
+	}
+
 	virtual ~Workspace(){
+		if(simRandomCurrent == &random) simRandomCurrent = NULL;
 		delete top;
 		#ifdef TRACE
 		delete tfp;
 		#endif
 
-		for(SimElement* simElement : simElements) {
-			delete simElement;
-		}
+		deleteSimElements();
 	}
 
+	// Extra SimElement, called after the models of the configuration through its virtual functions, owned by the
+	// workspace
+	Workspace* addSimElement(SimElement* element){ simElements.push_back(element); return this; }
+
+	// The file is parsed once per process (or mapped from its image pack), then mapped copy-on-write into both
+	// the DUT and the golden model memories
 	Workspace* loadHex(string path){
-		loadHexImpl(path,&mem);
-		loadHexImpl(path,&riscvRef.mem);
+		loadImage(imageLoad("hex", path, [](const string &path, ImageBuilder *image){ loadHexImpl(path, image); }));
 		return this;
 	}
 
     Workspace* loadBin(string path, uint32_t offset){
-    	loadBinImpl(path,&mem, offset);
-    	loadBinImpl(path,&riscvRef.mem, offset);
+    	char kind[16];
+    	sprintf(kind, "bin@%08x", offset);
+    	loadImage(imageLoad(kind, path, [offset](const string &path, ImageBuilder *image){ loadBinImpl(path, image, offset); }));
         return this;
     }
 
+	// Also boots at the ELF entry point when it isn't the reset vector, and watches the HTIF tohost symbol
+	Workspace* loadElf(string path){
+		shared_ptr<const Image> image = imageLoad("elf", path, [](const string &path, ImageBuilder *image){ loadElfImpl(path, image); });
+		loadImage(image);
+		image->symbol("tohost", &tohost);
+		if(traceFilter.needsSymbols()) traceFilter.resolve(ElfFile(path));
+		#ifdef FLIGHT
+		if(flightTrigger.needsSymbols()) flightTrigger.resolve(ElfFile(path));
+		#endif
+		if(image->hasEntry && image->entry != 0x80000000u) bootAt(image->entry);
+		return this;
+	}
+
+	void loadImage(shared_ptr<const Image> image){
+		image->mapInto(&mem);
+		image->mapInto(&riscvRef.mem);
+	}
+
 	Workspace* setCyclesPerSecond(double value){
 		cyclesPerSecond = value;
 		return this;
@@ -1577,28 +1727,24 @@ public:
 			cout << "Warning, unaligned IBusAccess : " << addr << endl;
 			fail();
 		}
-		*data =     (  (mem[addr + 0] << 0)
-					 | (mem[addr + 1] << 8)
-					 | (mem[addr + 2] << 16)
-					 | (mem[addr + 3] << 24));
+		*data = mem.read32(addr);
 		*error = false;
 	}
 
 
     virtual bool isDBusCheckedRegion(uint32_t address){ return isPerifRegion(address);}
+	// dBusAccess of the bus models, charged to the mmio or memory section of the profile
+	inline void dBusRequest(uint32_t addr,bool wr, uint32_t size, uint8_t *data, bool *error){
+		SimProfile::Scope scope(profile, profile.enabled && isPerifRegion(addr) ? SIM_PROFILE_MMIO : SIM_PROFILE_MEMORY);
+		dBusAccess(addr, wr, size, data, error);
+	}
 	virtual void dBusAccess(uint32_t addr,bool wr, uint32_t size, uint8_t *data, bool *error) {
 		assertEq(addr % size, 0);
 		if(!isPerifRegion(addr)) {
 			if(wr){
-				for(uint32_t b = 0;b < size;b++){
-                    *mem.get(addr + b) = ((uint8_t*)data)[b];
-				}
-
+				mem.write(addr, size, data);
 			}else{
-                uint32_t innerOffset = addr & (DBUS_LOAD_DATA_WIDTH/8-1);
-				for(uint32_t b = 0;b < size;b++){
-					((uint8_t*)data)[b] = mem[addr + b];
-				}
+				mem.read(addr, size, data);
 			}
 		}
 
@@ -1615,6 +1761,7 @@ public:
 			}
 		} else {
 			if(isPerifRegion(addr)){
+				if(replayInputs() && !replay->read(instanceCycles, riscvRef.stepCounter, random.position(), addr, size, data, error)) replayFailed();
 				CpuRef::MemRead r;
 				r.address = addr;
 				r.size = size;
@@ -1644,15 +1791,81 @@ public:
 //		}
 //	}
 
+	// The interrupt lines of the DUT as MIP bits, as the golden model and the replay log take them
+	uint32_t interruptLines(){
+		uint32_t lines = 0;
+		#ifdef TIMER_INTERRUPT
+		lines |= top->timerInterrupt << 7;
+		#endif
+		#ifdef EXTERNAL_INTERRUPT
+		lines |= top->externalInterrupt << 11;
+		#endif
+		#ifdef CSR
+		lines |= top->softwareInterrupt << 3;
+		#endif
+		#ifdef SUPERVISOR
+		lines |= top->externalInterruptS << 9;
+		#endif
+		return lines;
+	}
+
+	void setInterruptLines(uint32_t lines){
+		#ifdef TIMER_INTERRUPT
+		top->timerInterrupt = lines >> 7 & 1;
+		#endif
+		#ifdef EXTERNAL_INTERRUPT
+		top->externalInterrupt = lines >> 11 & 1;
+		#endif
+		#ifdef CSR
+		top->softwareInterrupt = lines >> 3 & 1;
+		#endif
+		#ifdef SUPERVISOR
+		top->externalInterruptS = lines >> 9 & 1;
+		#endif
+	}
+
+	// The replay log which the run feeds, or is fed by. A recording skips the cycles which the flight recorder
+	// simulates again, a replay feeds them again.
+	ReplayLog* replayInputs(){ return replay && (replay->replaying() || !flightReplaying) ? replay.get() : NULL; }
+
+	void replayFailed(){
+		staticMutex.lock();
+		if(replay->divergence.empty()) cout << "REPLAY " << replay->error << endl;
+		else cout << replay->divergence;
+		staticMutex.unlock();
+		fail();
+	}
+
+	#ifdef UTIME_INPUT
+	// csrr of time / timeh, which the golden model takes from the DUT
+	static bool isTimeRead(uint32_t instruction){
+		uint32_t csr = instruction >> 20;
+		return (instruction & 0x7F) == 0x73 && (instruction >> 12 & 7) != 0 && (csr == UTIME || csr == UTIMEH);
+	}
+	#endif
+
 	virtual void postReset() {}
 	virtual void checks(){}
 	virtual void pass(){ throw success();}
 	virtual void fail(){ throw std::exception();}
     virtual void fillSimELements();
+	void deleteSimElements();
+	// simModels, then the simElements
+	inline void elementsOnReset();
+	inline void elementsPostReset();
+	inline void elementsPreCycle();
+	inline void elementsPostCycle();
+	inline bool elementsIdle();
+	inline void elementsCheckpoint(Checkpoint &c);
+	void elementsProfileSlots(); // before a profiled run
 	void dump(uint64_t i){
 		#ifdef TRACE
+		#ifdef FLIGHT
+		if(flight.enabled() && !flightReplaying) return;
+		#endif
+		SimProfile::Scope scope(profile, SIM_PROFILE_WAVE);
 		if(i == TRACE_START && i != 0) cout << "**" << endl << "**" << endl << "**" << endl << "**" << endl << "**" << endl << "START TRACE" << endl;
-		if(i >= TRACE_START) tfp->dump(i);
+		if(i >= TRACE_START && traceFilter.dumping()) tfp->dump(i);
 		#ifdef TRACE_SPORADIC
 		else if(i % 1000000 < 100) tfp->dump(i);
 		#endif
@@ -1660,16 +1873,114 @@ public:
 	}
 
 	uint64_t privilegeCounters[4] = {0,0,0,0};
-	Workspace* run(uint64_t timeout = 5000){
-//		cout << "Start " << name << endl;
-		if(timeout == 0) timeout = 0x7FFFFFFFFFFFFFFF;
 
+	// Checkpoints (see checkpoint.h), taken at the top of a cycle once a trigger matched
+	bool checkpointPending = false;
+	string consoleTail; // last characters printed by the DUT, for the console trigger
+
+	// Everything which isn't in the Verilated model, subclasses with their own state extend it
+	virtual void checkpoint(Checkpoint &c){
+		c.tag("workspace");
+		c.io(mem, currentTime, mTimeCmp, mTime, i, instanceCycles, bootPc, tohost, riscvRefEnable, iStall, dStall, allowInvalidate);
+		c.io(privilegeCounters, consoleTail, random, traceFilter.state);
+		c.io(idleWfi, idleSkipped, idleJumps);
+		#ifdef RVF
+		c.io(fpuPending);
+		#endif
+		riscvRef.checkpoint(c);
+		c.tag("elements");
+		elementsCheckpoint(c);
+	}
+
+	void consoleChar(char c){
+		const string &match = checkpointTriggers.console;
+		if(match.empty()) return;
+		consoleTail += c;
+		if(consoleTail.size() > match.size()) consoleTail.erase(0, consoleTail.size() - match.size());
+		if(consoleTail == match) checkpointPending = true;
+	}
+
+	// The harness state goes to path, the Verilated model to path.vlt. The harness random generator is part of the
+	// state, so the restored runs draw the same stall / garbage values as this one.
+	void saveCheckpoint(){
+		checkpointPending = false;
+		if(flightReplaying) return;
+		string path = checkpointTriggers.file.empty() ? name + ".ckpt" : checkpointTriggers.file;
+		#ifdef CHECKPOINT
+		string error;
+		if(!saveState(path, path + ".vlt", &error)){
+			cout << "CHECKPOINT " << error << endl;
+			fail();
+		}
+		cout << "CHECKPOINT " << path << " cycle=" << instanceCycles << endl;
+		if(checkpointTriggers.exitAfter){
+			regTraces.flush(); memTraces.flush(); logTraces.flush(); fregTraces.flush();
+			#ifdef TRACE
+			tfp->close();
+			#endif
+			exit(0);
+		}
+		#else
+		cout << "CHECKPOINT " << path << " can't be written, the simulator was built without CHECKPOINT=yes" << endl;
+		fail();
+		#endif
+	}
+
+	// Checkpoints and flight recorder snapshots
+	#ifdef CHECKPOINT
+	bool saveState(const string &path, const string &modelPath, string *error){
+		Checkpoint c(path, Checkpoint::SAVE);
+		c.io(name);
+		checkpoint(c);
+		VerilatedSave os;
+		os.open(modelPath.c_str());
+		os << *top;
+		os.close();
+		bool ok = c.close();
+		*error = c.error;
+		return ok;
+	}
+	#endif
+
+	// Returns false when the checkpoint belongs to another test, which then starts from reset
+	bool restoreCheckpoint(string path){
+		#ifdef CHECKPOINT
+		Checkpoint c(path, Checkpoint::RESTORE);
+		string owner;
+		c.io(owner);
+		if(c.ok() && owner != name) return false;
+		checkpoint(c);
+		if(!c.ok()){
+			cerr << "CHECKPOINT " << c.error << endl;
+			exit(4);
+		}
+		traceFilter.restored(instanceCycles);
+		VerilatedRestore os;
+		os.open((path + ".vlt").c_str());
+		os >> *top;
+		os.close();
+		cout << "RESTORE " << path << " cycle=" << instanceCycles << endl;
+		return true;
+		#else
+		cerr << "CHECKPOINT " << path << " can't be restored, the simulator was built without CHECKPOINT=yes" << endl;
+		exit(4);
+		#endif
+	}
+
+	// Trace init and reset sequence, run() does it when it wasn't done before (the fork server resets once for
+	// every input)
+	Workspace* reset(){
 		currentTime = 4;
 		// init trace dump
 		#ifdef TRACE
-		Verilated::traceEverOn(true);
-		tfp = new VerilatedFstC;
-		top->trace(tfp, 99);
+		context->traceEverOn(true);
+		if(tfp == NULL){
+			tfp = new VerilatedFstC;
+			top->trace(tfp, 99);
+		}
+		#ifdef FLIGHT
+		if(!flight.enabled())
+		#endif
 		tfp->open((vcdName + ".fst").c_str());
 		#endif
 
@@ -1679,7 +1990,7 @@ public:
 
 
 		top->eval(); currentTime = 3;
-		for(SimElement* simElement : simElements) simElement->onReset();
+		elementsOnReset();
 
 		top->reset = 1;
 		top->eval();
@@ -1701,7 +2012,7 @@ public:
 		#endif
 		dump(0);
 		top->reset = 0;
-		for(SimElement* simElement : simElements) simElement->postReset();
+		elementsPostReset();
 
 		top->eval(); currentTime = 2;
 
@@ -1713,171 +2024,146 @@ public:
             riscvRef.regs[i] = VEX_CPU->RegFilePlugin_regFile[i];
         }
 		resetDone = true;
+		return this;
+	}
 
-		#ifdef  REF
-		if(bootPc != -1) VEX_CPU->core->prefetch_pc = bootPc;
-		#else
-		if(bootPc != -1) {
-		    #if defined(IBUS_SIMPLE) || defined(IBUS_SIMPLE_WISHBONE) || defined(IBUS_SIMPLE_AHBLITE3)
-                VEX_CPU->IBusSimplePlugin_fetchPc_pcReg = bootPc;
-                #ifdef COMPRESSED
-                VEX_CPU->IBusSimplePlugin_decodePc_pcReg = bootPc;
-                #endif
-            #else
-                VEX_CPU->IBusCachedPlugin_fetchPc_pcReg = bootPc;
-                #ifdef COMPRESSED
-                VEX_CPU->IBusCachedPlugin_decodePc_pcReg = bootPc;
-                #endif
-            #endif
+	// One clock cycle of the simulation at time i, run() loops on it and the flight recorder replays with it
+	void cycle(){
+		/*while(allowedCycles <= 0.0){
+			struct timespec end_time;
+			clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_time);
+			uint64_t diffInNanos = end_time.tv_sec*1e9 + end_time.tv_nsec -  start_time.tv_sec*1e9 - start_time.tv_nsec;
+			start_time = end_time;
+			double dt = diffInNanos*1e-9;
+			allowedCycles += dt*cyclesPerSecond;
+			if(allowedCycles > cyclesPerSecond/100) allowedCycles = cyclesPerSecond/100;
 		}
-		#endif
-
-
-        bool failed = false;
-		try {
-			// run simulation for 100 clock periods
-			for (i = 16; i < timeout*2; i+=2) {
-				/*while(allowedCycles <= 0.0){
-					struct timespec end_time;
-					clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end_time);
-					uint64_t diffInNanos = end_time.tv_sec*1e9 + end_time.tv_nsec -  start_time.tv_sec*1e9 - start_time.tv_nsec;
-					start_time = end_time;
-					double dt = diffInNanos*1e-9;
-					allowedCycles += dt*cyclesPerSecond;
-					if(allowedCycles > cyclesPerSecond/100) allowedCycles = cyclesPerSecond/100;
-				}
-				allowedCycles-=1.0;*/
+		allowedCycles-=1.0;*/
 
 
-				#ifndef REF_TIME
-                #ifndef MTIME_INSTR_FACTOR
-                mTime = i/2;
-                #else
-				mTime += VEX_CPU->lastStageIsFiring*MTIME_INSTR_FACTOR;
-                #endif
-				#endif
-				#ifdef TIMER_INTERRUPT
-				top->timerInterrupt = mTime >= mTimeCmp ? 1 : 0;
-				//if(mTime == mTimeCmp) printf("SIM timer tick\n");
-				#endif
-
+		#ifndef REF_TIME
+        #ifndef MTIME_INSTR_FACTOR
+        mTime = i/2;
+        #else
+		mTime += VEX_CPU->lastStageIsFiring*MTIME_INSTR_FACTOR;
+        #endif
+		#endif
+		#ifdef TIMER_INTERRUPT
+		top->timerInterrupt = mTime >= mTimeCmp ? 1 : 0;
+		//if(mTime == mTimeCmp) printf("SIM timer tick\n");
+		#endif
+		if(replayInputs()){
+			uint32_t lines = interruptLines();
+			replay->lines(instanceCycles, riscvRef.stepCounter, random.position(), &lines);
+			setInterruptLines(lines);
+		}
 
-				#ifdef UTIME_INPUT
-				top->utime = mTime;
-				#endif
 
-				currentTime = i;
+		#ifdef UTIME_INPUT
+		top->utime = mTime;
+		#endif
 
-                #ifdef FLOW_INFO
-                    if(i % 5000000 == 0) cout << endl << "**" << endl << "**"  << endl << "PROGRESS TRACE_START=" << i << endl;
-                #endif
+		currentTime = i;
 
+        #ifdef FLOW_INFO
+            if(i % 5000000 == 0) cout << endl << "**" << endl << "**"  << endl << "PROGRESS TRACE_START=" << i << endl;
+        #endif
 
-				// dump variables into VCD file and toggle clock
 
-				dump(i);
-				//top->eval();
-				top->clk = 0;
-				top->eval();
+		// dump variables into VCD file and toggle clock
 
-				#ifdef CSR
-				    if(riscvRefEnable) {
-                        riscvRef.ipInput = 0;
-    #ifdef TIMER_INTERRUPT
-                        riscvRef.ipInput |= top->timerInterrupt << 7;
-    #endif
-    #ifdef EXTERNAL_INTERRUPT
-                        riscvRef.ipInput |= top->externalInterrupt << 11;
-    #endif
-    #ifdef CSR
-                        riscvRef.ipInput |= top->softwareInterrupt << 3;
-    #endif
-    #ifdef SUPERVISOR
-    //					riscvRef.ipInput |= top->timerInterruptS << 5;
-                        riscvRef.ipInput |= top->externalInterruptS << 9;
-    #endif
+		dump(i);
+		//top->eval();
+		top->clk = 0;
+		{
+			SimProfile::Scope scope(profile, SIM_PROFILE_EVAL);
+			top->eval();
+		}
 
-                        riscvRef.liveness(VEX_CPU->CsrPlugin_inWfi);
-                        if(VEX_CPU->CsrPlugin_interruptJump){
-                            if(riscvRefEnable) riscvRef.trap(true, VEX_CPU->CsrPlugin_interrupt_code);
-                        }
-                    }
-				#endif
+		#ifdef CSR
+		    idleWfi = VEX_CPU->CsrPlugin_inWfi ? idleWfi + 1 : 0;
+		    if(riscvRefEnable) {
+                riscvRef.ipInput = interruptLines();
+                riscvRef.liveness(VEX_CPU->CsrPlugin_inWfi);
+                if(VEX_CPU->CsrPlugin_interruptJump){
+                    if(riscvRefEnable) riscvRef.trap(true, VEX_CPU->CsrPlugin_interrupt_code);
+                }
+            }
+            if(VEX_CPU->CsrPlugin_interruptJump && replayInputs()){
+                if(!replay->interrupt(instanceCycles, riscvRef.stepCounter, random.position(), VEX_CPU->CsrPlugin_interrupt_code)) replayFailed();
+            }
+		#endif
 
-				#ifdef RVF
-				// Capture DUT FPU commit stream for the golden model and track
-				// architectural PCs for FP register writes.
-				if(VEX_CPU->writeBack_FpuPlugin_commit_valid &&
-				   VEX_CPU->writeBack_FpuPlugin_commit_ready &&
-				   VEX_CPU->writeBack_FpuPlugin_commit_payload_write){
-
-					if(riscvRefEnable){
-						FpuCommit c;
-						c.value = VEX_CPU->writeBack_FpuPlugin_commit_payload_value;
-						riscvRef.fpuCommit.push(c);
-					}
+		#ifdef RVF
+		// Capture DUT FPU commit stream for the golden model and track
+		// architectural PCs for FP register writes.
+		if(VEX_CPU->writeBack_FpuPlugin_commit_valid &&
+		   VEX_CPU->writeBack_FpuPlugin_commit_ready &&
+		   VEX_CPU->writeBack_FpuPlugin_commit_payload_write){
+
+			if(riscvRefEnable){
+				FpuCommit c;
+				c.value = VEX_CPU->writeBack_FpuPlugin_commit_payload_value;
+				riscvRef.fpuCommit.push(c);
+			}
 
-					FpuIssueInfo info;
-					info.pc = VEX_CPU->lastStagePc;
-					info.rd = VEX_CPU->writeBack_FpuPlugin_commit_payload_rd;
-					info.opcode = VEX_CPU->writeBack_FpuPlugin_commit_payload_opcode;
-					fpuPending.push_back(info);
-				}
+			FpuIssueInfo info;
+			info.pc = VEX_CPU->lastStagePc;
+			info.rd = VEX_CPU->writeBack_FpuPlugin_commit_payload_rd;
+			info.opcode = VEX_CPU->writeBack_FpuPlugin_commit_payload_opcode;
+			fpuPending.push_back(info);
+		}
 
-				// Architectural F-register writeback trace from FpuCore, tagged with
-				// the original instruction PC captured at FPU command issue time.
-				if(VEX_CPU->FpuPlugin_fpu && VEX_CPU->FpuPlugin_fpu->fregWriteValid){
-					uint32_t fpc = VEX_CPU->lastStagePc;
-					uint32_t frdHw  = VEX_CPU->FpuPlugin_fpu->fregWriteReg;
-					#ifdef RVD
-					uint64_t fval = VEX_CPU->FpuPlugin_fpu->fregWriteData;
-					#else
-					uint32_t fval = VEX_CPU->FpuPlugin_fpu->fregWriteData;
-					#endif
-					for(auto it = fpuPending.begin(); it != fpuPending.end(); ++it){
-						if(it->rd == frdHw){
-							fpc = it->pc;
-							fpuPending.erase(it);
-							break;
-						}
-					}
-					fregTraces
-						<< "PC " << std::hex << std::setw(8) << std::setfill('0') << fpc
-						<< " : f[" << std::dec << std::setw(2) << (uint32_t)frdHw
-						<< "] = 0x" << std::hex
-						#ifdef RVD
-						<< std::setw(16)
-						#else
-						<< std::setw(8)
-						#endif
-						<< std::setfill('0') << fval
-						<< std::dec << std::setfill(' ') << std::endl;
+		// Architectural F-register writeback trace from FpuCore, tagged with
+		// the original instruction PC captured at FPU command issue time.
+		if(VEX_CPU->FpuPlugin_fpu && VEX_CPU->FpuPlugin_fpu->fregWriteValid){
+			uint32_t fpc = VEX_CPU->lastStagePc;
+			uint32_t frdHw  = VEX_CPU->FpuPlugin_fpu->fregWriteReg;
+			#ifdef RVD
+			uint64_t fval = VEX_CPU->FpuPlugin_fpu->fregWriteData;
+			#else
+			uint32_t fval = VEX_CPU->FpuPlugin_fpu->fregWriteData;
+			#endif
+			for(auto it = fpuPending.begin(); it != fpuPending.end(); ++it){
+				if(it->rd == frdHw){
+					fpc = it->pc;
+					fpuPending.erase(it);
+					break;
 				}
+			}
+			SimProfile::Scope scope(profile, SIM_PROFILE_TRACE);
+			if(traceFilter.accept(fpc, riscvRefEnable ? riscvRef.privilege : TRACE_PRIVILEGE_UNKNOWN)) fregTraces.freg(fpc, frdHw, fval);
+		}
 
-				if(riscvRefEnable){
-                    if(VEX_CPU->FpuPlugin_port_rsp_valid && VEX_CPU->FpuPlugin_port_rsp_ready && VEX_CPU->lastStageIsFiring){
-                        FpuRsp c;
-                        c.value = VEX_CPU->FpuPlugin_port_rsp_payload_value;
-                        c.flags = (VEX_CPU->FpuPlugin_port_rsp_payload_NX << 0) |
-                                  (VEX_CPU->FpuPlugin_port_rsp_payload_NV << 4);
-                        riscvRef.fpuRsp.push(c);
-                    }
+		if(riscvRefEnable){
+            if(VEX_CPU->FpuPlugin_port_rsp_valid && VEX_CPU->FpuPlugin_port_rsp_ready && VEX_CPU->lastStageIsFiring){
+                FpuRsp c;
+                c.value = VEX_CPU->FpuPlugin_port_rsp_payload_value;
+                c.flags = (VEX_CPU->FpuPlugin_port_rsp_payload_NX << 0) |
+                          (VEX_CPU->FpuPlugin_port_rsp_payload_NV << 4);
+                riscvRef.fpuRsp.push(c);
+            }
 
-                    if(VEX_CPU->FpuPlugin_port_completion_valid && VEX_CPU->FpuPlugin_port_completion_payload_written){
-                        FpuCompletion c;
-                        c.flags = (VEX_CPU->FpuPlugin_port_completion_payload_flags_NX << 0) |
-                                  (VEX_CPU->FpuPlugin_port_completion_payload_flags_UF << 1) |
-                                  (VEX_CPU->FpuPlugin_port_completion_payload_flags_OF << 2) |
-                                  (VEX_CPU->FpuPlugin_port_completion_payload_flags_DZ << 3) |
-                                  (VEX_CPU->FpuPlugin_port_completion_payload_flags_NV << 4);
-                        riscvRef.fpuCompletion.push(c);
-                    }
-                }
-                #endif
+            if(VEX_CPU->FpuPlugin_port_completion_valid && VEX_CPU->FpuPlugin_port_completion_payload_written){
+                FpuCompletion c;
+                c.flags = (VEX_CPU->FpuPlugin_port_completion_payload_flags_NX << 0) |
+                          (VEX_CPU->FpuPlugin_port_completion_payload_flags_UF << 1) |
+                          (VEX_CPU->FpuPlugin_port_completion_payload_flags_OF << 2) |
+                          (VEX_CPU->FpuPlugin_port_completion_payload_flags_DZ << 3) |
+                          (VEX_CPU->FpuPlugin_port_completion_payload_flags_NV << 4);
+                riscvRef.fpuCompletion.push(c);
+            }
+        }
+        #endif
 
 
-                if(VEX_CPU->lastStageIsFiring){
-                   	if(riscvRefEnable) {
+        if(VEX_CPU->lastStageIsFiring){
+           	uint32_t commitPrivilege = riscvRefEnable ? riscvRef.privilege : TRACE_PRIVILEGE_UNKNOWN;
+           	traceFilter.onCommit(VEX_CPU->lastStagePc, instanceCycles);
+           	#ifdef FLIGHT
+           	flightTrigger.onCommit(VEX_CPU->lastStagePc, instanceCycles);
+           	#endif
+           	if(riscvRefEnable) {
 //                        privilegeCounters[riscvRef.privilege]++;
 //                        if((riscvRef.stepCounter & 0xFFFFF) == 0){
 //                            cout << "privilege report" << endl;
@@ -1885,111 +2171,421 @@ public:
 //                            cout << "- S " << privilegeCounters[1] << endl;
 //                            cout << "- M " << privilegeCounters[3] << endl;
 //                        }
-                        riscvRef.dutRfWriteValue = VEX_CPU->lastStageRegFileWrite_payload_data;
-                   	    riscvRef.step();
-                   	    bool mIntTimer = false;
-                   	    bool mIntExt = false;
-                   	}
-
-                   	if(riscvRefEnable && VEX_CPU->lastStagePc != riscvRef.lastPc){
-						cout << hex << " pc missmatch " << VEX_CPU->lastStagePc << " should be " << riscvRef.lastPc << dec << endl;
-						fail();
-					}
+                riscvRef.dutRfWriteValue = VEX_CPU->lastStageRegFileWrite_payload_data;
+           	    {
+           	        SimProfile::Scope scope(profile, SIM_PROFILE_GOLDEN);
+           	        riscvRef.step();
+           	    }
+           	    #ifdef UTIME_INPUT
+           	    if(replayInputs() && isTimeRead(riscvRef.lastInstruction)) replay->time(instanceCycles, riscvRef.stepCounter - 1, riscvRef.dutRfWriteValue);
+           	    #endif
+           	    bool mIntTimer = false;
+           	    bool mIntExt = false;
+           	}
+
+           	if(riscvRefEnable && VEX_CPU->lastStagePc != riscvRef.lastPc){
+				cout << hex << " pc missmatch " << VEX_CPU->lastStagePc << " should be " << riscvRef.lastPc << dec << endl;
+				fail();
+			}
+			if(checkpointTriggers.hasPc && VEX_CPU->lastStagePc == checkpointTriggers.pc) checkpointPending = true;
+			if(lockstep && !lockstep->commit(0, VEX_CPU->lastStagePc, VEX_CPU->lastStageRegFileWrite_valid ? VEX_CPU->lastStageRegFileWrite_payload_address : 0, VEX_CPU->lastStageRegFileWrite_payload_data)){
+				staticMutex.lock();
+				cout << lockstep->mismatch;
+				staticMutex.unlock();
+				fail();
+			}
+
+
+        	bool rfWriteValid = false;
+        	int32_t rfWriteAddress;
+        	int32_t rfWriteData;
+
+            if(VEX_CPU->lastStageRegFileWrite_valid == 1 && VEX_CPU->lastStageRegFileWrite_payload_address != 0){
+            	rfWriteValid = true;
+            	rfWriteAddress = VEX_CPU->lastStageRegFileWrite_payload_address;
+            	rfWriteData = VEX_CPU->lastStageRegFileWrite_payload_data;
+            	#ifdef TRACE_ACCESS
+            	SimProfile::Scope scope(profile, SIM_PROFILE_TRACE);
+                if(traceFilter.accept(VEX_CPU->lastStagePc, commitPrivilege)) regTraces.reg(currentTime, VEX_CPU->lastStagePc, VEX_CPU->lastStageRegFileWrite_payload_address, (uint32_t)VEX_CPU->lastStageRegFileWrite_payload_data);
+                #endif
+            } else {
+                #ifdef TRACE_ACCESS
+                SimProfile::Scope scope(profile, SIM_PROFILE_TRACE);
+                if(traceFilter.accept(VEX_CPU->lastStagePc, commitPrivilege)) regTraces.pc(currentTime, VEX_CPU->lastStagePc);
+                #endif
+            }
+			if(riscvRefEnable) if(rfWriteValid != riscvRef.rfWriteValid ||
+				(rfWriteValid && (rfWriteAddress!= riscvRef.rfWriteAddress || rfWriteData!= riscvRef.rfWriteData))){
+            	cout << "regFile write missmatch :" << endl;
+            	if(rfWriteValid) cout << " REF: RF[" << riscvRef.rfWriteAddress << "] = 0x" << hex << riscvRef.rfWriteData << dec << endl;
+            	if(rfWriteValid) cout << " DUT: RF[" << rfWriteAddress << "] = 0x" << hex << rfWriteData << dec << endl;
+            	fail();
+            }
+        }
+
+        #ifdef CSR
+            if(VEX_CPU->CsrPlugin_hadException){
+                traceFilter.onException(instanceCycles);
+                #ifdef FLIGHT
+                flightTrigger.onException(instanceCycles);
+                #endif
+                // Log exception PC and RISC-V exception cause code (stdout + run.logTrace)
+                if(!flightReplaying) std::cout << "EXC pc=0x" << std::hex << std::setw(8) << std::setfill('0')
+                          << VEX_CPU->lastStagePc
+                          << " cause=" << std::dec << (unsigned)VEX_CPU->CsrPlugin_trapCause
+                          << std::setfill(' ') << std::endl;
+                {
+                    SimProfile::Scope scope(profile, SIM_PROFILE_TRACE);
+                    char exception[64];
+                    logTraces.text(exception, snprintf(exception, sizeof(exception), "EXC pc=0x%08x cause=%u\n", (uint32_t)VEX_CPU->lastStagePc, (unsigned)VEX_CPU->CsrPlugin_trapCause));
+                    #ifdef TRACE_ACCESS
+                    regTraces.exception(currentTime, VEX_CPU->lastStagePc, VEX_CPU->CsrPlugin_trapCause);
+                    memTraces.exception(currentTime, VEX_CPU->lastStagePc, VEX_CPU->CsrPlugin_trapCause);
+                    #endif
+                }
+                if(riscvRefEnable) {
+                    SimProfile::Scope scope(profile, SIM_PROFILE_GOLDEN);
+                    riscvRef.step();
+                }
+            }
+        #endif
+
+		elementsPreCycle();
+
+		dump(i + 1);
+
+		checks();
+		//top->eval();
+		top->clk = 1;
+		{
+			SimProfile::Scope scope(profile, SIM_PROFILE_EVAL);
+			top->eval();
+		}
+
+		instanceCycles += 1;
+		traceFilter.tick(instanceCycles);
+		#ifdef FLIGHT
+		flightTrigger.tick(instanceCycles);
+		#endif
+		if(checkpointTriggers.hasCycle && instanceCycles == checkpointTriggers.cycle) checkpointPending = true;
+
+		elementsPostCycle();
+		#ifdef RVF
+		top->fpuCmdHalt = VL_RANDOM_I_WIDTH(1);
+        top->fpuCommitHalt = VL_RANDOM_I_WIDTH(1);
+        top->fpuRspHalt = VL_RANDOM_I_WIDTH(1);
+        #endif
+
+
+
+		if (context->gotFinish())
+			exit(0);
+	}
+
+	// +idle=fast : when the core waits in wfi and the buses are quiescent, moves the time to the cycle before the timer
+	// interrupt rises, at most to the cycle before limit, as if the skipped cycles were simulated (see idle.h)
+	void idleForward(uint64_t limit){
+		#if defined(CSR) && !defined(REF_TIME) && !defined(MTIME_INSTR_FACTOR)
+		if(!idleConfig.fast || idleWfi < IDLE_WFI_CYCLES) return;
+		if(!elementsIdle()) return;
+		uint64_t target = limit - 2;
+		#ifdef TIMER_INTERRUPT
+		// The timer line rises at the cycle of i == mTimeCmp*2, nothing else changes before
+		if(mTime < mTimeCmp && mTimeCmp < UINT64_MAX/2) target = min(target, mTimeCmp*2 - 2);
+		#endif
+		if(target <= i) return;
+		uint64_t skipped = (target - i)/2;
+		if(checkpointTriggers.hasCycle && checkpointTriggers.cycle > instanceCycles) skipped = min(skipped, checkpointTriggers.cycle - instanceCycles - 1);
+		if(skipped == 0) return;
+		i += skipped*2;
+		instanceCycles += skipped;
+		idleSkipped += skipped;
+		idleJumps++;
+		idleAddMcycle(VEX_CPU, skipped, 0);
+		traceFilter.tick(instanceCycles);
+		#ifdef FLIGHT
+		flightTrigger.tick(instanceCycles);
+		#endif
+		#endif
+	}
+
+	#ifdef FLIGHT
+	void flightSnapshot(){
+		FlightRecorder::Slot* slot = flight.take(instanceCycles);
+		string error = "can't create the snapshot memory files";
+		if(slot && saveState(slot->path(), slot->modelPath(), &error)) {
+			slot->valid = true;
+			double ms;
+			uint64_t bytes;
+			if(flight.taken(*slot, &ms, &bytes)){
+				staticMutex.lock();
+				cout << "FLIGHT " << name << " snapshot of " << bytes/1024 << " KiB took " << ms << " ms, interval raised to " << flight.interval << " cycles" << endl;
+				staticMutex.unlock();
+			}
+			return;
+		}
+		cout << "FLIGHT " << error << endl;
+	}
+
+	// Rewind to the oldest snapshot and simulate again up to now, with the waveform dumped to path. The traces,
+	// the console and the lockstep reference skip the replayed cycles. False if the snapshot can't be restored.
+	bool flightRecord(const string &path){
+		const FlightRecorder::Slot* slot = flight.oldest();
+		if(slot == NULL) return true;
+		uint64_t end = i, endCycles = instanceCycles;
+		bool pending = checkpointPending;
+		Checkpoint c(slot->path(), Checkpoint::RESTORE);
+		string owner;
+		c.io(owner);
+		checkpoint(c);
+		if(!c.ok()){
+			cout << "FLIGHT " << c.error << endl;
+			return false;
+		}
+		traceFilter.restored(instanceCycles);
+		VerilatedRestore os;
+		os.open(slot->modelPath().c_str());
+		os >> *top;
+		os.close();
+		if(replay && replay->replaying()) replay->seek(instanceCycles);
+
+		for(TraceWriter* writer : {&regTraces, &memTraces, &logTraces, &fregTraces}) writer->suspend();
+		std::unique_ptr<Lockstep> held = std::move(lockstep);
+		flightReplaying = true;
+		tfp->open(path.c_str());
+		bool diverged = false;
+		try {
+			for(;i < end;i += 2){
+				idleForward(end);
+				cycle();
+			}
+			dump(i);
+		} catch (...) {
+			diverged = true;
+		}
+		tfp->close();
+		flightReplaying = false;
+		lockstep = std::move(held);
+		checkpointPending = pending;
+		for(TraceWriter* writer : {&regTraces, &memTraces, &logTraces, &fregTraces}) writer->resume();
+
+		staticMutex.lock();
+		cout << "FLIGHT " << path << " cycles " << slot->cycle << " to " << instanceCycles << endl;
+		if(diverged || instanceCycles != endCycles) cout << "FLIGHT the replay of " << name << " diverged at cycle " << instanceCycles << ", " << endCycles << " expected" << endl;
+		staticMutex.unlock();
+		return !diverged && instanceCycles == endCycles;
+	}
+	#endif
+
+	// +replay_golden : the golden model alone, fed by the replay log with the reads and the interrupts of the DUT, up to
+	// steps instructions or the end of the recorded run. It writes the regTrace which the DUT would have written and
+	// passes once there, with its state printed.
+	void runGolden(uint64_t steps){
+		#ifdef RVF
+		cout << "REPLAY +replay_golden doesn't support the FPU" << endl;
+		fail();
+		#endif
+		if(!replay->header.golden){
+			cout << "REPLAY " << name << " was recorded without the golden model" << endl;
+			fail();
+		}
+		const ReplayEvent &end = replay->recordedEnd();
+		uint64_t cycle = 0;
+		while(riscvRef.stepCounter < steps){
+			while(const ReplayEvent* e = replay->golden(riscvRef.stepCounter)){
+				cycle = e->cycle;
+				switch(e->kind){
+				case REPLAY_REG: riscvRef.regs[e->address] = e->value; break;
+				case REPLAY_LINES: riscvRef.ipInput = e->value; break;
+				case REPLAY_INTERRUPT: riscvRef.liveness(true); riscvRef.trap(true, e->address); break;
+				case REPLAY_TIME: riscvRef.dutRfWriteValue = e->value; break;
+				case REPLAY_READ: {
+					CpuRef::MemRead r;
+					r.address = e->address;
+					r.size = e->size;
+					memcpy(r.data42, &e->value, e->size);
+					r.error = e->error;
+					riscvRef.periphRead.push(r);
+				} break;
+				}
+			}
+			if(riscvRef.stepCounter >= end.step) break;
+			currentTime = 16 + cycle*2;
+			uint32_t pc = riscvRef.pc;
+			riscvRef.step();
+			// The DUT side of the peripheral writes isn't there to check them against
+			while(!riscvRef.periphWritesGolden.empty()) riscvRef.periphWritesGolden.pop();
+			riscvRef.periphWriteTimer = 0;
+			#ifdef TRACE_ACCESS
+			if(riscvRef.stepTrapped){
+				uint32_t cause = riscvRef.privilege == 3 ? riscvRef.mcause.exceptionCode : riscvRef.scause.exceptionCode;
+				regTraces.exception(currentTime, pc, cause);
+			} else if(traceFilter.accept(riscvRef.lastPc, riscvRef.privilege)){
+				if(riscvRef.rfWriteValid) regTraces.reg(currentTime, riscvRef.lastPc, riscvRef.rfWriteAddress, (uint32_t)riscvRef.rfWriteData);
+				else regTraces.pc(currentTime, riscvRef.lastPc);
+			}
+			#endif
+		}
+		staticMutex.lock();
+		cout << "REPLAY " << name << " golden model at step " << riscvRef.stepCounter << ", cycle " << cycle << " of the recorded run which "
+			 << (end.error ? "failed" : "passed") << " at cycle " << end.cycle << " step " << end.step << endl;
+		cout << hex << setfill('0') << " pc=" << setw(8) << riscvRef.pc << " privilege=" << riscvRef.privilege << endl;
+		for(int r = 0;r < 32;r++) cout << (r % 8 == 0 ? " " : "") << "x" << dec << r << hex << "=" << setw(8) << (uint32_t)riscvRef.regs[r] << (r % 8 == 7 ? "\n" : " ");
+		cout << dec << setfill(' ');
+		staticMutex.unlock();
+		throw success();
+	}
 
+	// +replay_record / +replay log of the test, if any
+	void openReplay(){
+		if(replayConfig.record.empty() && replayConfig.replay.empty()) return;
+		if(replayConfig.replay.empty()) replay.reset(new ReplayLog(replayConfig.record, name, ReplayLog::RECORD));
+		else replay.reset(new ReplayLog(replayConfig.replay, name, ReplayLog::REPLAY));
+	}
 
-                	bool rfWriteValid = false;
-                	int32_t rfWriteAddress;
-                	int32_t rfWriteData;
-
-                    if(VEX_CPU->lastStageRegFileWrite_valid == 1 && VEX_CPU->lastStageRegFileWrite_payload_address != 0){
-                    	rfWriteValid = true;
-                    	rfWriteAddress = VEX_CPU->lastStageRegFileWrite_payload_address;
-                    	rfWriteData = VEX_CPU->lastStageRegFileWrite_payload_data;
-                    	#ifdef TRACE_ACCESS
-                        regTraces <<
-                            #ifdef TRACE_WITH_TIME
-                            currentTime <<
-                             #endif
-                             " PC " << hex << setw(8) <<  VEX_CPU->lastStagePc << " : reg[" << dec << setw(2) << (uint32_t)VEX_CPU->lastStageRegFileWrite_payload_address << "] = " << hex << setw(8) << VEX_CPU->lastStageRegFileWrite_payload_data <<  dec << endl;
-                        #endif
-                    } else {
-                        #ifdef TRACE_ACCESS
-                        regTraces <<
-                                #ifdef TRACE_WITH_TIME
-                                currentTime <<
-                                 #endif
-                                 " PC " << hex << setw(8) <<  VEX_CPU->lastStagePc << dec << endl;
-                        #endif
-                    }
-					if(riscvRefEnable) if(rfWriteValid != riscvRef.rfWriteValid ||
-						(rfWriteValid && (rfWriteAddress!= riscvRef.rfWriteAddress || rfWriteData!= riscvRef.rfWriteData))){
-                    	cout << "regFile write missmatch :" << endl;
-                    	if(rfWriteValid) cout << " REF: RF[" << riscvRef.rfWriteAddress << "] = 0x" << hex << riscvRef.rfWriteData << dec << endl;
-                    	if(rfWriteValid) cout << " DUT: RF[" << rfWriteAddress << "] = 0x" << hex << rfWriteData << dec << endl;
-                    	fail();
-                    }
-                }
+	Workspace* run(uint64_t timeout = 5000){
+//		cout << "Start " << name << endl;
+		if(timeout == 0) timeout = 0x7FFFFFFFFFFFFFFF;
+		simRandomCurrent = &random;
+		if(!replay) openReplay();
+		if(replay && !replayBegun){
+			replayBegun = true;
+			if(replay->ok()){
+				uint64_t position = random.position();
+				replay->begin(modelSeed, seed, &position, riscvRefEnable);
+				if(replay->replaying()){
+					// The random stream of the recorded run, from where it was there
+					seed = replay->header.seed;
+					random.seed(seed);
+					random.seek(position);
+				}
+			}
+		}
+		if(!resetDone) reset();
+		if(replay && replay->ok() && instanceCycles == 0){
+			// The register file isn't reset, its content comes from the random initialisation of the model
+			for(uint32_t r = 1;r < 32;r++){
+				uint32_t value = VEX_CPU->RegFilePlugin_regFile[r];
+				if(!replay->reg(r, &value)) break;
+				VEX_CPU->RegFilePlugin_regFile[r] = value;
+				riscvRef.regs[r] = value;
+			}
+		}
 
-                #ifdef CSR
-                    if(VEX_CPU->CsrPlugin_hadException){
-                        // Log exception PC and RISC-V exception cause code (stdout + run.logTrace)
-                        std::cout << "EXC pc=0x" << std::hex << std::setw(8) << std::setfill('0')
-                                  << VEX_CPU->lastStagePc
-                                  << " cause=" << std::dec << (unsigned)VEX_CPU->CsrPlugin_trapCause
-                                  << std::setfill(' ') << std::endl;
-                        logTraces << "EXC pc=0x" << std::hex << std::setw(8) << std::setfill('0')
-                                  << VEX_CPU->lastStagePc
-                                  << " cause=" << std::dec << (unsigned)VEX_CPU->CsrPlugin_trapCause
-                                  << std::setfill(' ') << std::endl;
-                        if(riscvRefEnable) {
-                            riscvRef.step();
-                        }
-                    }
+		#ifdef  REF
+		if(bootPc != -1) VEX_CPU->core->prefetch_pc = bootPc;
+		#else
+		if(bootPc != -1) {
+		    #if defined(IBUS_SIMPLE) || defined(IBUS_SIMPLE_WISHBONE) || defined(IBUS_SIMPLE_AHBLITE3)
+                VEX_CPU->IBusSimplePlugin_fetchPc_pcReg = bootPc;
+                #ifdef COMPRESSED
+                VEX_CPU->IBusSimplePlugin_decodePc_pcReg = bootPc;
                 #endif
+            #else
+                VEX_CPU->IBusCachedPlugin_fetchPc_pcReg = bootPc;
+                #ifdef COMPRESSED
+                VEX_CPU->IBusCachedPlugin_decodePc_pcReg = bootPc;
+                #endif
+            #endif
+		}
+		#endif
 
-				for(SimElement* simElement : simElements) simElement->preCycle();
-
-				dump(i + 1);
-
-				checks();
-				//top->eval();
-				top->clk = 1;
-				top->eval();
 
-				instanceCycles += 1;
+		uint64_t startAt = 16;
+		if(!checkpointTriggers.restore.empty() && restoreCheckpoint(checkpointTriggers.restore)){
+			startAt = i;
+			if(replay && replay->replaying()) replay->seek(instanceCycles);
+		}
 
-				for(SimElement* simElement : simElements) simElement->postCycle();
-				#ifdef RVF
-				top->fpuCmdHalt = VL_RANDOM_I_WIDTH(1);
-                top->fpuCommitHalt = VL_RANDOM_I_WIDTH(1);
-                top->fpuRspHalt = VL_RANDOM_I_WIDTH(1);
-                #endif
+		staticMutex.lock();
+		if(startupMs < 0) startupMs = memoryElapsedMs(processStartedAt);
+		staticMutex.unlock();
 
+		if(!lockstepConfig.path.empty() && !lockstep) lockstep.reset(new Lockstep(lockstepConfig.path, name));
 
+		#ifdef FLIGHT
+		flight.reset(instanceCycles);
+		#endif
+		profile.start(instanceCycles);
+		if(profile.enabled) elementsProfileSlots();
+		failed = false;
+		try {
+			if(lockstep && !lockstep->ok()){
+				cout << "LOCKSTEP " << lockstep->error << endl;
+				fail();
+			}
+			if(replay && !replay->ok()) replayFailed();
+			if(replay && replay->replaying()){
+				if(replayConfig.goldenSteps) runGolden(replayConfig.goldenSteps);
+				if(replay->header.modelSeed != modelSeed){
+					staticMutex.lock();
+					cout << "REPLAY " << name << " was recorded with the model seeded with " << replay->header.modelSeed << ", this one with " << modelSeed
+						 << " (VM_COVERAGE shares the context of the process), the model isn't initialised the same" << endl;
+					staticMutex.unlock();
+				}
+			}
+			// run simulation for 100 clock periods
+			for (i = startAt; i < timeout*2; i+=2) {
+				if(checkpointPending) saveCheckpoint();
+				#ifdef FLIGHT
+				if(instanceCycles >= flight.next) flightSnapshot();
+				if(flightArmed && flightTrigger.state.started){
+					flightArmed = false;
+					if(!flightRecord(vcdName + ".trigger.fst")) fail();
+				}
+				#endif
 
-				if (Verilated::gotFinish())
-					exit(0);
+				idleForward(timeout*2);
+				cycle();
+				if(profile.progressDue()){
+					staticMutex.lock();
+					profile.progress(stdout, name, instanceCycles);
+					staticMutex.unlock();
+				}
 			}
 			cout << "timeout" << endl;
 			fail();
 		} catch (const success e) {
-			staticMutex.lock();
-			cout <<"SUCCESS " << name <<  endl;
 			successCounter++;
 			cycles += instanceCycles;
+			staticMutex.lock();
+			cout <<"SUCCESS " << name <<  endl;
 			staticMutex.unlock();
 		} catch (const std::exception& e) {
+			cycles += instanceCycles;
 			staticMutex.lock();
 
-			cout << "FAIL " <<  name << " at PC=" << hex << setw(8) << VEX_CPU->lastStagePc << dec; //<<  " seed : " << seed <<
+			cout << "FAIL " <<  name << " at PC=" << hex << setw(8) << VEX_CPU->lastStagePc << dec;
 			if(riscvRefEnable) cout << hex << " REF PC=" << riscvRef.lastPc << " REF I=" << riscvRef.lastInstruction << dec;
-			cout << " time=" << i;
+			cout << " time=" << i << " seed=0x" << hex << seed << dec;
 			cout << endl;
 
-			cycles += instanceCycles;
 			staticMutex.unlock();
 			failed = true;
 		}
+		if(profile.enabled){
+			profile.stop(instanceCycles);
+			if(!profile.writeJson(name + ".profile.json", name)) perror((name + ".profile.json").c_str());
+			staticMutex.lock();
+			profile.summary(stdout, name.c_str());
+			profileTotal.add(profile);
+			staticMutex.unlock();
+		}
+		#ifdef FLIGHT
+		if(failed) flightRecord(vcdName + ".fst");
+		#endif
+		if(replay && replay->ok() && !replayConfig.goldenSteps){
+			bool reproduced = replay->end(instanceCycles, riscvRef.stepCounter, random.position(), failed);
+			staticMutex.lock();
+			if(reproduced) cout << replay->summary() << endl;
+			else cout << replay->divergence;
+			staticMutex.unlock();
+		}
+		if(idleSkipped){
+			staticMutex.lock();
+			cout << "IDLE " << name << " fast-forwarded " << idleSkipped << " of " << instanceCycles << " cycles in " << idleJumps << " jumps" << endl;
+			staticMutex.unlock();
+		}
 
 
 
@@ -1998,6 +2594,21 @@ public:
 		#ifdef TRACE
 		tfp->close();
 		#endif
+		regTraces.flush();
+		memTraces.flush();
+		logTraces.flush();
+		fregTraces.flush();
+		if(lockstep && lockstep->error.empty()){
+			staticMutex.lock();
+			cout << lockstep->summary() << endl;
+			staticMutex.unlock();
+		}
+		TraceSinkStats sinkStats = traceSink.stats();
+		if(sinkStats.stalls || sinkStats.dropped){
+			staticMutex.lock();
+			cout << "TRACE SINK " << name << " records=" << sinkStats.records << " stalls=" << sinkStats.stalls << " dropped=" << sinkStats.dropped << " high_water=" << sinkStats.highWater << endl;
+			staticMutex.unlock();
+		}
         #ifdef STOP_ON_ERROR
             if(failed){
                 sleep(1);
@@ -2029,6 +2640,10 @@ public:
 	virtual void dBusAccess(uint32_t addr,bool wr, uint32_t size, uint8_t *dataBytes, bool *error) {
 		uint32_t *data = ((uint32_t*)dataBytes);
 
+		if(wr) traceFilter.onStore(addr, size, instanceCycles);
+		#ifdef FLIGHT
+		if(wr) flightTrigger.onStore(addr, size, instanceCycles);
+		#endif
 #ifdef TRACE_ACCESS
 		if(wr){
 			uint32_t logPc = VEX_CPU->__PVT__memory_to_writeBack_PC;
@@ -2038,22 +2653,22 @@ public:
 			for(uint32_t b = 0; b < capped; b++){
 				value |= ((uint64_t)((uint8_t*)dataBytes)[b]) << (8*b);
 			}
-			#ifdef TRACE_WITH_TIME
-			memTraces << currentTime;
-			#endif
-			memTraces << " PC " << hex << setw(8) << setfill('0') << logPc;
-			memTraces << " : MEM[0x" << setw(8) << addr << "] <= " << dec << size << " bytes : 0x";
-			uint32_t widthVal = size * 2;
-			if(widthVal < 2) widthVal = 2;
-			memTraces << hex << setw(static_cast<int>(widthVal)) << value;
-			memTraces << dec << setfill(' ') << endl;
+			if(lockstep && !lockstep->store(0, logPc, addr, size, value)){
+				staticMutex.lock();
+				cout << lockstep->mismatch;
+				staticMutex.unlock();
+				fail();
+			}
+			SimProfile::Scope scope(profile, SIM_PROFILE_TRACE);
+			if(traceFilter.accept(logPc, riscvRefEnable ? riscvRef.privilege : TRACE_PRIVILEGE_UNKNOWN)) memTraces.mem(currentTime, logPc, addr, size, value);
 		}
 #endif
 		if(wr){
 			switch(addr){
 			case 0xF0010000u: {
-				cout << (char)*data;
-				logTraces << (char)*data;
+				if(!flightReplaying) cout << (char)*data;
+				logTraces.text((char)*data);
+				consoleChar((char)*data);
 				dutPutChar((char)*data);
 				break;
 			}
@@ -2067,8 +2682,9 @@ public:
 			case 0xF0013000u: top->softwareInterrupt = *data & 1; break;
 #endif
 			case 0xF00FFF00u: {
-				cout << (char)*data;
-				logTraces << (char)*data;
+				if(!flightReplaying) cout << (char)*data;
+				logTraces.text((char)*data);
+				consoleChar((char)*data);
 				dutPutChar((char)*data);
 				break;
 			}
@@ -2089,14 +2705,19 @@ public:
 			case 0xF00FFF4Cu: mTimeCmp = (mTimeCmp & 0x00000000FFFFFFFF) | (((uint64_t)*data) << 32); break;
 			case 0xF00FFF50u: cout << "mTime " << *data << " : " << mTime << endl;
 			}
+			#ifndef DEBUG_PLUGIN_EXTERNAL
+			if(tohost && addr == tohost && !isPerifRegion(addr) && (*data & 1)){
+				if(*data == 1) pass();
+				cout << "tohost test asked for failure " << (*data >> 1) << endl;
+				fail();
+			}
+			#endif
 			if((addr & 0xFFFFF000) == 0xF5670000){
 			    uint32_t t = 0x900FF000 | (addr & 0xFFF);
-			    uint32_t old = (*mem.get(t + 3) << 24) | (*mem.get(t + 2) << 16)  | (*mem.get(t + 1) << 8)  | (*mem.get(t + 0) << 0);
+			    uint32_t old;
+			    mem.read(t, 4, (uint8_t*)&old);
 			    old++;
-			    *mem.get(t + 0) = old & 0xFF; old >>= 8;
-			    *mem.get(t + 1) = old & 0xFF; old >>= 8;
-			    *mem.get(t + 2) = old & 0xFF; old >>= 8;
-			    *mem.get(t + 3) = old & 0xFF; old >>= 8;
+			    mem.write(t, 4, (uint8_t*)&old);
 			}
 		}else{
 			switch(addr){
@@ -2137,6 +2758,13 @@ public:
 
 	}
 
+    virtual void checkpoint(Checkpoint &c){
+        WorkspaceRegression::checkpoint(c);
+        uint32_t hitOffset = hit - target;
+        c.io(regFileWriteRefIndex, hitOffset);
+        hit = target + hitOffset;
+    }
+
     virtual void dutPutChar(char c){
         if(*hit == c) hit++; else hit = target;
         if(*hit == 0) {
@@ -2165,7 +2793,11 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(pendings, rPtr, wPtr); }
+	virtual bool idle(){ return rPtr == wPtr && !top->iBus_cmd_valid; }
+
 	virtual void onReset(){
+		rPtr = wPtr = 0;
 		top->iBus_cmd_ready = 1;
 		top->iBus_rsp_valid = 0;
 	}
@@ -2213,6 +2845,9 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(nextData); }
+	virtual bool idle(){ return !top->iBusTc_enable; }
+
 	virtual void onReset(){
 	}
 
@@ -2254,7 +2889,11 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(rsps); }
+	virtual bool idle(){ return rsps.empty() && !top->iBusAvalon_read; }
+
 	virtual void onReset(){
+		while(!rsps.empty()) rsps.pop();
 		top->iBusAvalon_waitRequestn = 1;
 		top->iBusAvalon_readDataValid = 0;
 	}
@@ -2301,6 +2940,9 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(iBusAhbLite3_HRDATA, iBusAhbLite3_HRESP, pending); }
+	virtual bool idle(){ return !pending && top->iBusAhbLite3_HTRANS != 2; }
+
 	virtual void onReset(){
 	    pending = false;
 		top->iBusAhbLite3_HREADY = 1;
@@ -2345,8 +2987,13 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(error_next, pendingCount, address); }
+	virtual bool idle(){ return pendingCount == 0 && !top->iBus_cmd_valid; }
+
 
 	virtual void onReset(){
+		error_next = false;
+		pendingCount = 0;
 		top->iBus_cmd_ready = 1;
 		top->iBus_rsp_valid = 0;
 	}
@@ -2407,7 +3054,12 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(inst_next, error_next, tasks); }
+	virtual bool idle(){ return tasks.empty() && !top->iBusAvalon_read; }
+
 	virtual void onReset(){
+		error_next = false;
+		while(!tasks.empty()) tasks.pop();
 		top->iBusAvalon_waitRequestn = 1;
 		top->iBusAvalon_readDataValid = 0;
 	}
@@ -2458,6 +3110,8 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual bool idle(){ return !top->iBusWishbone_CYC; }
+
 	virtual void onReset(){
 		top->iBusWishbone_ACK = !ws->iStall;
 		top->iBusWishbone_ERR = 0;
@@ -2501,7 +3155,12 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(data_next, error_next, pending); }
+	virtual bool idle(){ return !pending && !top->dBus_cmd_valid; }
+
 	virtual void onReset(){
+		error_next = false;
+		pending = false;
 		top->dBus_cmd_ready = 1;
 		top->dBus_rsp_ready = 1;
 	}
@@ -2510,7 +3169,7 @@ public:
 		if (top->dBus_cmd_valid && top->dBus_cmd_ready) {
 			pending = true;
 			data_next = top->dBus_cmd_payload_data;
-			ws->dBusAccess(top->dBus_cmd_payload_address,top->dBus_cmd_payload_wr,1 << top->dBus_cmd_payload_size,((uint8_t*)&data_next) + (top->dBus_cmd_payload_address & 3),&error_next);
+			ws->dBusRequest(top->dBus_cmd_payload_address,top->dBus_cmd_payload_wr,1 << top->dBus_cmd_payload_size,((uint8_t*)&data_next) + (top->dBus_cmd_payload_address & 3),&error_next);
 		}
 	}
 
@@ -2549,7 +3208,11 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(rsps); }
+	virtual bool idle(){ return rsps.empty() && !top->dBusAvalon_read && !top->dBusAvalon_write; }
+
 	virtual void onReset(){
+		while(!rsps.empty()) rsps.pop();
 		top->dBusAvalon_waitRequestn = 1;
 		top->dBusAvalon_readDataValid = 0;
 	}
@@ -2598,6 +3261,9 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(dBusAhbLite3_HADDR, dBusAhbLite3_HSIZE, dBusAhbLite3_HTRANS, dBusAhbLite3_HWRITE); }
+	virtual bool idle(){ return dBusAhbLite3_HTRANS != 2 && top->dBusAhbLite3_HTRANS != 2; }
+
 	virtual void onReset(){
 		top->dBusAhbLite3_HREADY = 1;
 		top->dBusAhbLite3_HRESP = 0;
@@ -2608,7 +3274,7 @@ public:
         if(top->dBusAhbLite3_HREADY && dBusAhbLite3_HTRANS == 2 && dBusAhbLite3_HWRITE){
             uint32_t data = top->dBusAhbLite3_HWDATA;
             bool error;
-            ws->dBusAccess(dBusAhbLite3_HADDR, 1, (1<<dBusAhbLite3_HSIZE),((uint8_t*)&data) + (dBusAhbLite3_HADDR&0x3),&error);
+            ws->dBusRequest(dBusAhbLite3_HADDR, 1, (1<<dBusAhbLite3_HSIZE),((uint8_t*)&data) + (dBusAhbLite3_HADDR&0x3),&error);
         }
 
         if(top->dBusAhbLite3_HREADY){
@@ -2628,7 +3294,7 @@ public:
 
 		if(top->dBusAhbLite3_HREADY && dBusAhbLite3_HTRANS == 2 && !dBusAhbLite3_HWRITE){
 		    bool error;
-		    ws->dBusAccess(dBusAhbLite3_HADDR, 0, (1<<dBusAhbLite3_HSIZE),((uint8_t*)&top->dBusAhbLite3_HRDATA) + (dBusAhbLite3_HADDR&0x3),&error);
+		    ws->dBusRequest(dBusAhbLite3_HADDR, 0, (1<<dBusAhbLite3_HSIZE),((uint8_t*)&top->dBusAhbLite3_HRDATA) + (dBusAhbLite3_HADDR&0x3),&error);
 		    top->dBusAhbLite3_HRESP  = error;
 		}
 	}
@@ -2651,6 +3317,8 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual bool idle(){ return !top->dBusWishbone_CYC; }
+
 	virtual void onReset(){
 		top->dBusWishbone_ACK = !ws->iStall;
 		top->dBusWishbone_ERR = 0;
@@ -2708,7 +3376,21 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(rsps, invalidationHint, reservationValid, reservationAddress, pendingSync, rsp); }
+
+	// The random invalidations aren't sent over the skipped cycles
+	virtual bool idle(){
+		#ifdef DBUS_INVALIDATE
+		if(pendingSync != 0 || top->dBus_inv_valid || top->dBus_sync_valid) return false;
+		#endif
+		return rsps.empty() && !top->dBus_cmd_valid;
+	}
+
 	virtual void onReset(){
+		while(!rsps.empty()) rsps.pop();
+		while(!invalidationHint.empty()) invalidationHint.pop();
+		reservationValid = false;
+		pendingSync = 0;
 		top->dBus_cmd_ready = 1;
 		top->dBus_rsp_valid = 0;
 		#ifdef DBUS_AGGREGATION
@@ -2734,7 +3416,7 @@ public:
                 #ifndef DBUS_EXCLUSIVE
                     bool error;
                     int shift = top->dBus_cmd_payload_address & (DBUS_STORE_DATA_WIDTH/8-1);
-                    ws->dBusAccess(top->dBus_cmd_payload_address,1,size,((uint8_t*)&top->dBus_cmd_payload_data) + shift,&error);
+                    ws->dBusRequest(top->dBus_cmd_payload_address,1,size,((uint8_t*)&top->dBus_cmd_payload_data) + shift,&error);
                 #else
                     bool cancel = false, error = false;
                     if(top->dBus_cmd_payload_exclusive){
@@ -2746,7 +3428,7 @@ public:
                         for(int idx = 0;idx < 1;idx++){
                             bool localError = false;
                             int shift = top->dBus_cmd_payload_address & (DBUS_STORE_DATA_WIDTH/8-1);
-                            ws->dBusAccess(top->dBus_cmd_payload_address,1,size,((uint8_t*)&top->dBus_cmd_payload_data) + shift,&localError);
+                            ws->dBusRequest(top->dBus_cmd_payload_address,1,size,((uint8_t*)&top->dBus_cmd_payload_data) + shift,&localError);
                             error |= localError;
                         }
                     }
@@ -2763,12 +3445,17 @@ public:
                 uint32_t endAt = top->dBus_cmd_payload_address + (1 << top->dBus_cmd_payload_size);
                 uint32_t address = top->dBus_cmd_payload_address & ~(DBUS_LOAD_DATA_WIDTH/8-1);
                 uint8_t buffer[64];
-                ws->dBusAccess(top->dBus_cmd_payload_address,0,1 << top->dBus_cmd_payload_size,buffer, &error);
+                ws->dBusRequest(top->dBus_cmd_payload_address,0,1 << top->dBus_cmd_payload_size,buffer, &error);
                 for(int beat = 0;beat <= beatCount;beat++){
-                    for(int i = 0;i < DBUS_LOAD_DATA_WIDTH/8;i++){
-                        rsp.data[i] = (address >= startAt && address < endAt) ? buffer[address-top->dBus_cmd_payload_address] : VL_RANDOM_I_WIDTH(8);
-                        address += 1;
-                    }
+                    //Bytes of the beat outside of the access are garbage, the others are a single copy from the access buffer
+                    uint32_t beatBytes = DBUS_LOAD_DATA_WIDTH/8;
+                    uint32_t lo = address < startAt ? min(startAt - address, beatBytes) : 0;
+                    uint32_t hi = endAt > address ? min(endAt - address, beatBytes) : 0;
+                    if(hi < lo) hi = lo;
+                    for(uint32_t i = 0;i < lo;i++) rsp.data[i] = VL_RANDOM_I_WIDTH(8);
+                    memcpy(rsp.data + lo, buffer + (address + lo - startAt), hi - lo);
+                    for(uint32_t i = hi;i < beatBytes;i++) rsp.data[i] = VL_RANDOM_I_WIDTH(8);
+                    address += beatBytes;
                     rsp.last = beat == beatCount;
                     #ifdef DBUS_EXCLUSIVE
                         if(top->dBus_cmd_payload_exclusive){
@@ -2869,7 +3556,12 @@ public:
 		this->top = ws->top;
 	}
 
+	virtual void checkpoint(Checkpoint &c){ c.io(beatCounter, rsps); }
+	virtual bool idle(){ return beatCounter == 0 && rsps.empty() && !top->dBusAvalon_read && !top->dBusAvalon_write; }
+
 	virtual void onReset(){
+		beatCounter = 0;
+		while(!rsps.empty()) rsps.pop();
 		top->dBusAvalon_waitRequestn = 1;
 		top->dBusAvalon_readDataValid = 0;
 	}
@@ -2881,7 +3573,7 @@ public:
                 uint32_t size = __builtin_popcount(top->dBusAvalon_byteEnable);
                 uint32_t offset = ffs(top->dBusAvalon_byteEnable)-1;
 				bool error_next = false;
-				ws->dBusAccess(top->dBusAvalon_address + beatCounter * 4 + offset,1,size,((uint8_t*)&top->dBusAvalon_writeData)+offset,&error_next);
+				ws->dBusRequest(top->dBusAvalon_address + beatCounter * 4 + offset,1,size,((uint8_t*)&top->dBusAvalon_writeData)+offset,&error_next);
 				beatCounter++;
 				if(beatCounter == top->dBusAvalon_burstCount){
 					beatCounter = 0;
@@ -2889,7 +3581,7 @@ public:
 			} else {
 				for(int beat = 0;beat < top->dBusAvalon_burstCount;beat++){
 					DBusCachedAvalonTask rsp;
-					ws->dBusAccess(top->dBusAvalon_address  + beat * 4 ,0,4,((uint8_t*)&rsp.data),&rsp.error);
+					ws->dBusRequest(top->dBusAvalon_address  + beat * 4 ,0,4,((uint8_t*)&rsp.data),&rsp.error);
 					rsps.push(rsp);
 				}
 			}
@@ -2961,6 +3653,8 @@ public:
 	bool taskValid = false;
 	DebugPluginTask task;
 
+	// The debugger connection itself isn't part of the checkpoint
+	virtual void checkpoint(Checkpoint &c){ c.io(timeSpacer, taskValid, task); }
 
 	DebugPlugin(Workspace* ws){
 		this->ws = ws;
@@ -3029,6 +3723,15 @@ public:
 		top->debugReset = 0;
 	}
 
+	// No debugger connected nor command pending. With DEBUG_PLUGIN_EXTERNAL one may connect at any time, never idle.
+	virtual bool idle(){
+		#ifdef DEBUG_PLUGIN_EXTERNAL
+		return false;
+		#else
+		return clientHandle == -1 && !taskValid;
+		#endif
+	}
+
 	void connectionReset(){
 		printf("CONNECTION RESET\n");
 		shutdown(clientHandle,SHUT_RDWR);
@@ -3112,6 +3815,8 @@ public:
 
 	bool rspFire = false;
 
+	virtual bool idle(){ return DebugPlugin::idle() && !rspFire; }
+
 	virtual void preCycle(){
 		DebugPlugin::preCycle();
 
@@ -3162,6 +3867,8 @@ public:
 
 	bool rspFire = false;
 
+	virtual bool idle(){ return DebugPlugin::idle() && !rspFire; }
+
 	virtual void preCycle(){
 		DebugPlugin::preCycle();
 
@@ -3224,69 +3931,152 @@ public:
 };
 #endif
 
+// The models of the configuration, one per slot, in the order the harness calls them (see sim_elements.h)
+#if defined(IBUS_SIMPLE)
+typedef IBusSimple IBusModel;
+#elif defined(IBUS_SIMPLE_AVALON)
+typedef IBusSimpleAvalon IBusModel;
+#elif defined(IBUS_SIMPLE_AHBLITE3)
+typedef IBusSimpleAhbLite3 IBusModel;
+#elif defined(IBUS_CACHED)
+typedef IBusCached IBusModel;
+#elif defined(IBUS_CACHED_AVALON)
+typedef IBusCachedAvalon IBusModel;
+#elif defined(IBUS_CACHED_WISHBONE) || defined(IBUS_SIMPLE_WISHBONE)
+typedef IBusCachedWishbone IBusModel;
+#else
+typedef NoSimElement IBusModel;
+#endif
+
+#ifdef IBUS_TC
+typedef IBusTc IBusTcModel;
+#else
+typedef NoSimElement IBusTcModel;
+#endif
+
+#if defined(DBUS_SIMPLE)
+typedef DBusSimple DBusModel;
+#elif defined(DBUS_SIMPLE_AVALON)
+typedef DBusSimpleAvalon DBusModel;
+#elif defined(DBUS_SIMPLE_AHBLITE3)
+typedef DBusSimpleAhbLite3 DBusModel;
+#elif defined(DBUS_CACHED)
+typedef DBusCached DBusModel;
+#elif defined(DBUS_CACHED_AVALON)
+typedef DBusCachedAvalon DBusModel;
+#elif defined(DBUS_CACHED_WISHBONE) || defined(DBUS_SIMPLE_WISHBONE)
+typedef DBusCachedWishbone DBusModel;
+#else
+typedef NoSimElement DBusModel;
+#endif
+
+#if defined(DEBUG_PLUGIN_STD)
+typedef DebugPluginStd DebugModel;
+#elif defined(DEBUG_PLUGIN_AVALON)
+typedef DebugPluginAvalon DebugModel;
+#else
+typedef NoSimElement DebugModel;
+#endif
+
+#if defined(RISCV_JTAG) || defined(VEXRISCV_JTAG)
+// The JTAG probe of the core
+class JtagProbe : public Jtag{
+public:
+	JtagProbe(Workspace* ws) : Jtag(&ws->top->jtag_tms, &ws->top->jtag_tdi, &ws->top->jtag_tdo, &ws->top->jtag_tck, 4) {}
+};
+#endif
+
+#ifdef RISCV_JTAG
+typedef SimElements<JtagProbe, VexRiscvJtag> RiscvJtagModel;
+#else
+typedef NoSimElement RiscvJtagModel;
+#endif
+#ifdef VEXRISCV_JTAG
+typedef SimElements<JtagProbe, VexRiscvJtag> VexRiscvJtagModel;
+#else
+typedef NoSimElement VexRiscvJtagModel;
+#endif
+
+class SimModels : public SimElements<IBusModel, IBusTcModel, DBusModel, DebugModel, RiscvJtagModel, VexRiscvJtagModel>{
+public:
+	SimModels(Workspace* ws) : SimElements(ws) {}
+};
+
 void Workspace::fillSimELements(){
-	#ifdef IBUS_SIMPLE
-		simElements.push_back(new IBusSimple(this));
-	#endif
-	#ifdef IBUS_SIMPLE_AVALON
-		simElements.push_back(new IBusSimpleAvalon(this));
-	#endif
-    #ifdef IBUS_SIMPLE_AHBLITE3
-        simElements.push_back(new IBusSimpleAhbLite3(this));
-    #endif
+	simModels = new SimModels(this);
+}
 
+void Workspace::deleteSimElements(){
+	delete simModels;
+	simModels = NULL;
+	for(SimElement* simElement : simElements) {
+		delete simElement;
+	}
+	simElements.clear();
+}
 
-	#ifdef IBUS_CACHED
-		simElements.push_back(new IBusCached(this));
-	#endif
-	#ifdef IBUS_CACHED_AVALON
-		simElements.push_back(new IBusCachedAvalon(this));
-	#endif
-	#if defined(IBUS_CACHED_WISHBONE) || defined(IBUS_SIMPLE_WISHBONE)
-		simElements.push_back(new IBusCachedWishbone(this));
-	#endif
+inline void Workspace::elementsOnReset(){
+	simModels->onReset();
+	for(SimElement* simElement : simElements) simElement->onReset();
+}
 
-	#ifdef IBUS_TC
-		simElements.push_back(new IBusTc(this));
-	#endif
+inline void Workspace::elementsPostReset(){
+	simModels->postReset();
+	for(SimElement* simElement : simElements) simElement->postReset();
+}
 
-	#ifdef DBUS_SIMPLE
-		simElements.push_back(new DBusSimple(this));
-	#endif
-	#ifdef DBUS_SIMPLE_AVALON
-		simElements.push_back(new DBusSimpleAvalon(this));
-	#endif
-    #ifdef DBUS_SIMPLE_AHBLITE3
-        simElements.push_back(new DBusSimpleAhbLite3(this));
-    #endif
-	#ifdef DBUS_CACHED
-		simElements.push_back(new DBusCached(this));
-	#endif
-	#ifdef DBUS_CACHED_AVALON
-		simElements.push_back(new DBusCachedAvalon(this));
-	#endif
-	#if defined(DBUS_CACHED_WISHBONE) || defined(DBUS_SIMPLE_WISHBONE)
-		simElements.push_back(new DBusCachedWishbone(this));
-	#endif
-	#ifdef DEBUG_PLUGIN_STD
-		simElements.push_back(new DebugPluginStd(this));
-	#endif
-	#ifdef DEBUG_PLUGIN_AVALON
-		simElements.push_back(new DebugPluginAvalon(this));
-	#endif
-	#ifdef RISCV_JTAG
-		simElements.push_back(new Jtag(&top->jtag_tms, &top->jtag_tdi, &top->jtag_tdo, &top->jtag_tck, 4));
-        simElements.push_back(new VexRiscvJtag(this));
-	#endif
-    #ifdef VEXRISCV_JTAG
-        simElements.push_back(new Jtag(&top->jtag_tms, &top->jtag_tdi, &top->jtag_tdo, &top->jtag_tck, 4));
-        simElements.push_back(new VexRiscvJtag(this));
-    #endif
+inline void Workspace::elementsPreCycle(){
+	if(profile.enabled){
+		simModels->preCycle(profile);
+		for(size_t e = 0;e < simElements.size();e++){
+			SimProfile::Scope scope(profile, simElementSlots[e]);
+			simElements[e]->preCycle();
+		}
+		return;
+	}
+	simModels->preCycle();
+	for(SimElement* simElement : simElements) simElement->preCycle();
+}
+
+inline void Workspace::elementsPostCycle(){
+	if(profile.enabled){
+		simModels->postCycle(profile);
+		for(size_t e = 0;e < simElements.size();e++){
+			SimProfile::Scope scope(profile, SimProfile::postCycleSlot(simElementSlots[e]));
+			simElements[e]->postCycle();
+		}
+		return;
+	}
+	simModels->postCycle();
+	for(SimElement* simElement : simElements) simElement->postCycle();
+}
+
+void Workspace::elementsProfileSlots(){
+	simModels->profileSlots(profile);
+	simElementSlots.clear();
+	for(SimElement* simElement : simElements) simElementSlots.push_back(profile.element(typeid(*simElement)));
+}
+
+inline bool Workspace::elementsIdle(){
+	if(!simModels->idle()) return false;
+	for(SimElement* simElement : simElements) if(!simElement->idle()) return false;
+	return true;
+}
+
+inline void Workspace::elementsCheckpoint(Checkpoint &c){
+	simModels->checkpoint(c);
+	for(SimElement* simElement : simElements) simElement->checkpoint(c);
 }
 
 mutex Workspace::staticMutex;
-uint64_t Workspace::cycles = 0;
-uint32_t Workspace::testsCounter = 0, Workspace::successCounter = 0;
+atomic<uint64_t> Workspace::cycles(0);
+struct timespec Workspace::processStartedAt;
+double Workspace::startupMs = -1;
+thread_local map<string, uint32_t> Workspace::taskOccurrences;
+atomic<uint32_t> Workspace::testsCounter(0), Workspace::successCounter(0);
+uint64_t Workspace::baseSeed = 0;
+int Workspace::processArgc = 0;
+char** Workspace::processArgv = NULL;
 
 #ifndef REF
 #define testA1ReagFileWriteRef {1,10},{2,20},{3,40},{4,60}
@@ -3308,6 +4098,11 @@ public:
 		loadHex(string(REGRESSION_PATH) + "../../resources/hex/testA.hex");
 	}
 
+	virtual void checkpoint(Checkpoint &c){
+		WorkspaceRegression::checkpoint(c);
+		c.io(regFileWriteRefIndex);
+	}
+
 	virtual void checks(){
 		if(VEX_CPU->lastStageRegFileWrite_valid == 1 && VEX_CPU->lastStageRegFileWrite_payload_address != 0){
 			assertEq(VEX_CPU->lastStageRegFileWrite_payload_address, regFileWriteRefArray[regFileWriteRefIndex][0]);
@@ -3334,6 +4129,11 @@ public:
 		loadHex(string(REGRESSION_PATH) + "../../resources/hex/" + name + ".hex");
 	}
 
+	virtual void checkpoint(Checkpoint &c){
+		WorkspaceRegression::checkpoint(c);
+		c.io(refIndex);
+	}
+
 	virtual void checks(){
 		if(VEX_CPU->lastStageRegFileWrite_valid == 1 && VEX_CPU->lastStageRegFileWrite_payload_address == 28){
 			assertEq(VEX_CPU->lastStageRegFileWrite_payload_data, ref[refIndex]);
@@ -3450,6 +4250,11 @@ public:
 		}
 	}
 
+	virtual void checkpoint(Checkpoint &c){
+		WorkspaceRegression::checkpoint(c);
+		c.io(out32Counter);
+	}
+
 
     virtual void dBusAccess(uint32_t addr,bool wr, uint32_t size, uint8_t *dataBytes, bool *error) {
         if(wr && addr == 0xF00FFF2C){
@@ -3797,6 +4602,11 @@ public:
 	    stdinRestore();
 	    #endif
 	}
+
+	virtual void checkpoint(Checkpoint &c){
+		Workspace::checkpoint(c);
+		c.io(customCin);
+	}
 	virtual bool isDBusCheckedRegion(uint32_t address){ return true;}
 	virtual bool isPerifRegion(uint32_t addr) { return (addr & 0xF0000000) == 0xF0000000 || (addr & 0xE0000000) == 0xE0000000;}
     virtual bool isMmuRegion(uint32_t addr) { return true; }
@@ -3816,12 +4626,12 @@ public:
                     if(wr){
                         char c = (char)*data;
                         cout << c;
-                        logTraces << c;
-                        logTraces.flush();
+                        logTraces.text(c);
+                        consoleChar(c);
                         onStdout(c);
                     } else {
                         #ifdef WITH_USER_IO
-                        if(stdinNonEmpty()){
+                        if(!(replay && replay->replaying()) && stdinNonEmpty()){ // the recorded input is fed back
                             char c;
                             read(0, &c, 1);
                             *data = c;
@@ -3863,6 +4673,11 @@ public:
     ~LinuxRegression() {
     }
 
+    virtual void checkpoint(Checkpoint &c){
+        LinuxSoc::checkpoint(c);
+        c.io(pendingLine, state);
+    }
+
 
     virtual void onStdout(char c){
         pendingLine += c;
@@ -3903,6 +4718,11 @@ public:
 	    stdinRestore();
 	    #endif
 	}
+
+	virtual void checkpoint(Checkpoint &c){
+		Workspace::checkpoint(c);
+		c.io(customCin);
+	}
 	virtual bool isDBusCheckedRegion(uint32_t address){ return true;}
 	virtual bool isPerifRegion(uint32_t addr) { return (addr & 0xF0000000) == 0xF0000000;}
     virtual bool isMmuRegion(uint32_t addr) { return true; }
@@ -3921,14 +4741,14 @@ public:
     		    if(wr){
     		        char c = (char)*data;
                     cout << c;
-                    logTraces << c;
-                    logTraces.flush();
+                    logTraces.text(c);
+                    consoleChar(c);
                     onStdout(c);
 				}
             case 0xF0000004:
     		    if(!wr){
 				    #ifdef WITH_USER_IO
-					if(stdinNonEmpty()){
+					if(!(replay && replay->replaying()) && stdinNonEmpty()){
 						char c;
 						read(0, &c, 1);
 						*data = c;
@@ -4210,59 +5030,199 @@ long timer_end(struct timespec start_time){
     return diffInNanos;
 }
 
-#define redo(count,that) for(uint32_t xxx = 0;xxx < count;xxx++) that
 #include <pthread.h>
 #include <queue>
 #include <functional>
 #include <thread>
 
 
-static void multiThreading(queue<std::function<void()>> *lambdas, std::mutex *mutex){
-    uint32_t counter = 0;
-	while(true){
-		mutex->lock();
-		if(lambdas->empty()){
-			mutex->unlock();
-			break;
+// Every test of the regression is a task of this pool. The THREAD_COUNT workers are started on the first submit
+// and pick the tasks in submission order, each Workspace only touches its own Verilated context, so any mix of
+// tests can run side by side.
+class TaskPool{
+public:
+	TaskPool(uint32_t threadCount) : threadCount(threadCount) {}
+	~TaskPool(){ join(); }
+
+	void submit(std::function<void()> task){
+		if(threadCount <= 1) {
+			Workspace::taskOccurrences.clear();
+			task();
+			return;
 		}
-
-        #ifdef SEED
-            uint32_t seed = SEED + counter;
-            counter++;
-            srand48(seed);
-            printf("MT_SEED=%d \n", seed);
-        #endif
-		std::function<void()> lambda = lambdas->front();
-		lambdas->pop();
-		mutex->unlock();
-
-		lambda();
+		{
+			lock_guard<mutex> lock(tasksMutex);
+			if(workers.empty()) for(uint32_t id = 0;id < threadCount;id++) workers.emplace_back(&TaskPool::work, this);
+			tasks.push(std::move(task));
+			pending++;
+		}
+		taskReady.notify_one();
 	}
-}
 
+	// Returns once every submitted task is done
+	void wait(){
+		unique_lock<mutex> lock(tasksMutex);
+		idle.wait(lock, [&](){ return pending == 0; });
+	}
 
-static void multiThreadedExecute(queue<std::function<void()>> &lambdas){
-    std::mutex mutex;
-    if(THREAD_COUNT == 1){
-        multiThreading(&lambdas, &mutex);
-    } else {
-        std::thread * t[THREAD_COUNT];
-        for(int id = 0;id < THREAD_COUNT;id++){
-            t[id] = new thread(multiThreading,&lambdas,&mutex);
-        }
-        for(int id = 0;id < THREAD_COUNT;id++){
-            t[id]->join();
-            delete t[id];
-        }
+	// wait() then stop the workers
+	void join(){
+		wait();
+		{
+			lock_guard<mutex> lock(tasksMutex);
+			stopping = true;
+		}
+		taskReady.notify_all();
+		for(std::thread &worker : workers) worker.join();
+		workers.clear();
+	}
+
+private:
+	uint32_t threadCount;
+	mutex tasksMutex;
+	condition_variable taskReady, idle;
+	queue<std::function<void()>> tasks;
+	vector<std::thread> workers;
+	uint32_t pending = 0;
+	bool stopping = false;
+
+	void work(){
+		unique_lock<mutex> lock(tasksMutex);
+		while(true){
+			taskReady.wait(lock, [&](){ return stopping || !tasks.empty(); });
+			if(tasks.empty()) return;
+			std::function<void()> task = std::move(tasks.front());
+			tasks.pop();
+			lock.unlock();
+			Workspace::taskOccurrences.clear();
+			task();
+			lock.lock();
+			if(--pending == 0) idle.notify_all();
+		}
 	}
-}
+};
+
+// The REDO runs of a test share its trace / output files, so they stay one task
+#define redo(count,that) regressionPool.submit([=]() mutable { for(uint32_t xxx = 0;xxx < count;xxx++) { that; } });
 
 int main(int argc, char **argv, char **env) {
+	clock_gettime(CLOCK_MONOTONIC, &Workspace::processStartedAt);
     #ifdef SEED
     srand48(SEED);
     #endif
 	Verilated::randReset(2);
 	Verilated::commandArgs(argc, argv);
+	Workspace::processArgc = argc;
+	Workspace::processArgv = argv;
+	modelThreads(Verilated::defaultContextp());
+	#ifdef SEED
+	Workspace::baseSeed = SEED;
+	#else
+	// +verilator+seed+N, else a new one per process, like Verilator's own generator
+	Workspace::baseSeed = Verilated::threadContextp()->randSeed();
+	if(Workspace::baseSeed == 0) Workspace::baseSeed = (((uint64_t)getpid() << 16) ^ Workspace::processStartedAt.tv_nsec) & 0x7FFFFFFF;
+	#endif
+	simRandomMain.seed(Workspace::baseSeed);
+
+	if (const char* pages_arg = Verilated::commandArgsPlusMatch("mem_pages=")) {
+		const char* val = pages_arg + std::strlen("+mem_pages=");
+		memoryConfigure(*pages_arg ? val : NULL);
+	}
+	if (const char* pack_arg = Verilated::commandArgsPlusMatch("image_pack=")) {
+		const char* val = pack_arg + std::strlen("+image_pack=");
+		imagePackConfigure(*pack_arg ? val : NULL);
+	}
+	if (const char* fork_arg = Verilated::commandArgsPlusMatch("fork_server=")) {
+		const char* val = fork_arg + std::strlen("+fork_server=");
+		forkServerConfigure(*fork_arg ? val : NULL);
+	}
+	if (const char* batch_arg = Verilated::commandArgsPlusMatch("batch=")) {
+		const char* val = batch_arg + std::strlen("+batch=");
+		batchConfigure(*batch_arg ? val : NULL);
+	}
+	if (const char* trace_format_arg = Verilated::commandArgsPlusMatch("trace_format=")) {
+		const char* val = trace_format_arg + std::strlen("+trace_format=");
+		traceFormatConfigure(*trace_format_arg ? val : NULL);
+	} else {
+		traceFormatConfigure(NULL);
+	}
+	if (const char* trace_index_arg = Verilated::commandArgsPlusMatch("trace_index=")) {
+		const char* val = trace_index_arg + std::strlen("+trace_index=");
+		traceIndexConfigure(*trace_index_arg ? val : NULL);
+	} else {
+		traceIndexConfigure(NULL);
+	}
+	for(const char* name : {"pc", "cycles", "priv", "start", "stop", "for"}){
+		string plusarg = string("trace_") + name + "=";
+		if (const char* trace_filter_arg = Verilated::commandArgsPlusMatch(plusarg.c_str())) {
+			const char* val = trace_filter_arg + plusarg.size() + 1;
+			if(!traceFilterConfigure(name, *trace_filter_arg ? val : NULL)){
+				cout << "Bad +" << plusarg << val << endl;
+				exit(4);
+			}
+		}
+	}
+	for(const char* name : {"flight", "flight_trigger"}){
+		string plusarg = string(name) + "=";
+		if (const char* flight_arg = Verilated::commandArgsPlusMatch(plusarg.c_str())) {
+			const char* val = flight_arg + plusarg.size() + 1;
+			if(!flightConfigure(name, *flight_arg ? val : NULL)){
+				cout << "Bad +" << plusarg << val << endl;
+				exit(4);
+			}
+		}
+	}
+	if (const char* profile_arg = Verilated::commandArgsPlusMatch("profile=")) {
+		if(*profile_arg){
+			const char* val = profile_arg + std::strlen("+profile=");
+			if(!profileConfigure(val)){
+				cout << "Bad +profile=" << val << endl;
+				exit(4);
+			}
+		}
+	}
+	if (!std::strcmp(Verilated::commandArgsPlusMatch("profile"), "+profile")) profileConfigure(NULL);
+	if (const char* idle_arg = Verilated::commandArgsPlusMatch("idle=")) {
+		const char* val = idle_arg + std::strlen("+idle=");
+		if(!idleConfigure(*idle_arg ? val : NULL)){
+			cout << "Bad +idle=" << val << endl;
+			exit(4);
+		}
+	}
+	for(const char* name : {"lockstep", "lockstep_context"}){
+		string plusarg = string(name) + "=";
+		if (const char* lockstep_arg = Verilated::commandArgsPlusMatch(plusarg.c_str())) {
+			const char* val = lockstep_arg + plusarg.size() + 1;
+			lockstepConfigure(name, *lockstep_arg ? val : NULL);
+		}
+	}
+	for(const char* name : {"replay_record", "replay", "replay_golden"}){
+		string plusarg = string(name) + "=";
+		if (const char* replay_arg = Verilated::commandArgsPlusMatch(plusarg.c_str())) {
+			const char* val = replay_arg + plusarg.size() + 1;
+			if(!replayConfigure(name, *replay_arg ? val : NULL)){
+				cout << "Bad +" << plusarg << val << endl;
+				exit(4);
+			}
+		}
+	}
+	if(replayConfig.goldenSteps && replayConfig.replay.empty()){
+		cout << "+replay_golden needs +replay" << endl;
+		exit(4);
+	}
+	if (const char* trace_sink_arg = Verilated::commandArgsPlusMatch("trace_sink=")) {
+		const char* val = trace_sink_arg + std::strlen("+trace_sink=");
+		traceSinkConfigure(*trace_sink_arg ? val : NULL);
+	} else {
+		traceSinkConfigure(NULL);
+	}
+	for(const char* name : {"cycle", "pc", "console", "file", "then", "restore"}){
+		string plusarg = string("checkpoint_") + name + "=";
+		if (const char* checkpoint_arg = Verilated::commandArgsPlusMatch(plusarg.c_str())) {
+			const char* val = checkpoint_arg + plusarg.size() + 1;
+			checkpointConfigure(name, *checkpoint_arg ? val : NULL);
+		}
+	}
 
 #if VM_COVERAGE
 	g_cov_path = "logs/coverage.dat";
@@ -4282,6 +5242,13 @@ int main(int argc, char **argv, char **env) {
 
 	printf("BOOT\n");
 	timespec startedAt = timer_start();
+	// The tests share the cores with the threads of their model. Under coverage they all share the process context and
+	// its thread pool, which evaluates one model at a time.
+	uint32_t regressionThreads = max(1, THREAD_COUNT / VERILATOR_THREADS);
+	#if VM_COVERAGE
+	if(VERILATOR_THREADS > 1) regressionThreads = 1;
+	#endif
+	TaskPool regressionPool(regressionThreads);
 
     auto endsWith = [](const std::string &value, const std::string &ending)->bool{
         if (ending.size() > value.size()) return false;
@@ -4295,39 +5262,6 @@ int main(int argc, char **argv, char **env) {
         return true;
     };
 
-    auto convertElfToIhex = [](const std::string &elfPath)->std::string{
-        // create temp file path
-        char tmpTpl[] = "/tmp/vexriscv_elf_XXXXXX";
-        int fd = mkstemp(tmpTpl);
-        if(fd < 0){
-            std::cerr << "Failed to create temporary file for ihex output" << std::endl;
-            exit(1);
-        }
-        close(fd);
-        std::string hexPath = std::string(tmpTpl) + ".hex";
-
-        // Allow override from env
-        std::vector<std::string> candidates;
-        const char* envObjcopy = getenv("RISCV_OBJCOPY");
-        if(envObjcopy && strlen(envObjcopy)) candidates.emplace_back(envObjcopy);
-        candidates.emplace_back("riscv64-unknown-elf-objcopy");
-        candidates.emplace_back("riscv32-unknown-elf-objcopy");
-
-        int lastRet = -1;
-        for(const auto &oc : candidates){
-            std::string cmd = oc + " -O ihex \"" + elfPath + "\" \"" + hexPath + "\"";
-            lastRet = system(cmd.c_str());
-            if(lastRet == 0){
-                return hexPath;
-            }
-        }
-        std::cerr << "Could not convert ELF to Intel HEX. Tried:";
-        for(const auto &oc : candidates) std::cerr << " " << oc;
-        std::cerr << std::endl;
-        std::cerr << "Hint: install a RISC-V toolchain providing riscv64-unknown-elf-objcopy." << std::endl;
-        exit(2);
-    };
-
 #ifdef LINUX_SOC_SMP
     {
 
@@ -4357,6 +5291,9 @@ int main(int argc, char **argv, char **env) {
 		//soc.setDStall(true);
 		soc.bootAt(0x80000000);
 		soc.run(0);
+		memoryReport(stdout, Workspace::startupMs);
+		imagePackReport(stdout);
+		profileReport(stdout);
 //		soc.run((496300000l + 2000000) / 2);
 //		soc.run(438700000l/2);
         return -1;
@@ -4433,6 +5370,9 @@ int main(int argc, char **argv, char **env) {
 		//soc.setDStall(true);
 		soc.bootAt(0x80000000);
 		soc.run(0);
+		memoryReport(stdout, Workspace::startupMs);
+		imagePackReport(stdout);
+		profileReport(stdout);
 //		soc.run((496300000l + 2000000) / 2);
 //		soc.run(438700000l/2);
         return -1;
@@ -4455,32 +5395,76 @@ int main(int argc, char **argv, char **env) {
 		#if defined(DEBUG_PLUGIN_EXTERNAL) || defined(RUN_HEX)
 		{
 			WorkspaceRegression w("run");
+			w.setIStall(false);
+			w.setDStall(false);
             int imageArgIdx = -1;
             for (int i = 1; i < argc; ++i) {
                 if (argv[i][0] == '+') continue;
                 imageArgIdx = i;
                 break;
             }
-            // If an argument is provided, treat it as input image:
-            // - .elf: convert to Intel HEX using objcopy then load
+            // Load an input image:
+            // - .elf: load the PT_LOAD segments directly (no toolchain needed)
             // - .hex: load directly
-            // Otherwise, fall back to RUN_HEX if defined.
-            if(imageArgIdx != -1){
-                std::string in = argv[imageArgIdx];
-                std::string toLoad = in;
-                if(endsWith(in, ".elf")){
-                    toLoad = convertElfToIhex(in);
-                } else if(!endsWith(in, ".hex")){
+            // Returns the exit status of the harness when the input can't be used
+            auto loadInput = [&](const std::string &in) -> int {
+                if(!fileExists(in)){
+                    std::cerr << "Input file not found: " << in << std::endl;
+                    return 4;
+                }
+                if(endsWith(in, ".elf") || ElfFile::isElf(in)){
+                    w.loadElf(in);
+                } else if(endsWith(in, ".hex")){
+                    w.loadHex(in);
+                } else {
                     std::cerr << "Unknown input format: " << in << std::endl;
                     std::cerr << "Please pass a .elf or .hex image." << std::endl;
-                    exit(3);
+                    return 3;
                 }
-                if(!fileExists(toLoad)){
-                    std::cerr << "Input file not found: " << toLoad << std::endl;
+                w.withRiscvRef();
+                return 0;
+            };
+            #ifdef RUN_HEX
+            // Batch mode : every input of the manifest runs in this process, one after the other (see batch.h)
+            if(!batchManifestPath.empty()){
+                BatchManifest manifest(batchManifestPath);
+                if(!manifest.ok()){
+                    std::cerr << "BATCH " << manifest.error << std::endl;
                     exit(4);
                 }
-                w.loadHex(toLoad);
-                w.withRiscvRef();
+                BatchEntry entry;
+                while(manifest.next(&entry)){
+                    struct timespec startedAt;
+                    clock_gettime(CLOCK_MONOTONIC, &startedAt);
+                    w.recycle(entry.name);
+                    int status = loadInput(entry.image);
+                    if(status == 0){
+                        w.run(0xFFFFFFFFFFFF);
+                        status = w.failed ? 1 : 0;
+                    }
+                    ImageCache::clear();
+                    manifest.report(entry, status, w.instanceCycles, memoryElapsedMs(startedAt));
+                }
+                memoryReport(stdout, Workspace::startupMs);
+                imagePackReport(stdout);
+                profileReport(stdout);
+                exit(manifest.failed ? 1 : 0);
+            }
+            // Under a fuzzer, the model is built and reset once, then each input only loads its image and runs
+            // in a forked child (see fork_server.h)
+            if(imageArgIdx != -1){
+                w.reset();
+                w.traceSink.stop();
+                if(forkServerStart()){
+                    clock_gettime(CLOCK_MONOTONIC, &Workspace::processStartedAt);
+                    Workspace::startupMs = -1;
+                    w.openTraces();
+                }
+            }
+            #endif
+            // If an argument is provided, treat it as input image, otherwise fall back to RUN_HEX if defined.
+            if(imageArgIdx != -1){
+                if(int status = loadInput(argv[imageArgIdx])) exit(status);
             } else {
                 #ifdef RUN_HEX
                 {
@@ -4498,14 +5482,15 @@ int main(int argc, char **argv, char **env) {
                 exit(5);
                 #endif
             }
-			w.setIStall(false);
-			w.setDStall(false);
 
 			#if defined(TRACE) || defined(TRACE_ACCESS)
 				//w.setCyclesPerSecond(5e3);
 				//printf("Speed reduced 5Khz\n");
 			#endif
 			w.run(0xFFFFFFFFFFFF);
+			memoryReport(stdout, Workspace::startupMs);
+			imagePackReport(stdout);
+			profileReport(stdout);
 			exit(0);
 		}
 		#endif
@@ -4608,7 +5593,9 @@ int main(int argc, char **argv, char **env) {
 
 			#ifdef DEBUG_PLUGIN
 			#ifndef CONCURRENT_OS_EXECUTIONS
-				redo(REDO,DebugPluginTest().run(1e6););
+				// Owns the debug TCP port, so it runs alone
+				regressionPool.wait();
+				for(uint32_t xxx = 0;xxx < REDO;xxx++) DebugPluginTest().run(1e6);
             #endif
 			#endif
 		#endif
@@ -4646,25 +5633,25 @@ int main(int argc, char **argv, char **env) {
         #endif
 
 		#ifdef DHRYSTONE
-			Dhrystone("dhrystoneO3_Stall","dhrystoneO3",true,true).run(1.5e6);
+			regressionPool.submit([](){ Dhrystone("dhrystoneO3_Stall","dhrystoneO3",true,true).run(1.5e6); });
 			#if defined(COMPRESSED)
-			    Dhrystone("dhrystoneO3C_Stall","dhrystoneO3C",true,true).run(1.5e6);
+			    regressionPool.submit([](){ Dhrystone("dhrystoneO3C_Stall","dhrystoneO3C",true,true).run(1.5e6); });
             #endif
 			#if defined(MUL) && defined(DIV)
-				Dhrystone("dhrystoneO3M_Stall","dhrystoneO3M",true,true).run(1.9e6);
+				regressionPool.submit([](){ Dhrystone("dhrystoneO3M_Stall","dhrystoneO3M",true,true).run(1.9e6); });
 				#if defined(COMPRESSED)
-				    Dhrystone("dhrystoneO3MC_Stall","dhrystoneO3MC",true,true).run(1.9e6);
+				    regressionPool.submit([](){ Dhrystone("dhrystoneO3MC_Stall","dhrystoneO3MC",true,true).run(1.9e6); });
 				#endif
 			#endif
 			#if defined(COMPRESSED)
-			Dhrystone("dhrystoneO3C","dhrystoneO3C",false,false).run(1.9e6);
+			regressionPool.submit([](){ Dhrystone("dhrystoneO3C","dhrystoneO3C",false,false).run(1.9e6); });
             #endif
-			Dhrystone("dhrystoneO3","dhrystoneO3",false,false).run(1.9e6);
+			regressionPool.submit([](){ Dhrystone("dhrystoneO3","dhrystoneO3",false,false).run(1.9e6); });
 			#if defined(MUL) && defined(DIV)
 				#if defined(COMPRESSED)
-				    Dhrystone("dhrystoneO3MC","dhrystoneO3MC",false,false).run(1.9e6);
+				    regressionPool.submit([](){ Dhrystone("dhrystoneO3MC","dhrystoneO3MC",false,false).run(1.9e6); });
 				#endif
-				Dhrystone("dhrystoneO3M","dhrystoneO3M",false,false).run(1.9e6);
+				regressionPool.submit([](){ Dhrystone("dhrystoneO3M","dhrystoneO3M",false,false).run(1.9e6); });
 			#endif
 		#endif
 
@@ -4680,12 +5667,14 @@ int main(int argc, char **argv, char **env) {
                 #else
                     if(withStall == -1) break;
                 #endif
-                WorkspaceRegression("coremark_" + rv + (withStall  > 0 ? "_stall" : "_nostall")).withRiscvRef()
-                ->loadBin(string(REGRESSION_PATH) + "../../resources/bin/coremark_" + rv + ".bin", 0x80000000)
-                ->bootAt(0x80000000)
-                ->setIStall(withStall > 0)
-                ->setDStall(withStall > 0)
-                ->run(50e6);
+                regressionPool.submit([=](){
+                    WorkspaceRegression("coremark_" + rv + (withStall  > 0 ? "_stall" : "_nostall")).withRiscvRef()
+                    ->loadBin(string(REGRESSION_PATH) + "../../resources/bin/coremark_" + rv + ".bin", 0x80000000)
+                    ->bootAt(0x80000000)
+                    ->setIStall(withStall > 0)
+                    ->setDStall(withStall > 0)
+                    ->run(50e6);
+                });
             }
         #endif
 
@@ -4693,9 +5682,7 @@ int main(int argc, char **argv, char **env) {
 
 		#ifdef FREERTOS
 		{
-		    #ifdef SEED
-            srand48(SEED);
-            #endif
+            simRandomMain.seed(Workspace::baseSeed);
 			//redo(1,WorkspaceRegression("freeRTOS_demo").loadHex("../../resources/hex/freeRTOS_demo.hex")->bootAt(0x80000000u)->run(100e6);)
 			vector <std::function<void()>> tasks;
 
@@ -4722,16 +5709,13 @@ int main(int argc, char **argv, char **env) {
             }
 
 
-            queue <std::function<void()>> tasksSelected(std::deque<std::function<void()>>(tasks.begin(), tasks.end()));
-			multiThreadedExecute(tasksSelected);
+            for(std::function<void()> &task : tasks) regressionPool.submit(task);
         }
 		#endif
 
         #ifdef ZEPHYR
         {
-            #ifdef SEED
-            srand48(SEED);
-            #endif
+            simRandomMain.seed(Workspace::baseSeed);
             //redo(1,WorkspaceRegression("freeRTOS_demo").loadHex("../../resources/hex/freeRTOS_demo.hex")->bootAt(0x80000000u)->run(100e6);)
             vector <std::function<void()>> tasks;
 
@@ -4753,13 +5737,12 @@ int main(int argc, char **argv, char **env) {
             }
 
 
-            queue <std::function<void()>> tasksSelected(std::deque<std::function<void()>>(tasks.begin(), tasks.end()));
-            multiThreadedExecute(tasksSelected);
+            for(std::function<void()> &task : tasks) regressionPool.submit(task);
         }
         #endif
 
 		#if defined(LINUX_REGRESSION)
-            {
+            regressionPool.submit([=](){
 
         	    LinuxRegression soc("linux");
         	    #ifndef DEBUG_PLUGIN_EXTERNAL
@@ -4775,18 +5758,26 @@ int main(int argc, char **argv, char **env) {
         		soc.run(153995602l*9);
 //        		soc.run((470000000l + 2000000) / 2);
 //        		soc.run(438700000l/2);
-            }
+            });
         #endif
 
 	}
 
+	regressionPool.join();
 	uint64_t duration = timer_end(startedAt);
+	uint64_t cycles = Workspace::cycles.load();
+	uint32_t testsCounter = Workspace::testsCounter.load(), successCounter = Workspace::successCounter.load();
 	cout << endl << "****************************************************************" << endl;
-	cout << "Had simulate " << Workspace::cycles << " clock cycles in " << duration*1e-9 << " s (" << Workspace::cycles / (duration*1e-6) << " Khz)" << endl;
-	if(Workspace::successCounter == Workspace::testsCounter)
-		cout << "REGRESSION SUCCESS " << Workspace::successCounter << "/" << Workspace::testsCounter << endl;
+	cout << "Had simulate " << cycles << " clock cycles in " << duration*1e-9 << " s (" << cycles / (duration*1e-6) << " Khz) on " << regressionThreads << " threads";
+	if(VERILATOR_THREADS > 1) cout << " (" << VERILATOR_THREADS << " per model)";
+	cout << ", seed " << Workspace::baseSeed << endl;
+	if(successCounter == testsCounter)
+		cout << "REGRESSION SUCCESS " << successCounter << "/" << testsCounter << endl;
 	else
-		cout<< "REGRESSION FAILURE " << Workspace::testsCounter - Workspace::successCounter << "/"  << Workspace::testsCounter << endl;
+		cout<< "REGRESSION FAILURE " << testsCounter - successCounter << "/"  << testsCounter << endl;
+	memoryReport(stdout, Workspace::startupMs);
+	imagePackReport(stdout);
+	profileReport(stdout);
 	cout << "****************************************************************" << endl << endl;
 
 
@@ -5,12 +5,33 @@
 // - Provide a simple external DRAM model for iBridge/dBridge.
 // - Detect tohost writes (0xF00FFF20) on the peripheral Wishbone bus.
 // - Emit run.memTrace lines (PC=0) so perf extraction works for both harts.
+// - +batch=<manifest|-> runs many images in one process, each with its own traces (see batch.h).
+// - +trace_format=text|bin|binz selects the regTrace/memTrace encoding (see trace_format.h), records carry the hart.
+// - +trace_index=on|off : each trace gets a sparse .idx (time, first PC, exception positions) for tools/vexquery.
+// - +trace_split=on : one regTrace / memTrace per hart (<prefix>.hart<N>.regTrace ...), their records numbered by a
+//   sequence shared by all of them, tools/vexmerge rebuilds the cluster traces from them.
+// - +trace_sink=sync|async|drop : the traces are written by a background thread by default (see trace_sink.h).
+// - +trace_pc/cycles/start/stop/for restrict what the traces record (see trace_filter.h), +trace_priv is ignored.
+// - +smp_log=<level> logs the bus activity to the logTrace, nothing by default (see smp_log.h).
+// - +lockstep=<reference> checks the commits of both harts against a reference commit log as they happen and stops
+//   at the first divergence (see lockstep.h). The stores aren't checked here, the AMO writes aren't observed.
+// - Built with VERILATOR_THREADS=N (verilator --threads), the model evaluates on N threads. The harness only touches
+//   it between the eval() calls, which return once the workers are done.
 
 #include "VVexRiscv.h"
 #include "VVexRiscv_VexRiscv.h"
 #include "VVexRiscv_VexRiscvCore_0.h"
 #include "VVexRiscv_VexRiscvCore_1.h"
 #include "verilated.h"
+#include "sim_memory.h"
+#include "elf_loader.h"
+#include "ihex.h"
+#include "batch.h"
+#include "trace_format.h"
+#include "trace_sink.h"
+#include "trace_filter.h"
+#include "lockstep.h"
+#include "smp_log.h"
 
 #include <cstdint>
 #include <cstdio>
@@ -19,7 +40,9 @@
 #include <deque>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 using std::string;
@@ -29,148 +52,98 @@ static constexpr uint32_t kDramBase = 0x80000000u;
 // LiteDRAM native ports in this SMP cluster use 128-bit words; cmd_payload_addr is a word index.
 static constexpr uint32_t kDramWordBytes = 16u;
 
-static bool ends_with(const string &s, const string &suffix) {
-    if (suffix.size() > s.size()) return false;
-    return s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
-}
+#ifndef SMP_CORES
+#define SMP_CORES 2
+#endif
 
-static uint32_t hti(char c) {
-    if (c >= 'A' && c <= 'F') return static_cast<uint32_t>(c - 'A' + 10);
-    if (c >= 'a' && c <= 'f') return static_cast<uint32_t>(c - 'a' + 10);
-    return static_cast<uint32_t>(c - '0');
-}
-
-static uint32_t hToI(const char *c, uint32_t size) {
-    uint32_t value = 0;
-    for (uint32_t i = 0; i < size; i++) {
-        value += hti(c[i]) << ((size - i - 1) * 4);
-    }
-    return value;
-}
+#ifndef VERILATOR_THREADS
+#define VERILATOR_THREADS 1
+#endif
 
-class Memory {
-public:
-    uint8_t *mem[1 << 12];
-    Memory() {
-        for (uint32_t i = 0; i < (1u << 12); i++) mem[i] = NULL;
-    }
-    ~Memory() {
-        for (uint32_t i = 0; i < (1u << 12); i++) {
-            if (mem[i]) delete[] mem[i];
-        }
-    }
-    uint8_t *get(uint32_t address) {
-        if (mem[address >> 20] == NULL) {
-            uint8_t *ptr = new uint8_t[1024 * 1024];
-            for (uint32_t i = 0; i < 1024 * 1024; i++) ptr[i] = 0xFF;
-            mem[address >> 20] = ptr;
-        }
-        return &mem[address >> 20][address & 0xFFFFF];
-    }
-    uint8_t &operator[](uint32_t address) { return *get(address); }
-};
+// Per hart traces (+trace_split=on)
+static bool trace_split = false;
 
-static void loadHexImpl(const string &path, Memory *mem) {
-    std::ifstream file(path);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open HEX file: " << path << std::endl;
-        std::exit(2);
-    }
+// SmpCore<I>::get(soc) is the Verilated CPU of hart I. A larger cluster includes the header of each generated core
+// and adds its SMP_CORE line.
+template <size_t I> struct SmpCore;
+#define SMP_CORE(n) \
+    template <> struct SmpCore<n> { \
+        template <typename Soc> static auto *get(Soc *soc) { return soc->cores_##n##_cpu_logic_cpu; } \
+    };
+SMP_CORE(0)
+SMP_CORE(1)
+
+// Calls f(cpu, hart) for each core, hart being a std::integral_constant : the per cycle code is unrolled at compile
+// time, without a loop nor an index to test, whatever the number of cores.
+template <typename Soc, typename F, size_t... I>
+static inline void for_each_core(Soc *soc, F &&f, std::index_sequence<I...>) {
+    using expand = int[];
+    (void)expand{0, (f(SmpCore<I>::get(soc), std::integral_constant<uint32_t, I>()), 0)...};
+}
 
-    string line;
-    uint32_t upper = 0;
-    while (std::getline(file, line)) {
-        if (line.empty() || line[0] != ':') continue;
-        const char *s = line.c_str();
-        uint32_t byteCount = hToI(s + 1, 2);
-        uint32_t addr = hToI(s + 3, 4);
-        uint32_t recordType = hToI(s + 7, 2);
-        if (recordType == 0x00) {
-            uint32_t base = (upper << 16) | addr;
-            for (uint32_t i = 0; i < byteCount; i++) {
-                uint32_t v = hToI(s + 9 + i * 2, 2);
-                (*mem)[base + i] = static_cast<uint8_t>(v);
-            }
-        } else if (recordType == 0x04) {
-            upper = hToI(s + 9, 4);
-        } else if (recordType == 0x01) {
-            break;
-        }
-    }
+template <typename Soc, typename F>
+static inline void for_each_core(Soc *soc, F &&f) {
+    for_each_core(soc, std::forward<F>(f), std::make_index_sequence<SMP_CORES>());
 }
 
-static string pick_objcopy() {
-    const char *env = std::getenv("RISCV_OBJCOPY");
-    if (env && env[0] != '\0') return string(env);
-    // Prefer 64-bit toolchain name; 32-bit works too.
-    return string("riscv64-unknown-elf-objcopy");
+static bool ends_with(const string &s, const string &suffix) {
+    if (suffix.size() > s.size()) return false;
+    return s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
 
-static string elf_to_hex(const string &elf_path) {
-    const string out_hex = elf_path + ".hex";
-    const string objcopy = pick_objcopy();
-    string cmd = objcopy + " -O ihex \"" + elf_path + "\" \"" + out_hex + "\"";
-    int ret = std::system(cmd.c_str());
-    if (ret != 0) {
-        std::cerr << "objcopy failed: " << cmd << std::endl;
-        std::exit(2);
+static bool load_hex(const string &path, Memory *mem) {
+    IhexResult result = ihexLoad(path, mem);
+    if (!result.ok) {
+        std::cerr << "Failed to load HEX file: " << path << ":" << result.line << " " << result.error << std::endl;
+        return false;
     }
-    return out_hex;
+    return true;
 }
 
-static void pack_u32_words_from_bytes(const uint8_t bytes[16], uint32_t words[4]) {
-    for (int w = 0; w < 4; w++) {
-        uint32_t v = 0;
-        v |= static_cast<uint32_t>(bytes[w * 4 + 0]) << 0;
-        v |= static_cast<uint32_t>(bytes[w * 4 + 1]) << 8;
-        v |= static_cast<uint32_t>(bytes[w * 4 + 2]) << 16;
-        v |= static_cast<uint32_t>(bytes[w * 4 + 3]) << 24;
-        words[w] = v;
+// Loads the PT_LOAD segments straight into mem (no objcopy) and sets tohost to its symbol, 0 when absent.
+// The symbols of the trace filter are resolved against the same file.
+static bool load_elf(const string &path, Memory *mem, uint32_t *tohost, TraceFilter *filter) {
+    ElfFile elf(path);
+    if (!elf.valid()) {
+        std::cerr << "Failed to load ELF file: " << elf.error << std::endl;
+        return false;
     }
+    elf.load(mem);
+    if (elf.entry != kDramBase) {
+        std::cerr << "Warning: ELF entry 0x" << std::hex << elf.entry << std::dec << " ignored, harts boot from their reset vector" << std::endl;
+    }
+    *tohost = 0;
+    elf.symbol("tohost", tohost);
+    if (filter->needsSymbols()) filter->resolve(elf);
+    return true;
 }
 
-static void unpack_bytes_from_u32_words(const uint32_t words[4], uint8_t bytes[16]) {
-    for (int w = 0; w < 4; w++) {
-        uint32_t v = words[w];
-        bytes[w * 4 + 0] = static_cast<uint8_t>((v >> 0) & 0xFF);
-        bytes[w * 4 + 1] = static_cast<uint8_t>((v >> 8) & 0xFF);
-        bytes[w * 4 + 2] = static_cast<uint8_t>((v >> 16) & 0xFF);
-        bytes[w * 4 + 3] = static_cast<uint8_t>((v >> 24) & 0xFF);
+// Little-endian value of bytes[start..start+len), the text trace prints it high byte first.
+static uint64_t mem_write_value(const uint8_t *bytes, int start, int len) {
+    uint64_t value = 0;
+    for (int j = len - 1; j >= 0; j--) {
+        value = (value << 8) | bytes[start + j];
     }
+    return value;
 }
 
-static void log_mem_write_groups(FILE *f, uint64_t time, uint32_t pc, uint32_t base, const uint8_t bytes[16], uint16_t mask) {
-    // Group contiguous enabled bytes and emit one line per group.
+static void log_mem_write_groups(TraceWriter &f, uint64_t time, uint32_t pc, uint32_t base, const uint8_t bytes[16], uint16_t mask, uint32_t hart) {
+    // Group contiguous enabled bytes and emit one record per group.
     int i = 0;
     while (i < 16) {
         while (i < 16 && ((mask >> i) & 1u) == 0) i++;
         if (i >= 16) break;
         int start = i;
         int len = 0;
-        while (i < 16 && ((mask >> i) & 1u) != 0) {
+        while (i < 16 && ((mask >> i) & 1u) != 0 && len < 8) {
             len++;
             i++;
         }
-        // Print hex bytes high->low so the parser reconstructs little-endian correctly.
-        std::string hex;
-        hex.reserve(static_cast<size_t>(len) * 2);
-        for (int j = len - 1; j >= 0; j--) {
-            char buf[3];
-            std::snprintf(buf, sizeof(buf), "%02x", bytes[start + j]);
-            hex += buf;
-        }
-        std::fprintf(
-            f,
-            "%llu PC %08x : MEM[0x%08x] <= %d bytes : 0x%s\n",
-            static_cast<unsigned long long>(time),
-            static_cast<unsigned int>(pc),
-            static_cast<unsigned int>(base + static_cast<uint32_t>(start)),
-            len,
-            hex.c_str());
+        f.mem(time, pc, base + static_cast<uint32_t>(start), static_cast<uint32_t>(len), mem_write_value(bytes, start, len), hart);
     }
 }
 
-static void log_mem_write_masked32(FILE *f, uint64_t time, uint32_t pc, uint32_t addr, uint32_t data, uint8_t mask) {
+static void log_mem_write_masked32(TraceWriter &f, uint64_t time, uint32_t pc, uint32_t addr, uint32_t data, uint8_t mask, uint32_t hart) {
     uint8_t bytes[4];
     bytes[0] = static_cast<uint8_t>((data >> 0) & 0xFF);
     bytes[1] = static_cast<uint8_t>((data >> 8) & 0xFF);
@@ -187,21 +160,7 @@ static void log_mem_write_masked32(FILE *f, uint64_t time, uint32_t pc, uint32_t
             len++;
             i++;
         }
-        std::string hex;
-        hex.reserve(static_cast<size_t>(len) * 2);
-        for (int j = len - 1; j >= 0; j--) {
-            char buf[3];
-            std::snprintf(buf, sizeof(buf), "%02x", bytes[start + j]);
-            hex += buf;
-        }
-        std::fprintf(
-            f,
-            "%llu PC %08x : MEM[0x%08x] <= %d bytes : 0x%s\n",
-            static_cast<unsigned long long>(time),
-            static_cast<unsigned int>(pc),
-            static_cast<unsigned int>(addr + static_cast<uint32_t>(start)),
-            len,
-            hex.c_str());
+        f.mem(time, pc, addr + static_cast<uint32_t>(start), static_cast<uint32_t>(len), mem_write_value(bytes, start, len), hart);
     }
 }
 
@@ -223,48 +182,71 @@ static void toggle_debug_clock(VVexRiscv *top) {
     top->eval();
 }
 
-int main(int argc, char **argv) {
-    Verilated::commandArgs(argc, argv);
-
-    string image;
-    for (int i = 1; i < argc; i++) {
-        const char *a = argv[i];
-        if (a[0] == '+') continue; // ignore plusargs
-        image = string(a);
-        break;
-    }
-    if (image.empty()) {
-        std::cerr << "Usage: VVexRiscv <program.elf|program.hex> [plusargs...]" << std::endl;
-        return 2;
-    }
-
-    string to_load = image;
-    if (ends_with(image, ".elf")) {
-        to_load = elf_to_hex(image);
+// Runs one image on the model from its reset sequence until tohost or the timeout, with the traces in
+// <prefix>.memTrace/.regTrace/.logTrace. Returns the exit code : 0 pass, 1 fail, 2 timeout or error.
+static int run_image(VVexRiscv *top, Memory &mem, const string &image, const string &prefix, struct timespec started_at, uint64_t *cycles) {
+    // HTIF tohost inside DRAM (ELF symbol); the peripheral kTohostAddr is always watched.
+    uint32_t dram_tohost = 0;
+    TraceFilter filter;
+    if (ends_with(image, ".elf") || ElfFile::isElf(image)) {
+        if (!load_elf(image, &mem, &dram_tohost, &filter)) return 2;
+        if (dram_tohost < kDramBase) dram_tohost = 0;
+    } else {
+        if (!load_hex(image, &mem)) return 2;
     }
 
-    Memory mem;
-    loadHexImpl(to_load, &mem);
-
-    FILE *mem_trace = std::fopen("run.memTrace", "w");
-    if (!mem_trace) {
-        std::perror("failed to open run.memTrace");
-        return 2;
+    // Declared first, so they outlive the writers attached to the sink
+    uint64_t trace_sequence = 0;
+    TraceSink sink;
+
+    // The cluster traces, or one of each per hart. mem_out / reg_out[hart] is where the records of a hart go.
+    static_assert(2 * SMP_CORES <= TRACE_SINK_WRITERS, "a trace sink writer per hart trace");
+    TraceWriter mem_trace, reg_trace;
+    TraceWriter hart_mem_traces[SMP_CORES], hart_reg_traces[SMP_CORES];
+    TraceWriter *mem_out[SMP_CORES], *reg_out[SMP_CORES];
+    auto open_trace = [&](TraceWriter &writer, const string &path, uint32_t flags) {
+        sink.attach(writer);
+        writer.sequence(&trace_sequence);
+        if (writer.open(path, flags)) return true;
+        std::perror(("failed to open " + path).c_str());
+        return false;
+    };
+    if (trace_split) {
+        for (uint32_t hart = 0; hart < SMP_CORES; hart++) {
+            const string hart_prefix = prefix + ".hart" + std::to_string(hart);
+            if (!open_trace(hart_mem_traces[hart], hart_prefix + ".memTrace", TRACE_FLAG_TIME | TRACE_FLAG_SEQ) ||
+                !open_trace(hart_reg_traces[hart], hart_prefix + ".regTrace", TRACE_FLAG_TIME | TRACE_FLAG_SEQ)) {
+                return 2;
+            }
+            mem_out[hart] = &hart_mem_traces[hart];
+            reg_out[hart] = &hart_reg_traces[hart];
+        }
+    } else {
+        if (!open_trace(mem_trace, prefix + ".memTrace", TRACE_FLAG_TIME) || !open_trace(reg_trace, prefix + ".regTrace", TRACE_FLAG_TIME)) {
+            return 2;
+        }
+        for (uint32_t hart = 0; hart < SMP_CORES; hart++) {
+            mem_out[hart] = &mem_trace;
+            reg_out[hart] = &reg_trace;
+        }
     }
 
-    FILE *reg_trace = std::fopen("run.regTrace", "w");
-    if (!reg_trace) {
-        std::perror("failed to open run.regTrace");
+    FILE *log_trace = std::fopen((prefix + ".logTrace").c_str(), "w");
+    if (!log_trace) {
+        std::perror(("failed to open " + prefix + ".logTrace").c_str());
         return 2;
     }
 
-    VVexRiscv *top = new VVexRiscv;
-
-    FILE *log_trace = std::fopen("run.logTrace", "w");
-    if (!log_trace) {
-        std::perror("failed to open run.logTrace");
-        return 2;
+    std::unique_ptr<Lockstep> lockstep;
+    if (!lockstepConfig.path.empty()) {
+        lockstep.reset(new Lockstep(lockstepConfig.path, prefix));
+        if (!lockstep->ok()) {
+            std::cerr << "LOCKSTEP " << lockstep->error << std::endl;
+            std::fclose(log_trace);
+            return 2;
+        }
     }
+    bool diverged = false;
 
     // Static input tie-offs.
     top->interrupts = 0;
@@ -343,57 +325,12 @@ int main(int argc, char **argv) {
     uint64_t rdata_d_count = 0;
 
     // Per-core store edge tracking (memory stage can be held while back-pressured).
-    uint8_t cpu0_store_prev = 0;
-    uint8_t cpu1_store_prev = 0;
-
-    // Extra visibility: capture if data/periph ever toggles.
-    uint64_t d_cmd_seen = 0;
-    uint64_t d_wdata_seen = 0;
-    uint64_t periph_seen = 0;
-    auto log_bus_phase = [&](const char *phase, uint64_t cyc) {
-        if (top->dBridge_dram_cmd_valid) {
-            if (d_cmd_seen < 50) {
-                uint32_t addr = kDramBase + (static_cast<uint32_t>(top->dBridge_dram_cmd_payload_addr) * kDramWordBytes);
-                std::fprintf(
-                    log_trace,
-                    "time=%llu phase=%s d_cmd_valid=1 ready=%u addr=0x%08x we=%u\n",
-                    static_cast<unsigned long long>(cyc),
-                    phase,
-                    static_cast<unsigned int>(top->dBridge_dram_cmd_ready ? 1 : 0),
-                    static_cast<unsigned int>(addr),
-                    static_cast<unsigned int>(top->dBridge_dram_cmd_payload_we ? 1 : 0));
-            }
-            d_cmd_seen++;
-        }
-        if (top->dBridge_dram_wdata_valid) {
-            if (d_wdata_seen < 50) {
-                std::fprintf(
-                    log_trace,
-                    "time=%llu phase=%s d_wdata_valid=1 ready=%u we=0x%04x\n",
-                    static_cast<unsigned long long>(cyc),
-                    phase,
-                    static_cast<unsigned int>(top->dBridge_dram_wdata_ready ? 1 : 0),
-                    static_cast<unsigned int>(static_cast<uint16_t>(top->dBridge_dram_wdata_payload_we)));
-            }
-            d_wdata_seen++;
-        }
-        if (top->peripheral_CYC && top->peripheral_STB) {
-            if (periph_seen < 50) {
-                uint32_t addr = static_cast<uint32_t>(top->peripheral_ADR) << 2;
-                std::fprintf(
-                    log_trace,
-                    "time=%llu phase=%s periph_req=1 addr=0x%08x we=%u sel=0x%x wdata=0x%08x\n",
-                    static_cast<unsigned long long>(cyc),
-                    phase,
-                    static_cast<unsigned int>(addr),
-                    static_cast<unsigned int>(top->peripheral_WE ? 1 : 0),
-                    static_cast<unsigned int>(static_cast<uint32_t>(top->peripheral_SEL) & 0xF),
-                    static_cast<unsigned int>(static_cast<uint32_t>(top->peripheral_DAT_MOSI)));
-            }
-            periph_seen++;
-        }
-    };
-    while (!done && cycle < kMaxCycles && !Verilated::gotFinish()) {
+    uint8_t store_prev[SMP_CORES] = {};
+
+    // Bus debug log, nothing by default (+smp_log).
+    SmpLog<> bus_log(log_trace, kDramBase, kDramWordBytes);
+    const double startup_ms = memoryElapsedMs(started_at);
+    while (!done && !diverged && cycle < kMaxCycles && !Verilated::gotFinish()) {
         // Drive slave responses for this cycle (stable during eval).
         top->peripheral_ACK = peripheral_ack_next;
         top->peripheral_ERR = peripheral_err_next;
@@ -422,56 +359,67 @@ int main(int argc, char **argv) {
         // Tick.
         top->debugCd_external_clk = 0;
         top->eval();
-        log_bus_phase("L", cycle);
+        bus_log.phase(top, "L", cycle);
         top->debugCd_external_clk = 1;
         top->eval();
-        log_bus_phase("H", cycle);
+        bus_log.phase(top, "H", cycle);
 
         // Architectural traces (per-core) at posedge.
         // These are required by riscv_fuzz_test for per-instruction diff analysis.
         auto *soc = top->VexRiscv;
-        auto *cpu0 = soc->cores_0_cpu_logic_cpu;
-        auto *cpu1 = soc->cores_1_cpu_logic_cpu;
 
-        // Register writes
-        if (cpu0->lastStageIsFiring && cpu0->lastStageRegFileWrite_valid && cpu0->lastStageRegFileWrite_payload_address != 0) {
-            std::fprintf(
-                reg_trace,
-                "%llu PC %08x : reg[%2u] = %08x\n",
-                static_cast<unsigned long long>(cycle),
-                static_cast<unsigned int>(cpu0->lastStagePc),
-                static_cast<unsigned int>(cpu0->lastStageRegFileWrite_payload_address),
-                static_cast<unsigned int>(cpu0->lastStageRegFileWrite_payload_data));
-        }
-        if (cpu1->lastStageIsFiring && cpu1->lastStageRegFileWrite_valid && cpu1->lastStageRegFileWrite_payload_address != 0) {
-            std::fprintf(
-                reg_trace,
-                "%llu PC %08x : reg[%2u] = %08x\n",
-                static_cast<unsigned long long>(cycle),
-                static_cast<unsigned int>(cpu1->lastStagePc),
-                static_cast<unsigned int>(cpu1->lastStageRegFileWrite_payload_address),
-                static_cast<unsigned int>(cpu1->lastStageRegFileWrite_payload_data));
+        filter.tick(cycle);
+        bool trapped = false;
+        for_each_core(soc, [&](auto *cpu, auto) {
+            if (cpu->lastStageIsFiring) filter.onCommit(static_cast<uint32_t>(cpu->lastStagePc), cycle);
+            trapped |= cpu->CsrPlugin_hadException != 0;
+        });
+        if (trapped) filter.onException(cycle);
+
+        // Before the traces, nothing past a divergence gets recorded
+        if (lockstep) {
+            auto check = [&](auto *cpu, uint32_t hart) {
+                if (!cpu->lastStageIsFiring || diverged) return;
+                const int32_t rd = cpu->lastStageRegFileWrite_valid ? static_cast<int32_t>(cpu->lastStageRegFileWrite_payload_address) : 0;
+                if (!lockstep->commit(hart, static_cast<uint32_t>(cpu->lastStagePc), rd, static_cast<uint32_t>(cpu->lastStageRegFileWrite_payload_data))) {
+                    std::cerr << lockstep->mismatch;
+                    std::fputs(lockstep->mismatch.c_str(), log_trace);
+                    diverged = true;
+                }
+            };
+            for_each_core(soc, check);
+            if (diverged) break;
         }
 
+        // Register writes
+        for_each_core(soc, [&](auto *cpu, auto hart) {
+            if (cpu->lastStageIsFiring && cpu->lastStageRegFileWrite_valid && cpu->lastStageRegFileWrite_payload_address != 0 &&
+                filter.accept(static_cast<uint32_t>(cpu->lastStagePc))) {
+                reg_out[hart]->reg(
+                    cycle,
+                    static_cast<uint32_t>(cpu->lastStagePc),
+                    static_cast<uint32_t>(cpu->lastStageRegFileWrite_payload_address),
+                    static_cast<uint32_t>(cpu->lastStageRegFileWrite_payload_data),
+                    hart);
+            }
+        });
+
         // Exceptions
-        if (cpu0->CsrPlugin_hadException) {
+        for_each_core(soc, [&](auto *cpu, auto hart) {
+            if (!cpu->CsrPlugin_hadException) return;
             std::fprintf(
                 log_trace,
-                "EXC pc=0x%08x cause=%u\n",
-                static_cast<unsigned int>(cpu0->lastStagePc),
-                static_cast<unsigned int>(cpu0->CsrPlugin_trapCause));
-        }
-        if (cpu1->CsrPlugin_hadException) {
-            std::fprintf(
-                log_trace,
-                "EXC pc=0x%08x cause=%u\n",
-                static_cast<unsigned int>(cpu1->lastStagePc),
-                static_cast<unsigned int>(cpu1->CsrPlugin_trapCause));
-        }
+                "EXC pc=0x%08x cause=%u hart=%u\n",
+                static_cast<unsigned int>(cpu->lastStagePc),
+                static_cast<unsigned int>(cpu->CsrPlugin_trapCause),
+                static_cast<unsigned int>(hart));
+            reg_out[hart]->exception(cycle, static_cast<uint32_t>(cpu->lastStagePc), static_cast<uint32_t>(cpu->CsrPlugin_trapCause), hart);
+            mem_out[hart]->exception(cycle, static_cast<uint32_t>(cpu->lastStagePc), static_cast<uint32_t>(cpu->CsrPlugin_trapCause), hart);
+        });
 
         // Memory writes (architectural stores) from the memory stage pipeline regs.
         // This avoids relying on internal dBus wiring which can be hidden behind cache/arb wrappers.
-        auto log_store = [&](auto *cpu, uint8_t &prev) {
+        auto log_store = [&](auto *cpu, uint8_t &prev, uint32_t hart) {
             const uint8_t is_store = (cpu->__PVT__memory_arbitration_isValid && cpu->__PVT__execute_to_memory_MEMORY_ENABLE && cpu->__PVT__execute_to_memory_MEMORY_WR) ? 1 : 0;
             if (is_store && !prev) {
                 const uint32_t pc = static_cast<uint32_t>(cpu->__PVT__execute_to_memory_PC);
@@ -483,6 +431,7 @@ int main(int argc, char **argv) {
                 const uint32_t funct3 = (insn >> 12) & 0x7;
 
                 if (opcode == 0x23) { // STORE
+                    filter.onStore(addr, 1u << (funct3 & 3u), cycle);
                     const uint32_t base = addr & ~3u;
                     const uint32_t byte_off = addr & 3u;
                     uint8_t mask = 0;
@@ -503,40 +452,30 @@ int main(int argc, char **argv) {
                             data_word = store_data;
                         }
                     }
-                    if (mask != 0) {
-                        log_mem_write_masked32(mem_trace, cycle, pc, base, data_word, mask);
+                    if (mask != 0 && filter.accept(pc)) {
+                        log_mem_write_masked32(*mem_out[hart], cycle, pc, base, data_word, mask, hart);
                     }
                 }
             }
             prev = is_store;
         };
-        log_store(cpu0, cpu0_store_prev);
-        log_store(cpu1, cpu1_store_prev);
+        for_each_core(soc, [&](auto *cpu, auto hart) { log_store(cpu, store_prev[hart], hart); });
 
         // Consume read data if the DUT is ready.
         if (top->iBridge_dram_rdata_valid) {
-            if (rdata_i_count < 200) {
-                std::fprintf(
-                    log_trace,
-                    "time=%llu i_rdata valid=1 ready=%u data0=0x%08x data1=0x%08x\n",
-                    static_cast<unsigned long long>(cycle),
-                    static_cast<unsigned int>(top->iBridge_dram_rdata_ready ? 1 : 0),
-                    static_cast<unsigned int>(static_cast<uint32_t>(top->iBridge_dram_rdata_payload_data[0])),
-                    static_cast<unsigned int>(static_cast<uint32_t>(top->iBridge_dram_rdata_payload_data[1])));
-            }
+            bus_log.iRdata(
+                cycle,
+                top->iBridge_dram_rdata_ready,
+                static_cast<uint32_t>(top->iBridge_dram_rdata_payload_data[0]),
+                static_cast<uint32_t>(top->iBridge_dram_rdata_payload_data[1]),
+                rdata_i_count);
             rdata_i_count++;
         }
         if (top->iBridge_dram_rdata_valid && top->iBridge_dram_rdata_ready) {
             i_dram.rdata_q.pop_front();
         }
         if (top->dBridge_dram_rdata_valid) {
-            if (rdata_d_count < 200) {
-                std::fprintf(
-                    log_trace,
-                    "time=%llu d_rdata valid=1 ready=%u\n",
-                    static_cast<unsigned long long>(cycle),
-                    static_cast<unsigned int>(top->dBridge_dram_rdata_ready ? 1 : 0));
-            }
+            bus_log.dRdata(cycle, top->dBridge_dram_rdata_ready, rdata_d_count);
             rdata_d_count++;
         }
         if (top->dBridge_dram_rdata_valid && top->dBridge_dram_rdata_ready) {
@@ -549,16 +488,13 @@ int main(int argc, char **argv) {
         peripheral_rdata_next = 0;
         if (top->peripheral_CYC && top->peripheral_STB) {
             uint32_t addr = static_cast<uint32_t>(top->peripheral_ADR) << 2;
-            if (periph_count < 200) {
-                std::fprintf(
-                    log_trace,
-                    "time=%llu periph addr=0x%08x we=%u sel=0x%x wdata=0x%08x\n",
-                    static_cast<unsigned long long>(cycle),
-                    static_cast<unsigned int>(addr),
-                    static_cast<unsigned int>(top->peripheral_WE ? 1 : 0),
-                    static_cast<unsigned int>(static_cast<uint32_t>(top->peripheral_SEL) & 0xF),
-                    static_cast<unsigned int>(static_cast<uint32_t>(top->peripheral_DAT_MOSI)));
-            }
+            bus_log.periph(
+                cycle,
+                addr,
+                top->peripheral_WE,
+                static_cast<uint32_t>(top->peripheral_SEL) & 0xF,
+                static_cast<uint32_t>(top->peripheral_DAT_MOSI),
+                periph_count);
             periph_count++;
             if (top->peripheral_WE) {
                 uint32_t wdata = static_cast<uint32_t>(top->peripheral_DAT_MOSI);
@@ -592,34 +528,19 @@ int main(int argc, char **argv) {
         if (top->iBridge_dram_cmd_valid && top->iBridge_dram_cmd_ready) {
             uint32_t addr = kDramBase + (static_cast<uint32_t>(top->iBridge_dram_cmd_payload_addr) * kDramWordBytes);
             bool we = (top->iBridge_dram_cmd_payload_we != 0);
-            if (i_cmd_count < 200) {
-                std::fprintf(
-                    log_trace,
-                    "time=%llu i_cmd addr=0x%08x we=%u\n",
-                    static_cast<unsigned long long>(cycle),
-                    static_cast<unsigned int>(addr),
-                    static_cast<unsigned int>(we ? 1 : 0));
-            }
+            bus_log.cmd("i", cycle, addr, we, i_cmd_count);
             i_cmd_count++;
             if (we) {
                 i_dram.write_addr_q.push_back(addr);
             } else {
-                uint8_t bytes[16];
-                for (int i = 0; i < 16; i++) bytes[i] = mem[addr + static_cast<uint32_t>(i)];
                 DramReadResp r;
                 r.addr = addr;
-                pack_u32_words_from_bytes(bytes, r.words);
+                mem.read128(addr, r.words);
                 i_dram.rdata_q.push_back(r);
             }
         }
         if (top->iBridge_dram_wdata_valid && top->iBridge_dram_wdata_ready) {
-            if (wdata_i_count < 200) {
-                std::fprintf(
-                    log_trace,
-                    "time=%llu i_wdata we=0x%04x\n",
-                    static_cast<unsigned long long>(cycle),
-                    static_cast<unsigned int>(static_cast<uint16_t>(top->iBridge_dram_wdata_payload_we)));
-            }
+            bus_log.wdata("i", cycle, static_cast<uint16_t>(top->iBridge_dram_wdata_payload_we), wdata_i_count);
             wdata_i_count++;
             if (!i_dram.write_addr_q.empty()) {
                 uint32_t addr = i_dram.write_addr_q.front();
@@ -630,12 +551,8 @@ int main(int argc, char **argv) {
                     static_cast<uint32_t>(top->iBridge_dram_wdata_payload_data[2]),
                     static_cast<uint32_t>(top->iBridge_dram_wdata_payload_data[3]),
                 };
-                uint8_t bytes[16];
-                unpack_bytes_from_u32_words(words, bytes);
                 uint16_t mask = static_cast<uint16_t>(top->iBridge_dram_wdata_payload_we);
-                for (int i = 0; i < 16; i++) {
-                    if ((mask >> i) & 1u) mem[addr + static_cast<uint32_t>(i)] = bytes[i];
-                }
+                mem.writeMasked(addr, reinterpret_cast<const uint8_t *>(words), mask, kDramWordBytes);
                 // Keep functional memory updates; trace architectural stores via per-core dBus.
             }
         }
@@ -644,34 +561,19 @@ int main(int argc, char **argv) {
         if (top->dBridge_dram_cmd_valid && top->dBridge_dram_cmd_ready) {
             uint32_t addr = kDramBase + (static_cast<uint32_t>(top->dBridge_dram_cmd_payload_addr) * kDramWordBytes);
             bool we = (top->dBridge_dram_cmd_payload_we != 0);
-            if (d_cmd_count < 200) {
-                std::fprintf(
-                    log_trace,
-                    "time=%llu d_cmd addr=0x%08x we=%u\n",
-                    static_cast<unsigned long long>(cycle),
-                    static_cast<unsigned int>(addr),
-                    static_cast<unsigned int>(we ? 1 : 0));
-            }
+            bus_log.cmd("d", cycle, addr, we, d_cmd_count);
             d_cmd_count++;
             if (we) {
                 d_dram.write_addr_q.push_back(addr);
             } else {
-                uint8_t bytes[16];
-                for (int i = 0; i < 16; i++) bytes[i] = mem[addr + static_cast<uint32_t>(i)];
                 DramReadResp r;
                 r.addr = addr;
-                pack_u32_words_from_bytes(bytes, r.words);
+                mem.read128(addr, r.words);
                 d_dram.rdata_q.push_back(r);
             }
         }
         if (top->dBridge_dram_wdata_valid && top->dBridge_dram_wdata_ready) {
-            if (wdata_d_count < 200) {
-                std::fprintf(
-                    log_trace,
-                    "time=%llu d_wdata we=0x%04x\n",
-                    static_cast<unsigned long long>(cycle),
-                    static_cast<unsigned int>(static_cast<uint16_t>(top->dBridge_dram_wdata_payload_we)));
-            }
+            bus_log.wdata("d", cycle, static_cast<uint16_t>(top->dBridge_dram_wdata_payload_we), wdata_d_count);
             wdata_d_count++;
             if (!d_dram.write_addr_q.empty()) {
                 uint32_t addr = d_dram.write_addr_q.front();
@@ -682,23 +584,29 @@ int main(int argc, char **argv) {
                     static_cast<uint32_t>(top->dBridge_dram_wdata_payload_data[2]),
                     static_cast<uint32_t>(top->dBridge_dram_wdata_payload_data[3]),
                 };
-                uint8_t bytes[16];
-                unpack_bytes_from_u32_words(words, bytes);
                 uint16_t mask = static_cast<uint16_t>(top->dBridge_dram_wdata_payload_we);
-                for (int i = 0; i < 16; i++) {
-                    if ((mask >> i) & 1u) mem[addr + static_cast<uint32_t>(i)] = bytes[i];
-                }
+                mem.writeMasked(addr, reinterpret_cast<const uint8_t *>(words), mask, kDramWordBytes);
                 // Keep functional memory updates; trace architectural stores via per-core dBus.
+                if (dram_tohost && (dram_tohost & ~(kDramWordBytes - 1)) == addr && ((mask >> (dram_tohost & (kDramWordBytes - 1))) & 1u)) {
+                    const uint32_t value = mem.read32(dram_tohost);
+                    if (value & 1u) {
+                        exit_code = value == 1 ? 0 : 1;
+                        done = true;
+                    }
+                }
             }
         }
 
         cycle++;
     }
 
-    if (!done) {
+    if (diverged) {
+        exit_code = 1;
+    } else if (!done) {
         std::cerr << "Timeout: no tohost write after " << cycle << " cycles" << std::endl;
         exit_code = 2;
     }
+    if (lockstep && lockstep->ok()) std::fprintf(log_trace, "%s\n", lockstep->summary().c_str());
 
     std::fprintf(
         log_trace,
@@ -712,15 +620,117 @@ int main(int argc, char **argv) {
         static_cast<unsigned long long>(wdata_i_count),
         static_cast<unsigned long long>(wdata_d_count));
 
-    std::fflush(mem_trace);
-    std::fclose(mem_trace);
+    memoryReport(log_trace, startup_ms);
 
-    std::fflush(reg_trace);
-    std::fclose(reg_trace);
+    mem_trace.close();
+    reg_trace.close();
+    for (uint32_t hart = 0; hart < SMP_CORES; hart++) {
+        hart_mem_traces[hart].close();
+        hart_reg_traces[hart].close();
+    }
+    const TraceSinkStats sink_stats = sink.stats();
+    std::fprintf(
+        log_trace,
+        "trace_sink records=%llu stalls=%llu dropped=%llu batches=%llu high_water=%llu\n",
+        static_cast<unsigned long long>(sink_stats.records),
+        static_cast<unsigned long long>(sink_stats.stalls),
+        static_cast<unsigned long long>(sink_stats.dropped),
+        static_cast<unsigned long long>(sink_stats.batches),
+        static_cast<unsigned long long>(sink_stats.highWater));
 
     std::fflush(log_trace);
     std::fclose(log_trace);
 
+    *cycles = cycle;
+    return exit_code;
+}
+
+int main(int argc, char **argv) {
+    struct timespec started_at;
+    clock_gettime(CLOCK_MONOTONIC, &started_at);
+    Verilated::commandArgs(argc, argv);
+#if VERILATOR_THREADS > 1 && defined(VERILATOR_VERSION_INTEGER) && VERILATOR_VERSION_INTEGER >= 5000000
+    // The thread pool of the model comes from its context, sized before the model is created
+    Verilated::defaultContextp()->threads(VERILATOR_THREADS);
+#endif
+    if (const char *pages_arg = Verilated::commandArgsPlusMatch("mem_pages=")) {
+        memoryConfigure(*pages_arg ? pages_arg + std::strlen("+mem_pages=") : NULL);
+    }
+    if (const char *batch_arg = Verilated::commandArgsPlusMatch("batch=")) {
+        batchConfigure(*batch_arg ? batch_arg + std::strlen("+batch=") : NULL);
+    }
+    const char *trace_format_arg = Verilated::commandArgsPlusMatch("trace_format=");
+    traceFormatConfigure(trace_format_arg && *trace_format_arg ? trace_format_arg + std::strlen("+trace_format=") : NULL);
+    const char *trace_index_arg = Verilated::commandArgsPlusMatch("trace_index=");
+    traceIndexConfigure(trace_index_arg && *trace_index_arg ? trace_index_arg + std::strlen("+trace_index=") : NULL);
+    for (const char *name : {"pc", "cycles", "priv", "start", "stop", "for"}) {
+        const string plusarg = string("trace_") + name + "=";
+        const char *filter_arg = Verilated::commandArgsPlusMatch(plusarg.c_str());
+        if (filter_arg && *filter_arg && !traceFilterConfigure(name, filter_arg + plusarg.size() + 1)) {
+            std::cerr << "Bad +" << plusarg << (filter_arg + plusarg.size() + 1) << std::endl;
+            return 2;
+        }
+    }
+    if (const char *trace_split_arg = Verilated::commandArgsPlusMatch("trace_split=")) {
+        const char *value = *trace_split_arg ? trace_split_arg + std::strlen("+trace_split=") : "";
+        if (!std::strcmp(value, "on")) trace_split = true;
+        else if (std::strcmp(value, "off")) std::cerr << "Unknown trace split mode '" << value << "'" << std::endl;
+    }
+    if (const char *smp_log_arg = Verilated::commandArgsPlusMatch("smp_log=")) {
+        const char *value = *smp_log_arg ? smp_log_arg + std::strlen("+smp_log=") : NULL;
+        if (!smpLogConfigure(value)) {
+            std::cerr << "Bad +smp_log=" << value << std::endl;
+            return 2;
+        }
+    }
+    const char *trace_sink_arg = Verilated::commandArgsPlusMatch("trace_sink=");
+    traceSinkConfigure(trace_sink_arg && *trace_sink_arg ? trace_sink_arg + std::strlen("+trace_sink=") : NULL);
+    for (const char *name : {"lockstep", "lockstep_context"}) {
+        const string plusarg = string(name) + "=";
+        const char *lockstep_arg = Verilated::commandArgsPlusMatch(plusarg.c_str());
+        lockstepConfigure(name, lockstep_arg && *lockstep_arg ? lockstep_arg + plusarg.size() + 1 : NULL);
+    }
+
+    string image;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (a[0] == '+') continue; // ignore plusargs
+        image = string(a);
+        break;
+    }
+    if (image.empty() && batchManifestPath.empty()) {
+        std::cerr << "Usage: VVexRiscv <program.elf|program.hex> [plusargs...]" << std::endl;
+        std::cerr << "       VVexRiscv +batch=<manifest|-> [plusargs...]" << std::endl;
+        return 2;
+    }
+
+    Memory mem;
+    VVexRiscv *top = new VVexRiscv;
+    int exit_code = 0;
+    if (batchManifestPath.empty()) {
+        uint64_t cycles = 0;
+        exit_code = run_image(top, mem, image, "run", started_at, &cycles);
+    } else {
+        // The model is built once; each input releases the memory pages of the previous one and goes through
+        // the reset sequence again.
+        BatchManifest manifest(batchManifestPath);
+        if (!manifest.ok()) {
+            std::cerr << "BATCH " << manifest.error << std::endl;
+            delete top;
+            return 2;
+        }
+        BatchEntry entry;
+        while (manifest.next(&entry)) {
+            struct timespec entry_started_at;
+            clock_gettime(CLOCK_MONOTONIC, &entry_started_at);
+            mem.reset();
+            uint64_t cycles = 0;
+            const int status = run_image(top, mem, entry.image, entry.name, entry_started_at, &cycles);
+            manifest.report(entry, status, cycles, memoryElapsedMs(entry_started_at));
+        }
+        exit_code = manifest.failed ? 1 : 0;
+    }
+
     delete top;
     return exit_code;
 }
@@ -0,0 +1,283 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Self-profiling of the regression harness (main.cpp), +profile[=<on|off|seconds>].
+//
+// Splits the host time of a run between the steps of a simulated cycle : eval of the Verilated model (top->eval()),
+// preCycle / postCycle of each bus and debug model (SimElement), golden model (riscvRef.step()), traces (trace filter
+// and writer calls of the simulation thread, which include the formatting and the writes with +trace_sink=sync),
+// waveform dump, data bus handlers (Workspace::dBusAccess, peripherals (mmio) apart from memory) and the rest of the
+// harness. The time stamp counter (clock_gettime when there isn't one) is read at each change of section and the
+// elapsed ticks are charged to the section which was running. The sections nest : an access of a bus model is charged
+// to mmio / memory, not to the preCycle which did it, and all of them add up to the time of the run.
+//
+// Each run writes its breakdown next to its traces (<test>.profile.json) and every <seconds> (10 by default, 0 for
+// none) prints a PROFILE line with the KHz and the breakdown of the last interval. The final report adds up all the
+// runs, in profile.json too. Off, the default, a section costs a predicted branch (simbench profile).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cxxabi.h>
+#include <string>
+#include <typeinfo>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define SIM_PROFILE_SLOTS 64
+#define SIM_PROFILE_DEPTH 16
+#define SIM_PROFILE_POLL 4096 // cycles between two looks at the clock for the progress line
+
+enum SimProfileSection {
+	SIM_PROFILE_HARNESS, // everything else
+	SIM_PROFILE_EVAL,
+	SIM_PROFILE_GOLDEN,
+	SIM_PROFILE_TRACE,
+	SIM_PROFILE_WAVE,
+	SIM_PROFILE_MMIO,
+	SIM_PROFILE_MEMORY,
+	SIM_PROFILE_SECTIONS // then the preCycle / postCycle slots of the SimElements
+};
+
+struct ProfileConfig{
+	bool enabled = false;
+	double progress = 10; // seconds between two PROFILE lines, 0 for none
+};
+
+static ProfileConfig profileConfig;
+
+// +profile (plusarg value, NULL or "" for on), false if it can't be parsed
+static inline bool profileConfigure(const char* value){
+	if(value == NULL || *value == 0 || !strcmp(value, "on")) { profileConfig.enabled = true; return true; }
+	if(!strcmp(value, "off")) { profileConfig.enabled = false; return true; }
+	char* end;
+	double seconds = strtod(value, &end);
+	if(*end || seconds < 0) return false;
+	profileConfig.enabled = true;
+	profileConfig.progress = seconds;
+	return true;
+}
+
+static inline uint64_t simProfileTicks(){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000ull + t.tv_nsec;
+#endif
+}
+
+static inline double simProfileSeconds(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+class SimProfile{
+public:
+	// Charges the ticks until its end to slot
+	class Scope{
+	public:
+		inline Scope(SimProfile &profile, uint32_t slot) : profile(profile) { profile.enter(slot); }
+		inline ~Scope(){ profile.leave(); }
+	private:
+		SimProfile &profile;
+	};
+
+	bool enabled = false; // between start() and stop()
+	uint32_t slotCount = SIM_PROFILE_SECTIONS;
+	std::string names[SIM_PROFILE_SLOTS];
+	uint64_t ticks[SIM_PROFILE_SLOTS];
+	uint64_t calls[SIM_PROFILE_SLOTS];
+	uint64_t cycles = 0;
+	double seconds = 0;
+
+	SimProfile(){
+		const char* sections[SIM_PROFILE_SECTIONS] = {"harness", "eval", "golden", "trace", "wave", "mmio", "memory"};
+		for(uint32_t s = 0;s < SIM_PROFILE_SECTIONS;s++) names[s] = sections[s];
+		clear();
+	}
+
+	void clear(){
+		memset(ticks, 0, sizeof(ticks));
+		memset(calls, 0, sizeof(calls));
+		cycles = 0;
+		seconds = 0;
+	}
+
+	// preCycle slot of the elements of that type (see postCycleSlot), harness once the slots are all taken
+	uint32_t element(const std::type_info &type){
+		int status;
+		char* demangled = abi::__cxa_demangle(type.name(), NULL, NULL, &status);
+		std::string name = status == 0 ? demangled : type.name();
+		free(demangled);
+		return slots(name + ".preCycle", name + ".postCycle");
+	}
+
+	static inline uint32_t postCycleSlot(uint32_t preCycleSlot){
+		return preCycleSlot == SIM_PROFILE_HARNESS ? (uint32_t)SIM_PROFILE_HARNESS : preCycleSlot + 1;
+	}
+
+	// Counters cleared, profiles if +profile. cycles : the cycle counter of the run, to which stop() and progress() compare theirs.
+	void start(uint64_t cycles){
+		clear();
+		enabled = profileConfig.enabled;
+		if(!enabled) return;
+		current = SIM_PROFILE_HARNESS;
+		depth = 0;
+		startSeconds = progressSeconds = simProfileSeconds();
+		last = progressTicks = simProfileTicks();
+		memset(progressSlots, 0, sizeof(progressSlots));
+		startCycles = progressCycles = cycles;
+		poll = SIM_PROFILE_POLL;
+	}
+
+	void stop(uint64_t cycles){
+		if(!enabled) return;
+		charge();
+		this->cycles = cycles - startCycles;
+		seconds = simProfileSeconds() - startSeconds;
+		enabled = false;
+	}
+
+	inline void enter(uint32_t slot){
+		if(!enabled) return;
+		charge();
+		stack[depth++] = current;
+		current = slot;
+		calls[slot]++;
+	}
+
+	inline void leave(){
+		if(!enabled) return;
+		charge();
+		current = stack[--depth];
+	}
+
+	// Once per cycle, true when a progress line is due
+	inline bool progressDue(){
+		if(!enabled || --poll) return false;
+		poll = SIM_PROFILE_POLL;
+		return profileConfig.progress > 0 && simProfileSeconds() - progressSeconds >= profileConfig.progress;
+	}
+
+	// PROFILE line of the interval since the previous one
+	void progress(FILE* f, const std::string &name, uint64_t cycles){
+		charge();
+		double now = simProfileSeconds();
+		uint64_t total = last - progressTicks;
+		fprintf(f, "PROFILE %s cycles=%lu khz=%.1f", name.c_str(), (unsigned long)cycles, (cycles - progressCycles)/((now - progressSeconds)*1e3));
+		for(uint32_t s = 0;s < SIM_PROFILE_SECTIONS;s++) fprintf(f, " %s=%.1f%%", names[s].c_str(), share(ticks[s] - progressSlots[s], total));
+		uint64_t elements = 0;
+		for(uint32_t s = SIM_PROFILE_SECTIONS;s < slotCount;s++) elements += ticks[s] - progressSlots[s];
+		fprintf(f, " elements=%.1f%%\n", share(elements, total));
+		memcpy(progressSlots, ticks, sizeof(progressSlots));
+		progressTicks = last;
+		progressSeconds = now;
+		progressCycles = cycles;
+	}
+
+	// Adds the counters of another profile, its slots matched by name
+	void add(const SimProfile &other){
+		for(uint32_t s = 0;s < other.slotCount;s++){
+			uint32_t slot = s < SIM_PROFILE_SECTIONS ? s : slots(other.names[s], std::string());
+			ticks[slot] += other.ticks[s];
+			calls[slot] += other.calls[s];
+		}
+		cycles += other.cycles;
+		seconds += other.seconds;
+	}
+
+	uint64_t totalTicks() const {
+		uint64_t total = 0;
+		for(uint32_t s = 0;s < slotCount;s++) total += ticks[s];
+		return total;
+	}
+
+	// One line, the sections by decreasing time
+	void summary(FILE* f, const char* name) const {
+		uint64_t total = totalTicks();
+		fprintf(f, "PROFILE %s cycles=%lu seconds=%.3f khz=%.1f ticks_per_cycle=%.0f", name, (unsigned long)cycles, seconds,
+			seconds > 0 ? cycles/(seconds*1e3) : 0.0, cycles ? (double)total/cycles : 0.0);
+		bool done[SIM_PROFILE_SLOTS] = {};
+		for(uint32_t n = 0;n < slotCount;n++){
+			uint32_t best = slotCount;
+			for(uint32_t s = 0;s < slotCount;s++) if(!done[s] && (best == slotCount || ticks[s] > ticks[best])) best = s;
+			done[best] = true;
+			if(ticks[best]) fprintf(f, " %s=%.1f%%", names[best].c_str(), share(ticks[best], total));
+		}
+		fprintf(f, "\n");
+	}
+
+	// seconds is the run time of the simulation threads, summed over them for a total of several runs
+	bool writeJson(const std::string &path, const std::string &name) const {
+		FILE* f = fopen(path.c_str(), "w");
+		if(!f) return false;
+		uint64_t total = totalTicks();
+		fprintf(f, "{\n  \"name\": \"%s\",\n  \"cycles\": %lu,\n  \"seconds\": %.6f,\n  \"khz\": %.3f,\n", escape(name).c_str(),
+			(unsigned long)cycles, seconds, seconds > 0 ? cycles/(seconds*1e3) : 0.0);
+		fprintf(f, "  \"tick_hz\": %.0f,\n  \"ticks\": %lu,\n  \"ticks_per_cycle\": %.3f,\n  \"sections\": [",
+			seconds > 0 ? total/seconds : 0.0, (unsigned long)total, cycles ? (double)total/cycles : 0.0);
+		for(uint32_t s = 0;s < slotCount;s++){
+			fprintf(f, "%s\n    {\"name\": \"%s\", \"ticks\": %lu, \"calls\": %lu, \"share\": %.6f, \"ticks_per_cycle\": %.3f}",
+				s ? "," : "", escape(names[s]).c_str(), (unsigned long)ticks[s], (unsigned long)calls[s], share(ticks[s], total)/100,
+				cycles ? (double)ticks[s]/cycles : 0.0);
+		}
+		fprintf(f, "\n  ]\n}\n");
+		return fclose(f) == 0;
+	}
+
+private:
+	uint32_t current = SIM_PROFILE_HARNESS;
+	uint32_t stack[SIM_PROFILE_DEPTH];
+	uint32_t depth = 0;
+	uint64_t last = 0, startCycles = 0;
+	double startSeconds = 0;
+	uint32_t poll = SIM_PROFILE_POLL;
+	uint64_t progressSlots[SIM_PROFILE_SLOTS];
+	uint64_t progressTicks = 0, progressCycles = 0;
+	double progressSeconds = 0;
+
+	inline void charge(){
+		uint64_t now = simProfileTicks();
+		ticks[current] += now - last;
+		last = now;
+	}
+
+	// Slot named first, second (if any) right after it
+	uint32_t slots(const std::string &first, const std::string &second){
+		for(uint32_t s = SIM_PROFILE_SECTIONS;s < slotCount;s++) if(names[s] == first) return s;
+		uint32_t count = second.empty() ? 1 : 2;
+		if(slotCount + count > SIM_PROFILE_SLOTS) return SIM_PROFILE_HARNESS;
+		names[slotCount] = first;
+		if(!second.empty()) names[slotCount + 1] = second;
+		slotCount += count;
+		return slotCount - count;
+	}
+
+	static double share(uint64_t ticks, uint64_t total){ return total ? 100.0*ticks/total : 0.0; }
+
+	static std::string escape(const std::string &value){
+		std::string escaped;
+		for(char c : value){
+			if(c == '"' || c == '\\') escaped += '\\';
+			escaped += c;
+		}
+		return escaped;
+	}
+};
+
+// Sum of the runs of the process, for the final report
+static SimProfile profileTotal;
+
+static inline void profileReport(FILE* f){
+	if(!profileConfig.enabled) return;
+	profileTotal.summary(f, "total");
+	if(!profileTotal.writeJson("profile.json", "total")) perror("profile.json");
+}
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+// Record / replay of the inputs which the regression harness (main.cpp) gives to the DUT from its own state.
+//
+// +replay_record=<path> logs, for each test, what the run depends on besides the program : the values returned by
+// the peripheral reads (mTime, UART / console input, ...), the edges of the interrupt lines, the interrupts the DUT
+// took and the reset content of its register file, each stamped with the cycle, the steps of the golden model and
+// the position of the harness random generator (the bits drawn from it, see sim_random.h), which pins down the
+// stall / garbage draws made up to the event. Its seed and position at the start of the run are in the header.
+// {name} in the path is replaced by the test name.
+//
+// +replay=<path> runs the test again with these inputs fed back : the peripheral reads return the recorded values
+// (the console input isn't read), the interrupt lines follow the log and the random generator restarts from the
+// seed and the position of the recorded run. The first input which the run doesn't ask for at the recorded cycle
+// fails it with a REPLAY report, so a failure is either reproduced at the same cycle or the report tells where
+// things went apart. The random initialisation of the Verilated model is seeded as in the recorded run (randSeed of
+// its context, in the header), except in VM_COVERAGE builds whose tests share the context of the process : the report
+// gives the recorded seed when it differs.
+//
+// +replay_golden=<steps|end> with +replay only steps the golden model, fed with the recorded reads and interrupts,
+// up to that many instructions, at the speed of the ISS. Its regTrace / memTrace can be compared with the ones of the
+// recorded run (tools/vexdiff) and its state is printed at the end. It needs a recording made with the golden model
+// enabled (withRiscvRef), and doesn't support the FPU.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define REPLAY_MAGIC "VEXRPL01"
+#define REPLAY_VERSION 3
+
+enum ReplayKind : uint8_t{
+	REPLAY_READ = 1,      // address, size, error, value : a peripheral read
+	REPLAY_LINES = 2,     // value : the interrupt lines as MIP bits, logged when they change
+	REPLAY_INTERRUPT = 3, // address : the cause of an interrupt which the DUT took
+	REPLAY_TIME = 4,      // value : the time CSR which the golden model read from the DUT (UTIME_INPUT)
+	REPLAY_REG = 5,       // address, value : the register file content out of reset
+	REPLAY_END = 6,       // error : the run failed
+};
+
+struct ReplayHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t golden;       // the golden model was enabled, steps are counted
+	uint64_t modelSeed;    // randSeed of the context of the Verilated model
+	uint64_t seed;         // of the test
+	uint64_t random;       // position of the harness random generator when the run started
+	char name[64];
+};
+
+struct ReplayEvent{
+	uint8_t kind;
+	uint8_t size;
+	uint8_t error;
+	uint8_t reserved;
+	uint32_t address;
+	uint64_t cycle;
+	uint64_t step;
+	uint64_t random;
+	uint64_t value;
+};
+
+struct ReplayConfig{
+	std::string record, replay;
+	uint64_t goldenSteps = 0; // +replay_golden, 0 : the DUT is simulated
+};
+
+static ReplayConfig replayConfig;
+
+// Apply the value of one +replay_record / +replay / +replay_golden plusarg, false if it can't be parsed
+static inline bool replayConfigure(const char* name, const char* value){
+	if(value == NULL || *value == 0) return true;
+	if(!strcmp(name, "replay_record")) replayConfig.record = value;
+	else if(!strcmp(name, "replay")) replayConfig.replay = value;
+	else if(!strcmp(name, "replay_golden")){
+		char* end;
+		replayConfig.goldenSteps = strcmp(value, "end") ? strtoull(value, &end, 0) : UINT64_MAX;
+		if(replayConfig.goldenSteps == 0 || (replayConfig.goldenSteps != UINT64_MAX && *end != 0)) return false;
+	}
+	else return false;
+	return true;
+}
+
+// The log of one test. In both modes the harness calls the same methods with what its run produced : they log it
+// when recording, and when replaying they replace it with the recorded value and return false on a divergence
+// (then reported in divergence).
+class ReplayLog{
+public:
+	enum Mode{RECORD, REPLAY};
+	const Mode mode;
+	std::string error;      // the log can't be used
+	std::string divergence; // the first difference between the run and the recording
+	ReplayHeader header;
+	uint64_t events = 0;
+
+	// path : {name} replaced by name
+	ReplayLog(std::string path, const std::string &name, Mode mode) : mode(mode) {
+		for(size_t at;(at = path.find("{name}")) != std::string::npos;) path.replace(at, 6, name);
+		this->path = path;
+		memset(&header, 0, sizeof(header));
+		if(mode == RECORD){
+			file = fopen(path.c_str(), "wb");
+			if(file == NULL) { error = "can't create " + path; return; }
+			setvbuf(file, NULL, _IOFBF, 1 << 20);
+			memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+			header.version = REPLAY_VERSION;
+			strncpy(header.name, name.c_str(), sizeof(header.name) - 1);
+			return;
+		}
+		FILE* in = fopen(path.c_str(), "rb");
+		if(in == NULL) { error = "can't open " + path; return; }
+		if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) || header.version != REPLAY_VERSION){
+			error = path + " isn't a replay log of this version";
+		} else {
+			ReplayEvent e;
+			while(fread(&e, sizeof(e), 1, in) == 1) log.push_back(e);
+			if(log.empty() || log.back().kind != REPLAY_END) error = path + " is truncated, the recorded run didn't end";
+			else if(strncmp(header.name, name.c_str(), sizeof(header.name) - 1)) error = path + " was recorded for " + header.name;
+		}
+		fclose(in);
+	}
+	ReplayLog(const ReplayLog&) = delete;
+	ReplayLog& operator=(const ReplayLog&) = delete;
+	~ReplayLog(){ if(file) fclose(file); }
+
+	bool ok() const { return error.empty() && divergence.empty(); }
+	bool replaying() const { return mode == REPLAY; }
+
+	// Start of the run : the header when recording, the random position to restart from when replaying
+	void begin(uint64_t modelSeed, uint64_t seed, uint64_t *random, bool golden){
+		if(mode == REPLAY) { *random = header.random; return; }
+		header.modelSeed = modelSeed;
+		header.seed = seed;
+		header.random = *random;
+		header.golden = golden;
+		if(fwrite(&header, sizeof(header), 1, file) != 1) error = "can't write " + path;
+	}
+
+	// Register r of the DUT out of reset
+	bool reg(uint32_t r, uint32_t *value){
+		ReplayEvent e = event(REPLAY_REG, 0, 0, 0);
+		e.address = r;
+		e.value = *value;
+		const ReplayEvent* recorded = exchange(e, REPLAY_REG);
+		if(recorded == NULL) return false;
+		if(recorded->address != r) return diverged(e, *recorded, "register");
+		*value = recorded->value;
+		return true;
+	}
+
+	// A peripheral read of size bytes at cycle, data and busError as the harness answered it
+	bool read(uint64_t cycle, uint64_t step, uint64_t random, uint32_t address, uint32_t size, uint8_t *data, bool *busError){
+		if(size > sizeof(uint64_t)) return fault("peripheral read of " + std::to_string(size) + " bytes at " + hex(address));
+		ReplayEvent e = event(REPLAY_READ, cycle, step, random);
+		e.address = address;
+		e.size = size;
+		e.error = *busError;
+		memcpy(&e.value, data, size);
+		const ReplayEvent* recorded = exchange(e, REPLAY_READ);
+		if(recorded == NULL) return false;
+		if(recorded->cycle != cycle || recorded->address != address || recorded->size != size || recorded->random != random) return diverged(e, *recorded, "peripheral read");
+		memcpy(data, &recorded->value, size);
+		*busError = recorded->error;
+		return true;
+	}
+
+	// The interrupt lines at the start of cycle, as MIP bits. Logged when they change, the replay gives the recorded
+	// ones whatever the harness computed.
+	void lines(uint64_t cycle, uint64_t step, uint64_t random, uint32_t *value){
+		if(mode == RECORD){
+			if(*value == linesValue && linesLogged) return;
+			linesValue = *value;
+			linesLogged = true;
+			ReplayEvent e = event(REPLAY_LINES, cycle, step, random);
+			e.value = *value;
+			write(e);
+			return;
+		}
+		size_t &at = cursors[REPLAY_LINES];
+		while((at = find(at, REPLAY_LINES)) < log.size() && log[at].cycle <= cycle) linesValue = log[at++].value;
+		*value = linesValue;
+	}
+
+	// The DUT took the interrupt cause
+	bool interrupt(uint64_t cycle, uint64_t step, uint64_t random, uint32_t cause){
+		ReplayEvent e = event(REPLAY_INTERRUPT, cycle, step, random);
+		e.address = cause;
+		const ReplayEvent* recorded = exchange(e, REPLAY_INTERRUPT);
+		if(recorded == NULL) return false;
+		if(recorded->cycle != cycle || recorded->address != cause || recorded->random != random) return diverged(e, *recorded, "interrupt");
+		return true;
+	}
+
+	// The golden model read the time CSR, given by the DUT, at step (only needed by +replay_golden)
+	void time(uint64_t cycle, uint64_t step, uint32_t value){
+		if(mode != RECORD) return;
+		ReplayEvent e = event(REPLAY_TIME, cycle, step, 0);
+		e.value = value;
+		write(e);
+	}
+
+	// End of the run. When replaying, false if it didn't end as the recorded one.
+	bool end(uint64_t cycle, uint64_t step, uint64_t random, bool failed){
+		ReplayEvent e = event(REPLAY_END, cycle, step, random);
+		e.error = failed;
+		if(mode == RECORD){
+			write(e);
+			if(file && fflush(file) != 0) error = "can't write " + path;
+			return true;
+		}
+		if(!divergence.empty()) return false;
+		const ReplayEvent &recorded = log.back();
+		if(recorded.cycle != cycle || recorded.error != failed) return diverged(e, recorded, "end");
+		return true;
+	}
+
+	// Back to cycle, after the harness restored a checkpoint of it
+	void seek(uint64_t cycle){
+		for(size_t &at : cursors) at = 0;
+		linesValue = 0;
+		for(size_t kind = REPLAY_READ;kind < REPLAY_END;kind++){
+			size_t &at = cursors[kind];
+			while((at = find(at, kind)) < log.size() && log[at].cycle < cycle){
+				if(kind == REPLAY_LINES) linesValue = log[at].value;
+				at++;
+			}
+		}
+	}
+
+	// +replay_golden : the recorded events which come before the golden step, in order, NULL when there are none
+	const ReplayEvent* golden(uint64_t step){
+		size_t &at = cursors[0];
+		if(at >= log.size() || log[at].step > step) return NULL;
+		return &log[at++];
+	}
+
+	// The recorded run, for the reports
+	const ReplayEvent& recordedEnd() const { return log.back(); }
+
+	std::string summary() const {
+		std::ostringstream s;
+		if(mode == RECORD) { s << "REPLAY " << header.name << " recorded " << events << " events in " << path; return s.str(); }
+		const ReplayEvent &last = log.back();
+		s << "REPLAY " << header.name << " reproduced the recorded run, " << (last.error ? "failed" : "passed") << " at cycle " << last.cycle;
+		return s.str();
+	}
+
+private:
+	std::string path;
+	FILE* file = NULL;
+	std::vector<ReplayEvent> log;
+	size_t cursors[REPLAY_END] = {}; // per kind, [0] for +replay_golden
+	uint64_t linesValue = 0;
+	bool linesLogged = false;
+
+	static std::string hex(uint64_t value){
+		char text[24];
+		snprintf(text, sizeof(text), "0x%llx", (unsigned long long)value);
+		return text;
+	}
+
+	ReplayEvent event(ReplayKind kind, uint64_t cycle, uint64_t step, uint64_t random){
+		ReplayEvent e;
+		memset(&e, 0, sizeof(e));
+		e.kind = kind;
+		e.cycle = cycle;
+		e.step = step;
+		e.random = random;
+		return e;
+	}
+
+	void write(const ReplayEvent &e){
+		if(file == NULL || !error.empty()) return;
+		if(fwrite(&e, sizeof(e), 1, file) != 1) error = "can't write " + path;
+		events++;
+	}
+
+	size_t find(size_t at, size_t kind) const {
+		while(at < log.size() && log[at].kind != kind) at++;
+		return at;
+	}
+
+	// Records e, or gives the next recorded event of its kind
+	const ReplayEvent* exchange(const ReplayEvent &e, ReplayKind kind){
+		if(mode == RECORD) { write(e); return &e; }
+		if(!divergence.empty()) return NULL;
+		size_t &at = cursors[kind];
+		at = find(at, kind);
+		if(at >= log.size()){
+			std::ostringstream s;
+			s << "REPLAY " << header.name << " diverged at cycle " << e.cycle << " : the recorded run had no more events of this kind (" << (int)kind << ")" << std::endl;
+			divergence = s.str();
+			return NULL;
+		}
+		events++;
+		return &log[at++];
+	}
+
+	bool diverged(const ReplayEvent &run, const ReplayEvent &recorded, const char* what){
+		std::ostringstream s;
+		s << "REPLAY " << header.name << " diverged at cycle " << run.cycle << " on " << what << std::endl;
+		auto line = [&](const char* side, const ReplayEvent &e){
+			s << " " << side << " cycle=" << e.cycle << " step=" << e.step << " random=" << hex(e.random) << " address=" << hex(e.address)
+			  << " size=" << (int)e.size << " value=" << hex(e.value) << " error=" << (int)e.error << std::endl;
+		};
+		line("RUN     ", run);
+		line("RECORDED", recorded);
+		if(run.random != recorded.random) s << " the harness random draws differ, so do the stall decisions" << std::endl;
+		divergence = s.str();
+		return false;
+	}
+
+	bool fault(const std::string &what){
+		if(error.empty()) error = "can't log the " + what;
+		return false;
+	}
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef SIM_ELEMENTS_H
+#define SIM_ELEMENTS_H
+
+// Bus and debug models of the regression harness (main.cpp) composed at compile time.
+//
+// SimElements<IBus, DBus, ...> holds the models of the configuration by value and calls them by their static type, so
+// their preCycle / postCycle inline into the cycle loop instead of going through two virtual calls per model and cycle
+// over a vector<SimElement*>. The models are called in the order of the list, which is the order of the former
+// vector, so their random draws don't change. Each type of the list is constructed from the workspace pointer,
+// NoSimElement fills the slots which a configuration doesn't use. SimElements added at run time
+// (Workspace::addSimElement) are still called, after these ones, through their virtual functions.
+//
+// With +profile (see profile.h) the cycle goes through preCycle(profile) / postCycle(profile) instead, which charge
+// each model to its own slot of the profile, named after its type.
+
+#include <stdint.h>
+#include <typeinfo>
+
+// Empty slot of a SimElements list
+class NoSimElement{
+public:
+	template <typename Workspace> explicit NoSimElement(Workspace*){}
+	inline void onReset(){}
+	inline void postReset(){}
+	inline void preCycle(){}
+	inline void postCycle(){}
+	inline bool idle(){ return true; }
+	template <typename Checkpoint> inline void checkpoint(Checkpoint &c){}
+};
+
+template <typename... Elements> class SimElements;
+
+// Profiled calls of one element of a list, NoSimElement isn't profiled and a nested list profiles its own elements
+template <typename Element, typename Profile> inline uint32_t simElementSlot(Element &, Profile &p){ return p.element(typeid(Element)); }
+template <typename Profile> inline uint32_t simElementSlot(NoSimElement &, Profile &){ return 0; }
+template <typename... Elements, typename Profile> inline uint32_t simElementSlot(SimElements<Elements...> &e, Profile &p){ e.profileSlots(p); return 0; }
+
+template <typename Element, typename Profile> inline void simElementPreCycle(Element &e, Profile &p, uint32_t slot){
+	typename Profile::Scope scope(p, slot);
+	e.Element::preCycle();
+}
+template <typename Profile> inline void simElementPreCycle(NoSimElement &, Profile &, uint32_t){}
+template <typename... Elements, typename Profile> inline void simElementPreCycle(SimElements<Elements...> &e, Profile &p, uint32_t){ e.preCycle(p); }
+
+template <typename Element, typename Profile> inline void simElementPostCycle(Element &e, Profile &p, uint32_t slot){
+	typename Profile::Scope scope(p, Profile::postCycleSlot(slot));
+	e.Element::postCycle();
+}
+template <typename Profile> inline void simElementPostCycle(NoSimElement &, Profile &, uint32_t){}
+template <typename... Elements, typename Profile> inline void simElementPostCycle(SimElements<Elements...> &e, Profile &p, uint32_t){ e.postCycle(p); }
+
+template <> class SimElements<>{
+public:
+	template <typename Workspace> explicit SimElements(Workspace*){}
+	inline void onReset(){}
+	inline void postReset(){}
+	inline void preCycle(){}
+	inline void postCycle(){}
+	inline bool idle(){ return true; }
+	template <typename Checkpoint> inline void checkpoint(Checkpoint &c){}
+	template <typename Profile> inline void profileSlots(Profile &){}
+	template <typename Profile> inline void preCycle(Profile &){}
+	template <typename Profile> inline void postCycle(Profile &){}
+};
+
+template <typename Head, typename... Tail>
+class SimElements<Head, Tail...>{
+public:
+	Head head; // constructed before the tail, as the vector was filled
+	SimElements<Tail...> tail;
+
+	template <typename Workspace> explicit SimElements(Workspace* ws) : head(ws), tail(ws) {}
+
+	// The qualified calls don't go through the vtable of the models which derive from SimElement
+	inline void onReset(){ head.Head::onReset(); tail.onReset(); }
+	inline void postReset(){ head.Head::postReset(); tail.postReset(); }
+	inline void preCycle(){ head.Head::preCycle(); tail.preCycle(); }
+	inline void postCycle(){ head.Head::postCycle(); tail.postCycle(); }
+	inline bool idle(){ return head.Head::idle() && tail.idle(); }
+	template <typename Checkpoint> inline void checkpoint(Checkpoint &c){ head.Head::checkpoint(c); tail.checkpoint(c); }
+
+	// Before the profiled calls, slots of the profile which they charge
+	template <typename Profile> void profileSlots(Profile &p){ profileSlot = simElementSlot(head, p); tail.profileSlots(p); }
+	template <typename Profile> inline void preCycle(Profile &p){ simElementPreCycle(head, p, profileSlot); tail.preCycle(p); }
+	template <typename Profile> inline void postCycle(Profile &p){ simElementPostCycle(head, p, profileSlot); tail.postCycle(p); }
+
+private:
+	uint32_t profileSlot = 0;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef SIM_IMAGE_H
+#define SIM_IMAGE_H
+
+// Process wide cache of parsed program images (hex / bin / ...).
+//
+// Each file is parsed once into an Image : a set of immutable 1 MiB guest pages stored in a memfd. Every Memory
+// which loads it (DUT and CpuRef of every Workspace, in every thread) maps those pages MAP_PRIVATE, so they share
+// the physical frames until one of them writes, and only the written 4 KiB frames are copied.
+// When a target page is already materialised (two images in the same 1 MiB, heap fallback, ...) the image is
+// copied instead, restricted to the byte runs which were really written by the parser.
+// Images can also be backed by a file (see image_pack.h), as segments whose whole host pages are mapped
+// copy-on-write from that file.
+
+#include "sim_memory.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Image{
+public:
+	struct Page{
+		uint32_t id;     // guest page index (address >> MEMORY_PAGE_BITS)
+		uint32_t slot;   // page index inside the image storage
+		uint8_t* data;   // read only view of the page
+		std::vector<std::pair<uint32_t, uint32_t>> runs; // written [begin, end) offsets inside the page
+	};
+
+	// File backed bytes, the file offset is congruent to the address modulo 4 KiB
+	struct Segment{
+		uint32_t address;
+		uint32_t length;
+		uint64_t offset;
+	};
+
+	std::string name;
+	std::vector<Page> pages;
+	std::vector<Segment> segments;
+	int fd = -1;
+	uint8_t* view = NULL;  // read only mapping of the whole fd
+	size_t viewSize = 0;
+	uint32_t slots = 0;
+	uint32_t entry = 0; // optional entry point provided by the parser
+	bool hasEntry = false;
+	std::map<std::string, uint32_t> symbols; // optional symbols resolved by the parser (tohost, ...)
+
+	~Image(){
+		if(view) munmap(view, viewSize);
+		if(fd >= 0) close(fd);
+		if(fd < 0) for(Page &page : pages) delete [] page.data;
+	}
+
+	bool symbol(const std::string &name, uint32_t *value) const {
+		auto it = symbols.find(name);
+		if(it == symbols.end()) return false;
+		*value = it->second;
+		return true;
+	}
+
+	uint64_t byteCount() const {
+		uint64_t count = 0;
+		for(const Page &page : pages) for(auto &run : page.runs) count += run.second - run.first;
+		for(const Segment &segment : segments) count += segment.length;
+		return count;
+	}
+
+	void mapInto(Memory *mem) const {
+		for(const Page &page : pages){
+			if(mem->base && fd >= 0 && mem->mem[page.id] == NULL){
+				uint8_t* ptr = mem->base + (((uint64_t)page.id) << MEMORY_PAGE_BITS);
+				if(mmap(ptr, MEMORY_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, ((off_t)page.slot) << MEMORY_PAGE_BITS) != MAP_FAILED){
+					mem->mem[page.id] = ptr;
+					continue;
+				}
+			}
+			uint32_t pageAddress = page.id << MEMORY_PAGE_BITS;
+			for(auto &run : page.runs){
+				mem->write(pageAddress + run.first, run.second - run.first, page.data + run.first);
+			}
+		}
+		for(const Segment &segment : segments) mapSegment(mem, segment);
+	}
+
+private:
+	void mapSegment(Memory *mem, const Segment &segment) const {
+		static const uintptr_t hostPage = sysconf(_SC_PAGESIZE);
+		uint32_t address = segment.address;
+		uint32_t length = segment.length;
+		uint64_t offset = segment.offset;
+		while(length != 0){
+			uint32_t chunk = length;
+			uint8_t* dst = mem->span(address, &chunk);
+			uintptr_t begin = ((uintptr_t)dst + hostPage - 1) & ~(hostPage - 1);
+			uintptr_t end = ((uintptr_t)dst + chunk) & ~(hostPage - 1);
+			uint64_t beginOffset = offset + (begin - (uintptr_t)dst);
+			bool mapped = mem->base && fd >= 0 && end > begin && beginOffset % hostPage == 0 &&
+				mmap((void*)begin, end - begin, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, beginOffset) != MAP_FAILED;
+			if(mapped){
+				memcpy(dst, view + offset, begin - (uintptr_t)dst);
+				memcpy((void*)end, view + offset + (end - (uintptr_t)dst), (uintptr_t)dst + chunk - end);
+			} else {
+				memcpy(dst, view + offset, chunk);
+			}
+			address += chunk; offset += chunk; length -= chunk;
+		}
+	}
+};
+
+// Filled by the parsers, then frozen into an Image
+class ImageBuilder{
+public:
+	Image *image;
+	std::map<uint32_t, uint32_t> pageIndex; // guest page -> Image::pages index
+	std::vector<uint8_t*> slotPtr;
+
+	ImageBuilder(Image *image) : image(image) {
+		#ifdef SYS_memfd_create
+		image->fd = syscall(SYS_memfd_create, "vex_image", 0);
+		#endif
+	}
+
+	void write(uint32_t address, uint32_t length, const uint8_t *data){
+		while(length != 0){
+			uint32_t offset = address & MEMORY_PAGE_MASK;
+			uint32_t chunk = MEMORY_PAGE_SIZE - offset;
+			if(chunk > length) chunk = length;
+			Image::Page &page = getPage(address >> MEMORY_PAGE_BITS);
+			memcpy(slotPtr[page.slot] + offset, data, chunk);
+			if(!page.runs.empty() && page.runs.back().second == offset) {
+				page.runs.back().second = offset + chunk;
+			} else {
+				page.runs.push_back(std::make_pair(offset, offset + chunk));
+			}
+			address += chunk; data += chunk; length -= chunk;
+		}
+	}
+
+	void write32(uint32_t address, uint32_t value){ write(address, 4, (uint8_t*)&value); }
+
+	void setEntry(uint32_t pc){ image->entry = pc; image->hasEntry = true; }
+	void setSymbol(const std::string &name, uint32_t value){ image->symbols[name] = value; }
+
+	// Drop the writable mappings and expose a single read only view
+	void freeze(){
+		if(image->fd < 0) {
+			for(Image::Page &page : image->pages) page.data = slotPtr[page.slot];
+			return;
+		}
+		for(uint8_t* ptr : slotPtr) munmap(ptr, MEMORY_PAGE_SIZE);
+		slotPtr.clear();
+		if(image->slots == 0) return;
+		image->viewSize = ((size_t)image->slots) << MEMORY_PAGE_BITS;
+		image->view = (uint8_t*)mmap(NULL, image->viewSize, PROT_READ, MAP_SHARED, image->fd, 0);
+		if(image->view == MAP_FAILED){
+			perror("Image view mapping failed");
+			abort();
+		}
+		for(Image::Page &page : image->pages) page.data = image->view + (((size_t)page.slot) << MEMORY_PAGE_BITS);
+	}
+
+private:
+	Image::Page& getPage(uint32_t id){
+		auto it = pageIndex.find(id);
+		if(it != pageIndex.end()) return image->pages[it->second];
+
+		uint32_t slot = image->slots++;
+		uint8_t* ptr = NULL;
+		if(image->fd >= 0){
+			if(ftruncate(image->fd, ((off_t)image->slots) << MEMORY_PAGE_BITS) != 0){
+				perror("Image storage allocation failed");
+				abort();
+			}
+			ptr = (uint8_t*)mmap(NULL, MEMORY_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, image->fd, ((off_t)slot) << MEMORY_PAGE_BITS);
+			if(ptr == MAP_FAILED){
+				perror("Image storage mapping failed");
+				abort();
+			}
+		} else {
+			ptr = new uint8_t[MEMORY_PAGE_SIZE];
+		}
+		memset(ptr, MEMORY_FILL, MEMORY_PAGE_SIZE);
+		slotPtr.push_back(ptr);
+
+		Image::Page page;
+		page.id = id;
+		page.slot = slot;
+		page.data = NULL;
+		pageIndex[id] = image->pages.size();
+		image->pages.push_back(page);
+		return image->pages.back();
+	}
+};
+
+typedef std::function<void(const std::string &path, ImageBuilder *builder)> ImageParser;
+typedef std::function<Image*()> ImageFactory;
+
+// Run parser over path into a new memfd backed Image
+static inline Image* imageParse(const std::string &path, const ImageParser &parser){
+	Image *image = new Image();
+	image->name = path;
+	ImageBuilder builder(image);
+	parser(path, &builder);
+	builder.freeze();
+	return image;
+}
+
+class ImageCache{
+public:
+	// Returns the image of path parsed by parser, parsing it only on the first request of the process.
+	// kind discriminates the parsers (and their arguments) which can be applied to the same file.
+	static std::shared_ptr<const Image> get(const std::string &kind, const std::string &path, const ImageParser &parser){
+		return get(kind, path, [&](){ return imageParse(path, parser); });
+	}
+
+	// Same, with a factory which can produce the Image by other means (image packs, ...)
+	static std::shared_ptr<const Image> get(const std::string &kind, const std::string &path, const ImageFactory &factory){
+		struct stat st;
+		std::string key = kind + ":" + path;
+		if(stat(path.c_str(), &st) == 0) key += ":" + std::to_string((long long)st.st_size) + ":" + std::to_string((long long)st.st_mtime);
+
+		std::shared_ptr<Entry> entry;
+		{
+			std::lock_guard<std::mutex> lock(mutex());
+			std::shared_ptr<Entry> &slot = entries()[key];
+			if(!slot) slot = std::make_shared<Entry>();
+			entry = slot;
+		}
+		std::call_once(entry->once, [&](){ entry->image.reset(factory()); });
+		return entry->image;
+	}
+
+	// Forget every image, those still referenced stay alive until released (batch mode, between inputs, so a
+	// long manifest doesn't keep all its images around)
+	static void clear(){
+		std::lock_guard<std::mutex> lock(mutex());
+		entries().clear();
+	}
+
+private:
+	struct Entry{
+		std::once_flag once;
+		std::shared_ptr<const Image> image;
+	};
+	static std::mutex& mutex(){ static std::mutex m; return m; }
+	static std::map<std::string, std::shared_ptr<Entry>>& entries(){ static std::map<std::string, std::shared_ptr<Entry>> e; return e; }
+};
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef SIM_MEMORY_H
+#define SIM_MEMORY_H
+
+// Sparse 32 bits guest memory shared by the regression (main.cpp) and SMP (main_smp.cpp) harnesses.
+//
+// The whole guest address space is one reserved 4 GiB MAP_NORESERVE mapping. It is split in 4096 pages of
+// 1 MiB which are materialised on first touch :
+// - SMALL : the page is mapped MAP_PRIVATE over a process wide 0xFF template (memfd), so reads share the
+//           template frames and the kernel only copies the 4 KiB frames which are written.
+// - HUGE  : the reservation is anonymous + MADV_HUGEPAGE and the page is filled with 0xFF by memset on first
+//           touch, trading RSS for fewer TLB misses on large images.
+// If the reservation can't be done (ulimit -v, ...), pages fall back to heap allocations.
+//
+// The mode is selected by Memory::defaultMode(), which both harnesses set from +mem_pages=small|huge
+// (or the VEX_MEM_PAGES environment variable).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#define MEMORY_PAGE_BITS 20
+#define MEMORY_PAGE_SIZE (1u << MEMORY_PAGE_BITS)
+#define MEMORY_PAGE_MASK (MEMORY_PAGE_SIZE - 1)
+#define MEMORY_PAGE_COUNT (1u << (32 - MEMORY_PAGE_BITS))
+#define MEMORY_SPACE_SIZE (((uint64_t)MEMORY_PAGE_COUNT) << MEMORY_PAGE_BITS)
+#define MEMORY_FILL 0xFF
+
+class Memory{
+public:
+	enum Mode {PAGES_SMALL, PAGES_HUGE};
+	// Function-local static, so that several translation units can include the header
+	static Mode &defaultMode(){ static Mode value = PAGES_SMALL; return value; }
+
+	uint8_t* mem[MEMORY_PAGE_COUNT];
+	uint8_t* base;
+	Mode mode;
+
+	Memory(){
+		mode = defaultMode();
+		for(uint32_t i = 0;i < MEMORY_PAGE_COUNT;i++) mem[i] = NULL;
+		base = reserve(mode);
+	}
+
+	Memory(Memory &&that){
+		mode = that.mode;
+		base = that.base;
+		memcpy(mem, that.mem, sizeof(mem));
+		that.base = NULL;
+		for(uint32_t i = 0;i < MEMORY_PAGE_COUNT;i++) that.mem[i] = NULL;
+	}
+	Memory(const Memory&) = delete;
+	Memory& operator=(const Memory&) = delete;
+
+	~Memory(){
+		if(base){
+			munmap(base, MEMORY_SPACE_SIZE);
+		} else {
+			for(uint32_t i = 0;i < MEMORY_PAGE_COUNT;i++) if(mem[i]) delete [] mem[i];
+		}
+	}
+
+	uint8_t* get(uint32_t address){
+		uint8_t* page = mem[address >> MEMORY_PAGE_BITS];
+		if(page == NULL) page = allocate(address >> MEMORY_PAGE_BITS);
+		return &page[address & MEMORY_PAGE_MASK];
+	}
+
+	// Host pointer on [address, address + *length), *length is clamped to the end of the page
+	uint8_t* span(uint32_t address, uint32_t *length){
+		uint32_t available = MEMORY_PAGE_SIZE - (address & MEMORY_PAGE_MASK);
+		if(*length > available) *length = available;
+		return get(address);
+	}
+
+	void read(uint32_t address,uint32_t length, uint8_t *data){
+		while(length != 0){
+			uint32_t chunk = length;
+			memcpy(data, span(address, &chunk), chunk);
+			address += chunk; data += chunk; length -= chunk;
+		}
+	}
+
+	void write(uint32_t address,uint32_t length, const uint8_t *data){
+		while(length != 0){
+			uint32_t chunk = length;
+			memcpy(span(address, &chunk), data, chunk);
+			address += chunk; data += chunk; length -= chunk;
+		}
+	}
+
+	// Naturally aligned accesses never cross a page, so they are a single lookup + host load/store
+	uint32_t read32(uint32_t address){ uint32_t v; memcpy(&v, get(address), 4); return v; }
+	uint64_t read64(uint32_t address){ uint64_t v; memcpy(&v, get(address), 8); return v; }
+	void read128(uint32_t address, uint32_t *words){ memcpy(words, get(address), 16); }
+	void write32(uint32_t address, uint32_t v){ memcpy(get(address), &v, 4); }
+	void write64(uint32_t address, uint64_t v){ memcpy(get(address), &v, 8); }
+	void write128(uint32_t address, const uint32_t *words){ memcpy(get(address), words, 16); }
+
+	// Byte enable write of up to 16 bytes which stay in one page (bus beats)
+	void writeMasked(uint32_t address, const uint8_t *data, uint32_t mask, uint32_t length){
+		uint8_t* dst = get(address);
+		if(mask == (1u << length) - 1) { memcpy(dst, data, length); return; }
+		for(uint32_t i = 0;i < length;i++) if((mask >> i) & 1) dst[i] = data[i];
+	}
+
+	uint8_t& operator [](uint32_t address) {
+		return *get(address);
+	}
+
+	// Drop the materialised pages, the memory reads back as a fresh one (checkpoint restore, batch mode). mem[] is
+	// the dirty map : only the pages touched since the last reset are released, and within them the kernel only
+	// has the written 4 KiB frames (SMALL) or the touched huge pages (HUGE) to free. Returns the released count.
+	uint32_t reset(){
+		uint32_t released = 0;
+		for(uint32_t i = 0;i < MEMORY_PAGE_COUNT;i++){
+			if(mem[i] == NULL) continue;
+			release(i);
+			mem[i] = NULL;
+			released++;
+		}
+		return released;
+	}
+
+	// Pages currently materialised
+	uint32_t touchedPages() const {
+		uint32_t count = 0;
+		for(uint32_t i = 0;i < MEMORY_PAGE_COUNT;i++) if(mem[i]) count++;
+		return count;
+	}
+
+	static const char* modeName(Mode mode){ return mode == PAGES_HUGE ? "huge" : "small"; }
+
+	// Parse a "small"/"huge" option, keep the current default on anything else
+	static void setDefaultMode(const char* value){
+		if(value == NULL) return;
+		if(!strcmp(value, "huge")) defaultMode() = PAGES_HUGE;
+		else if(!strcmp(value, "small")) defaultMode() = PAGES_SMALL;
+		else fprintf(stderr, "Unknown memory page mode '%s', keeping %s\n", value, modeName(defaultMode()));
+	}
+
+private:
+	// Process wide read only 0xFF page used as copy-on-write source by every SMALL mode Memory
+	static int templateFd(){
+		static std::once_flag once;
+		static int fd = -1;
+		std::call_once(once, [](){
+			#ifdef SYS_memfd_create
+			fd = syscall(SYS_memfd_create, "vex_mem_template", 0);
+			#endif
+			if(fd < 0) return;
+			if(ftruncate(fd, MEMORY_PAGE_SIZE) != 0) { close(fd); fd = -1; return; }
+			uint8_t* ptr = (uint8_t*)mmap(NULL, MEMORY_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(ptr == MAP_FAILED) { close(fd); fd = -1; return; }
+			memset(ptr, MEMORY_FILL, MEMORY_PAGE_SIZE);
+			munmap(ptr, MEMORY_PAGE_SIZE);
+		});
+		return fd;
+	}
+
+	static uint8_t* reserve(Mode mode){
+		if(sizeof(void*) < 8) return NULL;
+		if(mode == PAGES_SMALL && templateFd() < 0) return NULL;
+		int prot = mode == PAGES_HUGE ? PROT_READ | PROT_WRITE : PROT_NONE;
+		void* ptr = mmap(NULL, MEMORY_SPACE_SIZE, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(ptr == MAP_FAILED) return NULL;
+		#ifdef MADV_HUGEPAGE
+		if(mode == PAGES_HUGE) madvise(ptr, MEMORY_SPACE_SIZE, MADV_HUGEPAGE);
+		#endif
+		return (uint8_t*)ptr;
+	}
+
+	uint8_t* allocate(uint32_t pageId){
+		uint8_t* ptr = NULL;
+		if(base){
+			ptr = base + (((uint64_t)pageId) << MEMORY_PAGE_BITS);
+			if(mode == PAGES_SMALL){
+				if(mmap(ptr, MEMORY_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, templateFd(), 0) == MAP_FAILED){
+					perror("Memory page mapping failed");
+					abort();
+				}
+			} else {
+				memset(ptr, MEMORY_FILL, MEMORY_PAGE_SIZE);
+			}
+		} else {
+			ptr = new uint8_t[MEMORY_PAGE_SIZE];
+			memset(ptr, MEMORY_FILL, MEMORY_PAGE_SIZE);
+		}
+		mem[pageId] = ptr;
+		return ptr;
+	}
+
+	void release(uint32_t pageId){
+		if(base == NULL) { delete [] mem[pageId]; return; }
+		// Back to the state of the reservation, which also drops the image file pages mapped by sim_image.h
+		uint8_t* ptr = mem[pageId];
+		int prot = mode == PAGES_HUGE ? PROT_READ | PROT_WRITE : PROT_NONE;
+		if(mmap(ptr, MEMORY_PAGE_SIZE, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED){
+			perror("Memory page release failed");
+			abort();
+		}
+		#ifdef MADV_HUGEPAGE
+		if(mode == PAGES_HUGE) madvise(ptr, MEMORY_PAGE_SIZE, MADV_HUGEPAGE);
+		#endif
+	}
+};
+
+// Apply +mem_pages=small|huge (plusarg value) or VEX_MEM_PAGES
+static inline void memoryConfigure(const char* plusargValue){
+	Memory::setDefaultMode(getenv("VEX_MEM_PAGES"));
+	if(plusargValue && *plusargValue) Memory::setDefaultMode(plusargValue);
+}
+
+// Peak resident set of the process in KiB
+static inline long memoryPeakRssKb(){
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+	return usage.ru_maxrss;
+}
+
+static inline double memoryElapsedMs(struct timespec from){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - from.tv_sec)*1e3 + (now.tv_nsec - from.tv_nsec)*1e-6;
+}
+
+static inline void memoryReport(FILE* f, double startupMs){
+	fprintf(f, "MEMORY pages=%s startup=%.3f ms peak_rss=%ld KiB\n", Memory::modeName(Memory::defaultMode()), startupMs, memoryPeakRssKb());
+}
+
+#endif
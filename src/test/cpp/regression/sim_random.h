@@ -0,0 +1,100 @@
+#ifndef SIM_RANDOM_H
+#define SIM_RANDOM_H
+
+// Random source of the regression harness (main.cpp) : bus stalls, garbage response data, cache invalidations, FPU
+// halts, ...
+//
+// Each Workspace owns a SimRandom seeded from its test (Workspace::seedFor) and makes it current on its thread, so a
+// test draws the same sequence whatever runs next to it and however many threads run the regression. The bits come
+// from xoshiro256** by batches of SIM_RANDOM_BATCH words, and a draw of w bits takes the next w bits of the current
+// word : the 1 and 7 bit draws of the bus models mostly cost a shift and a mask. A draw which doesn't fit in what is
+// left of the word starts the next one.
+//
+// position() counts the bits consumed since seed(). Along with the seed it identifies the state of the generator,
+// the replay log stamps its events with it and seek() comes back to it (see replay.h).
+
+#include <stdint.h>
+
+#ifndef SIM_RANDOM_BATCH
+#define SIM_RANDOM_BATCH 16
+#endif
+
+class SimRandom{
+public:
+	void seed(uint64_t value){
+		seedValue = value;
+		uint64_t z = value;
+		for(uint64_t &word : s) word = splitmix64(z);
+		index = SIM_RANDOM_BATCH;
+		words = 0;
+		bits = 0;
+		bitCount = 0;
+	}
+
+	uint64_t seedOf() const { return seedValue; }
+
+	// width random bits, 1 <= width <= 32
+	inline uint32_t next(uint32_t width){
+		if(bitCount < width){
+			bits = word();
+			bitCount = 64;
+		}
+		uint32_t value = bits & ((1ull << width) - 1);
+		bits >>= width;
+		bitCount -= width;
+		return value;
+	}
+
+	inline uint32_t next32(){ return next(32); }
+
+	inline uint64_t position() const { return words*64 - bitCount; }
+
+	// Back to position, counted from the current seed
+	void seek(uint64_t position){
+		seed(seedValue);
+		uint64_t count = (position + 63)/64, last = 0;
+		for(uint64_t n = 0;n < count;n++) last = word();
+		bitCount = count*64 - position;
+		bits = bitCount ? last >> (64 - bitCount) : 0;
+	}
+
+private:
+	uint64_t seedValue = 0;
+	uint64_t s[4];
+	uint64_t batch[SIM_RANDOM_BATCH];
+	uint32_t index = SIM_RANDOM_BATCH;
+	uint32_t bitCount = 0;
+	uint64_t words = 0; // taken from the batches since seed()
+	uint64_t bits = 0;
+
+	static inline uint64_t rotl(uint64_t x, int k){ return (x << k) | (x >> (64 - k)); }
+
+	static uint64_t splitmix64(uint64_t &z){
+		uint64_t r = (z += 0x9E3779B97F4A7C15ull);
+		r = (r ^ (r >> 30)) * 0xBF58476D1CE4E5B9ull;
+		r = (r ^ (r >> 27)) * 0x94D049BB133111EBull;
+		return r ^ (r >> 31);
+	}
+
+	inline uint64_t word(){
+		if(index == SIM_RANDOM_BATCH) refill();
+		words++;
+		return batch[index++];
+	}
+
+	__attribute__((noinline)) void refill(){
+		for(uint32_t n = 0;n < SIM_RANDOM_BATCH;n++){
+			batch[n] = rotl(s[1] * 5, 7) * 9;
+			uint64_t t = s[1] << 17;
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = rotl(s[3], 45);
+		}
+		index = 0;
+	}
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SMP_LOG_H
+#define SMP_LOG_H
+
+// Bus debug log of the SMP harness (main_smp.cpp), into its logTrace, by verbosity level :
+//   +smp_log=0  nothing, the default
+//   +smp_log=1  the first 200 DRAM commands, write data and read data of each bridge and peripheral requests
+//   +smp_log=2  also the first 50 requests seen at each clock phase
+//   +smp_log=3  all of them, without the caps
+// The levels above SMP_LOG_LEVEL (build time, 2 by default) are compiled out, so with SMP_LOG_LEVEL=0 the calls
+// leave nothing in the per cycle loop. Otherwise an event whose level is off costs one predictable branch, the
+// arguments of the call are only read when it is logged.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef SMP_LOG_LEVEL
+#define SMP_LOG_LEVEL 2
+#endif
+
+static int smpLogLevel = 0;
+
+// +smp_log=<level> (plusarg value), false if it can't be parsed
+static inline bool smpLogConfigure(const char* value){
+	if(value == NULL || *value == 0) return true;
+	char* end;
+	long level = strtol(value, &end, 0);
+	if(*end != 0 || level < 0) return false;
+	if(level > SMP_LOG_LEVEL) fprintf(stderr, "+smp_log=%ld : built with SMP_LOG_LEVEL=%d\n", level, SMP_LOG_LEVEL);
+	smpLogLevel = level > SMP_LOG_LEVEL ? SMP_LOG_LEVEL : level;
+	return true;
+}
+
+template <int MaxLevel = SMP_LOG_LEVEL>
+class SmpLog{
+public:
+	// Takes the +smp_log level of the moment
+	SmpLog(FILE* out, uint32_t dramBase, uint32_t dramWordBytes) : out(out), dramBase(dramBase), dramWordBytes(dramWordBytes), level(smpLogLevel) {}
+
+	// Whether the count-th event of a kind is logged at level, cap events per kind below level 3
+	template <int eventLevel>
+	inline bool on(uint64_t count, uint64_t cap) const {
+		return eventLevel <= MaxLevel && eventLevel <= level && (count < cap || (3 <= MaxLevel && level >= 3));
+	}
+
+	// The requests on the data bridge and the peripheral bus at one clock phase of cycle
+	template <typename Top>
+	inline void phase(const Top* top, const char* phase, uint64_t cycle){
+		if(!(2 <= MaxLevel && 2 <= level)) return;
+		if(top->dBridge_dram_cmd_valid){
+			if(on<2>(dCmdSeen, 50)){
+				uint32_t addr = dramBase + static_cast<uint32_t>(top->dBridge_dram_cmd_payload_addr) * dramWordBytes;
+				fprintf(out, "time=%llu phase=%s d_cmd_valid=1 ready=%u addr=0x%08x we=%u\n", (unsigned long long)cycle, phase,
+					top->dBridge_dram_cmd_ready ? 1u : 0u, addr, top->dBridge_dram_cmd_payload_we ? 1u : 0u);
+			}
+			dCmdSeen++;
+		}
+		if(top->dBridge_dram_wdata_valid){
+			if(on<2>(dWdataSeen, 50)){
+				fprintf(out, "time=%llu phase=%s d_wdata_valid=1 ready=%u we=0x%04x\n", (unsigned long long)cycle, phase,
+					top->dBridge_dram_wdata_ready ? 1u : 0u, (unsigned int)static_cast<uint16_t>(top->dBridge_dram_wdata_payload_we));
+			}
+			dWdataSeen++;
+		}
+		if(top->peripheral_CYC && top->peripheral_STB){
+			if(on<2>(periphSeen, 50)){
+				fprintf(out, "time=%llu phase=%s periph_req=1 addr=0x%08x we=%u sel=0x%x wdata=0x%08x\n", (unsigned long long)cycle, phase,
+					static_cast<uint32_t>(top->peripheral_ADR) << 2, top->peripheral_WE ? 1u : 0u,
+					static_cast<uint32_t>(top->peripheral_SEL) & 0xF, static_cast<uint32_t>(top->peripheral_DAT_MOSI));
+			}
+			periphSeen++;
+		}
+	}
+
+	// count : events of that kind before this one, the harness keeps them for its summary
+	inline void cmd(const char* bridge, uint64_t cycle, uint32_t addr, bool we, uint64_t count){
+		if(on<1>(count, 200)) fprintf(out, "time=%llu %s_cmd addr=0x%08x we=%u\n", (unsigned long long)cycle, bridge, addr, we ? 1u : 0u);
+	}
+
+	inline void wdata(const char* bridge, uint64_t cycle, uint16_t we, uint64_t count){
+		if(on<1>(count, 200)) fprintf(out, "time=%llu %s_wdata we=0x%04x\n", (unsigned long long)cycle, bridge, (unsigned int)we);
+	}
+
+	inline void iRdata(uint64_t cycle, bool ready, uint32_t data0, uint32_t data1, uint64_t count){
+		if(on<1>(count, 200)) fprintf(out, "time=%llu i_rdata valid=1 ready=%u data0=0x%08x data1=0x%08x\n", (unsigned long long)cycle, ready ? 1u : 0u, data0, data1);
+	}
+
+	inline void dRdata(uint64_t cycle, bool ready, uint64_t count){
+		if(on<1>(count, 200)) fprintf(out, "time=%llu d_rdata valid=1 ready=%u\n", (unsigned long long)cycle, ready ? 1u : 0u);
+	}
+
+	inline void periph(uint64_t cycle, uint32_t addr, bool we, uint32_t sel, uint32_t wdata, uint64_t count){
+		if(on<1>(count, 200)) fprintf(out, "time=%llu periph addr=0x%08x we=%u sel=0x%x wdata=0x%08x\n", (unsigned long long)cycle, addr, we ? 1u : 0u, sel, wdata);
+	}
+
+private:
+	FILE* out;
+	uint32_t dramBase, dramWordBytes;
+	const int level;
+	uint64_t dCmdSeen = 0, dWdataSeen = 0, periphSeen = 0;
+};
+
+#endif
@@ -0,0 +1,927 @@
+// Host side microbenchmarks of the simulation harness building blocks (no Verilator model needed).
+//
+// Usage : simbench <bench> [options]
+//   memory [beats]   host cycles per simulated bus beat, byte-wise Memory accesses vs span/word accesses
+//   image <file.elf|file.bin> [rounds]
+//                    time to get a program into the DUT + golden memories, parsing it vs mapping its image pack
+//   ihex [file.hex | MiB]
+//                    Intel HEX decoding throughput (MB/s of text), legacy per nibble decoder vs scalar/SSE2/AVX2
+//   forkserver [execs] [-- <command>]
+//                    execs/s of a command started once per input vs driven through its fork server, like afl-fuzz.
+//                    Without a command, runs the synthetic "forktarget" below instead of a simulator.
+//   forktarget [init_ms] [run_ms]
+//                    fork server target which burns init_ms before the server starts and run_ms per input
+//   trace [records] [work_ns]
+//                    regTrace/memTrace writing cost (ns per record) and size, legacy ofstream text vs TraceWriter
+//                    text/bin/binz, on a synthetic instruction stream. Then the cost left on the simulation thread,
+//                    with work_ns of simulation per instruction, writing inline vs through a TraceSink
+//   tracefilter [instructions]
+//                    per instruction cost of the runtime trace filter (tick, commit, accept), without +trace_*
+//                    plusargs vs with PC ranges, cycle windows and triggers
+//   smplog [cycles]  per cycle cost of the bus debug logging of main_smp.cpp on a synthetic bus activity (20M cycles
+//                    by default) : the former always-on capped logging vs smp_log.h at +smp_log=0, compiled out
+//                    (SMP_LOG_LEVEL=0) and at +smp_log=1
+//   elements [cycles]
+//                    per cycle cost of the bus and debug model calls of main.cpp (200M cycles by default), virtual
+//                    calls over a vector<SimElement*> vs the SimElements composition of sim_elements.h
+//   random [cycles]  per cycle cost of the random draws of the main.cpp bus models (100M cycles by default), the
+//                    former splitmix64 draw of 32 bits masked to the width vs the batched bits of sim_random.h
+//   profile [cycles] per cycle cost of the +profile sections of main.cpp (50M cycles by default) : two evals, the
+//                    models of the elements bench, a golden step and a trace record per cycle, without sections vs
+//                    +profile=off vs +profile, whose breakdown is printed
+
+#include "../sim_memory.h"
+#include "../image_pack.h"
+#include "../elf_loader.h"
+#include "../ihex.h"
+#include "../fork_server.h"
+#include "../trace_format.h"
+#include "../trace_sink.h"
+#include "../trace_filter.h"
+#include "../smp_log.h"
+#include "../sim_elements.h"
+#include "../sim_random.h"
+#include "../profile.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <sys/stat.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+static inline uint64_t ticks(){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000ull + t.tv_nsec;
+#endif
+}
+
+static const char* tickUnit(){
+#if defined(__x86_64__) || defined(__i386__)
+	return "cycles";
+#else
+	return "ns";
+#endif
+}
+
+static volatile uint64_t sink;
+
+// Run body over every address and return the best ticks per call out of a few rounds
+static double measure(const vector<uint32_t> &addresses, const function<void(uint32_t)> &body){
+	double best = 1e99;
+	for(int round = 0;round < 3;round++){
+		uint64_t start = ticks();
+		for(uint32_t address : addresses) body(address);
+		best = min(best, double(ticks() - start) / addresses.size());
+	}
+	return best;
+}
+
+static void report(const char* name, double legacy, double span){
+	printf("%-28s byte-wise %7.2f  span %7.2f  saved %7.2f %s/beat (x%.1f)\n", name, legacy, span, legacy - span, tickUnit(), legacy / span);
+}
+
+static int benchMemory(int argc, char** argv){
+	uint32_t beats = argc > 0 ? strtoul(argv[0], NULL, 0) : 4000000;
+	Memory mem;
+	vector<uint32_t> addresses(beats);
+	srand48(42);
+	for(uint32_t i = 0;i < beats;i++) addresses[i] = 0x80000000u + ((lrand48() % (8 << 20)) & ~15u);
+	for(uint32_t address = 0x80000000u;address < 0x80000000u + (8 << 20);address += 4) mem.write32(address, address);
+
+	printf("Memory %s pages, %u beats over 8 MiB\n", Memory::modeName(mem.mode), beats);
+
+	report("iBus 32 bits read",
+		measure(addresses, [&](uint32_t a){ sink += (mem[a + 0] << 0) | (mem[a + 1] << 8) | (mem[a + 2] << 16) | (mem[a + 3] << 24); }),
+		measure(addresses, [&](uint32_t a){ sink += mem.read32(a); }));
+	report("dBus 64 bits read beat",
+		measure(addresses, [&](uint32_t a){ uint8_t b[8]; for(int i = 0;i < 8;i++) b[i] = mem[a + i]; uint64_t v; memcpy(&v, b, 8); sink += v; }),
+		measure(addresses, [&](uint32_t a){ sink += mem.read64(a); }));
+	report("dBus 64 bits write beat",
+		measure(addresses, [&](uint32_t a){ uint64_t v = a; for(int i = 0;i < 8;i++) *mem.get(a + i) = ((uint8_t*)&v)[i]; }),
+		measure(addresses, [&](uint32_t a){ mem.write64(a, a); }));
+	report("DRAM 128 bits read beat",
+		measure(addresses, [&](uint32_t a){ uint8_t b[16]; for(int i = 0;i < 16;i++) b[i] = mem[a + i]; sink += b[3] + b[15]; }),
+		measure(addresses, [&](uint32_t a){ uint32_t w[4]; mem.read128(a, w); sink += w[0] + w[3]; }));
+	report("DRAM 128 bits masked write",
+		measure(addresses, [&](uint32_t a){ uint8_t b[16]; memset(b, a, 16); for(int i = 0;i < 16;i++) if((0xF0F0 >> i) & 1) mem[a + i] = b[i]; }),
+		measure(addresses, [&](uint32_t a){ uint8_t b[16]; memset(b, a, 16); mem.writeMasked(a, b, 0xF0F0, 16); }));
+	report("dBus 64 bytes line read",
+		measure(addresses, [&](uint32_t a){ uint8_t b[64]; a &= ~63u; for(int i = 0;i < 64;i++) b[i] = mem[a + i]; sink += b[7]; }),
+		measure(addresses, [&](uint32_t a){ uint8_t b[64]; mem.read(a & ~63u, 64, b); sink += b[7]; }));
+	return 0;
+}
+
+static void loadImageFile(const string &path, ImageBuilder *image){
+	if(ElfFile::isElf(path)){
+		ElfFile elf(path);
+		elf.load(image);
+		image->setEntry(elf.entry);
+		return;
+	}
+	FILE* f = fopen(path.c_str(), "rb");
+	vector<uint8_t> content;
+	uint8_t buffer[65536];
+	size_t count;
+	while(f && (count = fread(buffer, 1, sizeof(buffer), f)) > 0) content.insert(content.end(), buffer, buffer + count);
+	if(f) fclose(f);
+	image->write(0x80000000, content.size(), content.data());
+}
+
+static int benchImage(int argc, char** argv){
+	if(argc < 1) { fprintf(stderr, "Usage : simbench image <file.elf|file.bin> [rounds]\n"); return 1; }
+	string path = argv[0];
+	int rounds = argc > 1 ? atoi(argv[1]) : 20;
+	char dir[] = "/tmp/simbench_pack_XXXXXX";
+	if(!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+	setenv("VEX_IMAGE_PACK_DIR", dir, 1);
+
+	Image* parsed = imageParse(path, loadImageFile);
+	if(!ImagePack::write("bench", path, *parsed)) return 1;
+	printf("%s : %llu bytes, %u pages of %u KiB\n", path.c_str(), (unsigned long long)parsed->byteCount(), (uint32_t)parsed->pages.size(), MEMORY_PAGE_SIZE / 1024);
+	delete parsed;
+
+	// Each round is what a fresh process does before its first cycle : get the image, then load the DUT and golden memories
+	auto run = [&](const char* name, const function<Image*()> &factory){
+		double best = 1e99;
+		for(int round = 0;round < rounds;round++){
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			Image* image = factory();
+			Memory dut, golden;
+			image->mapInto(&dut);
+			image->mapInto(&golden);
+			best = min(best, memoryElapsedMs(start));
+			delete image;
+		}
+		printf("%-8s %9.3f ms\n", name, best);
+		return best;
+	};
+	double parse = run("parse", [&](){ return imageParse(path, loadImageFile); });
+	double pack = run("pack", [&](){ return ImagePack::open("bench", path); });
+	printf("pack speedup x%.1f\n", parse / pack);
+
+	unlink(ImagePack::packPath("bench", path).c_str());
+	rmdir(dir);
+	return 0;
+}
+
+// Decoder used before ihex.h : per nibble conversion, one Memory::get per byte, no checksum
+static uint32_t legacyHti(char c) {
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return c - '0';
+}
+
+static uint32_t legacyHToI(const char *c, uint32_t size) {
+	uint32_t value = 0;
+	for (uint32_t i = 0; i < size; i++) value += legacyHti(c[i]) << ((size - i - 1) * 4);
+	return value;
+}
+
+static void legacyLoadHex(const string &text, Memory *mem){
+	uint32_t offset = 0;
+	const char* line = text.c_str();
+	const char* end = line + text.size();
+	while(line < end){
+		if(line[0] == ':'){
+			uint32_t byteCount = legacyHToI(line + 1, 2);
+			uint32_t nextAddr = legacyHToI(line + 3, 4) + offset;
+			uint32_t key = legacyHToI(line + 7, 2);
+			if(key == 0) for(uint32_t i = 0;i < byteCount;i++) *mem->get(nextAddr + i) = legacyHToI(line + 9 + i*2, 2);
+			if(key == 4) offset = legacyHToI(line + 9, 4) << 16;
+		}
+		const char* eol = (const char*)memchr(line, '\n', end - line);
+		line = eol ? eol + 1 : end;
+	}
+}
+
+// Same layout as objcopy -O ihex : 16 data bytes per record, extended linear address every 64 KiB
+static string generateHex(uint32_t bytes){
+	string text;
+	char buffer[64];
+	srand48(7);
+	for(uint32_t address = 0x80000000u;address < 0x80000000u + bytes;address += 16){
+		if((address & 0xFFFF) == 0){
+			uint8_t sum = 2 + 4 + (address >> 24) + (address >> 16);
+			snprintf(buffer, sizeof(buffer), ":02000004%04X%02X\n", address >> 16, (uint8_t)-sum);
+			text += buffer;
+		}
+		uint8_t sum = 16 + (address >> 8) + address;
+		text += ":10";
+		snprintf(buffer, sizeof(buffer), "%04X00", address & 0xFFFF);
+		text += buffer;
+		for(int i = 0;i < 16;i++){
+			uint8_t v = lrand48();
+			sum += v;
+			snprintf(buffer, sizeof(buffer), "%02X", v);
+			text += buffer;
+		}
+		snprintf(buffer, sizeof(buffer), "%02X\n", (uint8_t)-sum);
+		text += buffer;
+	}
+	text += ":00000001FF\n";
+	return text;
+}
+
+static int benchIhex(int argc, char** argv){
+	string text;
+	if(argc > 0 && !isdigit(argv[0][0])){
+		FILE* f = fopen(argv[0], "rb");
+		if(!f) { perror(argv[0]); return 1; }
+		char buffer[65536];
+		size_t count;
+		while((count = fread(buffer, 1, sizeof(buffer), f)) > 0) text.append(buffer, count);
+		fclose(f);
+	} else {
+		text = generateHex((argc > 0 ? atoi(argv[0]) : 16) << 20);
+	}
+	printf("%.1f MB of hex text, best %s\n", text.size() / 1e6, ihexImplName(ihexBestImpl()));
+
+	auto run = [&](const char* name, const function<void(Memory*)> &body){
+		double best = 1e99;
+		for(int round = 0;round < 3;round++){
+			Memory mem;
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			body(&mem);
+			best = min(best, memoryElapsedMs(start));
+		}
+		printf("%-8s %8.1f MB/s\n", name, text.size() / 1e3 / best);
+	};
+	run("legacy", [&](Memory* mem){ legacyLoadHex(text, mem); });
+	vector<IhexImpl> impls = {IHEX_SCALAR};
+#if defined(__x86_64__) || defined(__i386__)
+	impls.push_back(IHEX_SSE2);
+	if(ihexBestImpl() == IHEX_AVX2) impls.push_back(IHEX_AVX2);
+#endif
+	for(IhexImpl impl : impls){
+		run(ihexImplName(impl), [&](Memory* mem){
+			IhexResult result = ihexDecode(text.data(), text.size(), mem, impl);
+			if(!result.ok) { printf("line %u : %s\n", result.line, result.error.c_str()); exit(1); }
+		});
+	}
+	return 0;
+}
+
+static void burnMs(double ms){
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while(memoryElapsedMs(start) < ms) sink++;
+}
+
+static int benchForkTarget(int argc, char** argv){
+	burnMs(argc > 0 ? atof(argv[0]) : 20.0);
+	forkServerStart();
+	burnMs(argc > 1 ? atof(argv[1]) : 1.0);
+	return 0;
+}
+
+// Child side of a launch : quiet stdout / stderr and exec command
+static void execQuiet(const vector<char*> &command){
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, 1);
+	dup2(null, 2);
+	execvp(command[0], command.data());
+	_exit(127);
+}
+
+static int benchForkServer(int argc, char** argv){
+	int execs = 200;
+	vector<char*> command;
+	string self, init = "20", run = "1";
+	int i = 0;
+	if(i < argc && strcmp(argv[i], "--")) execs = atoi(argv[i++]);
+	if(i < argc && !strcmp(argv[i], "--")) i++;
+	for(;i < argc;i++) command.push_back(argv[i]);
+	if(command.empty()){
+		char path[4096];
+		ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+		if(length <= 0) { perror("readlink"); return 1; }
+		self.assign(path, length);
+		command = {&self[0], (char*)"forktarget", &init[0], &run[0]};
+		printf("Synthetic target : %s ms of init, %s ms per input\n", init.c_str(), run.c_str());
+	}
+	command.push_back(NULL);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int e = 0;e < execs;e++){
+		pid_t pid = fork();
+		if(pid == 0) execQuiet(command);
+		int status;
+		waitpid(pid, &status, 0);
+	}
+	double perProcess = execs / (memoryElapsedMs(start) * 1e-3);
+
+	// Same handshake as afl-fuzz : control pipe on 198, status pipe on 199
+	int control[2], status[2];
+	if(pipe(control) || pipe(status)) { perror("pipe"); return 1; }
+	signal(SIGPIPE, SIG_IGN);
+	pid_t server = fork();
+	if(server == 0){
+		dup2(control[0], FORK_SERVER_FD);
+		dup2(status[1], FORK_SERVER_FD + 1);
+		close(control[0]); close(control[1]); close(status[0]); close(status[1]);
+		execQuiet(command);
+	}
+	close(control[0]);
+	close(status[1]);
+	uint32_t hello;
+	if(read(status[0], &hello, 4) != 4){
+		fprintf(stderr, "%s didn't start a fork server\n", command[0]);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int crashes = 0;
+	for(int e = 0;e < execs;e++){
+		uint32_t killed = 0;
+		int32_t pid, result;
+		if(write(control[1], &killed, 4) != 4 || read(status[0], &pid, 4) != 4 || read(status[0], &result, 4) != 4){
+			fprintf(stderr, "fork server died\n");
+			return 1;
+		}
+		if(WIFSIGNALED(result)) crashes++;
+	}
+	double forkServer = execs / (memoryElapsedMs(start) * 1e-3);
+	close(control[1]);
+	close(status[0]);
+	int serverStatus;
+	waitpid(server, &serverStatus, 0);
+
+	printf("%d execs\n", execs);
+	printf("per process  %9.1f execs/s\n", perProcess);
+	printf("fork server  %9.1f execs/s (x%.1f)%s\n", forkServer, forkServer / perProcess, crashes ? " some inputs crashed" : "");
+	return 0;
+}
+
+// Mostly sequential PCs with a few branches, one register write per cycle or two and a store every ~8 instructions
+struct TraceStimulus{
+	uint64_t time;
+	uint32_t pc, rd, value;
+	bool store;
+	uint32_t address, size;
+};
+
+static vector<TraceStimulus> traceStimuli(uint32_t count){
+	vector<TraceStimulus> stimuli(count);
+	uint64_t state = 0x1234;
+	auto random = [&](){ state = state*6364136223846793005ull + 1442695040888963407ull; return (uint32_t)(state >> 33); };
+	uint64_t time = 100;
+	uint32_t pc = 0x80000000;
+	for(TraceStimulus &s : stimuli){
+		time += 10 + 10*(random() % 3);
+		pc = random() % 16 == 0 ? 0x80000000 + (random() & 0xFFFC) : pc + 4;
+		s = {time, pc, 1 + random() % 31, random() % 4 == 0 ? random() : random() & 0xFF, random() % 8 == 0, 0x80010000 + (random() & 0xFFFC), 1u << (random() % 3)};
+	}
+	return stimuli;
+}
+
+static uint64_t fileSize(const string &path){
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+static int benchTrace(int argc, char** argv){
+	uint32_t count = argc > 0 ? strtoul(argv[0], NULL, 0) : 4000000;
+	double workNs = argc > 1 ? atof(argv[1]) : 1000;
+	vector<TraceStimulus> stimuli = traceStimuli(count);
+	string dir = "/tmp/simbench_trace_" + to_string(getpid());
+	string reg = dir + ".regTrace", mem = dir + ".memTrace";
+
+	auto run = [&](const char* name, const function<void()> &body, const vector<string> &files){
+		double best = 1e99;
+		for(int round = 0;round < 3;round++){
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			body();
+			best = min(best, memoryElapsedMs(start));
+		}
+		uint64_t bytes = 0;
+		for(const string &file : files) { bytes += fileSize(file); unlink(file.c_str()); }
+		printf("%-8s %7.1f ns/record %8.1f MB %6.2f bytes/record\n", name, best*1e6 / count, bytes / 1e6, (double)bytes / count);
+	};
+
+	printf("%u instructions\n", count);
+	// What main.cpp did before TraceWriter, TRACE_WITH_TIME
+	run("ofstream", [&](){
+		ofstream regTraces(reg), memTraces(mem);
+		for(const TraceStimulus &s : stimuli){
+			regTraces << s.time << " PC " << hex << setw(8) << s.pc << " : reg[" << dec << setw(2) << s.rd << "] = " << hex << setw(8) << s.value << dec << endl;
+			if(s.store){
+				memTraces << s.time << " PC " << hex << setw(8) << setfill('0') << s.pc << " : MEM[0x" << setw(8) << s.address << "] <= " << dec << s.size << " bytes : 0x";
+				memTraces << hex << setw(s.size*2) << (s.value & ((1ull << s.size*8) - 1)) << dec << setfill(' ') << endl;
+			}
+		}
+	}, {reg, mem});
+	for(TraceWriter::Format format : {TraceWriter::TEXT, TraceWriter::BINARY, TraceWriter::BINARY_COMPRESSED}){
+		const char* names[] = {"text", "bin", "binz"};
+		string suffix = format == TraceWriter::TEXT ? "" : ".bin";
+		run(names[format], [&](){
+			TraceWriter regTraces, memTraces;
+			regTraces.open(reg, TRACE_FLAG_TIME | TRACE_FLAG_SPACES, format);
+			memTraces.open(mem, TRACE_FLAG_TIME, format);
+			for(const TraceStimulus &s : stimuli){
+				regTraces.reg(s.time, s.pc, s.rd, s.value);
+				if(s.store) memTraces.mem(s.time, s.pc, s.address, s.size, s.value & ((1ull << s.size*8) - 1));
+			}
+		}, {reg + suffix, mem + suffix});
+	}
+
+	// What the simulation thread pays per instruction (its CPU time), with work_ns of simulation between two
+	// instructions : the writers inline vs through a TraceSink, then what the final flush waits for
+	// CPU time of this thread, which the writer thread of a sink doesn't count in even when it shares the CPU
+	auto threadMs = [](){
+		struct timespec t;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+		return t.tv_sec*1e3 + t.tv_nsec/1e6;
+	};
+	// Fixed amount of computation standing for the simulation of one instruction, calibrated to about work_ns
+	uint64_t workLoops = 1;
+	auto work = [&](uint32_t i){
+		uint64_t x = i;
+		for(uint64_t l = 0;l < workLoops;l++) x = x*6364136223846793005ull + 1442695040888963407ull;
+		sink += x;
+	};
+	double calibration = threadMs();
+	workLoops = 1000000;
+	work(0);
+	workLoops = max(1.0, workNs * 1e6 / ((threadMs() - calibration)*1e6));
+	double baseline = 1e99;
+	for(int round = 0;round < 3;round++){
+		double start = threadMs();
+		for(uint32_t i = 0;i < count;i++) work(i);
+		baseline = min(baseline, threadMs() - start);
+	}
+	printf("%.0f ns of simulation per instruction\n", baseline*1e6 / count);
+	for(TraceWriter::Format format : {TraceWriter::TEXT, TraceWriter::BINARY_COMPRESSED}){
+		for(bool async : {false, true}){
+			double bestRun = 1e99, bestFlush = 1e99;
+			TraceSinkStats stats;
+			for(int round = 0;round < 3;round++){
+				TraceSink traceSink;
+				TraceWriter regTraces, memTraces;
+				if(async){
+					traceSink.attach(regTraces);
+					traceSink.attach(memTraces);
+				}
+				regTraces.open(reg, TRACE_FLAG_TIME | TRACE_FLAG_SPACES, format);
+				memTraces.open(mem, TRACE_FLAG_TIME, format);
+				double start = threadMs();
+				for(uint32_t i = 0;i < count;i++){
+					const TraceStimulus &s = stimuli[i];
+					work(i);
+					regTraces.reg(s.time, s.pc, s.rd, s.value);
+					if(s.store) memTraces.mem(s.time, s.pc, s.address, s.size, s.value & ((1ull << s.size*8) - 1));
+				}
+				bestRun = min(bestRun, threadMs() - start);
+				struct timespec ran;
+				clock_gettime(CLOCK_MONOTONIC, &ran);
+				regTraces.close();
+				memTraces.close();
+				bestFlush = min(bestFlush, memoryElapsedMs(ran));
+				stats = traceSink.stats();
+			}
+			string suffix = format == TraceWriter::TEXT ? "" : ".bin";
+			unlink((reg + suffix).c_str());
+			unlink((mem + suffix).c_str());
+			printf("%-4s %-6s %7.1f ns/instruction overhead, final flush %6.2f ms, %llu stalls, ring high water %llu/%u\n",
+				format == TraceWriter::TEXT ? "text" : "binz", async ? "sink" : "inline", max(0.0, bestRun - baseline)*1e6 / count, bestFlush,
+				(unsigned long long)stats.stalls, (unsigned long long)stats.highWater, TRACE_SINK_DEPTH);
+		}
+	}
+	return 0;
+}
+
+static int benchTraceFilter(int argc, char** argv){
+	uint32_t count = argc > 0 ? strtoul(argv[0], NULL, 0) : 20000000;
+	vector<TraceStimulus> stimuli = traceStimuli(1 << 16); // cache resident, replayed
+	auto run = [&](const char* name){
+		TraceFilter filter;
+		uint64_t best = UINT64_MAX, accepted = 0;
+		for(int round = 0;round < 3;round++){
+			filter.reset();
+			accepted = 0;
+			uint64_t start = ticks();
+			for(uint32_t i = 0;i < count;i++){
+				const TraceStimulus &s = stimuli[i & 0xFFFF];
+				filter.tick(i);
+				filter.onCommit(s.pc, i);
+				if(s.store) filter.onStore(s.address, s.size, i);
+				accepted += filter.accept(s.pc, 3);
+			}
+			best = min(best, ticks() - start);
+		}
+		sink += accepted;
+		printf("%-10s %6.2f %s/instruction, %5.1f%% recorded\n", name, (double)best / count, tickUnit(), 100.0*accepted / count);
+	};
+	run("none");
+	traceFilterConfigure("pc", "0x80000000-0x80004000,0x80008000+0x1000");
+	traceFilterConfigure("cycles", "1000-");
+	traceFilterConfigure("priv", "m");
+	traceFilterConfigure("start", "store:0x80010000+0x100");
+	run("filtered");
+	return 0;
+}
+
+// The bus signals of the SMP cluster the logging looks at, per cycle
+struct SmpBusStimulus{
+	uint8_t dBridge_dram_cmd_valid, dBridge_dram_cmd_ready, dBridge_dram_cmd_payload_we;
+	uint8_t dBridge_dram_wdata_valid, dBridge_dram_wdata_ready;
+	uint8_t iBridge_dram_cmd_valid, iBridge_dram_cmd_ready, iBridge_dram_cmd_payload_we;
+	uint8_t iBridge_dram_wdata_valid, iBridge_dram_wdata_ready;
+	uint8_t iBridge_dram_rdata_valid, iBridge_dram_rdata_ready, dBridge_dram_rdata_valid, dBridge_dram_rdata_ready;
+	uint8_t peripheral_CYC, peripheral_STB, peripheral_WE, peripheral_SEL;
+	uint16_t dBridge_dram_wdata_payload_we, iBridge_dram_wdata_payload_we;
+	uint32_t dBridge_dram_cmd_payload_addr, iBridge_dram_cmd_payload_addr, peripheral_ADR, peripheral_DAT_MOSI;
+	uint32_t iBridge_dram_rdata_payload_data[4];
+};
+
+// Bus counters kept by the harness for its summary line
+struct SmpBusCounts{
+	uint64_t iCmd = 0, dCmd = 0, periph = 0, iWdata = 0, dWdata = 0, iRdata = 0, dRdata = 0;
+	uint64_t sum() const { return iCmd + dCmd + periph + iWdata + dWdata + iRdata + dRdata; }
+};
+
+// The logging main_smp.cpp did before smp_log.h, checked on every event and at both clock phases
+struct SmpLegacyLog{
+	FILE* out;
+	uint64_t dCmdSeen = 0, dWdataSeen = 0, periphSeen = 0;
+
+	void phase(const SmpBusStimulus* top, const char* phase, uint64_t cyc){
+		if(top->dBridge_dram_cmd_valid){
+			if(dCmdSeen < 50) fprintf(out, "time=%llu phase=%s d_cmd_valid=1 ready=%u addr=0x%08x we=%u\n", (unsigned long long)cyc, phase, top->dBridge_dram_cmd_ready ? 1u : 0u, 0x80000000u + top->dBridge_dram_cmd_payload_addr*16, top->dBridge_dram_cmd_payload_we ? 1u : 0u);
+			dCmdSeen++;
+		}
+		if(top->dBridge_dram_wdata_valid){
+			if(dWdataSeen < 50) fprintf(out, "time=%llu phase=%s d_wdata_valid=1 ready=%u we=0x%04x\n", (unsigned long long)cyc, phase, top->dBridge_dram_wdata_ready ? 1u : 0u, (unsigned)top->dBridge_dram_wdata_payload_we);
+			dWdataSeen++;
+		}
+		if(top->peripheral_CYC && top->peripheral_STB){
+			if(periphSeen < 50) fprintf(out, "time=%llu phase=%s periph_req=1 addr=0x%08x we=%u sel=0x%x wdata=0x%08x\n", (unsigned long long)cyc, phase, top->peripheral_ADR << 2, top->peripheral_WE ? 1u : 0u, top->peripheral_SEL & 0xFu, top->peripheral_DAT_MOSI);
+			periphSeen++;
+		}
+	}
+};
+
+// The bus event part of the main_smp.cpp cycle, with the legacy logging or an SmpLog
+template <typename Phase, typename Event>
+static inline void smpBusCycle(const SmpBusStimulus* top, uint64_t cycle, SmpBusCounts &c, Phase phase, Event event){
+	phase(top, "L", cycle);
+	phase(top, "H", cycle);
+	if(top->iBridge_dram_rdata_valid) event(0, cycle, top->iBridge_dram_rdata_payload_data[0], c.iRdata++);
+	if(top->dBridge_dram_rdata_valid) event(1, cycle, 0, c.dRdata++);
+	if(top->peripheral_CYC && top->peripheral_STB) event(2, cycle, top->peripheral_ADR << 2, c.periph++);
+	if(top->iBridge_dram_cmd_valid && top->iBridge_dram_cmd_ready) event(3, cycle, 0x80000000u + top->iBridge_dram_cmd_payload_addr*16, c.iCmd++);
+	if(top->iBridge_dram_wdata_valid && top->iBridge_dram_wdata_ready) event(4, cycle, top->iBridge_dram_wdata_payload_we, c.iWdata++);
+	if(top->dBridge_dram_cmd_valid && top->dBridge_dram_cmd_ready) event(5, cycle, 0x80000000u + top->dBridge_dram_cmd_payload_addr*16, c.dCmd++);
+	if(top->dBridge_dram_wdata_valid && top->dBridge_dram_wdata_ready) event(6, cycle, top->dBridge_dram_wdata_payload_we, c.dWdata++);
+}
+
+template <int MaxLevel>
+static void smpLogEvent(SmpLog<MaxLevel> &log, const SmpBusStimulus* top, int kind, uint64_t cycle, uint32_t value, uint64_t count){
+	switch(kind){
+	case 0: log.iRdata(cycle, top->iBridge_dram_rdata_ready, value, top->iBridge_dram_rdata_payload_data[1], count); break;
+	case 1: log.dRdata(cycle, top->dBridge_dram_rdata_ready, count); break;
+	case 2: log.periph(cycle, value, top->peripheral_WE, top->peripheral_SEL & 0xF, top->peripheral_DAT_MOSI, count); break;
+	case 3: log.cmd("i", cycle, value, top->iBridge_dram_cmd_payload_we, count); break;
+	case 4: log.wdata("i", cycle, value, count); break;
+	case 5: log.cmd("d", cycle, value, top->dBridge_dram_cmd_payload_we, count); break;
+	case 6: log.wdata("d", cycle, value, count); break;
+	}
+}
+
+static int benchSmpLog(int argc, char** argv){
+	uint64_t cycles = argc > 0 ? strtoull(argv[0], NULL, 0) : 20000000;
+	// Cache resident, replayed : a request on some bus every few cycles, as a booting Linux does
+	vector<SmpBusStimulus> stimuli(1 << 12);
+	srand(3);
+	for(SmpBusStimulus &s : stimuli){
+		memset(&s, 0, sizeof(s));
+		s.iBridge_dram_cmd_valid = rand() % 8 == 0; s.iBridge_dram_cmd_ready = 1; s.iBridge_dram_cmd_payload_addr = rand() & 0xFFFFF;
+		s.dBridge_dram_cmd_valid = rand() % 6 == 0; s.dBridge_dram_cmd_ready = 1; s.dBridge_dram_cmd_payload_addr = rand() & 0xFFFFF;
+		s.dBridge_dram_cmd_payload_we = rand() % 3 == 0;
+		s.dBridge_dram_wdata_valid = s.dBridge_dram_wdata_ready = s.dBridge_dram_cmd_payload_we;
+		s.dBridge_dram_wdata_payload_we = rand();
+		s.iBridge_dram_rdata_valid = s.iBridge_dram_rdata_ready = rand() % 8 == 0;
+		s.dBridge_dram_rdata_valid = s.dBridge_dram_rdata_ready = rand() % 8 == 0;
+		s.iBridge_dram_rdata_payload_data[0] = rand();
+		s.peripheral_CYC = s.peripheral_STB = rand() % 64 == 0;
+		s.peripheral_ADR = rand() & 0x3FFFFFFF;
+		s.peripheral_WE = rand() & 1;
+		s.peripheral_SEL = 0xF;
+	}
+	FILE* out = fopen("/dev/null", "w");
+	if(out == NULL) { perror("/dev/null"); return 1; }
+	double legacy = 0;
+	auto run = [&](const char* name, const function<uint64_t()> &body){
+		uint64_t best = UINT64_MAX, events = 0;
+		for(int round = 0;round < 3;round++){
+			uint64_t start = ticks();
+			events = body();
+			best = min(best, ticks() - start);
+		}
+		sink += events;
+		double perCycle = (double)best / cycles;
+		if(legacy == 0) legacy = perCycle;
+		printf("%-26s %6.2f %s/cycle (%+6.2f), %.1f bus events/cycle\n", name, perCycle, tickUnit(), perCycle - legacy, (double)events / cycles);
+	};
+	run("legacy (always on)", [&](){
+		SmpLegacyLog log = {out};
+		SmpBusCounts c;
+		for(uint64_t cycle = 0;cycle < cycles;cycle++){
+			smpBusCycle(&stimuli[cycle & 0xFFF], cycle, c,
+				[&](const SmpBusStimulus* top, const char* phase, uint64_t cyc){ log.phase(top, phase, cyc); },
+				[&](int kind, uint64_t cyc, uint32_t value, uint64_t count){
+					if(count < 200) fprintf(out, "time=%llu event=%d value=0x%08x\n", (unsigned long long)cyc, kind, value);
+				});
+		}
+		return c.sum();
+	});
+	auto smpLog = [&](auto &log){
+		SmpBusCounts c;
+		for(uint64_t cycle = 0;cycle < cycles;cycle++){
+			const SmpBusStimulus* top = &stimuli[cycle & 0xFFF];
+			smpBusCycle(top, cycle, c,
+				[&](const SmpBusStimulus* top, const char* phase, uint64_t cyc){ log.phase(top, phase, cyc); },
+				[&](int kind, uint64_t cyc, uint32_t value, uint64_t count){ smpLogEvent(log, top, kind, cyc, value, count); });
+		}
+		return c.sum();
+	};
+	smpLogLevel = 0;
+	run("smp_log.h +smp_log=0", [&](){ SmpLog<2> log(out, 0x80000000u, 16); return smpLog(log); });
+	run("smp_log.h SMP_LOG_LEVEL=0", [&](){ SmpLog<0> log(out, 0x80000000u, 16); return smpLog(log); });
+	smpLogLevel = 1;
+	run("smp_log.h +smp_log=1", [&](){ SmpLog<2> log(out, 0x80000000u, 16); return smpLog(log); });
+	smpLogLevel = 0;
+	fclose(out);
+	return 0;
+}
+
+// The model side of main.cpp : SimElement, the signals the bus models drive and their random stalls
+struct ElementTop{
+	uint8_t iCmdValid, iCmdReady, iRspValid, dCmdValid, dCmdReady, dRspValid, debugReset;
+	uint32_t iRspData, dRspData;
+};
+
+static uint64_t elementRandom = 0;
+static inline uint32_t elementRandom7(){
+	uint64_t z = (elementRandom += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	return (z ^ (z >> 27)) & 0x7F;
+}
+
+class BenchElement{
+public:
+	virtual ~BenchElement(){}
+	virtual void onReset(){}
+	virtual void postReset(){}
+	virtual void preCycle(){}
+	virtual void postCycle(){}
+	virtual bool idle(){ return false; }
+	template <typename Checkpoint> void checkpoint(Checkpoint &c){}
+};
+
+// IBusCached : a burst of 8 words per command, randomly stalled
+class BenchIBus : public BenchElement{
+public:
+	ElementTop* top;
+	uint32_t pendingCount = 0, address = 0;
+	BenchIBus(ElementTop* top) : top(top) {}
+	virtual void preCycle(){
+		if(top->iCmdValid && top->iCmdReady && pendingCount == 0) { pendingCount = 8; address += 32; }
+	}
+	virtual void postCycle(){
+		top->iRspValid = 0;
+		if(pendingCount != 0 && elementRandom7() < 100){
+			top->iRspData = address + pendingCount;
+			pendingCount--;
+			top->iRspValid = 1;
+		}
+		top->iCmdReady = elementRandom7() < 100 && pendingCount == 0;
+	}
+};
+
+// DBusCached : a response per command, randomly stalled
+class BenchDBus : public BenchElement{
+public:
+	ElementTop* top;
+	uint32_t pending = 0;
+	BenchDBus(ElementTop* top) : top(top) {}
+	virtual void preCycle(){
+		if(top->dCmdValid && top->dCmdReady) pending++;
+	}
+	virtual void postCycle(){
+		if(pending != 0 && elementRandom7() < 100){
+			pending--;
+			top->dRspValid = 1;
+			top->dRspData = pending;
+		} else {
+			top->dRspValid = 0;
+			top->dRspData = elementRandom7();
+		}
+		top->dCmdReady = elementRandom7() < 100;
+	}
+};
+
+// DebugPluginStd without a debugger connected : polls its socket now and then
+class BenchDebug : public BenchElement{
+public:
+	ElementTop* top;
+	uint32_t timeSpacer = 0, polls = 0;
+	BenchDebug(ElementTop* top) : top(top) {}
+	virtual void postCycle(){
+		top->debugReset = 0;
+		if(timeSpacer == 0){
+			polls++;
+			timeSpacer = 1000;
+		} else {
+			timeSpacer--;
+		}
+	}
+};
+
+static int benchElements(int argc, char** argv){
+	uint64_t cycles = argc > 0 ? strtoull(argv[0], NULL, 0) : 200000000;
+	ElementTop top;
+	memset(&top, 0, sizeof(top));
+	// The requests of the core, replayed
+	vector<uint8_t> requests(1 << 12);
+	srand(3);
+	for(uint8_t &r : requests) r = (rand() % 8 == 0) | (rand() % 4 == 0) << 1;
+	double legacy = 0;
+	auto run = [&](const char* name, const function<void()> &body){
+		uint64_t best = UINT64_MAX;
+		for(int round = 0;round < 3;round++){
+			elementRandom = 0;
+			uint64_t start = ticks();
+			body();
+			best = min(best, ticks() - start);
+		}
+		double perCycle = (double)best / cycles;
+		if(legacy == 0) legacy = perCycle;
+		printf("%-34s %6.2f %s/cycle (%+6.2f)\n", name, perCycle, tickUnit(), perCycle - legacy);
+	};
+	auto loop = [&](auto preCycle, auto postCycle){
+		for(uint64_t cycle = 0;cycle < cycles;cycle++){
+			uint8_t r = requests[cycle & 0xFFF];
+			top.iCmdValid = r & 1;
+			top.dCmdValid = r >> 1 & 1;
+			preCycle();
+			postCycle();
+		}
+		sink += top.iRspData + top.dRspData;
+	};
+	run("vector<SimElement*>, virtual", [&](){
+		vector<BenchElement*> elements = {new BenchIBus(&top), new BenchDBus(&top), new BenchDebug(&top)};
+		loop([&](){ for(BenchElement* e : elements) e->preCycle(); }, [&](){ for(BenchElement* e : elements) e->postCycle(); });
+		for(BenchElement* e : elements) delete e;
+	});
+	run("SimElements<IBus, DBus, Debug>", [&](){
+		SimElements<BenchIBus, BenchDBus, BenchDebug> elements(&top);
+		loop([&](){ elements.preCycle(); }, [&](){ elements.postCycle(); });
+	});
+	run("SimElements + empty slow path", [&](){
+		SimElements<BenchIBus, BenchDBus, BenchDebug> elements(&top);
+		vector<BenchElement*> extra;
+		loop([&](){ elements.preCycle(); for(BenchElement* e : extra) e->preCycle(); },
+			[&](){ elements.postCycle(); for(BenchElement* e : extra) e->postCycle(); });
+	});
+	return 0;
+}
+
+// The generator of main.cpp before sim_random.h : a 32 bits splitmix64 draw masked to the width
+struct LegacyRandom{
+	uint64_t state = 0;
+	inline uint32_t next(uint32_t width){
+		uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return ((z ^ (z >> 31)) >> 32) & ((1ull << width) - 1);
+	}
+};
+
+static int benchRandom(int argc, char** argv){
+	uint64_t cycles = argc > 0 ? strtoull(argv[0], NULL, 0) : 100000000;
+	// The draws of a cycle of IBusCached + DBusCached with stalls and invalidations : response and command stalls,
+	// garbage response data and flags, invalidation injection
+	static const uint32_t widths[] = {7, 7, 7, 32, 32, 1, 1, 7, 7, 7};
+	double legacy = 0;
+	auto run = [&](const char* name, const function<uint64_t()> &body){
+		uint64_t best = UINT64_MAX;
+		for(int round = 0;round < 3;round++){
+			uint64_t start = ticks();
+			sink += body();
+			best = min(best, ticks() - start);
+		}
+		double perCycle = (double)best / cycles;
+		if(legacy == 0) legacy = perCycle;
+		printf("%-28s %6.2f %s/cycle (%+6.2f), %u draws/cycle\n", name, perCycle, tickUnit(), perCycle - legacy, (uint32_t)(sizeof(widths)/sizeof(widths[0])));
+	};
+	auto draws = [&](auto &random){
+		uint64_t sum = 0;
+		for(uint64_t cycle = 0;cycle < cycles;cycle++){
+			for(uint32_t width : widths) sum += random.next(width);
+		}
+		return sum;
+	};
+	run("splitmix64 per draw", [&](){ LegacyRandom random; return draws(random); });
+	run("sim_random.h batched bits", [&](){ SimRandom random; random.seed(1); return draws(random); });
+	return 0;
+}
+
+static int benchProfile(int argc, char** argv){
+	uint64_t cycles = argc > 0 ? strtoull(argv[0], NULL, 0) : 50000000;
+	ElementTop top;
+	memset(&top, 0, sizeof(top));
+	uint64_t model = 1, golden = 1, trace = 0;
+	SimProfile profile;
+	double none = 0;
+	auto run = [&](const char* name, bool enabled, const function<void()> &body){
+		uint64_t best = UINT64_MAX;
+		profileConfig.enabled = enabled;
+		for(int round = 0;round < 3;round++){
+			elementRandom = 0;
+			profile.start(0);
+			uint64_t start = ticks();
+			body();
+			best = min(best, ticks() - start);
+			profile.stop(cycles);
+		}
+		double perCycle = (double)best / cycles;
+		if(none == 0) none = perCycle;
+		printf("%-28s %6.2f %s/cycle (%+6.2f)\n", name, perCycle, tickUnit(), perCycle - none);
+	};
+	// Stand-ins of top->eval(), riscvRef.step() and a trace record
+	auto eval = [&](){ for(int n = 0;n < 8;n++) model = model*6364136223846793005ull + 1442695040888963407ull; top.iCmdValid = model >> 63; top.dCmdValid = model >> 62 & 1; };
+	auto step = [&](){ golden = golden*0x9E3779B97F4A7C15ull + model; };
+	auto record = [&](){ trace += golden >> 60; };
+	run("no sections", false, [&](){
+		SimElements<BenchIBus, BenchDBus, BenchDebug> elements(&top);
+		for(uint64_t cycle = 0;cycle < cycles;cycle++){
+			eval(); step(); record(); elements.preCycle();
+			eval(); elements.postCycle();
+		}
+	});
+	auto sections = [&](){
+		SimElements<BenchIBus, BenchDBus, BenchDebug> elements(&top);
+		if(profile.enabled) elements.profileSlots(profile);
+		for(uint64_t cycle = 0;cycle < cycles;cycle++){
+			{ SimProfile::Scope scope(profile, SIM_PROFILE_EVAL); eval(); }
+			{ SimProfile::Scope scope(profile, SIM_PROFILE_GOLDEN); step(); }
+			{ SimProfile::Scope scope(profile, SIM_PROFILE_TRACE); record(); }
+			if(profile.enabled) elements.preCycle(profile); else elements.preCycle();
+			{ SimProfile::Scope scope(profile, SIM_PROFILE_EVAL); eval(); }
+			if(profile.enabled) elements.postCycle(profile); else elements.postCycle();
+		}
+	};
+	run("+profile=off", false, sections);
+	run("+profile", true, sections);
+	sink += model + golden + trace;
+	profile.summary(stdout, "bench");
+	return 0;
+}
+
+int main(int argc, char** argv){
+	memoryConfigure(NULL);
+	if(argc >= 2 && !strcmp(argv[1], "memory")) return benchMemory(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "image")) return benchImage(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "ihex")) return benchIhex(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "forkserver")) return benchForkServer(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "forktarget")) return benchForkTarget(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "trace")) return benchTrace(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "tracefilter")) return benchTraceFilter(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "smplog")) return benchSmpLog(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "elements")) return benchElements(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "random")) return benchRandom(argc - 2, argv + 2);
+	if(argc >= 2 && !strcmp(argv[1], "profile")) return benchProfile(argc - 2, argv + 2);
+	fprintf(stderr, "Usage : simbench memory [beats]\n");
+	fprintf(stderr, "        simbench image <file.elf|file.bin> [rounds]\n");
+	fprintf(stderr, "        simbench ihex [file.hex | MiB]\n");
+	fprintf(stderr, "        simbench forkserver [execs] [-- <command>]\n");
+	fprintf(stderr, "        simbench forktarget [init_ms] [run_ms]\n");
+	fprintf(stderr, "        simbench trace [records] [work_ns]\n");
+	fprintf(stderr, "        simbench tracefilter [instructions]\n");
+	fprintf(stderr, "        simbench smplog [cycles]\n");
+	fprintf(stderr, "        simbench elements [cycles]\n");
+	fprintf(stderr, "        simbench random [cycles]\n");
+	fprintf(stderr, "        simbench profile [cycles]\n");
+	return 1;
+}
@@ -0,0 +1,468 @@
+// Architectural diff of two traces of the harnesses (regTrace, memTrace, fregTrace, see ../trace_format.h).
+//
+// Usage : vexdiff [-j threads] [-c context] [-n divergences] [-w window] <trace a> <trace b>
+// The traces are text, in any of the dialects the harnesses write (with or without TRACE_WITH_TIME times, +trace_split
+// sequence prefixes, space or zero padding), or .bin. Each line / record is reduced to what the CPU did : the PC and
+// the register write, store or F register write, so the benign differences (times, padding, leading zeros of wide
+// store values) never show. The text files are mapped, their lines counted in chunks (SSE2 / AVX2) and compared in
+// parallel ranges, each thread stopping past the first divergence found so far.
+// A divergence is reported with -c records of context (5) on both sides, then vexdiff realigns the traces : the
+// closest pair of positions, within -w records (1000), from where 8 records match again, an instruction missing on
+// one side or an extra trap handler entry being the usual cases. Up to -n divergences (1) are reported this way.
+// Exit status : 0 same records, 1 divergent, 2 error.
+
+#include "../trace_format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VEXDIFF_X86
+#endif
+
+using namespace std;
+
+#define REALIGN_MATCH 8
+
+// What a record says about the CPU
+struct Record{
+	enum {OTHER, PC, REG, MEM, FREG} type;
+	uint32_t index; // register, store size
+	uint32_t pc;
+	uint32_t address;
+	uint64_t value; // the value, or a hash of its digits when it has more than 64 bits, of the line for OTHER
+
+	bool operator==(const Record &o) const { return type == o.type && index == o.index && pc == o.pc && address == o.address && value == o.value; }
+	bool operator!=(const Record &o) const { return !(*this == o); }
+};
+
+static inline uint64_t hashBytes(const char* p, const char* end){
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(;p < end;p++) h = (h ^ (uint8_t)*p) * 0x100000001b3ull;
+	return h;
+}
+
+// Table driven, the digits of the values are random and a branch per digit mispredicts
+static inline int hexDigit(char c){
+	static const struct Table{
+		int8_t v[256];
+		Table(){
+			for(int i = 0;i < 256;i++) v[i] = -1;
+			for(int i = 0;i < 10;i++) v['0' + i] = i;
+			for(int i = 0;i < 6;i++) v['a' + i] = v['A' + i] = 10 + i;
+		}
+	} table;
+	return table.v[(uint8_t)c];
+}
+
+// Leading spaces / zeros don't count, wider than 64 bits values are hashed
+static inline bool parseHex(const char* &p, const char* end, uint64_t* value){
+	while(p < end && *p == ' ') p++;
+	while(p + 1 < end && *p == '0' && hexDigit(p[1]) >= 0) p++;
+	const char* start = p;
+	uint64_t v = 0;
+	for(int d;p < end && (d = hexDigit(*p)) >= 0;p++) v = v << 4 | d;
+	if(p == start) return false;
+	*value = p - start > 16 ? hashBytes(start, p) : v;
+	return true;
+}
+
+static inline bool parseDec(const char* &p, const char* end, uint32_t* value){
+	while(p < end && *p == ' ') p++;
+	const char* start = p;
+	uint32_t v = 0;
+	for(;p < end && *p >= '0' && *p <= '9';p++) v = v*10 + (*p - '0');
+	*value = v;
+	return p != start;
+}
+
+template <size_t N>
+static inline bool expect(const char* &p, const char* end, const char (&text)[N]){
+	while(p < end && *p == ' ') p++;
+	if((size_t)(end - p) < N - 1 || memcmp(p, text, N - 1) != 0) return false;
+	p += N - 1;
+	return true;
+}
+
+// One line of a text trace, end excludes the '\n'
+static Record parseLine(const char* p, const char* end){
+	Record r = {Record::OTHER, 0, 0, 0, 0};
+	while(end > p && (end[-1] == '\r' || end[-1] == ' ')) end--;
+	if(p < end && *p == '#'){ // +trace_split sequence and hart
+		for(int spaces = 0;p < end && spaces < 2;p++) if(*p == ' ') spaces++;
+	}
+	while(p < end && *p == ' ') p++;
+	while(p < end && *p >= '0' && *p <= '9') p++; // time
+	const char* body = p;
+	uint64_t pc = 0, value = 0, address = 0;
+	uint32_t index = 0;
+	if(!expect(p, end, "PC") || !parseHex(p, end, &pc)) goto other;
+	r.pc = pc;
+	while(p < end && *p == ' ') p++;
+	if(p == end) { r.type = Record::PC; return r; }
+	if(!expect(p, end, ":")) goto other;
+	if(expect(p, end, "reg[")){
+		if(!parseDec(p, end, &index) || !expect(p, end, "]") || !expect(p, end, "=") || !parseHex(p, end, &value) || p != end) goto other;
+		r.type = Record::REG;
+	} else if(expect(p, end, "MEM[0x")){
+		if(!parseHex(p, end, &address) || !expect(p, end, "]") || !expect(p, end, "<=") || !parseDec(p, end, &index) ||
+		   !expect(p, end, "bytes") || !expect(p, end, ":") || !expect(p, end, "0x") || !parseHex(p, end, &value) || p != end) goto other;
+		r.type = Record::MEM;
+		r.address = address;
+	} else if(expect(p, end, "f[")){
+		if(!parseDec(p, end, &index) || !expect(p, end, "]") || !expect(p, end, "=") || !expect(p, end, "0x") || !parseHex(p, end, &value) || p != end) goto other;
+		r.type = Record::FREG;
+	} else {
+		goto other;
+	}
+	r.index = index;
+	r.value = value;
+	return r;
+other:
+	r = {Record::OTHER, 0, 0, 0, hashBytes(body, end)};
+	return r;
+}
+
+static Record fromEvent(const TraceEvent &e){
+	Record r = {Record::OTHER, e.index, e.pc, 0, e.value};
+	switch(e.type){
+	case TRACE_RECORD_PC: r.type = Record::PC; r.index = 0; r.value = 0; break;
+	case TRACE_RECORD_REG: r.type = Record::REG; break;
+	case TRACE_RECORD_MEM: r.type = Record::MEM; r.address = e.address; break;
+	case TRACE_RECORD_FREG: r.type = Record::FREG; break;
+	}
+	return r;
+}
+
+// Newlines in [p, p + size)
+static size_t countLinesScalar(const char* p, size_t size){
+	size_t count = 0;
+	for(const char* end = p + size;(p = (const char*)memchr(p, '\n', end - p)) != NULL;p++) count++;
+	return count;
+}
+
+#ifdef VEXDIFF_X86
+static size_t countLinesSse2(const char* p, size_t size){
+	const __m128i nl = _mm_set1_epi8('\n');
+	size_t count = 0, i = 0;
+	for(;i + 16 <= size;i += 16){
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+		count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+	}
+	return count + countLinesScalar(p + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t countLinesAvx2(const char* p, size_t size){
+	const __m256i nl = _mm256_set1_epi8('\n');
+	size_t count = 0, i = 0;
+	for(;i + 64 <= size;i += 64){
+		__m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)), nl);
+		__m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i + 32)), nl);
+		count += _mm_popcnt_u64((uint32_t)_mm256_movemask_epi8(a) | (uint64_t)(uint32_t)_mm256_movemask_epi8(b) << 32);
+	}
+	return count + countLinesSse2(p + i, size - i);
+}
+#endif
+
+static size_t countLines(const char* p, size_t size){
+#ifdef VEXDIFF_X86
+	static size_t (*best)(const char*, size_t) = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") ? countLinesAvx2 : countLinesSse2;
+	return best(p, size);
+#else
+	return countLinesScalar(p, size);
+#endif
+}
+
+// Runs body(i) for i in [0, count) over threads
+template <typename Body>
+static void parallel(uint32_t threads, uint64_t count, Body body){
+	vector<thread> pool;
+	for(uint32_t t = 1;t < threads && t < count;t++) pool.emplace_back([&, t](){ for(uint64_t i = t;i < count;i += threads) body(i); });
+	for(uint64_t i = 0;i < count;i += threads) body(i);
+	for(thread &t : pool) t.join();
+}
+
+#define TEXT_CHUNK (1 << 20)
+
+class TextTrace{
+public:
+	string path, error;
+
+	TextTrace(const string &path, uint32_t threads) : path(path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if(fd < 0 || fstat(fd, &st) != 0) { error = "can't open " + path; if(fd >= 0) ::close(fd); return; }
+		size = st.st_size;
+		if(size) data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(data == MAP_FAILED) { data = NULL; error = "can't map " + path; return; }
+		uint64_t chunks = (size + TEXT_CHUNK - 1) / TEXT_CHUNK;
+		chunkLines.assign(chunks + 1, 0);
+		parallel(threads, chunks, [&](uint64_t i){
+			chunkLines[i + 1] = countLines(data + i*TEXT_CHUNK, min<uint64_t>(TEXT_CHUNK, size - i*TEXT_CHUNK));
+		});
+		for(uint64_t i = 0;i < chunks;i++) chunkLines[i + 1] += chunkLines[i];
+		count = chunkLines[chunks] + (size && data[size - 1] != '\n');
+	}
+	TextTrace(const TextTrace&) = delete;
+	TextTrace& operator=(const TextTrace&) = delete;
+	~TextTrace(){ if(data) munmap((void*)data, size); }
+
+	uint64_t records() const { return count; }
+
+	class Cursor{
+	public:
+		bool next(Record* r){
+			if(p >= end) return false;
+			const char* eol = (const char*)memchr(p, '\n', end - p);
+			lineEnd = eol ? eol : end;
+			*r = parseLine(p, lineEnd);
+			line = p;
+			p = eol ? eol + 1 : end;
+			return true;
+		}
+		string text() const { return string(line, lineEnd); }
+
+	private:
+		friend class TextTrace;
+		const char *p, *end, *line = NULL, *lineEnd = NULL;
+	};
+
+	// At the index-th line
+	Cursor at(uint64_t index) const {
+		Cursor c;
+		c.end = data + size;
+		if(index >= count) { c.p = c.end; return c; }
+		uint64_t chunk = upper_bound(chunkLines.begin(), chunkLines.end() - 1, index) - chunkLines.begin() - 1;
+		// Line chunkLines[chunk] starts after the last '\n' before the chunk, which can be in a previous one
+		const char* p = data + chunk*TEXT_CHUNK;
+		while(p > data && p[-1] != '\n') p--;
+		for(uint64_t skip = index - chunkLines[chunk];skip;skip--) p = (const char*)memchr(p, '\n', c.end - p) + 1;
+		c.p = p;
+		return c;
+	}
+
+private:
+	const char* data = NULL;
+	size_t size = 0;
+	vector<uint64_t> chunkLines; // lines before each chunk
+	uint64_t count = 0;
+};
+
+// Decoded in memory, the binary traces are several times smaller than their text
+class BinaryTrace{
+public:
+	string path, error;
+
+	BinaryTrace(const string &path, uint32_t) : path(path) {
+		TraceReader reader(path);
+		TraceEvent e = {};
+		while(reader.next(&e)) events.push_back(e);
+		error = reader.error;
+		flags = reader.flags & ~TRACE_FLAG_SEQ;
+	}
+
+	uint64_t records() const { return events.size(); }
+
+	class Cursor{
+	public:
+		bool next(Record* r){
+			if(i >= trace->events.size()) return false;
+			current = i++;
+			*r = fromEvent(trace->events[current]);
+			return true;
+		}
+		string text() const {
+			char line[TRACE_TEXT_MAX];
+			size_t size = traceFormatText(trace->events[current], trace->flags, line);
+			return string(line, size ? size - 1 : 0);
+		}
+
+	private:
+		friend class BinaryTrace;
+		const BinaryTrace* trace;
+		uint64_t i, current = 0;
+	};
+
+	Cursor at(uint64_t index) const {
+		Cursor c;
+		c.trace = this;
+		c.i = index;
+		return c;
+	}
+
+private:
+	vector<TraceEvent> events;
+	uint32_t flags = 0;
+};
+
+struct Options{
+	uint32_t threads = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
+	uint64_t context = 5;
+	uint64_t divergences = 1;
+	uint64_t window = 1000;
+};
+
+template <typename A, typename B>
+class Diff{
+public:
+	Diff(const A &a, const B &b, const Options &options) : a(a), b(b), options(options) {}
+
+	// Offset from (ia, ib) of the first records which differ, the length of the shorter rest if none
+	uint64_t firstDivergence(uint64_t ia, uint64_t ib){
+		uint64_t length = min(a.records() - ia, b.records() - ib);
+		uint64_t ranges = length < (1 << 16) ? 1 : (uint64_t)options.threads * 8;
+		atomic<uint64_t> found(length);
+		parallel(options.threads, ranges, [&](uint64_t range){
+			uint64_t lo = length * range / ranges, hi = length * (range + 1) / ranges;
+			if(lo >= found.load(memory_order_relaxed)) return;
+			typename A::Cursor ca = a.at(ia + lo);
+			typename B::Cursor cb = b.at(ib + lo);
+			Record ra = {}, rb = {};
+			for(uint64_t i = lo;i < hi;i++){
+				ca.next(&ra);
+				cb.next(&rb);
+				if(ra != rb){
+					for(uint64_t f = found.load();i < f && !found.compare_exchange_weak(f, i););
+					return;
+				}
+				if((i & 0xFFFF) == 0 && i >= found.load(memory_order_relaxed)) return;
+			}
+		});
+		return found.load();
+	}
+
+	// The closest pair of positions from (ia, ib) where REALIGN_MATCH records match again
+	bool realign(uint64_t ia, uint64_t ib, uint64_t* ra, uint64_t* rb){
+		vector<Record> wa = window(a, ia), wb = window(b, ib);
+		for(uint64_t distance = 1;distance <= 2*options.window;distance++){
+			for(uint64_t da = 0;da <= distance;da++){
+				uint64_t db = distance - da;
+				if(da > options.window || db > options.window) continue;
+				if(matches(wa, da, wb, db)) { *ra = ia + da; *rb = ib + db; return true; }
+			}
+		}
+		return false;
+	}
+
+	int run(){
+		uint64_t ia = 0, ib = 0, reported = 0;
+		while(true){
+			uint64_t offset = firstDivergence(ia, ib);
+			ia += offset;
+			ib += offset;
+			if(ia == a.records() && ib == b.records()) break;
+			reported++;
+			report(ia, ib);
+			if(ia == a.records() || ib == b.records()){
+				bool aEnded = ia == a.records();
+				printf("%s ends at record %llu, %s goes on\n", (aEnded ? a.path : b.path).c_str(), (unsigned long long)(aEnded ? ia : ib),
+					(aEnded ? b.path : a.path).c_str());
+				break;
+			}
+			if(reported == options.divergences) break;
+			uint64_t na, nb;
+			if(!realign(ia, ib, &na, &nb)){
+				printf("no realignment within %llu records, stopping\n", (unsigned long long)options.window);
+				break;
+			}
+			printf("realigned at a:%llu b:%llu, %llu records of a and %llu of b skipped\n", (unsigned long long)na + 1, (unsigned long long)nb + 1,
+				(unsigned long long)(na - ia), (unsigned long long)(nb - ib));
+			ia = na;
+			ib = nb;
+		}
+		printf("%llu records in %s, %llu in %s, %llu divergence%s\n", (unsigned long long)a.records(), a.path.c_str(),
+			(unsigned long long)b.records(), b.path.c_str(), (unsigned long long)reported, reported == 1 ? "" : "s");
+		return reported ? 1 : 0;
+	}
+
+private:
+	const A &a;
+	const B &b;
+	const Options &options;
+
+	template <typename T>
+	vector<Record> window(const T &trace, uint64_t index){
+		vector<Record> records;
+		typename T::Cursor c = trace.at(index);
+		Record r = {};
+		while(records.size() < options.window + REALIGN_MATCH && c.next(&r)) records.push_back(r);
+		return records;
+	}
+
+	static bool matches(const vector<Record> &wa, uint64_t da, const vector<Record> &wb, uint64_t db){
+		uint64_t length = min<uint64_t>(REALIGN_MATCH, min(wa.size() - min<uint64_t>(da, wa.size()), wb.size() - min<uint64_t>(db, wb.size())));
+		if(length == 0) return false;
+		for(uint64_t i = 0;i < length;i++) if(wa[da + i] != wb[db + i]) return false;
+		return true;
+	}
+
+	// Context before from a (those records match), then the records from the divergence on both sides. Line numbers
+	// start at 1.
+	void report(uint64_t ia, uint64_t ib){
+		uint64_t before = min(options.context, min(ia, ib));
+		printf("@@ divergence at a:%llu b:%llu @@\n", (unsigned long long)ia + 1, (unsigned long long)ib + 1);
+		Record r = {};
+		typename A::Cursor ca = a.at(ia - before);
+		for(uint64_t i = 0;i < before && ca.next(&r);i++) printf("  %s\n", ca.text().c_str());
+		for(uint64_t i = 0;i < options.context && ca.next(&r);i++) printf("- %s\n", ca.text().c_str());
+		typename B::Cursor cb = b.at(ib);
+		for(uint64_t i = 0;i < options.context && cb.next(&r);i++) printf("+ %s\n", cb.text().c_str());
+	}
+};
+
+template <typename A, typename B>
+static int diff(const string &pa, const string &pb, const Options &options){
+	A a(pa, options.threads);
+	if(!a.error.empty()) { fprintf(stderr, "%s\n", a.error.c_str()); return 2; }
+	B b(pb, options.threads);
+	if(!b.error.empty()) { fprintf(stderr, "%s\n", b.error.c_str()); return 2; }
+	return Diff<A, B>(a, b, options).run();
+}
+
+static bool isBinary(const string &path){
+	FILE* file = fopen(path.c_str(), "rb");
+	if(file == NULL) return false;
+	char magic[8];
+	bool binary = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return binary;
+}
+
+int main(int argc, char** argv){
+	Options options;
+	int arg = 1;
+	for(;arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] && !argv[arg][2];arg += 2){
+		uint64_t value = strtoull(argv[arg + 1], NULL, 0);
+		switch(argv[arg][1]){
+		case 'j': options.threads = max<uint64_t>(1, value); break;
+		case 'c': options.context = value; break;
+		case 'n': options.divergences = max<uint64_t>(1, value); break;
+		case 'w': options.window = value; break;
+		default: arg = argc; break;
+		}
+	}
+	if(argc - arg != 2){
+		fprintf(stderr, "Usage : vexdiff [-j threads] [-c context] [-n divergences] [-w window] <trace a> <trace b>\n");
+		return 2;
+	}
+	string pa = argv[arg], pb = argv[arg + 1];
+	bool ba = isBinary(pa), bb = isBinary(pb);
+	if(!ba && !bb) return diff<TextTrace, TextTrace>(pa, pb, options);
+	if(ba && bb) return diff<BinaryTrace, BinaryTrace>(pa, pb, options);
+	if(ba) return diff<BinaryTrace, TextTrace>(pa, pb, options);
+	return diff<TextTrace, BinaryTrace>(pa, pb, options);
+}
@@ -0,0 +1,189 @@
+// Merges traces numbered by a shared sequence (TRACE_FLAG_SEQ, the per hart streams of main_smp.cpp with
+// +trace_split=on, see ../trace_format.h) back into the single trace the harness writes without it.
+//
+// Usage : vexmerge [-t|-z] <output|-> <trace>...
+//   Text inputs give the text trace at output (- for stdout), the "#<sequence> h<hart> " prefixes removed.
+//   Binary inputs (.bin) give <output>.bin and its index, -z compresses it as binz, -t writes the text instead.
+// The records are written in sequence order, which is the order they were produced in by the simulation.
+
+#include "../trace_format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Lines of a text trace with their sequence number
+class TextInput{
+public:
+	string path, error;
+	uint64_t seq = 0;
+	const char* line = NULL; // current line, after its prefix
+	const char* end = NULL;  // of the current line, '\n' included
+
+	TextInput(const string &path) : path(path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if(fd < 0 || fstat(fd, &st) != 0) { error = "can't open " + path; if(fd >= 0) ::close(fd); return; }
+		size = st.st_size;
+		if(size) data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(data == MAP_FAILED) { data = NULL; error = "can't map " + path; return; }
+		if(data) madvise((void*)data, size, MADV_SEQUENTIAL);
+		next = data;
+	}
+	TextInput(const TextInput&) = delete;
+	TextInput& operator=(const TextInput&) = delete;
+	~TextInput(){ if(data) munmap((void*)data, size); }
+
+	// False at the end of the file or on error (then set)
+	bool advance(){
+		const char* limit = data + size;
+		if(next == NULL || next >= limit) return false;
+		const char* eol = (const char*)memchr(next, '\n', limit - next);
+		end = eol ? eol + 1 : limit;
+		const char* p = next;
+		next = end;
+		if(p == end || *p++ != '#') return fail();
+		seq = 0;
+		const char* digits = p;
+		while(p < end && *p >= '0' && *p <= '9') seq = seq*10 + (*p++ - '0');
+		if(p == digits || p + 2 > end || p[0] != ' ' || p[1] != 'h') return fail();
+		p += 2;
+		while(p < end && *p >= '0' && *p <= '9') p++;
+		if(p == end || *p++ != ' ') return fail();
+		line = p;
+		return true;
+	}
+
+private:
+	const char* data = NULL;
+	size_t size = 0;
+	const char* next = NULL;
+
+	bool fail(){
+		error = path + " has a line without sequence number (not written with TRACE_FLAG_SEQ ?)";
+		return false;
+	}
+};
+
+static bool isBinary(const string &path){
+	FILE* file = fopen(path.c_str(), "rb");
+	if(file == NULL) return false;
+	char magic[8];
+	bool binary = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return binary;
+}
+
+static FILE* openOutput(const string &output){
+	FILE* out = output == "-" ? stdout : fopen(output.c_str(), "w");
+	if(out == NULL) { perror(output.c_str()); return NULL; }
+	setvbuf(out, NULL, _IOFBF, 1 << 16);
+	return out;
+}
+
+static bool closeOutput(FILE* out, const string &output){
+	if(fflush(out) != 0 || (out != stdout && fclose(out) != 0)) { perror(output.c_str()); return false; }
+	return true;
+}
+
+// The input with the lowest sequence number, -1 once they are all done. A linear pick, there is an input per hart.
+template <typename Seq>
+static int lowest(const vector<bool> &live, Seq seq){
+	int found = -1;
+	for(size_t i = 0;i < live.size();i++){
+		if(live[i] && (found < 0 || seq(i) < seq(found))) found = i;
+	}
+	return found;
+}
+
+static int mergeText(const string &output, const vector<string> &paths){
+	vector<unique_ptr<TextInput>> inputs;
+	vector<bool> live;
+	for(const string &path : paths){
+		inputs.emplace_back(new TextInput(path));
+		if(!inputs.back()->error.empty()) { fprintf(stderr, "%s\n", inputs.back()->error.c_str()); return 1; }
+		live.push_back(inputs.back()->advance());
+	}
+	FILE* out = openOutput(output);
+	if(out == NULL) return 1;
+	auto seq = [&](size_t i){ return inputs[i]->seq; };
+	for(int i;(i = lowest(live, seq)) >= 0;){
+		TextInput &input = *inputs[i];
+		fwrite(input.line, 1, input.end - input.line, out);
+		live[i] = input.advance();
+	}
+	bool ok = closeOutput(out, output);
+	for(auto &input : inputs) if(!input->error.empty()) { fprintf(stderr, "%s\n", input->error.c_str()); ok = false; }
+	return ok ? 0 : 1;
+}
+
+static int mergeBinary(const string &output, const vector<string> &paths, char mode){
+	vector<unique_ptr<TraceReader>> readers;
+	vector<TraceEvent> heads(paths.size());
+	vector<bool> live;
+	uint32_t flags = 0;
+	for(size_t i = 0;i < paths.size();i++){
+		readers.emplace_back(new TraceReader(paths[i]));
+		TraceReader &reader = *readers.back();
+		if(!reader.ok()) { fprintf(stderr, "%s\n", reader.error.c_str()); return 1; }
+		if(!(reader.flags & TRACE_FLAG_SEQ)) { fprintf(stderr, "%s has no sequence numbers (not written with TRACE_FLAG_SEQ ?)\n", paths[i].c_str()); return 1; }
+		flags = reader.flags & ~TRACE_FLAG_SEQ;
+		live.push_back(reader.next(&heads[i]));
+	}
+	FILE* out = NULL;
+	TraceWriter writer;
+	if(mode == 't'){
+		if((out = openOutput(output)) == NULL) return 1;
+	} else if(!writer.open(output, flags, mode == 'z' ? TraceWriter::BINARY_COMPRESSED : TraceWriter::BINARY)){
+		perror((output + ".bin").c_str());
+		return 1;
+	}
+	auto seq = [&](size_t i){ return heads[i].seq; };
+	char line[TRACE_TEXT_MAX];
+	for(int i;(i = lowest(live, seq)) >= 0;){
+		if(out){
+			size_t size = traceFormatText(heads[i], flags, line);
+			if(size) fwrite(line, 1, size, out);
+		} else {
+			writer.emit(heads[i]);
+		}
+		live[i] = readers[i]->next(&heads[i]);
+	}
+	bool ok = out ? closeOutput(out, output) : true;
+	writer.close();
+	for(auto &reader : readers) if(!reader->ok()) { fprintf(stderr, "%s\n", reader->error.c_str()); ok = false; }
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv){
+	char mode = 0;
+	int arg = 1;
+	if(arg < argc && (!strcmp(argv[arg], "-t") || !strcmp(argv[arg], "-z"))) mode = argv[arg++][1];
+	if(argc - arg < 2){
+		fprintf(stderr, "Usage : vexmerge [-t|-z] <output|-> <trace>...\n");
+		return 1;
+	}
+	string output = argv[arg++];
+	vector<string> paths(argv + arg, argv + argc);
+	bool binary = isBinary(paths[0]);
+	for(const string &path : paths){
+		if(isBinary(path) != binary) { fprintf(stderr, "%s : the traces to merge are either all text or all binary\n", path.c_str()); return 1; }
+	}
+	if(!binary){
+		if(mode) { fprintf(stderr, "-%c only applies to binary traces\n", mode); return 1; }
+		return mergeText(output, paths);
+	}
+	if(output == "-" && mode != 't') { fprintf(stderr, "A binary output can't go to stdout, use -t\n"); return 1; }
+	return mergeBinary(output, paths, mode);
+}
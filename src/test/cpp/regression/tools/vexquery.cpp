@@ -0,0 +1,252 @@
+// Random access into the traces of the harnesses through their .idx sidecar (see ../trace_index.h).
+//
+// Usage : vexquery <trace> time <from> [to]      records of the time window [from, to)
+//         vexquery <trace> pc <address> [count]  count records (32) from the first one of that PC
+//         vexquery <trace> exceptions            the traps recorded by the index
+//         vexquery <trace> exception <n> [count] count records (32) from the n-th trap
+// <trace> is the text trace or the .bin one, the index is <trace>.idx. Both are mapped and only the blocks / lines
+// of the window are read. The windows of an untimed text trace are rounded to the index stride.
+
+#include "../trace_format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Mapped{
+public:
+	const uint8_t* data = NULL;
+	size_t size = 0;
+	string error;
+
+	Mapped(const string &path){
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if(fd < 0 || fstat(fd, &st) != 0) { error = "can't open " + path; if(fd >= 0) ::close(fd); return; }
+		size = st.st_size;
+		if(size) data = (const uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(data == MAP_FAILED) { data = NULL; error = "can't map " + path; }
+	}
+	~Mapped(){ if(data) munmap((void*)data, size); }
+};
+
+class Index{
+public:
+	TraceIndexHeader header;
+	vector<TraceIndexEntry> times, pcs, exceptions;
+	string error;
+
+	Index(const Mapped &file, const string &path){
+		if(file.size < sizeof(header)) { error = path + " isn't a trace index"; return; }
+		memcpy(&header, file.data, sizeof(header));
+		if(memcmp(header.magic, TRACE_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_INDEX_VERSION){
+			error = path + " isn't a trace index of this version";
+			return;
+		}
+		const TraceIndexEntry* entries = (const TraceIndexEntry*)(file.data + sizeof(header));
+		size_t count = (file.size - sizeof(header)) / sizeof(TraceIndexEntry);
+		for(size_t i = 0;i < count;i++){
+			const TraceIndexEntry &e = entries[i];
+			if(e.kind == TRACE_INDEX_TIME) times.push_back(e);
+			else if(e.kind == TRACE_INDEX_PC) pcs.push_back(e);
+			else if(e.kind == TRACE_INDEX_EXCEPTION) exceptions.push_back(e);
+		}
+	}
+
+	// Last TIME entry at or before time, NULL when time is before the first one
+	const TraceIndexEntry* before(uint64_t time) const {
+		auto it = upper_bound(times.begin(), times.end(), time, [](uint64_t t, const TraceIndexEntry &e){ return t < e.time; });
+		return it == times.begin() ? NULL : &*(it - 1);
+	}
+
+	// TIME entry of the binary block at offset
+	const TraceIndexEntry* block(uint64_t offset) const {
+		auto it = lower_bound(times.begin(), times.end(), offset, [](const TraceIndexEntry &e, uint64_t o){ return e.offset < o; });
+		return it != times.end() && it->offset == offset ? &*it : NULL;
+	}
+};
+
+// Records of a binary trace from a block start
+class BinaryCursor{
+public:
+	string error;
+
+	BinaryCursor(const Mapped &file) : file(file) {}
+
+	void seek(const TraceIndexEntry &block){
+		offset = block.offset;
+		time = block.time;
+		pc = block.pc;
+		records.clear();
+		position = 0;
+	}
+
+	bool next(TraceEvent *event){
+		while(error.empty()){
+			if(position == records.size() && !readBlock()) return false;
+			const TraceRecord &r = records[position++];
+			if(r.type == TRACE_RECORD_TIME) { time = r.value; continue; }
+			if(r.type == TRACE_RECORD_SEQ) { seq = r.value; continue; }
+			time += r.time;
+			pc += r.pc;
+			*event = {r.type, r.index, r.hart, time, pc, r.address, r.value, seq++};
+			return true;
+		}
+		return false;
+	}
+
+private:
+	const Mapped &file;
+	uint64_t offset = 0;
+	uint64_t time = 0;
+	uint32_t pc = 0;
+	uint64_t seq = 0;
+	vector<TraceRecord> records;
+	size_t position = 0;
+
+	bool readBlock(){
+		TraceBlockHeader header;
+		if(offset + sizeof(header) > file.size) return false;
+		memcpy(&header, file.data + offset, sizeof(header));
+		offset += sizeof(header);
+		if(header.records == 0 || header.records > TRACE_BLOCK_RECORDS || offset + header.bytes > file.size) { error = "corrupted block"; return false; }
+		records.resize(header.records);
+		position = 0;
+		const uint8_t* payload = file.data + offset;
+		offset += header.bytes;
+		if(header.codec == TRACE_CODEC_RAW && header.bytes == header.records*sizeof(TraceRecord)) { memcpy(records.data(), payload, header.bytes); return true; }
+		if(header.codec == TRACE_CODEC_SHUFFLE_RLE && traceDecompress(payload, header.bytes, records.data(), header.records)) return true;
+		error = "corrupted block";
+		return false;
+	}
+};
+
+static uint64_t lineTime(const char* line, const char* end){
+	uint64_t time = 0;
+	while(line < end && *line >= '0' && *line <= '9') time = time*10 + (*line++ - '0');
+	return time;
+}
+
+// The lines of a text trace from offset, until the line starting at stop or count lines
+static void printLines(const Mapped &file, uint64_t offset, uint64_t stop, uint64_t count){
+	const char* p = (const char*)file.data + offset;
+	const char* end = (const char*)file.data + min<uint64_t>(stop, file.size);
+	for(uint64_t printed = 0;p < end && printed < count;printed++){
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		const char* next = eol ? eol + 1 : end;
+		fwrite(p, 1, next - p, stdout);
+		p = next;
+	}
+}
+
+static void printEvent(const TraceEvent &e, uint32_t flags){
+	char line[TRACE_TEXT_MAX];
+	size_t size = traceFormatText(e, flags, line);
+	if(size) fwrite(line, 1, size, stdout);
+}
+
+static int queryTime(const Mapped &trace, const Index &index, uint64_t from, uint64_t to){
+	const TraceIndexEntry* start = index.before(from);
+	uint32_t flags = index.header.flags;
+	if(index.header.binary){
+		if(index.times.empty()) return 0;
+		BinaryCursor cursor(trace);
+		cursor.seek(start ? *start : index.times.front());
+		TraceEvent e;
+		while(cursor.next(&e) && e.time < to) if(e.time >= from) printEvent(e, flags);
+		if(!cursor.error.empty()) { fprintf(stderr, "%s\n", cursor.error.c_str()); return 1; }
+		return 0;
+	}
+	uint64_t offset = start ? start->offset : 0;
+	if(!(flags & TRACE_FLAG_TIME)){
+		// Only the index knows the times, from the stride before from to the one after to
+		auto stop = lower_bound(index.times.begin(), index.times.end(), to, [](const TraceIndexEntry &e, uint64_t t){ return e.time < t; });
+		printLines(trace, offset, stop == index.times.end() ? trace.size : stop->offset, UINT64_MAX);
+		return 0;
+	}
+	const char* p = (const char*)trace.data + offset;
+	const char* end = (const char*)trace.data + trace.size;
+	while(p < end){
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		const char* next = eol ? eol + 1 : end;
+		uint64_t time = lineTime(p, next);
+		if(time >= to) break;
+		if(time >= from) fwrite(p, 1, next - p, stdout);
+		p = next;
+	}
+	return 0;
+}
+
+// count records from the one at offset (text) or from the first one of block matching
+template <typename Match>
+static int printFrom(const Mapped &trace, const Index &index, uint64_t offset, uint64_t count, Match match){
+	if(!index.header.binary) { printLines(trace, offset, trace.size, count); return 0; }
+	const TraceIndexEntry* block = index.block(offset);
+	if(block == NULL) { fprintf(stderr, "no block at offset %llu\n", (unsigned long long)offset); return 1; }
+	BinaryCursor cursor(trace);
+	cursor.seek(*block);
+	TraceEvent e;
+	bool found = false;
+	for(uint64_t printed = 0;printed < count && cursor.next(&e);){
+		if(!found && !match(e)) continue;
+		found = true;
+		printEvent(e, index.header.flags);
+		printed++;
+	}
+	if(!cursor.error.empty()) { fprintf(stderr, "%s\n", cursor.error.c_str()); return 1; }
+	return 0;
+}
+
+static int usage(){
+	fprintf(stderr, "Usage : vexquery <trace> time <from> [to]\n");
+	fprintf(stderr, "        vexquery <trace> pc <address> [count]\n");
+	fprintf(stderr, "        vexquery <trace> exceptions\n");
+	fprintf(stderr, "        vexquery <trace> exception <n> [count]\n");
+	return 1;
+}
+
+int main(int argc, char** argv){
+	if(argc < 3) return usage();
+	string path = argv[1], query = argv[2];
+	Mapped trace(path), indexFile(path + ".idx");
+	if(!trace.error.empty()) { fprintf(stderr, "%s\n", trace.error.c_str()); return 1; }
+	if(!indexFile.error.empty()) { fprintf(stderr, "%s\n", indexFile.error.c_str()); return 1; }
+	Index index(indexFile, path + ".idx");
+	if(!index.error.empty()) { fprintf(stderr, "%s\n", index.error.c_str()); return 1; }
+	auto number = [&](int i, uint64_t fallback){ return argc > i ? strtoull(argv[i], NULL, 0) : fallback; };
+
+	if(query == "time" && argc >= 4) return queryTime(trace, index, number(3, 0), number(4, UINT64_MAX));
+	if(query == "pc" && argc >= 4){
+		uint32_t pc = number(3, 0);
+		for(const TraceIndexEntry &e : index.pcs){
+			if(e.pc == pc) return printFrom(trace, index, e.offset, number(4, 32), [&](const TraceEvent &r){ return r.pc == pc; });
+		}
+		fprintf(stderr, "PC %08x isn't in the trace\n", pc);
+		return 1;
+	}
+	if(query == "exceptions"){
+		for(size_t i = 0;i < index.exceptions.size();i++){
+			const TraceIndexEntry &e = index.exceptions[i];
+			printf("%zu time=%llu hart=%u pc=0x%08x cause=%llu\n", i, (unsigned long long)e.time, e.hart, e.pc, (unsigned long long)e.value);
+		}
+		return 0;
+	}
+	if(query == "exception" && argc >= 4){
+		uint64_t n = number(3, 0);
+		if(n >= index.exceptions.size()) { fprintf(stderr, "%zu exceptions in the index\n", index.exceptions.size()); return 1; }
+		const TraceIndexEntry &e = index.exceptions[n];
+		return printFrom(trace, index, e.offset, number(4, 32), [&](const TraceEvent &r){ return r.time >= e.time; });
+	}
+	return usage();
+}
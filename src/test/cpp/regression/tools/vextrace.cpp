@@ -0,0 +1,68 @@
+// Converts the binary traces of the harnesses (+trace_format=bin|binz, see ../trace_format.h) back to their text.
+//
+// Usage : vextrace <trace.bin> [output|-]
+//   The output defaults to the input path without its .bin suffix (the text trace the simulation would have
+//   written), - writes to stdout.
+//   vextrace -s <trace.bin> prints the record count per type and per hart instead.
+
+#include "../trace_format.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+static int stats(const string &input){
+	TraceReader reader(input);
+	if(!reader.ok()) { fprintf(stderr, "%s\n", reader.error.c_str()); return 1; }
+	static const char* names[] = {"?", "pc", "reg", "mem", "freg"};
+	map<pair<uint32_t, uint32_t>, uint64_t> counts;
+	TraceEvent e;
+	uint64_t total = 0, lastTime = 0;
+	while(reader.next(&e)){
+		counts[make_pair((uint32_t)e.hart, (uint32_t)e.type)]++;
+		total++;
+		lastTime = e.time;
+	}
+	if(!reader.ok()) { fprintf(stderr, "%s\n", reader.error.c_str()); return 1; }
+	printf("%llu records, last time %llu\n", (unsigned long long)total, (unsigned long long)lastTime);
+	for(auto &it : counts){
+		printf("hart %u %-4s %llu\n", it.first.first, it.first.second <= TRACE_RECORD_FREG ? names[it.first.second] : "?", (unsigned long long)it.second);
+	}
+	return 0;
+}
+
+int main(int argc, char** argv){
+	if(argc >= 3 && !strcmp(argv[1], "-s")) return stats(argv[2]);
+	if(argc < 2 || argc > 3){
+		fprintf(stderr, "Usage : vextrace <trace.bin> [output|-]\n");
+		fprintf(stderr, "        vextrace -s <trace.bin>\n");
+		return 1;
+	}
+	string input = argv[1];
+	string output = argc > 2 ? argv[2] : input;
+	if(argc == 2){
+		if(input.size() > 4 && input.compare(input.size() - 4, 4, ".bin") == 0) output.resize(input.size() - 4);
+		else output += ".txt";
+	}
+
+	TraceReader reader(input);
+	if(!reader.ok()) { fprintf(stderr, "%s\n", reader.error.c_str()); return 1; }
+	FILE* out = output == "-" ? stdout : fopen(output.c_str(), "w");
+	if(out == NULL) { perror(output.c_str()); return 1; }
+	setvbuf(out, NULL, _IOFBF, 1 << 16);
+
+	TraceEvent e;
+	char line[TRACE_TEXT_MAX];
+	while(reader.next(&e)){
+		size_t size = traceFormatText(e, reader.flags, line);
+		if(size) fwrite(line, 1, size, out);
+	}
+	bool failed = fflush(out) != 0 || (out != stdout && fclose(out) != 0);
+	if(!reader.ok()) { fprintf(stderr, "%s\n", reader.error.c_str()); return 1; }
+	if(failed) { perror(output.c_str()); return 1; }
+	return 0;
+}
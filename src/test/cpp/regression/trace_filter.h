@@ -0,0 +1,270 @@
+#ifndef TRACE_FILTER_H
+#define TRACE_FILTER_H
+
+// Runtime trace filtering, shared by both harnesses.
+//
+// TRACE_ACCESS / TRACE decide at build time which traces exist, the +trace_* plusargs below narrow down at run time
+// what gets recorded, so a fuzzing run can log only the region under study :
+//   +trace_pc=<range>[,<range>...]    instructions (and their stores) whose PC is in one of the ranges
+//   +trace_cycles=<a>-<b>[,...]       cycle windows, [a, b), either bound can be omitted (1000-, -5000)
+//   +trace_priv=<m|s|u>[,...]         privilege of the instruction, from the golden model (ignored without it)
+//   +trace_start=<trigger>            record nothing until the trigger fires ...
+//   +trace_for=<cycles>               ... then for that many cycles only
+//   +trace_stop=<trigger>             stop recording for good once the trigger fires
+// A range is <address|symbol>, <a>-<b> or <a>+<size>, the symbols come from the ELF input (a lone symbol spans its
+// st_size, a lone address one instruction). A trigger is exception (the first trap), store:<range> (a store which
+// writes a byte of the range), pc:<range> (an instruction of the range commits) or cycle:<n>.
+//
+// The register / memory / F register traces honour every filter, the waveform dumps only the cycle windows and
+// the triggers. Without any +trace_* plusarg accept() is a single predictable branch.
+
+#include "elf_loader.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define TRACE_PRIVILEGE_UNKNOWN 0xFF
+
+struct TraceRange{
+	std::string symbol; // resolved from the ELF input into lo / hi
+	uint32_t offset = 0;
+	enum {SINGLE, END, SIZE} bound = SINGLE;
+	uint32_t end = 0;   // END : last address + 1, SIZE : size
+	bool resolved = false;
+	uint32_t lo = 0, hi = 0; // [lo, hi)
+
+	bool contains(uint32_t address) const { return resolved && address - lo < hi - lo; }
+	bool overlaps(uint32_t address, uint32_t size) const { return resolved && address < hi && address + size > lo; }
+
+	// symbolValue / symbolSize : the symbol when there is one
+	void resolve(uint32_t symbolValue, uint32_t symbolSize){
+		lo = symbolValue + offset;
+		if(bound == END) hi = end;
+		else if(bound == SIZE) hi = lo + end;
+		else hi = lo + (!symbol.empty() && symbolSize ? symbolSize : 4);
+		resolved = hi > lo;
+	}
+
+	static bool parseNumber(const std::string &text, uint32_t *value){
+		if(text.empty()) return false;
+		char* end;
+		*value = strtoul(text.c_str(), &end, 0);
+		return *end == 0;
+	}
+
+	bool parse(const std::string &text){
+		std::string base = text;
+		size_t op = text.find_first_of("-+", 1);
+		if(op != std::string::npos){
+			base = text.substr(0, op);
+			if(!parseNumber(text.substr(op + 1), &end)) return false;
+			bound = text[op] == '-' ? END : SIZE;
+		}
+		if(!parseNumber(base, &offset)){
+			offset = 0;
+			symbol = base;
+		} else {
+			resolve(0, 0);
+		}
+		return !base.empty();
+	}
+};
+
+struct TraceTrigger{
+	enum Kind {NONE, EXCEPTION, STORE, PC, CYCLE} kind = NONE;
+	TraceRange range;
+	uint64_t cycle = 0;
+
+	bool parse(const std::string &text){
+		size_t colon = text.find(':');
+		std::string name = text.substr(0, colon);
+		std::string argument = colon == std::string::npos ? "" : text.substr(colon + 1);
+		if(name == "exception") { kind = EXCEPTION; return argument.empty(); }
+		if(name == "store") { kind = STORE; return range.parse(argument); }
+		if(name == "pc") { kind = PC; return range.parse(argument); }
+		if(name == "cycle") { kind = CYCLE; cycle = strtoull(argument.c_str(), NULL, 0); return !argument.empty(); }
+		return false;
+	}
+};
+
+struct TraceCycleWindow{
+	uint64_t begin, end;
+};
+
+// What the +trace_* plusargs asked for, each simulation gets its TraceFilter from it
+struct TraceFilterConfig{
+	std::vector<TraceRange> pcs;
+	std::vector<TraceCycleWindow> cycles;
+	uint32_t privileges = 0; // 1 << privilege, 0 : any
+	TraceTrigger start, stop;
+	uint64_t length = 0;     // +trace_for, 0 : until the end
+
+	bool enabled() const { return !pcs.empty() || !cycles.empty() || privileges || start.kind != TraceTrigger::NONE || stop.kind != TraceTrigger::NONE; }
+};
+
+static TraceFilterConfig traceFilterConfig;
+
+// Apply the value of one +trace_<name>= plusarg, false if it can't be parsed
+static inline bool traceFilterConfigure(const char* name, const char* value){
+	if(value == NULL || *value == 0) return true;
+	TraceFilterConfig &c = traceFilterConfig;
+	std::vector<std::string> items;
+	for(const char* p = value;;){
+		const char* comma = strchr(p, ',');
+		items.push_back(comma ? std::string(p, comma - p) : std::string(p));
+		if(!comma) break;
+		p = comma + 1;
+	}
+	if(!strcmp(name, "pc")){
+		for(const std::string &item : items){
+			TraceRange range;
+			if(!range.parse(item)) return false;
+			c.pcs.push_back(range);
+		}
+	} else if(!strcmp(name, "cycles")){
+		for(const std::string &item : items){
+			size_t dash = item.find('-');
+			if(dash == std::string::npos) return false;
+			std::string begin = item.substr(0, dash), end = item.substr(dash + 1);
+			c.cycles.push_back({begin.empty() ? 0 : strtoull(begin.c_str(), NULL, 0), end.empty() ? UINT64_MAX : strtoull(end.c_str(), NULL, 0)});
+		}
+	} else if(!strcmp(name, "priv")){
+		for(const std::string &item : items){
+			if(item == "m" || item == "3") c.privileges |= 1 << 3;
+			else if(item == "s" || item == "1") c.privileges |= 1 << 1;
+			else if(item == "u" || item == "0") c.privileges |= 1 << 0;
+			else return false;
+		}
+	} else if(!strcmp(name, "start")){
+		return c.start.parse(value);
+	} else if(!strcmp(name, "stop")){
+		return c.stop.parse(value);
+	} else if(!strcmp(name, "for")){
+		c.length = strtoull(value, NULL, 0);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+class TraceFilter{
+public:
+	// Trigger state, part of the checkpoints
+	struct State{
+		bool started = false;
+		bool stopped = false;
+		uint64_t startedAt = 0;
+	} state;
+
+	TraceFilter(){ reset(); }
+
+	// Start over from the plusargs, for a new program
+	void reset(const TraceFilterConfig &config = traceFilterConfig){
+		this->config = config;
+		active = config.enabled();
+		triggers = 1 << config.start.kind | 1 << config.stop.kind;
+		state = State();
+		state.started = config.start.kind == TraceTrigger::NONE;
+		update(0);
+	}
+
+	bool needsSymbols() const {
+		for(const TraceRange &range : config.pcs) if(!range.symbol.empty()) return true;
+		return !config.start.range.symbol.empty() || !config.stop.range.symbol.empty();
+	}
+
+	// Resolve the symbolic ranges against the ELF input, false if a symbol is missing (its range matches nothing)
+	bool resolve(const ElfFile &elf){
+		bool ok = true;
+		auto resolve = [&](TraceRange &range){
+			if(range.symbol.empty()) return;
+			uint32_t value, size = 0;
+			if(elf.symbol(range.symbol.c_str(), &value, &size)) { range.resolve(value, size); return; }
+			fprintf(stderr, "TRACE FILTER no symbol %s in %s\n", range.symbol.c_str(), elf.path.c_str());
+			range.resolved = false;
+			ok = false;
+		};
+		for(TraceRange &range : config.pcs) resolve(range);
+		resolve(config.start.range);
+		resolve(config.stop.range);
+		return ok;
+	}
+
+	// After state was restored from a checkpoint : recording and the next update follow from it, not from reset()
+	void restored(uint64_t cycle){ update(cycle); }
+
+	// Once per cycle, before the records of that cycle
+	inline void tick(uint64_t cycle){ if(active && cycle >= nextUpdate) update(cycle); }
+
+	// Whether a record of the instruction at pc goes to the traces
+	inline bool accept(uint32_t pc, uint32_t privilege = TRACE_PRIVILEGE_UNKNOWN) const {
+		if(!active) return true;
+		return recording && pcMatch(pc) && privilegeMatch(privilege);
+	}
+
+	// Whether the waveform dumps this cycle
+	inline bool dumping() const { return !active || recording; }
+
+	// Trigger events
+	inline void onCommit(uint32_t pc, uint64_t cycle){ if(triggers >> TraceTrigger::PC & 1) event(TraceTrigger::PC, pc, 4, cycle); }
+	inline void onStore(uint32_t address, uint32_t size, uint64_t cycle){ if(triggers >> TraceTrigger::STORE & 1) event(TraceTrigger::STORE, address, size, cycle); }
+	inline void onException(uint64_t cycle){ if(triggers >> TraceTrigger::EXCEPTION & 1) event(TraceTrigger::EXCEPTION, 0, 0, cycle); }
+
+private:
+	TraceFilterConfig config;
+	bool active = false;
+	uint32_t triggers = 0;     // 1 << TraceTrigger::Kind of the start / stop triggers
+	bool recording = true;     // triggers and cycle windows, the per record filters are applied by accept()
+	uint64_t nextUpdate = 0;   // next cycle at which recording may change without an event
+
+	bool pcMatch(uint32_t pc) const {
+		if(config.pcs.empty()) return true;
+		for(const TraceRange &range : config.pcs) if(range.contains(pc)) return true;
+		return false;
+	}
+
+	bool privilegeMatch(uint32_t privilege) const {
+		return config.privileges == 0 || privilege == TRACE_PRIVILEGE_UNKNOWN || (config.privileges >> privilege & 1);
+	}
+
+	static bool fires(const TraceTrigger &trigger, TraceTrigger::Kind kind, uint32_t address, uint32_t size){
+		if(trigger.kind != kind) return false;
+		switch(kind){
+		case TraceTrigger::EXCEPTION: return true;
+		case TraceTrigger::PC: return trigger.range.contains(address);
+		case TraceTrigger::STORE: return trigger.range.overlaps(address, size);
+		default: return false;
+		}
+	}
+
+	void event(TraceTrigger::Kind kind, uint32_t address, uint32_t size, uint64_t cycle){
+		bool changed = false;
+		if(!state.started && fires(config.start, kind, address, size)) { state.started = true; state.startedAt = cycle; changed = true; }
+		if(!state.stopped && fires(config.stop, kind, address, size)) { state.stopped = true; changed = true; }
+		if(changed) update(cycle);
+	}
+
+	void update(uint64_t cycle){
+		if(!state.started && config.start.kind == TraceTrigger::CYCLE && cycle >= config.start.cycle) { state.started = true; state.startedAt = cycle; }
+		if(!state.stopped && config.stop.kind == TraceTrigger::CYCLE && cycle >= config.stop.cycle) state.stopped = true;
+		if(state.started && config.length && cycle - state.startedAt >= config.length) state.stopped = true;
+		bool window = config.cycles.empty();
+		nextUpdate = UINT64_MAX;
+		auto next = [&](uint64_t at){ if(at > cycle && at < nextUpdate) nextUpdate = at; };
+		for(const TraceCycleWindow &w : config.cycles){
+			if(cycle >= w.begin && cycle < w.end) window = true;
+			next(w.begin);
+			next(w.end);
+		}
+		if(!state.started && config.start.kind == TraceTrigger::CYCLE) next(config.start.cycle);
+		if(!state.stopped && config.stop.kind == TraceTrigger::CYCLE) next(config.stop.cycle);
+		if(state.started && !state.stopped && config.length) next(state.startedAt + config.length);
+		recording = window && state.started && !state.stopped;
+	}
+};
+
+#endif
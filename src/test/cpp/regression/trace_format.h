@@ -0,0 +1,556 @@
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+// Architectural traces (regTrace, memTrace, fregTrace) shared by both harnesses.
+//
+// A TraceWriter streams the records of one trace file, either as the historical text lines (formatted by hand
+// into a large buffer, no iostream) or, with +trace_format=bin|binz, as <path>.bin :
+// - a TraceFileHeader, then blocks of up to TRACE_BLOCK_RECORDS records (TraceBlockHeader + payload)
+// - each record is a fixed size TraceRecord, its time and PC are deltas from the previous record of the file
+//   (a TRACE_RECORD_TIME record carries the absolute time when the delta doesn't fit)
+// - binz passes every block through a small built-in compressor : the record bytes are transposed so the mostly
+//   zero high bytes of the deltas line up, then run length encoded (TRACE_CODEC_SHUFFLE_RLE)
+// tools/vextrace converts a .bin file back to the text of the same trace, with traceFormatText().
+// Unless +trace_index=off, each trace gets a sparse <file>.idx next to it (trace_index.h), which tools/vexquery uses
+// to pull a time / PC window or the records around an exception.
+// A writer attached to a TraceQueue (TraceSink, trace_sink.h) leaves the formatting and the writes to its thread.
+// With TRACE_FLAG_SEQ, the writers sharing a sequence() counter number their records in the order they are written,
+// across the files : a binary file carries the number as TRACE_RECORD_SEQ records (at each block start and where
+// the numbers skip), a text line starts with "#<sequence> h<hart> ". tools/vexmerge merges such files back in order.
+
+#include "trace_index.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define TRACE_MAGIC "VEXTRACE"
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_RECORDS 4096
+
+enum TraceRecordType {TRACE_RECORD_PC = 1, TRACE_RECORD_REG, TRACE_RECORD_MEM, TRACE_RECORD_FREG, TRACE_RECORD_TIME, TRACE_RECORD_SEQ};
+// A TraceEvent which isn't written to the trace, only to its index
+#define TRACE_EVENT_EXCEPTION 0x10
+
+// Text dialect of a trace file
+enum TraceFlag {
+	TRACE_FLAG_TIME = 1,   // lines start with the time
+	TRACE_FLAG_SPACES = 2, // PC / register values padded with spaces instead of zeros (regression harness)
+	TRACE_FLAG_FREG64 = 4, // 64 bits F registers (RVD)
+	TRACE_FLAG_SEQ = 8     // records numbered by a sequence shared between files, lines start with it and the hart
+};
+
+enum TraceCodec {TRACE_CODEC_RAW, TRACE_CODEC_SHUFFLE_RLE};
+
+struct TraceFileHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+};
+
+struct TraceBlockHeader{
+	uint32_t records;
+	uint32_t bytes; // payload
+	uint32_t codec;
+	uint32_t reserved;
+};
+
+struct TraceRecord{
+	uint8_t type;
+	uint8_t index;    // register, store size in bytes
+	uint16_t hart;
+	uint32_t time;    // delta
+	uint32_t pc;      // delta
+	uint32_t address; // store address
+	uint64_t value;   // register value, store data, absolute time of TRACE_RECORD_TIME, sequence of TRACE_RECORD_SEQ
+};
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord is part of the file format");
+
+// A record with its absolute time and PC
+struct TraceEvent{
+	uint8_t type;
+	uint8_t index;
+	uint16_t hart;
+	uint64_t time;
+	uint32_t pc;
+	uint32_t address;
+	uint64_t value;
+	uint64_t seq;     // TRACE_FLAG_SEQ, set by the writer
+};
+
+#define TRACE_TEXT_MAX 256
+
+static inline char* traceHex(char* out, uint64_t value, int digits, char pad){
+	static const char hex[] = "0123456789abcdef";
+	int used = 1;
+	for(uint64_t v = value >> 4;v;v >>= 4) used++;
+	if(used > digits) digits = used;
+	for(int i = digits - 1;i >= 0;i--){
+		out[i] = i >= digits - used ? hex[value & 0xF] : pad;
+		value >>= 4;
+	}
+	return out + digits;
+}
+
+static inline char* traceDec(char* out, uint64_t value, int digits = 0, char pad = ' '){
+	char tmp[20];
+	int used = 0;
+	do { tmp[used++] = '0' + value % 10; value /= 10; } while(value);
+	for(int i = used;i < digits;i++) *out++ = pad;
+	while(used) *out++ = tmp[--used];
+	return out;
+}
+
+static inline char* traceStr(char* out, const char* str){
+	while(*str) *out++ = *str++;
+	return out;
+}
+
+// The text line of event, as the harnesses have always written it, into out (TRACE_TEXT_MAX bytes). Returns its
+// length, 0 for the records without a line.
+static inline size_t traceFormatText(const TraceEvent &e, uint32_t flags, char* out){
+	char* p = out;
+	char pad = (flags & TRACE_FLAG_SPACES) ? ' ' : '0';
+	if(e.type < TRACE_RECORD_PC || e.type > TRACE_RECORD_FREG) return 0;
+	if(flags & TRACE_FLAG_SEQ){
+		*p++ = '#';
+		p = traceDec(p, e.seq);
+		p = traceStr(p, " h");
+		p = traceDec(p, e.hart);
+		*p++ = ' ';
+	}
+	if(e.type != TRACE_RECORD_FREG && (flags & TRACE_FLAG_TIME)) p = traceDec(p, e.time);
+	switch(e.type){
+	case TRACE_RECORD_PC:
+		p = traceStr(p, " PC ");
+		p = traceHex(p, e.pc, 8, pad);
+		break;
+	case TRACE_RECORD_REG:
+		p = traceStr(p, " PC ");
+		p = traceHex(p, e.pc, 8, pad);
+		p = traceStr(p, " : reg[");
+		p = traceDec(p, e.index, 2);
+		p = traceStr(p, "] = ");
+		p = traceHex(p, e.value, 8, pad);
+		break;
+	case TRACE_RECORD_MEM:{
+		int digits = e.index*2;
+		if(digits < 2) digits = 2;
+		if(digits > 128) digits = 128;
+		p = traceStr(p, " PC ");
+		p = traceHex(p, e.pc, 8, '0');
+		p = traceStr(p, " : MEM[0x");
+		p = traceHex(p, e.address, 8, '0');
+		p = traceStr(p, "] <= ");
+		p = traceDec(p, e.index);
+		p = traceStr(p, " bytes : 0x");
+		p = traceHex(p, e.value, digits, '0');
+	} break;
+	case TRACE_RECORD_FREG:
+		p = traceStr(p, "PC ");
+		p = traceHex(p, e.pc, 8, '0');
+		p = traceStr(p, " : f[");
+		p = traceDec(p, e.index, 2, '0');
+		p = traceStr(p, "] = 0x");
+		p = traceHex(p, e.value, (flags & TRACE_FLAG_FREG64) ? 16 : 8, '0');
+		break;
+	default:
+		return 0;
+	}
+	*p++ = '\n';
+	return p - out;
+}
+
+// TRACE_CODEC_SHUFFLE_RLE : byte k of every record, for k in 0..23, then PackBits like runs. A control byte c
+// below 128 is followed by c + 1 literal bytes, otherwise the next byte is repeated c - 125 times (3 .. 130).
+static inline void traceCompress(const TraceRecord* records, uint32_t count, std::vector<uint8_t> &out){
+	const uint8_t* raw = (const uint8_t*)records;
+	std::vector<uint8_t> shuffled(count*sizeof(TraceRecord));
+	for(uint32_t k = 0;k < sizeof(TraceRecord);k++){
+		uint8_t* plane = &shuffled[k*count];
+		for(uint32_t r = 0;r < count;r++) plane[r] = raw[r*sizeof(TraceRecord) + k];
+	}
+	out.clear();
+	const uint8_t* in = shuffled.data();
+	size_t size = shuffled.size(), i = 0;
+	while(i < size){
+		size_t run = 1;
+		while(i + run < size && run < 130 && in[i + run] == in[i]) run++;
+		if(run >= 3){
+			out.push_back(125 + run);
+			out.push_back(in[i]);
+			i += run;
+			continue;
+		}
+		size_t start = i, literals = 0;
+		while(i < size && literals < 128){
+			if(i + 2 < size && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+			i++;
+			literals++;
+		}
+		out.push_back(literals - 1);
+		out.insert(out.end(), in + start, in + i);
+	}
+}
+
+static inline bool traceDecompress(const uint8_t* in, size_t size, TraceRecord* records, uint32_t count){
+	std::vector<uint8_t> shuffled(count*sizeof(TraceRecord));
+	size_t o = 0, i = 0;
+	while(i < size){
+		uint8_t c = in[i++];
+		if(c < 128){
+			size_t length = c + 1;
+			if(i + length > size || o + length > shuffled.size()) return false;
+			memcpy(&shuffled[o], in + i, length);
+			i += length; o += length;
+		} else {
+			size_t length = c - 125;
+			if(i >= size || o + length > shuffled.size()) return false;
+			memset(&shuffled[o], in[i++], length);
+			o += length;
+		}
+	}
+	if(o != shuffled.size()) return false;
+	uint8_t* raw = (uint8_t*)records;
+	for(uint32_t k = 0;k < sizeof(TraceRecord);k++){
+		const uint8_t* plane = &shuffled[k*count];
+		for(uint32_t r = 0;r < count;r++) raw[r*sizeof(TraceRecord) + k] = plane[r];
+	}
+	return true;
+}
+
+class TraceWriter;
+
+// Where an attached TraceWriter hands its records instead of writing them itself (TraceSink, trace_sink.h). The
+// queue calls back emit() / emitText() / flushOutput() of the writer from its own thread.
+class TraceQueue{
+public:
+	virtual ~TraceQueue(){}
+	virtual void push(TraceWriter* writer, const TraceEvent &event) = 0;
+	virtual void pushText(TraceWriter* writer, const char* data, size_t size) = 0;
+	// Returns once everything pushed for writer is written to its file
+	virtual void sync(TraceWriter* writer) = 0;
+};
+
+class TraceWriter{
+public:
+	enum Format {TEXT, BINARY, BINARY_COMPRESSED};
+	// Function-local statics, so that several translation units can include the header
+	static Format &defaultFormat(){ static Format value = TEXT; return value; }
+	static bool &defaultIndex(){ static bool value = true; return value; }
+
+	TraceWriter(){}
+	TraceWriter(const TraceWriter&) = delete;
+	TraceWriter& operator=(const TraceWriter&) = delete;
+	~TraceWriter(){ close(); }
+
+	// Text traces go to path, binary ones to path.bin, their index (index) to that file + .idx
+	bool open(const std::string &path, uint32_t flags, Format format = defaultFormat(), bool index = defaultIndex()){
+		close();
+		this->flags = flags;
+		this->format = format;
+		lastTime = 0;
+		lastPc = 0;
+		lastSeq = 0;
+		broken = false;
+		written = 0;
+		std::string file = format == TEXT ? path : path + ".bin";
+		fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0) return false;
+		if(index && !this->index.open(file + ".idx", format != TEXT, flags)) perror(("Trace index " + file + ".idx").c_str());
+		if(format == TEXT){
+			buffer.resize(1 << 16);
+		} else {
+			TraceFileHeader header;
+			memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+			header.version = TRACE_VERSION;
+			header.flags = flags;
+			put(&header, sizeof(header));
+			records.reserve(TRACE_BLOCK_RECORDS);
+		}
+		return true;
+	}
+
+	// From now on the records go through queue, NULL to write them from the calling thread again
+	void attach(TraceQueue* queue){
+		if(this->queue) this->queue->sync(this);
+		this->queue = queue;
+	}
+
+	bool isOpen() const { return fd >= 0; }
+
+	// Number the records (TRACE_FLAG_SEQ) from counter, shared with other writers. Those are all attached to the same
+	// queue, or none, the numbers are taken when the records are written.
+	void sequence(uint64_t* counter){ this->counter = counter; }
+
+	void close(){
+		resume();
+		if(fd < 0) return;
+		flush();
+		::close(fd);
+		fd = -1;
+		index.close();
+	}
+
+	void flush(){
+		if(fd < 0) return;
+		if(queue) queue->sync(this);
+		else flushOutput();
+	}
+
+	// Drop the records until resume(), for the cycles the flight recorder replays (see flight.h)
+	void suspend(){
+		if(fd < 0) return;
+		flush();
+		suspendedFd = fd;
+		fd = -1;
+	}
+
+	void resume(){
+		if(suspendedFd < 0) return;
+		fd = suspendedFd;
+		suspendedFd = -1;
+	}
+
+	// Instruction without register write
+	void pc(uint64_t time, uint32_t pc, uint32_t hart = 0){ push({TRACE_RECORD_PC, 0, (uint16_t)hart, time, pc, 0, 0, 0}); }
+	void reg(uint64_t time, uint32_t pc, uint32_t rd, uint64_t value, uint32_t hart = 0){ push({TRACE_RECORD_REG, (uint8_t)rd, (uint16_t)hart, time, pc, 0, value, 0}); }
+	void mem(uint64_t time, uint32_t pc, uint32_t address, uint32_t size, uint64_t value, uint32_t hart = 0){ push({TRACE_RECORD_MEM, (uint8_t)size, (uint16_t)hart, time, pc, address, value, 0}); }
+	// Untimed, the record takes the time of the previous one
+	void freg(uint32_t pc, uint32_t rd, uint64_t value, uint32_t hart = 0){ push({TRACE_RECORD_FREG, (uint8_t)rd, (uint16_t)hart, 0, pc, 0, value, 0}); }
+	// Trap of the instruction at pc, only recorded by the index
+	void exception(uint64_t time, uint32_t pc, uint32_t cause, uint32_t hart = 0){ if(index.isOpen()) push({TRACE_EVENT_EXCEPTION, 0, (uint16_t)hart, time, pc, 0, cause, 0}); }
+
+	// Free form text (logTrace), only written by TEXT writers
+	void text(const char* data, size_t size){
+		if(fd < 0) return;
+		if(queue) queue->pushText(this, data, size);
+		else emitText(data, size);
+	}
+	void text(char c){ text(&c, 1); }
+
+	// Writer side, called by the thread which owns the output : the caller, or the queue once attached
+
+	void emit(const TraceEvent &event){
+		TraceEvent e = event;
+		if(e.type == TRACE_EVENT_EXCEPTION){
+			index.exception(format == TEXT || records.empty() ? written + bufferUsed : blockOffset, e.time, e.pc, e.hart, e.value);
+			return;
+		}
+		if(e.type == TRACE_RECORD_FREG) e.time = lastTime;
+		if(flags & TRACE_FLAG_SEQ) e.seq = (*counter)++;
+		if(format == TEXT){
+			if(index.isOpen()) index.record(written + bufferUsed, e.time, e.pc, e.hart);
+			bufferUsed += traceFormatText(e, flags, &buffer[bufferUsed]);
+			if(bufferUsed > buffer.size() - TRACE_TEXT_MAX) flushOutput();
+			return;
+		}
+		// A block starts with the sequence number, leave room for it, the time base and the record
+		if((flags & TRACE_FLAG_SEQ) && records.size() + 3 > TRACE_BLOCK_RECORDS) flushBlock();
+		if(records.empty()){
+			blockOffset = written;
+			if(index.isOpen()) index.block(blockOffset, lastTime, lastPc);
+		}
+		if(index.isOpen()) index.record(blockOffset, e.time, e.pc, e.hart);
+		if((flags & TRACE_FLAG_SEQ) && (records.empty() || e.seq != lastSeq + 1)){
+			TraceRecord base = {TRACE_RECORD_SEQ, 0, 0, 0, 0, 0, e.seq};
+			append(base);
+		}
+		lastSeq = e.seq;
+		if(e.time < lastTime || e.time - lastTime > 0xFFFFFFFFull){
+			TraceRecord base = {TRACE_RECORD_TIME, 0, 0, 0, 0, 0, e.time};
+			append(base);
+			lastTime = e.time;
+		}
+		TraceRecord r = {e.type, e.index, e.hart, (uint32_t)(e.time - lastTime), e.pc - lastPc, e.address, e.value};
+		lastTime = e.time;
+		lastPc = e.pc;
+		append(r);
+	}
+
+	void emitText(const char* data, size_t size){
+		if(format != TEXT) return;
+		while(size){
+			size_t chunk = std::min(size, buffer.size() - bufferUsed);
+			memcpy(&buffer[bufferUsed], data, chunk);
+			bufferUsed += chunk;
+			data += chunk;
+			size -= chunk;
+			if(bufferUsed > buffer.size() - TRACE_TEXT_MAX) flushOutput();
+		}
+	}
+
+	void flushOutput(){
+		if(fd < 0) return;
+		if(format == TEXT){
+			put(buffer.data(), bufferUsed);
+			bufferUsed = 0;
+		} else {
+			flushBlock();
+		}
+		index.flush();
+	}
+
+private:
+	int fd = -1;
+	int suspendedFd = -1;
+	bool broken = false; // a write failed, the rest of the file is skipped
+	TraceQueue* queue = NULL;
+	Format format = TEXT;
+	uint32_t flags = 0;
+	uint64_t lastTime = 0;
+	uint32_t lastPc = 0;
+	uint64_t lastSeq = 0;
+	uint64_t ownCounter = 0;
+	uint64_t* counter = &ownCounter;
+	uint64_t written = 0;     // bytes of the file
+	uint64_t blockOffset = 0; // of the block being filled
+	TraceIndex index;
+	std::vector<char> buffer;
+	size_t bufferUsed = 0;
+	std::vector<TraceRecord> records;
+	std::vector<uint8_t> packed;
+
+	void push(const TraceEvent &event){
+		if(fd < 0) return;
+		if(queue) queue->push(this, event);
+		else emit(event);
+	}
+
+	void append(const TraceRecord &r){
+		records.push_back(r);
+		if(records.size() == TRACE_BLOCK_RECORDS) flushBlock();
+	}
+
+	void flushBlock(){
+		if(records.empty()) return;
+		TraceBlockHeader header = {(uint32_t)records.size(), (uint32_t)(records.size()*sizeof(TraceRecord)), TRACE_CODEC_RAW, 0};
+		const void* payload = records.data();
+		if(format == BINARY_COMPRESSED){
+			traceCompress(records.data(), records.size(), packed);
+			if(packed.size() < header.bytes){
+				header.bytes = packed.size();
+				header.codec = TRACE_CODEC_SHUFFLE_RLE;
+				payload = packed.data();
+			}
+		}
+		put(&header, sizeof(header));
+		put(payload, header.bytes);
+		records.clear();
+		index.flush();
+	}
+
+	void put(const void* data, size_t size){
+		const char* ptr = (const char*)data;
+		while(size && !broken){
+			ssize_t done = ::write(fd, ptr, size);
+			if(done <= 0) { perror("Trace write failed"); broken = true; return; }
+			ptr += done;
+			size -= done;
+			written += done;
+		}
+	}
+};
+
+// Sequential reader of a .bin trace
+class TraceReader{
+public:
+	std::string error;
+	uint32_t flags = 0;
+
+	TraceReader(const std::string &path) : path(path) {
+		file = fopen(path.c_str(), "rb");
+		if(file == NULL) { error = "can't open " + path; return; }
+		TraceFileHeader header;
+		if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION){
+			error = path + " isn't a binary trace of this version";
+			return;
+		}
+		flags = header.flags;
+	}
+
+	TraceReader(const TraceReader&) = delete;
+	TraceReader& operator=(const TraceReader&) = delete;
+	~TraceReader(){ if(file) fclose(file); }
+
+	bool ok() const { return error.empty(); }
+
+	// False at the end of the trace or on error (then set)
+	bool next(TraceEvent *event){
+		while(ok()){
+			if(position == block.size() && !readBlock()) return false;
+			const TraceRecord &r = block[position++];
+			if(r.type == TRACE_RECORD_TIME) { time = r.value; continue; }
+			if(r.type == TRACE_RECORD_SEQ) { seq = r.value; continue; }
+			time += r.time;
+			pc += r.pc;
+			event->type = r.type;
+			event->index = r.index;
+			event->hart = r.hart;
+			event->time = time;
+			event->pc = pc;
+			event->address = r.address;
+			event->value = r.value;
+			event->seq = seq++;
+			return true;
+		}
+		return false;
+	}
+
+private:
+	std::string path;
+	FILE* file = NULL;
+	std::vector<TraceRecord> block;
+	std::vector<uint8_t> packed;
+	size_t position = 0;
+	uint64_t time = 0;
+	uint32_t pc = 0;
+	uint64_t seq = 0;
+
+	bool readBlock(){
+		TraceBlockHeader header;
+		if(fread(&header, sizeof(header), 1, file) != 1) return false;
+		if(header.records == 0 || header.records > TRACE_BLOCK_RECORDS) { error = path + " has a corrupted block"; return false; }
+		block.resize(header.records);
+		position = 0;
+		if(header.codec == TRACE_CODEC_RAW && header.bytes == header.records*sizeof(TraceRecord)){
+			if(fread(block.data(), header.bytes, 1, file) == 1) return true;
+		} else if(header.codec == TRACE_CODEC_SHUFFLE_RLE){
+			packed.resize(header.bytes);
+			if(fread(packed.data(), 1, header.bytes, file) == header.bytes && traceDecompress(packed.data(), packed.size(), block.data(), header.records)) return true;
+		}
+		error = path + " has a truncated or corrupted block";
+		return false;
+	}
+};
+
+// +trace_format=text|bin|binz (plusarg value) or VEX_TRACE_FORMAT
+static inline void traceFormatConfigure(const char* plusargValue){
+	const char* values[] = {getenv("VEX_TRACE_FORMAT"), plusargValue};
+	for(const char* value : values){
+		if(value == NULL || *value == 0) continue;
+		if(!strcmp(value, "text")) TraceWriter::defaultFormat() = TraceWriter::TEXT;
+		else if(!strcmp(value, "bin")) TraceWriter::defaultFormat() = TraceWriter::BINARY;
+		else if(!strcmp(value, "binz")) TraceWriter::defaultFormat() = TraceWriter::BINARY_COMPRESSED;
+		else fprintf(stderr, "Unknown trace format '%s'\n", value);
+	}
+}
+
+// +trace_index=on|off (plusarg value) or VEX_TRACE_INDEX
+static inline void traceIndexConfigure(const char* plusargValue){
+	const char* values[] = {getenv("VEX_TRACE_INDEX"), plusargValue};
+	for(const char* value : values){
+		if(value == NULL || *value == 0) continue;
+		if(!strcmp(value, "on")) TraceWriter::defaultIndex() = true;
+		else if(!strcmp(value, "off")) TraceWriter::defaultIndex() = false;
+		else fprintf(stderr, "Unknown trace index mode '%s'\n", value);
+	}
+}
+
+#endif
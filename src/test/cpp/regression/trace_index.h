@@ -0,0 +1,165 @@
+#ifndef TRACE_INDEX_H
+#define TRACE_INDEX_H
+
+// Sparse sidecar index of a trace file, <trace file>.idx, written by its TraceWriter (trace_format.h) so that
+// tools/vexquery can jump into a multi-gigabyte trace instead of scanning it :
+// - a TraceIndexHeader, then TraceIndexEntry records in file order
+// - TIME entries : every TRACE_INDEX_STRIDE records of a text trace (the line of that record), every block of a
+//   binary one (with the time and PC the deltas of the block start from)
+// - PC entries : the first record of each PC
+// - EXCEPTION entries : the traps reported by the harness, with the position of the next record
+// Offsets are those of a line (text) or of a block (binary), the entries of a binary trace take the time and PC bases
+// from the TIME entry of their block.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#define TRACE_INDEX_MAGIC "VEXTIDX"
+#define TRACE_INDEX_VERSION 1
+#define TRACE_INDEX_STRIDE 4096
+
+enum TraceIndexKind {TRACE_INDEX_TIME = 1, TRACE_INDEX_PC, TRACE_INDEX_EXCEPTION};
+
+struct TraceIndexHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t binary; // the trace is a .bin
+	uint32_t flags;  // TraceFlag of the trace
+	uint32_t stride;
+};
+
+struct TraceIndexEntry{
+	uint8_t kind;
+	uint8_t reserved;
+	uint16_t hart;
+	uint32_t pc;     // TIME of a binary trace : PC base of the block
+	uint64_t time;   // TIME of a binary trace : time base of the block
+	uint64_t offset;
+	uint64_t value;  // TIME : records before, EXCEPTION : cause
+};
+static_assert(sizeof(TraceIndexEntry) == 32, "TraceIndexEntry is part of the file format");
+
+class TraceIndex{
+public:
+	TraceIndex(){}
+	TraceIndex(const TraceIndex&) = delete;
+	TraceIndex& operator=(const TraceIndex&) = delete;
+	~TraceIndex(){ close(); }
+
+	bool open(const std::string &path, bool binary, uint32_t flags){
+		close();
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0) return false;
+		this->binary = binary;
+		broken = false;
+		records = 0;
+		seenZero = false;
+		seen.assign(1 << 12, 0);
+		seenCount = 0;
+		TraceIndexHeader header;
+		memcpy(header.magic, TRACE_INDEX_MAGIC, sizeof(header.magic));
+		header.version = TRACE_INDEX_VERSION;
+		header.binary = binary;
+		header.flags = flags;
+		header.stride = TRACE_INDEX_STRIDE;
+		put(&header, sizeof(header));
+		return true;
+	}
+
+	bool isOpen() const { return fd >= 0; }
+
+	void close(){
+		if(fd < 0) return;
+		flush();
+		::close(fd);
+		fd = -1;
+	}
+
+	// A binary block starts at offset, its deltas from time / pc
+	void block(uint64_t offset, uint64_t time, uint32_t pc){
+		add(TRACE_INDEX_TIME, 0, pc, time, offset, records);
+	}
+
+	// A record at offset (its line, or its block)
+	inline void record(uint64_t offset, uint64_t time, uint32_t pc, uint16_t hart){
+		if(!binary && records % TRACE_INDEX_STRIDE == 0) add(TRACE_INDEX_TIME, hart, pc, time, offset, records);
+		records++;
+		if(firstSeen(pc)) add(TRACE_INDEX_PC, hart, pc, time, offset, 0);
+	}
+
+	// The next record will be at offset
+	void exception(uint64_t offset, uint64_t time, uint32_t pc, uint16_t hart, uint64_t cause){
+		add(TRACE_INDEX_EXCEPTION, hart, pc, time, offset, cause);
+	}
+
+	// Write the pending entries, after the trace data they point to
+	void flush(){
+		if(fd < 0 || pending.empty()) return;
+		put(pending.data(), pending.size()*sizeof(TraceIndexEntry));
+		pending.clear();
+	}
+
+private:
+	int fd = -1;
+	bool binary = false;
+	bool broken = false;
+	uint64_t records = 0;
+	std::vector<TraceIndexEntry> pending;
+	// Open addressing set of the PCs seen so far (0 is the empty slot, PC 0 has its own flag)
+	std::vector<uint32_t> seen;
+	size_t seenCount = 0;
+	bool seenZero = false;
+
+	void add(uint8_t kind, uint16_t hart, uint32_t pc, uint64_t time, uint64_t offset, uint64_t value){
+		TraceIndexEntry e = {kind, 0, hart, pc, time, offset, value};
+		pending.push_back(e);
+	}
+
+	static size_t hash(uint32_t pc){ return (pc * 0x9E3779B97F4A7C15ull) >> 32; }
+
+	bool firstSeen(uint32_t pc){
+		if(pc == 0){
+			if(seenZero) return false;
+			seenZero = true;
+			return true;
+		}
+		size_t mask = seen.size() - 1;
+		for(size_t slot = hash(pc) & mask;;slot = (slot + 1) & mask){
+			if(seen[slot] == pc) return false;
+			if(seen[slot] == 0){
+				seen[slot] = pc;
+				if(++seenCount * 2 > seen.size()) grow();
+				return true;
+			}
+		}
+	}
+
+	void grow(){
+		std::vector<uint32_t> old(seen.size()*2, 0);
+		old.swap(seen);
+		size_t mask = seen.size() - 1;
+		for(uint32_t pc : old){
+			if(pc == 0) continue;
+			size_t slot = hash(pc) & mask;
+			while(seen[slot]) slot = (slot + 1) & mask;
+			seen[slot] = pc;
+		}
+	}
+
+	void put(const void* data, size_t size){
+		const char* ptr = (const char*)data;
+		while(size && !broken){
+			ssize_t done = ::write(fd, ptr, size);
+			if(done <= 0) { perror("Trace index write failed"); broken = true; return; }
+			ptr += done;
+			size -= done;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef TRACE_SINK_H
+#define TRACE_SINK_H
+
+// Asynchronous trace output.
+//
+// A TraceSink takes the formatting and the file writes of the traces of one Workspace (one SMP run) off the
+// simulation thread. The TraceWriters attached to it only copy their records into a single producer / single
+// consumer ring, which a writer thread started on the first record drains in batches into the writers' buffers,
+// written with large write() calls. When the writer thread has caught up it writes out the partial buffers too,
+// so the files stay close to the simulation (tail -f of a logTrace) without a flush per line.
+//
+// The simulation only waits for the writer thread in flush() / close(), or when the ring is full : then it waits
+// for room (backpressure, +trace_sink=async, the default) or drops the record (+trace_sink=drop). Both are counted
+// in TraceSinkStats. +trace_sink=sync keeps the writes on the simulation thread.
+
+#include "trace_format.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef TRACE_SINK_DEPTH
+#define TRACE_SINK_DEPTH 16384 // records, power of two
+#endif
+#define TRACE_SINK_WRITERS 16
+
+enum TraceSinkMode {TRACE_SINK_SYNC, TRACE_SINK_ASYNC, TRACE_SINK_DROP};
+
+// +trace_sink=sync|async|drop
+static TraceSinkMode traceSinkMode = TRACE_SINK_ASYNC;
+
+struct TraceSinkStats{
+	uint64_t records = 0;   // pushed by the simulation (text chunks included)
+	uint64_t stalls = 0;    // pushes which found the ring full and waited for the writer thread
+	uint64_t dropped = 0;   // records lost to a full ring (+trace_sink=drop)
+	uint64_t batches = 0;   // drains of the ring by the writer thread
+	uint64_t highWater = 0; // highest ring occupancy seen by the writer thread
+};
+
+class TraceSink : public TraceQueue{
+public:
+	TraceSink() : ring(TRACE_SINK_DEPTH) {
+		static_assert((TRACE_SINK_DEPTH & (TRACE_SINK_DEPTH - 1)) == 0, "TRACE_SINK_DEPTH must be a power of two");
+	}
+	TraceSink(const TraceSink&) = delete;
+	TraceSink& operator=(const TraceSink&) = delete;
+	~TraceSink(){ stop(); }
+
+	// Route writer through this sink, unless +trace_sink=sync
+	void attach(TraceWriter &writer){
+		if(traceSinkMode == TRACE_SINK_SYNC) { writer.attach(NULL); return; }
+		if(slot(&writer) == writerCount){
+			if(writerCount == TRACE_SINK_WRITERS) { fprintf(stderr, "TraceSink : too many writers\n"); return; }
+			writers[writerCount++] = &writer;
+		}
+		writer.attach(this);
+	}
+
+	// Writes everything pushed so far and stops the writer thread, the next record starts it again. Required before
+	// a fork(), the child wouldn't have the thread.
+	void stop(){
+		if(!running) return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		thread.join();
+		running = false;
+		stopping = false;
+	}
+
+	// Consistent once the writers were flushed (or the sink stopped)
+	TraceSinkStats stats() const {
+		TraceSinkStats s = producer;
+		s.batches = consumer.batches;
+		s.highWater = consumer.highWater;
+		return s;
+	}
+
+	void push(TraceWriter* writer, const TraceEvent &event) override {
+		Item item;
+		item.kind = EVENT;
+		item.writer = slot(writer);
+		item.type = event.type;
+		item.index = event.index;
+		item.hart = event.hart;
+		item.record.pc = event.pc;
+		item.record.address = event.address;
+		item.record.time = event.time;
+		item.record.value = event.value;
+		enqueue(item, traceSinkMode == TRACE_SINK_DROP);
+	}
+
+	void pushText(TraceWriter* writer, const char* data, size_t size) override {
+		Item item;
+		item.kind = TEXT;
+		item.writer = slot(writer);
+		while(size){
+			item.index = size < sizeof(item.text) ? size : sizeof(item.text);
+			memcpy(item.text, data, item.index);
+			enqueue(item, traceSinkMode == TRACE_SINK_DROP);
+			data += item.index;
+			size -= item.index;
+		}
+	}
+
+	void sync(TraceWriter* writer) override {
+		if(!running) return;
+		Item item;
+		item.kind = SYNC;
+		item.writer = slot(writer);
+		uint64_t sequence = enqueue(item, false);
+		notify();
+		std::unique_lock<std::mutex> lock(doneMutex);
+		done.wait(lock, [&](){ return completed.load(std::memory_order_acquire) >= sequence; });
+	}
+
+private:
+	enum Kind {EVENT, TEXT, SYNC};
+	// Half a cache line, the ring traffic between the two cores is what the sink costs once it keeps up
+	struct Item{
+		uint8_t kind;
+		uint8_t writer; // in writers
+		uint8_t type;
+		uint8_t index;  // TEXT : byte count
+		uint16_t hart;
+		uint16_t reserved;
+		union {
+			struct { uint32_t pc, address; uint64_t time, value; } record;
+			char text[24];
+		};
+	};
+	static_assert(sizeof(Item) == 32, "TraceSink::Item layout");
+
+	std::vector<Item> ring;
+	// Attached writers, indexed by Item::writer. A fixed array, the writer thread reads it while more get attached
+	TraceWriter* writers[TRACE_SINK_WRITERS];
+	uint32_t writerCount = 0;
+	// Free running indexes, each on its own cache line with the state of its side (padded, as C++14 new doesn't
+	// honour alignas beyond 16 bytes)
+	char padding0[64];
+	std::atomic<uint64_t> tail{0};
+	uint64_t headCache = 0;
+	TraceSinkStats producer;
+	char padding1[64];
+	std::atomic<uint64_t> head{0};
+	std::atomic<uint64_t> completed{0}; // index + 1 of the last SYNC item done
+	std::atomic<bool> sleeping{false};
+	TraceSinkStats consumer;
+	std::vector<TraceWriter*> dirty;    // writers with buffered output, written once the ring is empty
+	char padding2[64];
+	bool running = false;
+	bool stopping = false;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::mutex doneMutex;
+	std::condition_variable done;
+
+	uint64_t depth() const { return ring.size(); }
+
+	uint32_t slot(TraceWriter* writer) const {
+		uint32_t i = 0;
+		while(i < writerCount && writers[i] != writer) i++;
+		return i;
+	}
+
+	// Returns the index + 1 of the item in the ring, 0 if dropped
+	uint64_t enqueue(const Item &item, bool droppable){
+		if(!running) start();
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		if(t - headCache == depth()){
+			headCache = head.load(std::memory_order_acquire);
+			if(t - headCache == depth()){
+				if(droppable) { producer.dropped++; return 0; }
+				producer.stalls++;
+				notify();
+				while(t - headCache == depth()){
+					std::this_thread::yield();
+					headCache = head.load(std::memory_order_acquire);
+				}
+			}
+		}
+		ring[t & (depth() - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		producer.records++;
+		// The writer thread polls every millisecond, only wake it up early when the ring fills up (checked every 256
+		// records, to keep the shared cache lines out of the common path)
+		if(((t + 1) & 255) == 0 && sleeping.load(std::memory_order_relaxed)){
+			headCache = head.load(std::memory_order_acquire);
+			if(t + 1 - headCache >= depth() / 4) notify();
+		}
+		return t + 1;
+	}
+
+	void notify(){
+		std::lock_guard<std::mutex> lock(mutex);
+		wake.notify_one();
+	}
+
+	void start(){
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		head.store(t, std::memory_order_relaxed);
+		headCache = t;
+		running = true;
+		thread = std::thread([this](){ writerLoop(); });
+	}
+
+	void writerLoop(){
+		uint64_t h = head.load(std::memory_order_relaxed);
+		while(true){
+			uint64_t t = tail.load(std::memory_order_acquire);
+			if(h != t){
+				consumer.batches++;
+				if(t - h > consumer.highWater) consumer.highWater = t - h;
+				for(;h != t;h++){
+					process(ring[h & (depth() - 1)], h + 1);
+					// Give the room back as we go, the producer may be waiting for it
+					if((h & 255) == 255) head.store(h + 1, std::memory_order_release);
+				}
+				head.store(h, std::memory_order_release);
+				continue;
+			}
+			for(TraceWriter* writer : dirty) writer->flushOutput();
+			dirty.clear();
+			std::unique_lock<std::mutex> lock(mutex);
+			if(stopping && tail.load(std::memory_order_acquire) == h) break;
+			sleeping.store(true, std::memory_order_relaxed);
+			if(tail.load(std::memory_order_acquire) == h && !stopping) wake.wait_for(lock, std::chrono::milliseconds(1));
+			sleeping.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	void process(const Item &item, uint64_t sequence){
+		TraceWriter* writer = writers[item.writer];
+		switch(item.kind){
+		case EVENT: {
+			TraceEvent event = {item.type, item.index, item.hart, item.record.time, item.record.pc, item.record.address, item.record.value, 0};
+			writer->emit(event);
+			markDirty(writer);
+		} break;
+		case TEXT: writer->emitText(item.text, item.index); markDirty(writer); break;
+		case SYNC: {
+			writer->flushOutput();
+			for(size_t i = 0;i < dirty.size();i++){
+				if(dirty[i] == writer) { dirty.erase(dirty.begin() + i); break; }
+			}
+			head.store(sequence, std::memory_order_release);
+			completed.store(sequence, std::memory_order_release);
+			{ std::lock_guard<std::mutex> lock(doneMutex); }
+			done.notify_all();
+		} break;
+		}
+	}
+
+	void markDirty(TraceWriter* writer){
+		if(!dirty.empty() && dirty.back() == writer) return;
+		for(TraceWriter* w : dirty) if(w == writer) return;
+		dirty.push_back(writer);
+	}
+};
+
+static inline void traceSinkConfigure(const char* plusargValue){
+	const char* values[] = {getenv("VEX_TRACE_SINK"), plusargValue};
+	for(const char* value : values){
+		if(value == NULL || *value == 0) continue;
+		if(!strcmp(value, "sync")) traceSinkMode = TRACE_SINK_SYNC;
+		else if(!strcmp(value, "async")) traceSinkMode = TRACE_SINK_ASYNC;
+		else if(!strcmp(value, "drop")) traceSinkMode = TRACE_SINK_DROP;
+		else fprintf(stderr, "Unknown trace sink mode '%s'\n", value);
+	}
+}
+
+#endif
@@ -783,7 +783,7 @@ class TestIndividualFeatures extends MultithreadedFunSuite(sys.env.getOrElse("VE
       }
 
       //Setup test
-      val files = List("main.cpp", "jtag.h", "encoding.h" ,"makefile", "dhrystoneO3.logRef", "dhrystoneO3C.logRef","dhrystoneO3MC.logRef","dhrystoneO3M.logRef")
+      val files = List("main.cpp", "jtag.h", "encoding.h", "sim_memory.h", "sim_image.h", "elf_loader.h", "image_pack.h", "ihex.h", "checkpoint.h", "fork_server.h", "batch.h", "trace_format.h", "trace_sink.h", "trace_filter.h", "lockstep.h", "flight.h", "trace_index.h", "replay.h", "idle.h", "sim_elements.h", "sim_random.h", "profile.h" ,"makefile", "dhrystoneO3.logRef", "dhrystoneO3C.logRef","dhrystoneO3MC.logRef","dhrystoneO3M.logRef")
       files.foreach(f => FileUtils.copyFileToDirectory(new File(s"src/test/cpp/regression/$f"), new File(project)))
 
       //Test RTL